@@ -0,0 +1,99 @@
+// Host stand-in for the Arduino core
+//
+// Only what Tomcio uses. Time is virtual - millis()/micros() read the
+// simulator clock in sim.cpp, delay() advances it instead of sleeping.
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))   // kept across -k, see sim.cpp
+#define F_CPU  240000000L
+#define HIGH   1
+#define LOW    0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 5
+#define FALLING      2
+
+typedef bool boolean;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+void     delayMicroseconds(uint32_t us);
+
+void     pinMode(uint8_t pin, uint8_t mode);
+void     digitalWrite(uint8_t pin, uint8_t val);
+int      digitalRead(uint8_t pin);
+void     attachInterrupt(uint8_t pin, void (*fn)(), int mode);
+#define  digitalPinToInterrupt(p) (p)
+
+class String : public std::string {
+public:
+  String() {}
+  String(const char *s) : std::string(s) {}
+  String(const std::string &s) : std::string(s) {}
+  String(int v) : std::string(std::to_string(v)) {}
+  String(unsigned v) : std::string(std::to_string(v)) {}
+  String(long v) : std::string(std::to_string(v)) {}
+  String(unsigned long v) : std::string(std::to_string(v)) {}
+  String operator+(const String &o) const { return String(std::string(*this) + std::string(o)); }
+  String operator+(const char *o) const { return String(std::string(*this) + o); }
+  friend String operator+(const char *a, const String &b) { return String(std::string(a) + std::string(b)); }
+};
+
+//---------------------------------Serial (stdout or pty)---------------------------------
+struct HWSerial {
+  void   begin(unsigned long) {}
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t println(const char *s = "") { print(s); return print("\n"); }
+  size_t println(const String &s) { return println(s.c_str()); }
+  size_t write(const uint8_t *b, size_t n);     // see sim.cpp
+  int    availableForWrite();
+  int    available();                          // scripted input or the pty
+  int    read();
+  int    printf(const char *f, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HWSerial Serial;
+
+// Tests talk to the port without a script or pty: fed bytes are read
+// before anything else, and while a capture buffer is set writes land there
+void sim_serial_feed(const uint8_t *b, size_t n);
+void sim_serial_capture(uint8_t *buf, size_t size, size_t *n);   // buf NULL: stdout again
+
+// Tests that call setup()/loop() themselves: a touch of TOUCH_HOLD ms at
+// that virtual time, and one loop() pass with the clock moved on to
+// whatever can happen next, as the sim does between passes
+void sim_touch(uint32_t at_ms, uint16_t x, uint16_t y);
+void sim_step();
+
+//---------------------------------Hardware timer---------------------------------
+// One timer, period = alarm * divider / 80 us like the 80MHz APB clock
+struct hw_timer_t;
+hw_timer_t *timerBegin(uint8_t num, uint16_t divider, bool countUp);
+void        timerAttachInterrupt(hw_timer_t *t, void (*fn)(), bool edge);
+void        timerAlarmWrite(hw_timer_t *t, uint64_t alarm, bool reload);
+void        timerAlarmEnable(hw_timer_t *t);
+
+struct EspClass {
+  void     restart();
+  uint32_t getFreeHeap() { return 300000; }
+  uint32_t getCycleCount() { return micros() * (F_CPU / 1000000); }
+};
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,68 @@
+// Host stand-in for laurb9/StepperDriver DRV8825
+//
+// Steps follow the library's LINEAR_SPEED series (step_profile) and
+// nextAction() waits out the previous interval on the virtual clock, the
+// same way the real one busy-waits.
+
+#ifndef SIM_DRV8825_H
+#define SIM_DRV8825_H
+
+#include "Arduino.h"
+#include "step_profile.h"
+
+class DRV8825 {
+public:
+  enum Mode { CONSTANT_SPEED, LINEAR_SPEED };
+
+  DRV8825(short steps, short dir_pin, short step_pin, short enable_pin, short m0, short m1, short m2)
+    : motor_steps(steps) {}
+
+  void  begin(float rpm = 60, short microsteps = 1) { this->rpm = rpm; this->microsteps = microsteps; }
+  short setMicrostep(short ms) { microsteps = ms; return ms; }
+  void  setEnableActiveState(short) {}
+  void  enable() { enabled = 1; }
+  void  disable() { enabled = 0; }
+  void  setSpeedProfile(Mode m, short accel = 1000, short decel = 1000) { this->accel = accel; this->decel = decel; }
+  void  setRPM(float rpm) { this->rpm = rpm; }
+
+  void startRotate(long deg) { startMove(deg * motor_steps * microsteps / 360); }
+  void startMove(long steps){
+    dir = steps < 0 ? -1 : 1;
+    profile_init(&prof, rpm, motor_steps, microsteps, accel, decel, labs(steps));
+    profile_start(&prof, &it);
+    pending = 0;
+  }
+  void rotate(long deg) { startRotate(deg); while (nextAction()) {} }
+
+  // One step, returns the interval to the next one or 0 when the move is done
+  long nextAction(){
+    if (pending) {
+      int32_t left = (int32_t)(last + pending - micros());
+      if (left > 0) delayMicroseconds(left);
+    }
+    if (it.remaining <= 0) { pending = 0; return 0; }
+    pending  = profile_next(&prof, &it);
+    last     = micros();
+    position += dir;
+    pulses++;
+    return pending;
+  }
+  long getStepsRemaining() { return it.remaining; }
+
+  short    motor_steps;
+  float    rpm = 60;
+  short    microsteps = 1;
+  short    accel = 1000, decel = 1000;
+  bool     enabled = 0;
+  long     position = 0;                         // microsteps from power on
+  uint32_t pulses = 0;                           // STEP pulses issued
+
+private:
+  step_profile prof = {};
+  step_iter    it = {};
+  int8_t       dir = 1;
+  long         pending = 0;                      // interval returned by the last step
+  uint32_t     last = 0;                         // micros() of the last step
+};
+
+#endif
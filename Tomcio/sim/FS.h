@@ -0,0 +1,84 @@
+// Host stand-in for the ESP32 FS / SPIFFS layer
+//
+// Files live in a host directory (sim_fs_root, .pio/simfs by default), paths
+// are the SPIFFS names appended to it. Opens and bytes moved are counted.
+// Reads cost SIM_FS_CALL_US plus SIM_FS_BYTE_US per byte of virtual time.
+
+#ifndef SIM_FS_H
+#define SIM_FS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "Arduino.h"
+
+#define SIM_FS_CALL_US 40                        // per read call, SPIFFS page lookup
+#define SIM_FS_BYTE_US 1                         // per byte read
+
+struct sim_fs_stats {
+  uint32_t opens;
+  uint32_t reads;                                // read calls
+  uint32_t writes;                               // write calls
+  uint64_t rd_bytes;
+  uint64_t wr_bytes;
+};
+extern sim_fs_stats sim_fs;
+
+namespace fs {
+
+class File {
+public:
+  File(FILE *f = nullptr) : fp(f) {}
+  operator bool() const { return fp != nullptr; }
+  size_t read(uint8_t *b, size_t n){
+    if (!fp) return 0;
+    size_t r = fread(b, 1, n, fp);
+    sim_fs.reads++; sim_fs.rd_bytes += r;
+    delayMicroseconds(SIM_FS_CALL_US + r * SIM_FS_BYTE_US);
+    return r;
+  }
+  size_t readBytes(char *b, size_t n) { return read((uint8_t *)b, n); }
+  size_t write(const uint8_t *b, size_t n){
+    if (!fp) return 0;
+    size_t w = fwrite(b, 1, n, fp);
+    sim_fs.writes++; sim_fs.wr_bytes += w;
+    return w;
+  }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  bool   seek(uint32_t pos) { return fp && fseek(fp, pos, SEEK_SET) == 0; }
+  size_t position() { return fp ? ftell(fp) : 0; }
+  size_t size(){
+    if (!fp) return 0;
+    long p = ftell(fp); fseek(fp, 0, SEEK_END);
+    long s = ftell(fp); fseek(fp, p, SEEK_SET);
+    return s;
+  }
+  int    available() { return fp ? size() - position() : 0; }
+  void   flush() { if (fp) fflush(fp); }
+  void   close() { if (fp) fclose(fp); fp = nullptr; }
+private:
+  FILE *fp;
+};
+
+class SPIFFSFS {
+public:
+  bool   begin(bool formatOnFail = false);
+  bool   format();
+  bool   exists(const char *path);
+  bool   exists(const String &path) { return exists(path.c_str()); }
+  bool   remove(const char *path);
+  bool   remove(const String &path) { return remove(path.c_str()); }
+  bool   rename(const char *from, const char *to);
+  File   open(const char *path, const char *mode = "r");
+  File   open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+  size_t totalBytes() { return 1441792; }        // default 1.375MB spiffs partition
+  size_t usedBytes();
+};
+
+}
+
+using fs::File;
+extern fs::SPIFFSFS SPIFFS;
+extern const char *sim_fs_root;
+
+#endif
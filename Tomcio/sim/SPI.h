@@ -0,0 +1,4 @@
+// Host stand-in - the display and touch SPI traffic is modelled in TFT_eSPI.h
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+#endif
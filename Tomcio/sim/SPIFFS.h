@@ -0,0 +1,4 @@
+#ifndef SIM_SPIFFS_H
+#define SIM_SPIFFS_H
+#include "FS.h"
+#endif
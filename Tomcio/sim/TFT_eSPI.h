@@ -0,0 +1,173 @@
+// Host stand-in for bodmer/TFT_eSPI
+//
+// Nothing is rendered. Every drawing call is counted with the pixels it would
+// send, so rendering cost can be compared between builds. Sprites keep a
+// real pixel buffer because the run screen composes into it. The touch
+// reads play the touch script loaded by sim.cpp.
+
+#ifndef SIM_TFT_ESPI_H
+#define SIM_TFT_ESPI_H
+
+#include "Arduino.h"
+#include "FS.h"
+
+#define TFT_BLACK       0x0000
+#define TFT_NAVY        0x000F
+#define TFT_DARKGREEN   0x03E0
+#define TFT_MAROON      0x7800
+#define TFT_LIGHTGREY   0xD69A
+#define TFT_DARKGREY    0x7BEF
+#define TFT_BLUE        0x001F
+#define TFT_GREEN       0x07E0
+#define TFT_CYAN        0x07FF
+#define TFT_RED         0xF800
+#define TFT_MAGENTA     0xF81F
+#define TFT_YELLOW      0xFFE0
+#define TFT_WHITE       0xFFFF
+#define TFT_ORANGE      0xFDA0
+#define TFT_GOLD        0xFEA0
+
+#define TL_DATUM 0
+#define TC_DATUM 1
+#define TR_DATUM 2
+#define ML_DATUM 3
+#define MC_DATUM 4
+#define MR_DATUM 5
+#define BL_DATUM 6
+#define BC_DATUM 7
+#define BR_DATUM 8
+
+#define LOAD_GFXFF
+
+#ifndef SIM_SPI_MHZ
+  #define SIM_SPI_MHZ 40                         // panel SPI clock, sets time spent drawing
+#endif
+
+struct GFXfont { uint8_t yAdvance; };
+
+struct sim_tft_stats {
+  uint32_t calls;                                // drawing calls
+  uint64_t px;                                   // pixels sent to the panel
+  uint32_t trans;                                // SPI transactions (CS low periods)
+  uint32_t touch_reads;                          // getTouch() calls
+  uint64_t busy_us;                              // time the bus was busy
+};
+extern sim_tft_stats sim_tft;
+
+void sim_tft_busy(uint64_t px, bool dma);        // charge bus time for px pixels
+
+class TFT_eSPI {
+public:
+  TFT_eSPI(int16_t w = 320, int16_t h = 480) : _iw(w), _ih(h) {}
+
+  void    init() {}
+  void    setRotation(uint8_t r) { rot = r & 3; }
+  int16_t width()  { return (rot & 1) ? _ih : _iw; }
+  int16_t height() { return (rot & 1) ? _iw : _ih; }
+
+  void startWrite() { if (!locked++) sim_tft.trans++; }
+  void endWrite()   { if (locked) locked--; }
+
+  void fillScreen(uint32_t c) { fillRect(0, 0, width(), height(), c); }
+  void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t c) { area(w, h); }
+  void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t c) { draw(2 * (w + h)); }
+  void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t c) { draw(max(abs(x1 - x0), abs(y1 - y0)) + 1); }
+  void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t c){
+    draw(abs((x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0)) / 2);
+  }
+  void fillSmoothRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint32_t c, uint32_t bg = 0x00FFFFFF) { area(w, h); }
+  void fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint32_t c) { area(w, h); }
+
+  void    setTextSize(uint8_t s) { tsize = s ? s : 1; }
+  void    setTextFont(uint8_t) { font = nullptr; }
+  void    setFreeFont(const GFXfont *f) { font = f; }
+  void    setTextColor(uint16_t fg, uint16_t bg) {}
+  void    setTextColor(uint16_t fg) {}
+  void    setTextDatum(uint8_t d) {}
+  void    setCursor(int16_t x, int16_t y) {}
+  void    println(const char *s = "") { draw(textWidth(s) * fontHeight()); }
+  int16_t fontHeight() { return (font ? 24 : 8) * tsize; }
+  int16_t textWidth(const char *s) { return (font ? 14 : 6) * tsize * strlen(s); }
+  int16_t drawString(const char *s, int32_t x, int32_t y) { int16_t w = textWidth(s); draw(w * fontHeight()); return w; }
+  int16_t drawString(const String &s, int32_t x, int32_t y) { return drawString(s.c_str(), x, y); }
+
+  bool     getTouch(uint16_t *x, uint16_t *y, uint16_t threshold = 600);
+  uint16_t getTouchRawZ();
+  uint8_t  getTouchRaw(uint16_t *x, uint16_t *y);
+  void     convertRawXY(uint16_t *x, uint16_t *y) {}       // script gives screen coordinates
+  void setTouch(uint16_t *data) {}
+  void calibrateTouch(uint16_t *data, uint32_t fg, uint32_t bg, uint8_t size) { for (int i = 0; i < 5; i++) data[i] = 0; }
+
+  bool initDMA(bool ctrl_cs = false) { return true; }
+  void dmaWait();
+  void pushImageDMA(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data, uint16_t *buf = nullptr) { area(w, h, 1); }
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data) { area(w, h); }
+
+protected:
+  void draw(uint32_t px, bool dma = 0){
+    sim_tft.calls++;
+    sim_tft.px += px;
+    if (!locked) sim_tft.trans++;
+    sim_tft_busy(px, dma);
+  }
+  void area(int32_t w, int32_t h, bool dma = 0) { draw(w > 0 && h > 0 ? w * h : 0, dma); }
+
+  int16_t        _iw, _ih;
+  uint8_t        rot = 0;
+  uint8_t        tsize = 1;
+  uint8_t        locked = 0;
+  const GFXfont *font = nullptr;
+};
+
+//---------------------------------Sprite---------------------------------
+// Draws into its own buffer (not counted), pushSprite() is what hits the panel
+class TFT_eSprite : public TFT_eSPI {
+public:
+  TFT_eSprite(TFT_eSPI *tft) : TFT_eSPI(0, 0), tft(tft) {}
+  ~TFT_eSprite() { deleteSprite(); }
+
+  void  setColorDepth(int8_t) {}
+  void *createSprite(int16_t w, int16_t h){
+    deleteSprite();
+    buf = (uint16_t *)calloc(w * h, sizeof(uint16_t));
+    if (buf) { _iw = w; _ih = h; }
+    return buf;
+  }
+  void  deleteSprite() { free(buf); buf = nullptr; _iw = _ih = 0; }
+  void *getPointer() { return buf; }
+  void  fillSprite(uint32_t c) { for (int32_t i = 0; i < _iw * _ih; i++) buf[i] = c; }
+  void  fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t c){
+    for (int32_t j = max(y, (int32_t)0); j < min(y + h, (int32_t)_ih); j++)
+      for (int32_t i = max(x, (int32_t)0); i < min(x + w, (int32_t)_iw); i++) buf[j * _iw + i] = c;
+  }
+  void    fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t c) {}
+  int16_t drawString(const char *s, int32_t x, int32_t y) { return textWidth(s); }
+  int16_t drawString(const String &s, int32_t x, int32_t y) { return drawString(s.c_str(), x, y); }
+  void    pushSprite(int32_t x, int32_t y) { tft->pushImage(x, y, _iw, _ih, buf); }
+
+private:
+  TFT_eSPI *tft;
+  uint16_t *buf = nullptr;
+};
+
+//---------------------------------GFX free fonts---------------------------------
+// Only the metrics above matter on the host, every font is the same object
+#define SIM_FONTS(F) \
+  F(FreeMono9pt7b) F(FreeMono12pt7b) F(FreeMono18pt7b) F(FreeMono24pt7b) \
+  F(FreeMonoBold9pt7b) F(FreeMonoBold12pt7b) F(FreeMonoBold18pt7b) F(FreeMonoBold24pt7b) \
+  F(FreeMonoOblique9pt7b) F(FreeMonoOblique12pt7b) F(FreeMonoOblique18pt7b) F(FreeMonoOblique24pt7b) \
+  F(FreeMonoBoldOblique9pt7b) F(FreeMonoBoldOblique12pt7b) F(FreeMonoBoldOblique18pt7b) F(FreeMonoBoldOblique24pt7b) \
+  F(FreeSans9pt7b) F(FreeSans12pt7b) F(FreeSans18pt7b) F(FreeSans24pt7b) \
+  F(FreeSansBold9pt7b) F(FreeSansBold12pt7b) F(FreeSansBold18pt7b) F(FreeSansBold24pt7b) \
+  F(FreeSansOblique9pt7b) F(FreeSansOblique12pt7b) F(FreeSansOblique18pt7b) F(FreeSansOblique24pt7b) \
+  F(FreeSansBoldOblique9pt7b) F(FreeSansBoldOblique12pt7b) F(FreeSansBoldOblique18pt7b) F(FreeSansBoldOblique24pt7b) \
+  F(FreeSerif9pt7b) F(FreeSerif12pt7b) F(FreeSerif18pt7b) F(FreeSerif24pt7b) \
+  F(FreeSerifItalic9pt7b) F(FreeSerifItalic12pt7b) F(FreeSerifItalic18pt7b) F(FreeSerifItalic24pt7b) \
+  F(FreeSerifBold9pt7b) F(FreeSerifBold12pt7b) F(FreeSerifBold18pt7b) F(FreeSerifBold24pt7b) \
+  F(FreeSerifBoldItalic9pt7b) F(FreeSerifBoldItalic12pt7b) F(FreeSerifBoldItalic18pt7b) F(FreeSerifBoldItalic24pt7b) \
+  F(TomThumb)
+
+#define SIM_FONT_DECL(name) extern const GFXfont name;
+SIM_FONTS(SIM_FONT_DECL)
+
+#endif
@@ -0,0 +1,19 @@
+// Host stand-in - only the RMT item layout, step_profile fills it
+#ifndef SIM_DRIVER_RMT_H
+#define SIM_DRIVER_RMT_H
+
+#include <stdint.h>
+
+typedef struct {
+  union {
+    struct {
+      uint32_t duration0 : 15;
+      uint32_t level0    : 1;
+      uint32_t duration1 : 15;
+      uint32_t level1    : 1;
+    };
+    uint32_t val;
+  };
+} rmt_item32_t;
+
+#endif
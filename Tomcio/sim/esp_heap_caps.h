@@ -0,0 +1,27 @@
+// Host stand-in - every capability maps to the plain heap
+//
+// Free size is SIM_HEAP less what the process has allocated, so heap use
+// measured by the firmware is the real one.
+#ifndef SIM_ESP_HEAP_CAPS_H
+#define SIM_ESP_HEAP_CAPS_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <malloc.h>
+
+#define SIM_HEAP 300000                          // about what the S3 has free after boot
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void  *heap_caps_malloc(size_t n, uint32_t) { return malloc(n); }
+static inline void   heap_caps_free(void *p) { free(p); }
+static inline size_t heap_caps_get_free_size(uint32_t){
+  size_t used = mallinfo2().uordblks;
+  return used < SIM_HEAP ? SIM_HEAP - used : 0;
+}
+
+#endif
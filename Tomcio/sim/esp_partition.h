@@ -0,0 +1,61 @@
+// Host stand-in for the ESP-IDF partition API
+//
+// The data partitions from partitions.csv are RAM buffers, loaded from
+// <fs dir>/.part_<label> on first use and saved back at exit. Erase sets
+// 0xFF and writes can only clear bits, as on NOR flash. Mapping hands out
+// the buffer itself. Erase and write move the virtual clock as long as the
+// flash chip would take.
+//
+// sim_flash_cut() makes the power fail after a number of bytes have been
+// erased or programmed: the operation in progress stops at that byte and
+// everything after it fails until the cut is lifted.
+
+#ifndef SIM_ESP_PARTITION_H
+#define SIM_ESP_PARTITION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+#define ESP_OK             0
+#define ESP_FAIL           -1
+#define ESP_ERR_INVALID_ARG 0x102
+
+#define SPI_FLASH_SEC_SIZE 4096
+#define SIM_ERASE_US       45000                 // per sector
+#define SIM_PAGE_US        600                   // per 256 byte page programmed
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1 } esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+typedef enum { SPI_FLASH_MMAP_DATA, SPI_FLASH_MMAP_INST } spi_flash_mmap_memory_t;
+typedef uint32_t spi_flash_mmap_handle_t;
+
+struct esp_partition_t {
+  esp_partition_type_t    type;
+  esp_partition_subtype_t subtype;
+  uint32_t                address;
+  uint32_t                size;
+  char                    label[17];
+};
+
+struct sim_flash_stats {
+  uint32_t maps;
+  uint32_t erases;                               // sectors
+  uint32_t writes;
+  uint64_t wr_bytes;
+};
+extern sim_flash_stats sim_flash;
+
+void sim_flash_cut(int32_t bytes);               // -1 = never
+void sim_flash_detach();                         // stop mirroring to the host file
+uint8_t *sim_flash_mem(const char *label);
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_mmap(const esp_partition_t *part, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void **out_ptr, spi_flash_mmap_handle_t *out_handle);
+void      spi_flash_munmap(spi_flash_mmap_handle_t handle);
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size);
+
+#endif
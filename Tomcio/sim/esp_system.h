@@ -0,0 +1,40 @@
+// Host stand-in - reset reason, and the resets the simulator makes (-k, -K)
+//
+// RTC_NOINIT_ATTR variables go to their own section. A reset saves it with
+// the RTC clock to <fs dir>/.rtc, the next start takes the file back and
+// reports ESP_RST_BROWNOUT. Without the file it is a power-on and RTC memory
+// holds noise.
+
+#ifndef SIM_ESP_SYSTEM_H
+#define SIM_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO
+} esp_reset_reason_t;
+
+esp_reset_reason_t esp_reset_reason();
+
+#define SIM_RESET_US   400000                    // ROM and bootloader before the next start
+#define SIM_RESET_EXIT 3                         // exit status of a reset or power cut
+
+void sim_reset_at(uint64_t us, bool keep_rtc);   // virtual time, keep_rtc false cuts the power
+extern void (*sim_on_reset)();                   // called just before
+extern void (*sim_on_setup)();                   // called when setup() returns
+
+void sim_rtc_save(uint64_t rtc_us);              // RTC clock at the next start
+void sim_rtc_drop();
+bool sim_rtc_load(uint64_t *rtc_us);             // false: power on
+
+#endif
@@ -0,0 +1,651 @@
+// Host simulator
+//
+// Runs setup()/loop() from src on a virtual clock. Time only moves when the
+// firmware waits: delay() advances it, and between loop() calls the clock
+// jumps straight to the next thing that can happen - timer 0 alarm, next
+// scheduler deadline or next motor step. A whole development session takes
+// well under a second of host time.
+//
+//   .pio/build/native/program [-s touch_script] [-t minutes] [-d fs_dir] [-r stalls] [-l recipes] [-w ms]
+//   .pio/build/native/program -p                  power-fail sweep of the program store
+//   .pio/build/native/program -b <rows>           recipe import benchmark
+//   .pio/build/native/program -u <speed> [...]    serial port on a pseudo-terminal
+//   .pio/build/native/program -k|-K <ms> [...]    reset / power cut at that time
+//   .pio/build/native/program -c <n>              resume test, n random resets and power cuts
+// -l writes that many made-up recipes to the library before setup(), the
+// clock starts from 0 after it.
+//
+// Touch script lines (ms is virtual time since power on):
+//   <ms> <x> <y> [hold_ms]       single touch
+//   every <ms> <x> <y>           touch repeated with that period
+//   serial <ms> <text>           text arrives on Serial at that time
+//   stall <ms> <len_ms>          loop() is held up for len_ms
+// -r adds that many stalls of 0.2..30s at random times. Every timer tick must
+// still reach loop(), after a stall longer than the tick ring rebuilt from its
+// seq - the sim exits with 1 if one went missing, or in a run without stalls
+// if the ring overran or a scheduler event fired more than SIM_LATE_MS after
+// its deadline (a boot after -k catches up what came due while it was down).
+// Built with -D HEAP_WATCH (env native_heap) it also exits with 1 if anything
+// allocated after setup().
+// Without a script the screen is touched at 240,270 every 3s, which hits
+// LOAD, START and the initial agitation button in turn. -w holds the first
+// of them back that many ms, the select screen waits that long.
+//
+// -u serves Serial on a pseudo-terminal for tools/tomcio_host.py, its name is
+// printed at start. The virtual clock is then held to <speed> times the wall
+// clock so the host can keep up, and there are no default touches - the
+// host loads and starts the run.
+//
+// -k resets the timer at that virtual time, as a brownout would: RTC memory
+// (RTC_NOINIT_ATTR variables) and the RTC clock behind gettimeofday() are
+// kept in <fs dir>/.rtc for the next start, which comes SIM_RESET_US later.
+// -K cuts the power instead and RTC memory is lost. Either way the flash
+// partitions are saved and the sim exits with SIM_RESET_EXIT, the next
+// start of the program is the timer booting again.
+
+#include <stdarg.h>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "Arduino.h"
+#include "TFT_eSPI.h"
+#include "SPIFFS.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "sched.h"
+#include "motor.h"
+#include "tick.h"
+#include "touch.h"
+#include "heapmon.h"
+
+HWSerial       Serial;
+EspClass       ESP;
+sim_tft_stats  sim_tft;
+
+static uint64_t now_us = 0;                      // virtual clock
+static uint64_t rtc_base;                        // RTC clock at power on, moved on by -k
+static esp_reset_reason_t reset_why = ESP_RST_POWERON;
+static uint64_t kill_us = UINT64_MAX;            // -k / -K
+static bool     kill_rtc;                        // -k, RTC memory survives
+
+void (*sim_on_reset)();
+void (*sim_on_setup)();
+
+static int      pty_fd = -1;                     // -u, master side of the host's serial port
+static double   pty_speed;                       // virtual seconds per wall second
+static std::chrono::steady_clock::time_point wall0;
+
+// Virtual time t as wall clock time
+static std::chrono::steady_clock::time_point wall_at(uint64_t t){
+  return wall0 + std::chrono::microseconds((int64_t)(t / pty_speed));
+}
+
+//=================================CLOCK AND TIMER=================================
+
+#define TOUCH_MAX  64                            // script touch lines
+#define TOUCH_HOLD 50                            // default touch length [ms]
+
+struct touch_t {
+  uint32_t at;                                   // first touch [ms]
+  uint32_t every;                                // repeat period, 0 = once
+  uint16_t hold;
+  uint16_t x, y;
+};
+static touch_t touches[TOUCH_MAX];
+static uint8_t touch_n;
+uint32_t       sim_touch_ms = 3000;              // first default touch, -w
+static void   (*pin_isr)();                      // attachInterrupt() handler, T_IRQ
+static uint64_t edge_next = UINT64_MAX;          // next scripted touch-down [us]
+
+// First touch-down at or after from_us
+static uint64_t edge_from(uint64_t from_us);
+
+void sim_touch(uint32_t at_ms, uint16_t x, uint16_t y){
+  if (touch_n < TOUCH_MAX) touches[touch_n++] = {at_ms, 0, TOUCH_HOLD, x, y};
+  edge_next = edge_from(now_us);
+}
+
+static uint64_t edge_from(uint64_t from_us){
+  uint64_t e = UINT64_MAX;
+  uint64_t from = (from_us + 999) / 1000;        // [ms]
+  for (uint8_t i = 0; i < touch_n; i++) {
+    const touch_t &t = touches[i];
+    uint64_t at = t.at;
+    if (at < from && t.every) at += (from - at + t.every - 1) / t.every * t.every;
+    if (at >= from) e = min(e, at * 1000);
+  }
+  return e;
+}
+
+struct hw_timer_t {
+  uint16_t div;
+  uint64_t alarm;
+  void   (*isr)();
+  bool     on;
+};
+static hw_timer_t timer0;
+static uint64_t   tick_us;                       // alarm period
+static uint64_t   tick_next;                     // next alarm
+static uint32_t   ticks;                         // alarms fired
+
+static void timer_arm(){
+  tick_us   = timer0.alarm * timer0.div / 80;
+  tick_next = now_us + tick_us;
+}
+
+static void sim_reset();
+
+// Move the clock forward, firing timer alarms and T_IRQ edges on the way
+static void advance_to(uint64_t t){
+  bool down = t >= kill_us;
+  if (down) t = kill_us;
+  if (pty_fd >= 0 && t > now_us) {
+    auto ahead = std::chrono::duration_cast<std::chrono::microseconds>(wall_at(t) - std::chrono::steady_clock::now());
+    if (ahead.count() > 0) usleep(ahead.count());
+  }
+  for (;;) {
+    uint64_t tk = (timer0.on && tick_us) ? tick_next : UINT64_MAX;
+    if (min(tk, edge_next) > t) break;
+    if (edge_next < tk) {
+      now_us    = max(now_us, edge_next);
+      edge_next = edge_from(edge_next + 1);
+      if (pin_isr) pin_isr();
+    } else {
+      now_us = tick_next;
+      tick_next += tick_us;
+      ticks++;
+      timer0.isr();
+    }
+  }
+  if (t > now_us) now_us = t;
+  if (down) sim_reset();
+}
+
+int64_t  esp_timer_get_time() { return now_us; }
+
+// System time runs on the RTC clock, which a reset doesn't stop
+int gettimeofday(struct timeval *tv, void *tz) throw(){
+  uint64_t t = rtc_base + now_us;
+  tv->tv_sec  = t / 1000000;
+  tv->tv_usec = t % 1000000;
+  return 0;
+}
+
+esp_reset_reason_t esp_reset_reason() { return reset_why; }
+
+void sim_reset_at(uint64_t us, bool keep_rtc){
+  kill_us  = us;
+  kill_rtc = keep_rtc;
+}
+
+// Exits wherever the firmware is, the partitions are saved at exit
+static void sim_reset(){
+  fflush(stdout);
+  if (sim_on_reset) sim_on_reset();
+  if (kill_rtc) sim_rtc_save(rtc_base + now_us + SIM_RESET_US);
+  else sim_rtc_drop();
+  fprintf(stderr, "\nsim: %s at %.3f s\n", kill_rtc ? "reset" : "power cut", now_us / 1e6);
+  exit(SIM_RESET_EXIT);
+}
+uint32_t millis() { return now_us / 1000; }
+uint32_t micros() { return now_us; }
+static void report();
+static uint64_t sim_end   = UINT64_MAX;          // -t
+static bool     sim_setup = false;               // inside setup()
+
+// setup() waits for touches in a loop, a script that never presses LOAD ends here
+void delay(uint32_t ms){
+  advance_to(now_us + ms * 1000ULL);
+  if (sim_setup && now_us >= sim_end) {
+    fprintf(stderr, "\nsim: still in setup() at the end of the run\n");
+    report();
+    exit(1);
+  }
+}
+void delayMicroseconds(uint32_t us) { advance_to(now_us + us); }
+
+hw_timer_t *timerBegin(uint8_t num, uint16_t divider, bool countUp){
+  timer0.div = divider;
+  return &timer0;
+}
+void timerAttachInterrupt(hw_timer_t *t, void (*fn)(), bool edge) { t->isr = fn; }
+void timerAlarmWrite(hw_timer_t *t, uint64_t alarm, bool reload) { t->alarm = alarm; }
+void timerAlarmEnable(hw_timer_t *t) { t->on = t->isr != nullptr; timer_arm(); }
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+void attachInterrupt(uint8_t pin, void (*fn)(), int mode) { pin_isr = fn; }
+
+#define INPUT_MAX  16                            // script serial lines
+
+struct input_t {
+  uint32_t at;
+  char     text[32];
+};
+static input_t input[INPUT_MAX];
+static uint8_t input_n;
+static uint8_t input_pos;                        // next line, chars consumed from it
+static uint8_t input_chr;
+
+#define SIM_CDC_TX 256                           // free TX buffer reported, as HWCDC's
+
+static uint8_t pty_in[256];
+static ssize_t pty_n, pty_pos;
+
+static uint8_t feed[1024];                       // sim_serial_feed()
+static size_t  feed_n, feed_pos;
+static uint8_t *cap;                             // sim_serial_capture()
+static size_t  cap_size, *cap_n;
+
+void sim_serial_feed(const uint8_t *b, size_t n){
+  if (feed_pos == feed_n) feed_n = feed_pos = 0;
+  n = min(n, sizeof(feed) - feed_n);
+  memcpy(feed + feed_n, b, n);
+  feed_n += n;
+}
+
+void sim_serial_capture(uint8_t *buf, size_t size, size_t *n){
+  cap      = buf;
+  cap_size = size;
+  cap_n    = n;
+}
+
+// Script lines must be in time order
+int HWSerial::available(){
+  if (feed_pos < feed_n) return feed_n - feed_pos;
+  if (pty_fd >= 0) {
+    if (pty_pos == pty_n) {
+      pty_n   = max(::read(pty_fd, pty_in, sizeof(pty_in)), (ssize_t)0);
+      pty_pos = 0;
+    }
+    return pty_n - pty_pos;
+  }
+  if (input_pos >= input_n || millis() < input[input_pos].at) return 0;
+  return strlen(input[input_pos].text) - input_chr;
+}
+
+int HWSerial::read(){
+  if (!available()) return -1;
+  if (feed_pos < feed_n) return feed[feed_pos++];
+  if (pty_fd >= 0) return pty_in[pty_pos++];
+  char c = input[input_pos].text[input_chr++];
+  if (!input[input_pos].text[input_chr]) { input_pos++; input_chr = 0; }
+  return c;
+}
+
+// The pty is written whole, like the USB driver waiting out its buffer
+size_t HWSerial::write(const uint8_t *b, size_t n){
+  if (cap) {
+    size_t k = min(n, cap_size - *cap_n);
+    memcpy(cap + *cap_n, b, k);
+    *cap_n += k;
+    return n;
+  }
+  if (pty_fd < 0) return fwrite(b, 1, n, stdout);
+  size_t done = 0;
+  while (done < n) {
+    ssize_t w = ::write(pty_fd, b + done, n - done);
+    if (w > 0) done += w;
+    else {
+      pollfd p = {pty_fd, POLLOUT, 0};
+      if (poll(&p, 1, 1000) <= 0) break;         // nobody reads, the rest is lost
+    }
+  }
+  return done;
+}
+
+int HWSerial::availableForWrite(){
+  if (pty_fd < 0) return SIM_CDC_TX;
+  pollfd p = {pty_fd, POLLOUT, 0};
+  return poll(&p, 1, 0) > 0 ? SIM_CDC_TX : 0;
+}
+
+// As Print::printf on arduino-esp32: 64 bytes on the stack, longer lines
+// in a malloc'd buffer, which a HEAP_WATCH build then counts
+int HWSerial::printf(const char *f, ...){
+  char loc[64];
+  char *s = loc;
+  va_list a, b;
+  va_start(a, f);
+  va_copy(b, a);
+  int r = vsnprintf(loc, sizeof(loc), f, a);
+  va_end(a);
+  if (r >= (int)sizeof(loc)) {
+    s = (char *)malloc(r + 1);
+    if (s) vsnprintf(s, r + 1, f, b);
+  }
+  va_end(b);
+  if (s && r > 0) write((const uint8_t *)s, r);
+  if (s != loc) free(s);
+  return r;
+}
+
+#ifndef PIO_UNIT_TESTING                         // main() only
+// Master side non-blocking, the slave raw and kept open so the master
+// doesn't see a hangup while no host has it open
+static bool pty_open(){
+  pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty_fd < 0 || grantpt(pty_fd) || unlockpt(pty_fd)) return false;
+  int slave = open(ptsname(pty_fd), O_RDWR | O_NOCTTY);
+  if (slave < 0) return false;
+  termios t;
+  tcgetattr(slave, &t);
+  cfmakeraw(&t);
+  tcsetattr(slave, TCSANOW, &t);
+  fcntl(pty_fd, F_SETFL, fcntl(pty_fd, F_GETFL) | O_NONBLOCK);
+  fprintf(stderr, "sim: serial port on %s, x%g real time\n", ptsname(pty_fd), pty_speed);
+  return true;
+}
+#endif
+
+// Waits for the wall clock to reach wake, or less if the host sends something
+static uint64_t pty_wait(uint64_t wake){
+  if (pty_fd < 0 || Serial.available()) return wake;
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(wall_at(wake) - std::chrono::steady_clock::now());
+  pollfd p = {pty_fd, POLLIN, 0};
+  if (left.count() <= 0 || poll(&p, 1, left.count()) <= 0) return wake;
+  auto in = std::chrono::steady_clock::now() - wall0;
+  uint64_t t = std::chrono::duration_cast<std::chrono::microseconds>(in).count() * pty_speed;
+  return max(min(t, wake), now_us + 1);
+}
+
+//=================================DISPLAY AND TOUCH=================================
+
+#define SIM_FONT_DEF(name) const GFXfont name = {24};
+SIM_FONTS(SIM_FONT_DEF)
+
+
+#define STALL_MAX  64
+
+struct stall_t {
+  uint32_t at;                                   // [ms]
+  uint32_t len;                                  // [ms]
+};
+static stall_t stalls[STALL_MAX];
+static uint8_t stall_n;
+static uint8_t stall_pos;
+
+#ifndef PIO_UNIT_TESTING
+static bool touch_load(const char *file){
+  FILE *f = fopen(file, "r");
+  if (!f) return false;
+  char line[96];
+  while (touch_n < TOUCH_MAX && fgets(line, sizeof(line), f)) {
+    touch_t t = {0, 0, TOUCH_HOLD, 0, 0};
+    unsigned a, x, y, h = TOUCH_HOLD;
+    if (stall_n < STALL_MAX && sscanf(line, " stall %u %u", &a, &h) == 2) {
+      stalls[stall_n++] = {a, h};
+      continue;
+    }
+    if (input_n < INPUT_MAX && sscanf(line, " serial %u %31s", &a, input[input_n].text) == 2) {
+      input[input_n++].at = a;
+      continue;
+    }
+    if (sscanf(line, " every %u %u %u", &a, &x, &y) == 3) {
+      t.every = a;
+      t.at    = a;
+    } else if (sscanf(line, " %u %u %u %u", &a, &x, &y, &h) >= 3) {
+      t.at = a;
+    } else continue;                             // comment or blank
+    t.x = x; t.y = y; t.hold = h;
+    touches[touch_n++] = t;
+  }
+  fclose(f);
+  return true;
+}
+#endif
+
+// 16 bits per pixel on the bus. Blocking writes move the clock, a DMA push
+// only marks the bus busy until dmaWait() or the next write.
+static uint64_t spi_free;                        // virtual time the bus is idle again
+static bool     spi_motor;                       // motor_service() running from spi_wait()
+
+// The motor task has a core of its own on the ESP32, it keeps stepping while
+// loop() waits for the display
+static void spi_wait(){
+  uint32_t d;
+  while (!spi_motor && motor_next_due(&d)) {
+    uint64_t at = now_us + max((int32_t)(d - micros()), (int32_t)0);
+    if (at >= spi_free) break;
+    advance_to(at);
+    spi_motor = true;
+    motor_service();
+    spi_motor = false;
+  }
+  advance_to(spi_free);
+}
+
+void sim_tft_busy(uint64_t px, bool dma){
+  uint64_t us = px * 16 / SIM_SPI_MHZ;
+  sim_tft.busy_us += us;
+  spi_free = max(spi_free, now_us) + us;
+  if (!dma) spi_wait();
+}
+
+void TFT_eSPI::dmaWait() { spi_wait(); }
+
+static bool touch_at(uint32_t ms, uint16_t *x, uint16_t *y){
+  for (uint8_t i = 0; i < touch_n; i++) {
+    const touch_t &t = touches[i];
+    if (ms < t.at) continue;
+    uint32_t into = t.every ? (ms - t.at) % t.every : ms - t.at;
+    if (into < t.hold) {
+      *x = t.x;
+      *y = t.y;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Each call is one transaction with the touch controller
+static void touch_read(bool locked){
+  sim_tft.touch_reads++;
+  if (!locked) sim_tft.trans++;
+}
+
+bool TFT_eSPI::getTouch(uint16_t *x, uint16_t *y, uint16_t threshold){
+  touch_read(locked);
+  return touch_at(millis(), x, y);
+}
+
+uint16_t TFT_eSPI::getTouchRawZ(){
+  uint16_t x, y;
+  touch_read(locked);
+  return touch_at(millis(), &x, &y) ? 1000 : 0;
+}
+
+uint8_t TFT_eSPI::getTouchRaw(uint16_t *x, uint16_t *y){
+  touch_read(locked);
+  return touch_at(millis(), x, y);
+}
+
+int digitalRead(uint8_t pin){
+  uint16_t x, y;
+  return touch_at(millis(), &x, &y) ? LOW : HIGH;  // only T_IRQ is read
+}
+
+//=================================RUN=================================
+
+static uint32_t loops;
+
+static void report(){
+  double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall0).count();
+  fprintf(stderr, "\n--- sim: %.1f s virtual in %.1f ms host (x%.0f)\n", now_us / 1e6, wall, now_us / 1e3 / (wall > 0 ? wall : 1));
+  fprintf(stderr, "loop() %u  timer ticks %u  events %u  worst lateness %u ms\n",
+          loops, ticks, sched_dispatched, sched_late_worst);
+  fprintf(stderr, "tft: %u calls  %llu px  %u SPI transactions  %u touch reads  bus busy %.1f s\n",
+          sim_tft.calls, (unsigned long long)sim_tft.px, sim_tft.trans, sim_tft.touch_reads, sim_tft.busy_us / 1e6);
+  fprintf(stderr, "fs: %u opens  %u reads %llu B  %u writes %llu B\n",
+          sim_fs.opens, sim_fs.reads, (unsigned long long)sim_fs.rd_bytes,
+          sim_fs.writes, (unsigned long long)sim_fs.wr_bytes);
+  fprintf(stderr, "flash: %u maps  %u sector erases  %u writes %llu B\n",
+          sim_flash.maps, sim_flash.erases, sim_flash.writes, (unsigned long long)sim_flash.wr_bytes);
+  fprintf(stderr, "motor: %u step pulses\n", stepper.pulses);
+  fprintf(stderr, "ticks: %u fired  %u handled  %u rebuilt after overrun  %u stalls\n",
+          ticks, tick_done, tick_rebuilt, stall_pos);
+}
+
+// n stalls spread over the run, fixed seed so failures repeat
+static void stall_random(uint8_t n, uint32_t minutes){
+  uint32_t seed = 12345;
+  uint32_t span = minutes * 60000 / (n + 1);
+  for (uint8_t i = 0; i < n && stall_n < STALL_MAX; i++) {
+    seed = seed * 1103515245 + 12345;
+    stalls[stall_n++] = {span * (i + 1), 200 + (seed >> 8) % 29800};
+  }
+}
+
+static int stall_cmp(const void *a, const void *b){
+  uint32_t x = ((const stall_t *)a)->at, y = ((const stall_t *)b)->at;
+  return x < y ? -1 : x > y;
+}
+
+void EspClass::restart(){
+  fflush(stdout);
+  report();
+  exit(0);
+}
+
+// Earliest of timer alarm, T_IRQ edge, scheduler deadline, motor step and touch sample
+static uint64_t next_wake(){
+  uint64_t wake = min(timer0.on ? tick_next : now_us + 1000, edge_next);
+  uint32_t d;
+  if (sched_next_due(&d)) {
+    int32_t ms = (int32_t)(d - millis());
+    wake = min(wake, ms > 0 ? (now_us / 1000 + ms) * 1000 : now_us);
+  }
+  if (motor_next_due(&d)) {
+    int32_t us = (int32_t)(d - micros());
+    wake = min(wake, now_us + max(us, (int32_t)0));
+  }
+  if (touch_next_due(&d)) {
+    int32_t ms = (int32_t)(d - millis());
+    wake = min(wake, ms > 0 ? (now_us / 1000 + ms) * 1000 : now_us);
+  }
+  return wake;
+}
+
+void setup();
+void loop();
+
+static void step(uint64_t end){
+  loop();
+  loops++;
+  uint64_t wake = pty_wait(min(next_wake(), end));
+  advance_to(wake > now_us ? wake : now_us + 1);
+}
+
+void sim_step(){
+  step(UINT64_MAX);
+}
+int  sim_powerfail();
+int  sim_import(uint32_t rows);
+void sim_library(uint32_t n);
+int  sim_resume(uint32_t n, uint32_t minutes);
+
+#define SIM_LATE_MS 5                            // worst event lateness that passes
+
+// setup() and loop() until the end of the run, 1 if a timer tick went missing,
+// or without stalls the tick ring overran or an event was late
+int sim_run(uint32_t minutes, uint8_t random_stalls){
+  uint64_t rtc;
+  if (sim_rtc_load(&rtc)) {                      // booting again after -k
+    rtc_base  = rtc;
+    reset_why = ESP_RST_BROWNOUT;
+  }
+  if (!touch_n && pty_fd < 0) touches[touch_n++] = {sim_touch_ms, 3000, TOUCH_HOLD, 240, 270};
+  edge_next = edge_from(0);
+  stall_random(random_stalls, minutes);
+  qsort(stalls, stall_n, sizeof(stall_t), stall_cmp);
+
+  wall0 = std::chrono::steady_clock::now();
+  uint64_t end = minutes * 60000000ULL;
+  sim_end   = end;
+  sim_setup = true;
+  setup();
+  sim_setup = false;
+  if (sim_on_setup) sim_on_setup();
+#ifdef HEAP_WATCH
+  uint32_t heap0 = heap_allocs();
+#endif
+
+  while (now_us < end) {
+    if (stall_pos < stall_n && millis() >= stalls[stall_pos].at) {
+      advance_to(now_us + stalls[stall_pos++].len * 1000ULL);   // timer keeps firing
+    }
+    step(end);
+  }
+  loop();                                        // pick up the last tick
+  fflush(stdout);
+  report();
+  if (tick_done != ticks) {
+    fprintf(stderr, "LOST %d timer ticks\n", (int)(ticks - tick_done));
+    return 1;
+  }
+  if (!stall_n && tick_rebuilt) {
+    fprintf(stderr, "OVERRUN %u timer ticks rebuilt without a stall\n", tick_rebuilt);
+    return 1;
+  }
+  if (!stall_n && reset_why == ESP_RST_POWERON && sched_late_worst > SIM_LATE_MS) {
+    fprintf(stderr, "LATE event by %u ms, more than %u\n", sched_late_worst, SIM_LATE_MS);
+    return 1;
+  }
+#ifdef HEAP_WATCH
+  if (heap_allocs() != heap0) {
+    fprintf(stderr, "HEAP %u allocations after setup()\n", heap_allocs() - heap0);
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv){
+  const char *script = nullptr;
+  uint32_t minutes = 30;
+  uint8_t  random_stalls = 0;
+  bool     powerfail = false;
+  uint32_t recipes = 0;
+  uint32_t bench = 0;
+  uint32_t cuts = 0;
+  double   speed = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-p")) powerfail = true;
+    else if (i + 1 == argc) break;
+    else if (!strcmp(argv[i], "-s")) script = argv[++i];
+    else if (!strcmp(argv[i], "-t")) minutes = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-d")) sim_fs_root = argv[++i];
+    else if (!strcmp(argv[i], "-r")) random_stalls = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-l")) recipes = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-b")) bench = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-u")) speed = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-k")) sim_reset_at(atoll(argv[++i]) * 1000, true);
+    else if (!strcmp(argv[i], "-K")) sim_reset_at(atoll(argv[++i]) * 1000, false);
+    else if (!strcmp(argv[i], "-c")) cuts = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-w")) sim_touch_ms = atoi(argv[++i]);
+  }
+  if (powerfail) return sim_powerfail();
+  if (bench) return sim_import(bench);
+  if (cuts) return sim_resume(cuts, minutes);
+  sim_library(recipes);
+  now_us = 0;                                    // flash writes above took virtual time
+  if (script && !touch_load(script)) {
+    fprintf(stderr, "can't read touch script %s\n", script);
+    return 1;
+  }
+  if (speed > 0) {
+    pty_speed = speed;
+    if (!pty_open()) {
+      fprintf(stderr, "can't open a pseudo-terminal\n");
+      return 1;
+    }
+  }
+  return sim_run(minutes, random_stalls);
+}
+#endif
@@ -0,0 +1,247 @@
+// Host simulator - SPIFFS on a host directory
+//
+// Kept apart from sim.cpp, motor.h defines DIR as a pin number.
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include "SPIFFS.h"
+
+fs::SPIFFSFS SPIFFS;
+sim_fs_stats sim_fs;
+const char  *sim_fs_root = ".pio/simfs";
+
+static const char *host_path(const char *p){
+  static char buf[512];
+  snprintf(buf, sizeof(buf), "%s%s%s", sim_fs_root, p[0] == '/' ? "" : "/", p);
+  return buf;
+}
+
+bool fs::SPIFFSFS::begin(bool formatOnFail){
+  char dir[256];
+  snprintf(dir, sizeof(dir), "%s", sim_fs_root);
+  for (char *s = dir + 1; *s; s++) {
+    if (*s == '/') { *s = 0; mkdir(dir, 0755); *s = '/'; }
+  }
+  mkdir(dir, 0755);
+  struct stat st;
+  return stat(dir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool fs::SPIFFSFS::format(){
+  DIR *d = opendir(sim_fs_root);
+  if (!d) return false;
+  struct dirent *e;
+  while ((e = readdir(d))) {
+    if (e->d_name[0] != '.') ::remove(host_path(e->d_name));
+  }
+  closedir(d);
+  return true;
+}
+
+bool fs::SPIFFSFS::exists(const char *path){
+  struct stat st;
+  return stat(host_path(path), &st) == 0;
+}
+
+bool fs::SPIFFSFS::remove(const char *path) { return ::remove(host_path(path)) == 0; }
+
+bool fs::SPIFFSFS::rename(const char *from, const char *to){
+  char src[512];
+  snprintf(src, sizeof(src), "%s", host_path(from));
+  return ::rename(src, host_path(to)) == 0;
+}
+
+fs::File fs::SPIFFSFS::open(const char *path, const char *mode){
+  const char *m = mode[0] == 'w' ? "w+b" : mode[0] == 'a' ? "a+b" : "rb";
+  FILE *f = fopen(host_path(path), m);
+  if (f) sim_fs.opens++;
+  return File(f);
+}
+
+size_t fs::SPIFFSFS::usedBytes(){
+  size_t used = 0;
+  DIR *d = opendir(sim_fs_root);
+  if (!d) return 0;
+  struct dirent *e;
+  struct stat st;
+  while ((e = readdir(d))) {
+    if (e->d_name[0] != '.' && stat(host_path(e->d_name), &st) == 0) used += st.st_size;
+  }
+  closedir(d);
+  return used;
+}
+
+//=================================RTC MEMORY=================================
+
+#include "esp_system.h"
+
+// Bounds of the RTC_NOINIT_ATTR section, from the linker
+extern uint8_t __start_rtc_noinit[], __stop_rtc_noinit[];
+
+static const char *rtc_file(){
+  return host_path(".rtc");
+}
+
+void sim_rtc_save(uint64_t rtc_us){
+  FILE *f = fopen(rtc_file(), "wb");
+  if (!f) return;
+  fwrite(&rtc_us, sizeof(rtc_us), 1, f);
+  fwrite(__start_rtc_noinit, 1, __stop_rtc_noinit - __start_rtc_noinit, f);
+  fclose(f);
+}
+
+void sim_rtc_drop(){
+  ::remove(rtc_file());
+}
+
+// The file is taken, RTC memory lasts one reset
+bool sim_rtc_load(uint64_t *rtc_us){
+  size_t n  = __stop_rtc_noinit - __start_rtc_noinit;
+  FILE  *f  = fopen(rtc_file(), "rb");
+  bool   ok = f && fread(rtc_us, sizeof(*rtc_us), 1, f) == 1 && fread(__start_rtc_noinit, 1, n, f) == n;
+  if (f) fclose(f);
+  sim_rtc_drop();
+  if (!ok) {
+    uint32_t seed = 2463534242u;
+    for (size_t i = 0; i < n; i++) {
+      seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+      __start_rtc_noinit[i] = seed;
+    }
+  }
+  return ok;
+}
+
+//=================================FLASH PARTITION=================================
+
+#include <string.h>
+#include "esp_partition.h"
+
+// As in partitions.csv
+struct sim_part {
+  esp_partition_t p;
+  uint8_t        *mem;
+  bool            dirty;                         // to be saved at exit
+};
+static uint8_t  progs_mem[0x10000];
+static uint8_t  recipes_mem[0x100000];
+static uint8_t  resume_mem[0x2000];
+static uint8_t  journal_mem[0x10000];
+static sim_part parts[] = {
+  {{ESP_PARTITION_TYPE_DATA, 0x40, 0x400000, sizeof(progs_mem),   "progs"},   progs_mem,   false},
+  {{ESP_PARTITION_TYPE_DATA, 0x41, 0x410000, sizeof(recipes_mem), "recipes"}, recipes_mem, false},
+  {{ESP_PARTITION_TYPE_DATA, 0x42, 0x510000, sizeof(resume_mem),  "resume"},  resume_mem,  false},
+  {{ESP_PARTITION_TYPE_DATA, 0x43, 0x512000, sizeof(journal_mem), "journal"}, journal_mem, false},
+};
+#define PART_N (sizeof(parts) / sizeof(parts[0]))
+
+sim_flash_stats sim_flash;
+
+static bool    loaded   = false;
+static bool    detached = false;
+static int32_t budget   = -1;                    // bytes until the power fails
+
+void sim_flash_cut(int32_t bytes) { budget = bytes; }
+void sim_flash_detach() { loaded = detached = true; }
+
+uint8_t *sim_flash_mem(const char *label){
+  for (sim_part &sp : parts) if (!strcmp(sp.p.label, label)) return sp.mem;
+  return NULL;
+}
+
+// Bytes of an n byte operation done before the power fails
+static size_t powered(size_t n){
+  if (budget < 0) return n;
+  size_t ok = (size_t)budget < n ? (size_t)budget : n;
+  budget -= ok;
+  return ok;
+}
+
+// Each partition is kept in a host file next to the SPIFFS files, .part_<label>
+static const char *part_file(const sim_part &sp){
+  static char name[32];
+  snprintf(name, sizeof(name), ".part_%s", sp.p.label);
+  return host_path(name);
+}
+
+static void part_save(){
+  for (sim_part &sp : parts) {
+    if (!sp.dirty || detached) continue;
+    FILE *f = fopen(part_file(sp), "wb");
+    if (f) {
+      fwrite(sp.mem, 1, sp.p.size, f);
+      fclose(f);
+    }
+    sp.dirty = false;
+  }
+}
+
+static void part_load(){
+  SPIFFS.begin();                                // makes the directory
+  for (sim_part &sp : parts) {
+    memset(sp.mem, 0xFF, sp.p.size);
+    FILE *f = fopen(part_file(sp), "rb");
+    if (f && fread(sp.mem, 1, sp.p.size, f) != sp.p.size) memset(sp.mem, 0xFF, sp.p.size);
+    if (f) fclose(f);
+  }
+  atexit(part_save);
+}
+
+static sim_part *find(const esp_partition_t *p, size_t offset, size_t size){
+  for (sim_part &sp : parts) {
+    if (p == &sp.p) return offset <= sp.p.size && size <= sp.p.size - offset ? &sp : NULL;
+  }
+  return NULL;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label){
+  if (!loaded) {
+    part_load();
+    loaded = true;
+  }
+  for (sim_part &sp : parts) {
+    if (type == sp.p.type && subtype == sp.p.subtype && (!label || !strcmp(label, sp.p.label))) return &sp.p;
+  }
+  return NULL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *p, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void **out_ptr, spi_flash_mmap_handle_t *out_handle){
+  sim_part *sp = find(p, offset, size);
+  if (!sp) return ESP_ERR_INVALID_ARG;
+  *out_ptr = sp->mem + offset;
+  *out_handle = ++sim_flash.maps;
+  return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t size){
+  sim_part *sp = find(p, offset, size);
+  if (!sp) return ESP_ERR_INVALID_ARG;
+  memcpy(dst, sp->mem + offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size){
+  sim_part *sp = find(p, offset, size);
+  if (!sp) return ESP_ERR_INVALID_ARG;
+  const uint8_t *s = (const uint8_t *)src;
+  size_t n = powered(size);
+  for (size_t i = 0; i < n; i++) sp->mem[offset + i] &= s[i];
+  sim_flash.writes++;
+  sim_flash.wr_bytes += n;
+  sp->dirty = true;
+  delayMicroseconds((offset + n + 255) / 256 * SIM_PAGE_US - offset / 256 * SIM_PAGE_US);
+  return n == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size){
+  sim_part *sp = find(p, offset, size);
+  if (!sp || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) return ESP_ERR_INVALID_ARG;
+  size_t n = powered(size);
+  memset(sp->mem + offset, 0xFF, n);
+  sim_flash.erases += size / SPI_FLASH_SEC_SIZE;
+  sp->dirty = true;
+  delayMicroseconds(n / SPI_FLASH_SEC_SIZE * SIM_ERASE_US);
+  return n == size ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,102 @@
+// Host simulator - recipe import benchmark (-b <rows>)
+//
+// Writes the same made-up recipes as -l to /bench.csv and /bench.json, one
+// row in 1000 with a development time the timeline rejects, then imports
+// each file. Prints throughput in virtual time (flash and SPIFFS costs as
+// modelled in esp_partition.h and FS.h) and host time, the heap the import
+// took, and checks the library that came out and that the process loaded
+// before the import still is.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "Arduino.h"
+#include "SPIFFS.h"
+#include "recipes.h"
+#include "import.h"
+#include "timeline.h"
+
+#define BENCH_BAD 1000                           // every n-th row is rejected
+
+void sim_recipe(uint32_t i, uint32_t n, recipe *r);
+
+static const char *const prog_cols[PROG_WORDS] = {
+  "dev_init",  "dev_time",  "dev_agit",  "dev_every",
+  "stop_init", "stop_time", "stop_agit", "stop_every",
+  "fix_init",  "fix_time",  "fix_agit",  "fix_every",
+  "rinse1", "rinse2", "rinse3", "rinse4", "rinse5"
+};
+
+static void put(File &f, const char *fmt, ...){
+  char b[256];
+  va_list a;
+  va_start(a, fmt);
+  int n = vsnprintf(b, sizeof(b), fmt, a);
+  va_end(a);
+  f.write((const uint8_t *)b, n);
+}
+
+static void write_csv(const char *path, uint32_t rows){
+  File f = SPIFFS.open(path, "w");
+  put(f, "film,developer,dilution,iso");
+  for (uint8_t w = 0; w < PROG_WORDS; w++) put(f, ",%s", prog_cols[w]);
+  put(f, "\r\n");
+  for (uint32_t i = 0; i < rows; i++) {
+    recipe r;
+    sim_recipe(i, rows, &r);
+    if (i % BENCH_BAD == BENCH_BAD - 1) r.prog[1] = 5;
+    put(f, "\"%s\",%s,%s,%u", r.film, r.dev, r.dil, r.iso);
+    for (uint8_t w = 0; w < PROG_WORDS; w++) put(f, ",%u", r.prog[w]);
+    put(f, "\r\n");
+  }
+  f.close();
+}
+
+static void write_json(const char *path, uint32_t rows){
+  File f = SPIFFS.open(path, "w");
+  put(f, "[\n");
+  for (uint32_t i = 0; i < rows; i++) {
+    recipe r;
+    sim_recipe(i, rows, &r);
+    if (i % BENCH_BAD == BENCH_BAD - 1) r.prog[1] = 5;
+    put(f, "  {\"film\": \"%s\", \"developer\": \"%s\", \"dilution\": \"%s\", \"iso\": %u, \"notes\": {\"by\": [1, 2]}",
+        r.film, r.dev, r.dil, r.iso);
+    for (uint8_t w = 0; w < PROG_WORDS; w++) put(f, ", \"%s\": %u", prog_cols[w], r.prog[w]);
+    put(f, "}%s\n", i + 1 < rows ? "," : "");
+  }
+  put(f, "]\n");
+  f.close();
+}
+
+static bool bench(const char *path, uint32_t rows){
+  tl_load(proc_builtin[0]);                      // loaded as for a run, the import must leave it
+  uint16_t n0 = tl_n;
+  auto w0 = std::chrono::steady_clock::now();
+  import_stats st;
+  bool ok = import_file(path, &st);
+  double host = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - w0).count();
+  import_report(st);
+  fflush(stdout);
+
+  uint32_t want = rows - rows / BENCH_BAD;
+  if (want > LIB_MAX) want = LIB_MAX;
+  bool good = ok && st.added == want && lib_count() == want;
+  for (uint16_t i = 1; good && i < lib_count(); i++) good = lib_cmp(lib_at(i - 1), lib_at(i)) <= 0;
+  good = good && tl_n == n0 && tl_proc.name == proc_builtin[0]->name;
+  fprintf(stderr, "%s: %u rows %u KB  virtual %.2f s (%.0f rows/s, %.0f KB/s)  host %.1f ms (%.0f rows/s)  heap %u B, %u B at the index sort  %s\n",
+          path, st.rows, st.bytes / 1024, st.us / 1e6, st.rows / (st.us / 1e6), st.bytes / 1024.0 / (st.us / 1e6),
+          host, st.rows / (host / 1e3), st.heap, st.index, good ? "ok" : "BAD");
+  SPIFFS.remove(path);
+  return good;
+}
+
+int sim_import(uint32_t rows){
+  SPIFFS.begin();
+  lib_begin();
+  write_csv("/bench.csv", rows);
+  write_json("/bench.json", rows);
+  bool ok = bench("/bench.csv", rows);
+  ok = bench("/bench.json", rows) && ok;
+  return ok ? 0 : 1;
+}
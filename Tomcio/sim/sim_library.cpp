@@ -0,0 +1,49 @@
+// Host simulator - recipe library fixture (-l <n>)
+//
+// Writes n made-up recipes into the recipes partition before setup(), in a
+// scrambled order so the index sort has work to do. Film names repeat with
+// a number once the combinations run out.
+
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "recipes.h"
+
+static const char *films[] = {"ACROS 100", "DELTA 100", "DELTA 3200", "DELTA 400", "FOMAPAN 100",
+                              "FOMAPAN 400", "FP4 PLUS", "HP5 PLUS", "KENTMERE 400", "PAN F PLUS",
+                              "RPX 100", "RPX 400", "SFX 200", "T-MAX 100", "T-MAX 400", "TRI-X 400"};
+static const char *devs[]  = {"ID-11", "ILFOSOL 3", "RODINAL", "HC-110", "XTOL", "D-76", "DD-X", "PERCEPTOL"};
+static const char *dils[]  = {"STOCK", "1+1", "1+3", "1+25", "1+50"};
+
+#define N_FILMS (sizeof(films) / sizeof(films[0]))
+#define N_DEVS  (sizeof(devs) / sizeof(devs[0]))
+#define N_DILS  (sizeof(dils) / sizeof(dils[0]))
+
+// Recipe i of n, also used by the import benchmark
+void sim_recipe(uint32_t i, uint32_t n, recipe *r){
+  uint32_t combos = N_FILMS * N_DEVS * N_DILS * 2;
+  uint32_t k = (i * 2654435761u) % n;             // scrambled order, a few repeats
+  uint32_t c = k % combos, rep = k / combos;
+  memset(r, 0, sizeof(*r));
+  if (rep) snprintf(r->film, sizeof(r->film), "%s #%u", films[c % N_FILMS], rep);
+  else     snprintf(r->film, sizeof(r->film), "%s", films[c % N_FILMS]);
+  snprintf(r->dev, sizeof(r->dev), "%s", devs[c / N_FILMS % N_DEVS]);
+  snprintf(r->dil, sizeof(r->dil), "%s", dils[c / N_FILMS / N_DEVS % N_DILS]);
+  r->iso = (c / N_FILMS / N_DEVS / N_DILS) ? 800 : 100 + 100 * (c % 4);
+  uint16_t dev = 300 + 30 * (c % 11);
+  uint16_t pd[PROG_WORDS] = {4, dev, 4, 60, 4, 60, 4, 30, 4, 300, 4, 60, 5, 10, 20, 0, 0};
+  memcpy(r->prog, pd, sizeof(pd));
+}
+
+void sim_library(uint32_t n){
+  if (!n) return;
+  if (n > LIB_MAX) n = LIB_MAX;
+  lib_clear();
+  for (uint32_t i = 0; i < n; i++) {
+    recipe r;
+    sim_recipe(i, n, &r);
+    lib_add(&r);
+  }
+  lib_end();
+  fprintf(stderr, "library: %u recipes written\n", lib_count());
+}
@@ -0,0 +1,165 @@
+// Host simulator - resume test (-c <n>)
+//
+// Runs the default session n times, each one cut at a random time - two in
+// three by a reset that keeps RTC memory, the rest by a power cut - and
+// boots again, where the default touch at 3s takes the resume offer. Each
+// run is a forked process, as a reset leaves nothing of the last boot but
+// RTC memory and the flash.
+//
+// After a reset the run must go on in the same stage and state, with the
+// stage timeline's start at the same RTC time to the ms and the cursor on
+// the same event. After a power cut the stage it was in starts again from
+// its screen, or the next one if it had ended. A cut outside a run must
+// boot to the select screen. Every resumed run must finish without losing a
+// timer tick. Failures print the -k / -K that repeats them.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "FS.h"
+#include "esp_system.h"
+#include "timeline.h"
+#include "resume.h"
+
+int sim_run(uint32_t minutes, uint8_t random_stalls);
+
+extern uint8_t       stage;                      // main.cpp
+extern uint8_t       run_state;
+extern uint16_t      tl_pos;
+extern uint32_t      tl_base;
+extern bool          session;
+
+enum { ST_READY, ST_ARMED, ST_INITIAL, ST_RUN, ST_DONE, ST_RINSE, ST_RINSE_AGIT, ST_FINISHED };   // as in main.cpp
+
+struct snap {
+  bool     taken;
+  bool     session;
+  uint8_t  stage;
+  uint8_t  state;
+  uint16_t tl_pos;
+  uint8_t  stages;
+  int64_t  zero_us;                              // RTC time of the stage timeline's 0
+};
+
+struct trial {
+  snap cut;                                      // first boot, as it went down
+  snap boot;                                     // second boot, when setup() returned
+  snap end;                                      // end of the second run
+};
+
+static trial *tr;                                // shared with the children
+
+static void take(snap *s){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  s->taken   = true;
+  s->session = session;
+  s->stage   = stage;
+  s->state   = run_state;
+  s->tl_pos  = tl_pos;
+  s->stages  = tl_proc.n;
+  s->zero_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (int64_t)(uint32_t)(millis() - tl_base) * 1000;
+}
+
+static void on_cut()   { take(&tr->cut); }
+static void on_setup() { take(&tr->boot); }
+
+static int child(uint32_t minutes, void (*hook)(), bool setup_hook, uint64_t cut_us, bool keep_rtc){
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr)) _exit(2);
+    if (setup_hook) sim_on_setup = hook;
+    else sim_on_reset = hook;
+    if (cut_us) sim_reset_at(cut_us, keep_rtc);
+    int rc = sim_run(minutes, 0);
+    take(&tr->end);
+    _exit(rc);
+  }
+  int st = 0;
+  waitpid(pid, &st, 0);
+  return WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+}
+
+// Every cut starts from a run loaded on the select screen, not the last one's checkpoint
+static void fresh(){
+  char name[256];
+  snprintf(name, sizeof(name), "%s/.part_" RESUME_PART_NAME, sim_fs_root);
+  remove(name);
+  sim_rtc_drop();
+}
+
+static bool timed(uint8_t s){
+  return s == ST_ARMED || s == ST_INITIAL || s == ST_RUN || s == ST_DONE;
+}
+
+// What the second boot should show, NULL if it does
+static const char *check(bool keep_rtc){
+  const snap &c = tr->cut, &b = tr->boot;
+  if (!b.taken) return "second boot didn't get through setup()";
+  if (!c.session) return b.session ? "resumed without a run on" : NULL;
+
+  if (keep_rtc) {
+    if (!b.session) return "run not resumed";
+    if (b.stage != c.stage) return "resumed in another stage";
+    if (timed(c.state)) {
+      bool ok = b.state == c.state || (c.state == ST_ARMED && b.state == ST_INITIAL);
+      if (!ok) return "resumed in another state";
+      if (b.tl_pos != c.tl_pos) return "timeline cursor moved";
+      int64_t d = b.zero_us - c.zero_us;
+      if (d < -2000 || d > 2000) return "stage time off by more than 2 ms";
+    } else if (b.state != ST_READY && b.state != ST_RINSE) return "stage not back on its screen";
+    return NULL;
+  }
+
+  uint8_t want = c.stage + (c.state == ST_DONE);
+  if (want >= c.stages) return b.state == ST_FINISHED ? NULL : "ended run not finished";
+  if (!b.session) return "run not resumed";
+  if (b.stage != want) return "resumed in another stage";
+  if (b.state != ST_READY && b.state != ST_RINSE) return "stage not back on its screen";
+  return NULL;
+}
+
+int sim_resume(uint32_t n, uint32_t minutes){
+  tr = (trial *)mmap(NULL, sizeof(trial), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (tr == MAP_FAILED) return 1;
+
+  // how long the session is, uncut
+  memset(tr, 0, sizeof(*tr));
+  fresh();
+  if (child(minutes, NULL, false, 0, false) != 0 || tr->end.state != ST_FINISHED) {
+    fprintf(stderr, "resume: the session doesn't finish in %u minutes\n", minutes);
+    return 1;
+  }
+
+  uint32_t seed = 4242, bad = 0, resumed = 0, exact = 0;
+  uint64_t span = minutes * 60000000ULL;
+  for (uint32_t i = 0; i < n; i++) {
+    seed = seed * 1103515245 + 12345;
+    uint64_t at   = (1000 + (uint64_t)(seed >> 4) % (span / 1000 - 1000)) * 1000;   // whole ms
+    bool     keep = i % 3 != 2;
+
+    memset(tr, 0, sizeof(*tr));
+    fresh();
+    int rc1 = child(minutes, on_cut, false, at, keep);
+    int rc2 = child(2 * minutes, on_setup, true, 0, false);
+
+    const char *why = rc1 != SIM_RESET_EXIT ? "first boot wasn't cut" : check(keep);
+    if (!why && rc2 != 0) why = "lost timer ticks after the resume";
+    if (!why && tr->end.state != ST_FINISHED) why = "resumed run didn't finish";
+    resumed += tr->boot.session;
+    exact   += tr->boot.session && keep && timed(tr->cut.state);
+    if (why) {
+      fprintf(stderr, "resume: %s at %llu ms, stage %u state %u -> stage %u state %u: %s (-%c %llu)\n",
+              keep ? "reset" : "power cut", (unsigned long long)(at / 1000), tr->cut.stage, tr->cut.state,
+              tr->boot.stage, tr->boot.state, why, keep ? 'k' : 'K', (unsigned long long)(at / 1000));
+      bad++;
+    }
+  }
+  fresh();
+  fprintf(stderr, "resume: %u cuts, %u runs resumed, %u to the ms, %u bad\n", n, resumed, exact, bad);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+#include <string.h>
+#include "agit.h"
+#include "motor.h"
+#include "step_profile.h"
+#include "progstore.h"
+
+// Bytes of each op including operands
+static const uint8_t op_len[AG_OPS] = {1, 2, 3, 3, 2, 1, 1, 3, 3};
+
+//---------------------------------Patterns---------------------------------
+// One pass of the outer loop is one of the agitations the program counts
+static const uint8_t p_invert[] = {
+  A_LOOP(0), A_MOVE(90), A_DWELL(AGIT_DWELL), A_MOVE(-90), A_DWELL(AGIT_DWELL), A_FLIP, A_NEXT,
+  A_END
+};
+
+static const uint8_t p_stearman[] = {            // half turns with a twist to free bubbles
+  A_LOOP(0), A_MOVE(180), A_TWIST(15, 1), A_DWELL(200), A_MOVE(-180), A_TWIST(15, 1), A_DWELL(200), A_NEXT,
+  A_END
+};
+
+static const uint8_t p_rotary[] = {              // full turns both ways, no rest
+  A_SPEED(40), A_LOOP(0), A_MOVE(360), A_DWELL(50), A_MOVE(-360), A_DWELL(50), A_NEXT,
+  A_END
+};
+
+static const uint8_t p_gentle[] = {              // slow rocking, then the vibration motor
+  A_SPEED(10), A_LOOP(0), A_MOVE(45), A_DWELL(300), A_MOVE(-45), A_DWELL(300), A_NEXT,
+  A_VIBE(500), A_END
+};
+
+const agit_pattern agit_patterns[] = {
+  {"invert",   p_invert  },
+  {"stearman", p_stearman},
+  {"rotary",   p_rotary  },
+  {"gentle",   p_gentle  },
+};
+const uint8_t agit_n = sizeof(agit_patterns) / sizeof(agit_patterns[0]);
+
+// Built in or a user pattern that passed agit_check()
+const uint8_t *agit_code(uint8_t pattern){
+  if (pattern < agit_n) return agit_patterns[pattern].code;
+  const agit_user *u = pattern >= AGIT_USER_BASE ? prog_pat(pattern - AGIT_USER_BASE) : NULL;
+  return u ? u->code : NULL;
+}
+
+const char *agit_name(uint8_t pattern){
+  if (pattern < agit_n) return agit_patterns[pattern].name;
+  const agit_user *u = pattern >= AGIT_USER_BASE ? prog_pat(pattern - AGIT_USER_BASE) : NULL;
+  return u ? u->name : NULL;
+}
+
+int16_t agit_find(const char *name){
+  for (uint8_t i = 0; i < agit_n; i++) {
+    if (!strcasecmp(name, agit_patterns[i].name)) return i;
+  }
+  for (uint8_t u = 0; u < AGIT_USER; u++) {
+    const agit_user *p = prog_pat(u);
+    if (p && !strcasecmp(name, p->name)) return AGIT_USER_BASE + u;
+  }
+  return -1;
+}
+
+//---------------------------------Interpreter---------------------------------
+static uint16_t u16(const uint8_t *p){
+  return p[0] | (p[1] << 8);
+}
+
+void agit_start(agit_vm *vm, const uint8_t *code, uint8_t count, uint8_t rpm){
+  memset(vm, 0, sizeof(*vm));
+  vm->code  = code;
+  vm->count = count;
+  vm->rpm   = rpm;
+  vm->dir   = 1;
+}
+
+// Past the AG_NEXT that closes the loop whose body starts at pc
+static uint8_t skip_loop(const uint8_t *code, uint8_t pc){
+  uint8_t depth = 1;
+  while (code[pc] != AG_END) {
+    if (code[pc] == AG_LOOP) depth++;
+    if (code[pc] == AG_NEXT && --depth == 0) return pc + 1;
+    pc += op_len[code[pc]];
+  }
+  return pc;
+}
+
+// Runs the code up to the next action. The code must have passed agit_check().
+bool agit_next(agit_vm *vm, agit_act *a){
+  const uint8_t *c = vm->code;
+  if (vm->twist_left) {
+    int16_t d = (vm->twist_left-- % 2) ? -vm->twist_deg : vm->twist_deg;
+    *a = {AA_MOVE, vm->rpm, (int16_t)(d * vm->dir), 0};
+    return true;
+  }
+  for (;;) {
+    uint8_t op = c[vm->pc];
+    const uint8_t *arg = c + vm->pc + 1;
+    vm->pc += op_len[op];
+    switch (op) {
+      case AG_END:
+        vm->pc--;                                // stays at the end
+        *a = {AA_END, 0, 0, 0};
+        return false;
+      case AG_SPEED:
+        vm->rpm = arg[0];
+        break;
+      case AG_MOVE:
+        *a = {AA_MOVE, vm->rpm, (int16_t)((int16_t)u16(arg) * vm->dir), 0};
+        return true;
+      case AG_DWELL:
+        *a = {AA_WAIT, 0, 0, u16(arg)};
+        return true;
+      case AG_VIBE:
+        *a = {AA_VIBE, 0, 0, u16(arg)};
+        return true;
+      case AG_LOOP: {
+        uint8_t n = arg[0] ? arg[0] : vm->count;
+        if (n == 0) vm->pc = skip_loop(c, vm->pc);
+        else {
+          vm->loop_pc[vm->sp] = vm->pc;
+          vm->loop_n[vm->sp]  = n;
+          vm->sp++;
+        }
+        break;
+      }
+      case AG_NEXT:
+        if (--vm->loop_n[vm->sp - 1] > 0) vm->pc = vm->loop_pc[vm->sp - 1];
+        else vm->sp--;
+        break;
+      case AG_FLIP:
+        vm->dir = -vm->dir;
+        break;
+      case AG_TWIST:
+        if (arg[1] == 0) break;
+        vm->twist_deg  = arg[0];
+        vm->twist_left = 2 * arg[1] - 1;
+        *a = {AA_MOVE, vm->rpm, (int16_t)(arg[0] * vm->dir), 0};
+        return true;
+    }
+  }
+}
+
+//---------------------------------Validate---------------------------------
+// Known ops, operands in range, loops closed and not too deep, ends in AG_END
+bool agit_check(const uint8_t *code){
+  uint8_t depth = 0;
+  uint8_t pc = 0;
+  while (pc < AGIT_MAX_LEN) {
+    uint8_t op = code[pc];
+    if (op >= AG_OPS || pc + op_len[op] > AGIT_MAX_LEN) return false;
+    const uint8_t *arg = code + pc + 1;
+    switch (op) {
+      case AG_END:   return depth == 0;
+      case AG_SPEED: if (arg[0] == 0 || arg[0] > AGIT_MAX_RPM) return false; break;
+      case AG_MOVE: {
+        int16_t d = (int16_t)u16(arg);
+        if (d == 0 || d > AGIT_MAX_DEG || d < -AGIT_MAX_DEG) return false;
+        break;
+      }
+      case AG_LOOP:  if (++depth > AGIT_DEPTH) return false; break;
+      case AG_NEXT:  if (depth-- == 0) return false; break;
+      case AG_TWIST: if (arg[0] == 0 || arg[1] > 127) return false; break;
+    }
+    pc += op_len[op];
+  }
+  return false;
+}
+
+//---------------------------------Duration---------------------------------
+// Move times are remembered, a pattern only has a few different moves
+#define MOVE_CACHE 4
+
+struct move_time {
+  uint8_t  rpm;
+  uint16_t deg;
+  uint32_t us;
+};
+static move_time cache[MOVE_CACHE];
+static uint8_t   cache_next;
+
+static uint32_t move_us(uint8_t rpm, int16_t deg){
+  uint16_t d = deg < 0 ? -deg : deg;
+  for (uint8_t i = 0; i < MOVE_CACHE; i++) {
+    if (cache[i].rpm == rpm && cache[i].deg == d) return cache[i].us;
+  }
+  step_profile prof;
+  profile_init(&prof, rpm, MOTOR_STEPS, MICROST, MOTOR_ACCEL, MOTOR_DECEL, (long)d * MOTOR_STEPS * MICROST / 360);
+  uint32_t us = profile_time_us(&prof);
+  cache[cache_next] = {rpm, d, us};
+  cache_next = (cache_next + 1) % MOVE_CACHE;
+  return us;
+}
+
+// Exactly what the motor path spends on the same code [us]
+uint32_t agit_us(const uint8_t *code, uint8_t count){
+  agit_vm  vm;
+  agit_act a;
+  uint32_t us = 0;
+  agit_start(&vm, code, count, RPM);
+  while (agit_next(&vm, &a)) {
+    if (a.op == AA_MOVE) us += move_us(a.rpm, a.deg);
+    else us += a.ms * 1000UL;
+  }
+  return us;
+}
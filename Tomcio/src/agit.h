@@ -0,0 +1,122 @@
+// Agitation patterns
+//
+// A pattern is a few bytes of code run by the motor for each agitation:
+// moves, speed changes, pauses, loops, short twists and vibration. The
+// interpreter hands out one action at a time - a move, a wait or the end -
+// and the motor path executes it, so a new pattern is only new bytes.
+//
+// Four patterns are built in, agit_patterns[]. AGIT_USER more are kept with
+// the programs (progstore) and come from the host, each a name and its
+// code; their index is AGIT_USER_BASE + slot. Their code is put through
+// agit_check() at boot and when it is written, agit_code() hands out only
+// code that passed.
+//
+// agit_us() runs the same interpreter without the motor and adds up the
+// step profile of every move and every wait, so the timeline knows ahead
+// how long an agitation takes.
+//
+// Code (operands little-endian):
+//   AG_SPEED rpm            speed of the moves that follow
+//   AG_MOVE  deg16          turn, signed, times the current direction
+//   AG_DWELL ms16           pause
+//   AG_LOOP  n              repeat up to AG_NEXT n times, 0 = agitation count
+//   AG_NEXT
+//   AG_FLIP                 reverse the direction of the moves that follow
+//   AG_TWIST deg n          n quick +deg / -deg pairs
+//   AG_VIBE  ms16           vibration motor on for that long
+//   AG_END
+
+#ifndef AGIT_H
+#define AGIT_H
+
+#include <stdint.h>
+
+#define AGIT_DEPTH   2                           // nested loops
+#define AGIT_MAX_LEN 64                          // bytes of code
+#define AGIT_MAX_DEG 360                         // longest single move
+#define AGIT_MAX_RPM 60
+#define AGIT_USER      8                         // patterns kept with the programs
+#define AGIT_USER_BASE 0x80                      // index of the first
+#define AGIT_NAME_LEN  10                        // with the terminating zero
+
+enum {                                           // ops
+  AG_END,
+  AG_SPEED,
+  AG_MOVE,
+  AG_DWELL,
+  AG_LOOP,
+  AG_NEXT,
+  AG_FLIP,
+  AG_TWIST,
+  AG_VIBE,
+  AG_OPS
+};
+
+#define AG_U16(v) (uint8_t)((v) & 0xFF), (uint8_t)(((v) >> 8) & 0xFF)
+#define A_SPEED(rpm)  AG_SPEED, (uint8_t)(rpm)
+#define A_MOVE(deg)   AG_MOVE, AG_U16((int16_t)(deg))
+#define A_DWELL(ms)   AG_DWELL, AG_U16(ms)
+#define A_LOOP(n)     AG_LOOP, (uint8_t)(n)
+#define A_NEXT        AG_NEXT
+#define A_FLIP        AG_FLIP
+#define A_TWIST(d, n) AG_TWIST, (uint8_t)(d), (uint8_t)(n)
+#define A_VIBE(ms)    AG_VIBE, AG_U16(ms)
+#define A_END         AG_END
+
+enum {                                           // agit_act.op
+  AA_MOVE,
+  AA_WAIT,
+  AA_VIBE,                                       // vibration on, off after ms
+  AA_END
+};
+
+struct agit_act {
+  uint8_t  op;
+  uint8_t  rpm;                                  // AA_MOVE
+  int16_t  deg;                                  // AA_MOVE, signed
+  uint16_t ms;                                   // AA_WAIT, AA_VIBE
+};
+
+struct agit_vm {
+  const uint8_t *code;
+  uint8_t  pc;
+  uint8_t  count;                                // agitation count, for AG_LOOP 0
+  uint8_t  rpm;
+  int8_t   dir;
+  uint8_t  sp;
+  uint8_t  loop_pc[AGIT_DEPTH];                  // first op of the loop body
+  uint8_t  loop_n[AGIT_DEPTH];                   // passes left
+  uint8_t  twist_left;                           // twist moves left
+  uint8_t  twist_deg;
+};
+
+struct agit_pattern {
+  const char    *name;
+  const uint8_t *code;
+};
+
+enum {                                           // agit_patterns[] index
+  AGIT_INVERT,                                   // the original +-90 deg inversions
+  AGIT_STEARMAN,
+  AGIT_ROTARY,
+  AGIT_GENTLE
+};
+
+struct agit_user {
+  char    name[AGIT_NAME_LEN];                   // empty: slot not used
+  uint8_t code[AGIT_MAX_LEN];
+};
+
+extern const agit_pattern agit_patterns[];
+extern const uint8_t      agit_n;
+
+void     agit_start(agit_vm *vm, const uint8_t *code, uint8_t count, uint8_t rpm);
+bool     agit_next(agit_vm *vm, agit_act *a);    // false at the end
+bool     agit_check(const uint8_t *code);
+uint32_t agit_us(const uint8_t *code, uint8_t count);
+
+const uint8_t *agit_code(uint8_t pattern);       // NULL if there is no such pattern
+const char    *agit_name(uint8_t pattern);
+int16_t        agit_find(const char *name);      // pattern by name, -1 if none
+
+#endif
@@ -0,0 +1,93 @@
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "boot.h"
+
+struct boot_phase {
+  const char *name;
+  uint32_t    t0, t1;                            // [us]
+  bool        loader;
+};
+
+static boot_phase phases[BOOT_PHASES];
+static uint8_t    phase_n;
+static uint32_t   main_last;                     // end of the previous phase on each side
+static uint32_t   load_last;
+static volatile bool load_done = 1;              // nothing to wait for until boot_load()
+
+#if BOOT_TASK
+static TaskHandle_t      load_th;
+static SemaphoreHandle_t load_sem;
+static void            (*load_fn)();
+#else
+static bool              loading;
+#endif
+
+static bool in_loader(){
+#if BOOT_TASK
+  return load_th != NULL && xTaskGetCurrentTaskHandle() == load_th;
+#else
+  return loading;
+#endif
+}
+
+//---------------------------------Phase ended---------------------------------
+// Both sides mark phases, each takes its own slot
+void boot_mark(const char *phase){
+  uint32_t now = esp_timer_get_time();
+  bool     ld  = in_loader();
+  uint8_t  i   = __atomic_fetch_add(&phase_n, 1, __ATOMIC_RELAXED);
+  uint32_t &last = ld ? load_last : main_last;
+  if (i < BOOT_PHASES) phases[i] = {phase, last, now, ld};
+  last = now;
+}
+
+//---------------------------------Loader---------------------------------
+#if BOOT_TASK
+static void load_task(void *){
+  load_fn();
+  load_done = 1;
+  xSemaphoreGive(load_sem);
+  vTaskDelete(NULL);
+}
+#endif
+
+void boot_load(void (*fn)()){
+  load_last = esp_timer_get_time();
+  load_done = 0;
+#if BOOT_TASK
+  load_fn  = fn;
+  load_sem = xSemaphoreCreateBinary();
+  xTaskCreatePinnedToCore(load_task, "boot", BOOT_STACK, NULL, BOOT_PRIO, &load_th, BOOT_CORE);
+#else
+  loading = 1;
+  fn();
+  loading = 0;
+  load_done = 1;
+#endif
+}
+
+bool boot_ready(){
+  return load_done;
+}
+
+void boot_wait(){
+#if BOOT_TASK
+  if (load_sem != NULL) {
+    xSemaphoreTake(load_sem, portMAX_DELAY);
+    vSemaphoreDelete(load_sem);
+    load_sem = NULL;
+  }
+#endif
+}
+
+//---------------------------------Report---------------------------------
+void boot_report(){
+  uint32_t now = esp_timer_get_time();
+  uint8_t  n   = phase_n < BOOT_PHASES ? phase_n : BOOT_PHASES;
+  Serial.printf("Boot: %u ms to program selector\n", now / 1000);
+  for (uint8_t i = 0; i < n; i++) {
+    const boot_phase &p = phases[i];
+    Serial.printf("  %-12s %7.1f ms  done at %6.1f ms%s\n", p.name, (p.t1 - p.t0) / 1000.0, p.t1 / 1000.0,
+                  p.loader ? "  (loader task)" : "");
+  }
+}
@@ -0,0 +1,36 @@
+// Boot sequence
+//
+// setup() marks the end of each boot phase with boot_mark(), boot_report()
+// prints how long each one took. Loading programs and the recipe library
+// only needs the flash, so it runs in a loader task on the other core while
+// setup() reads the touch calibration, draws the splash and starts the
+// motor. The splash stays up until the loader is done and no longer.
+// Phases the loader marks are shown as such in the report.
+//
+// Times are esp_timer_get_time(), which starts early in app startup - ROM
+// and second stage bootloader (about 0.3 s on the S3) come before it. On
+// the host the loader runs inline in boot_load().
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+
+#define BOOT_PHASES    16                        // marks kept
+
+#if defined(ARDUINO_ARCH_ESP32)
+  #define BOOT_TASK  1
+  #define BOOT_CORE  0                           // setup() runs on core 1
+  #define BOOT_PRIO  1
+  #define BOOT_STACK 6144                        // import and printf
+#else
+  #define BOOT_TASK  0
+#endif
+
+void boot_mark(const char *phase);               // phase ended now
+void boot_load(void (*fn)());                    // run fn in the loader task
+bool boot_ready();                               // loader done
+void boot_wait();
+void boot_report();
+
+#endif
@@ -0,0 +1,81 @@
+#include "digits.h"
+
+static const char cell_chars[] = "0123456789: ";
+
+static uint8_t cell_of(char c){
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c == ':') return 10;
+  return 11;
+}
+
+//---------------------------------Render the atlas---------------------------------
+// Cells are as wide as the widest glyph so digits never shift (tabular figures)
+bool atlas_build(digit_atlas *a, TFT_eSprite *spr, const GFXfont *font, uint8_t size, uint16_t fg, uint16_t bg, int16_t h){
+  char s[2] = {0, 0};
+  int16_t cw = 0;
+
+  spr->setFreeFont(font);
+  spr->setTextSize(size);
+  for (uint8_t i = 0; i < DIGIT_CELLS - 1; i++) {
+    s[0] = cell_chars[i];
+    int16_t w = spr->textWidth(s);
+    if (w > cw) cw = w;
+  }
+
+  spr->setColorDepth(16);
+  if (spr->createSprite(cw * DIGIT_CELLS, h) == NULL) return false;
+  spr->fillSprite(bg);
+  spr->setTextColor(fg, bg);
+  spr->setTextDatum(MC_DATUM);
+  for (uint8_t i = 0; i < DIGIT_CELLS - 1; i++) {
+    s[0] = cell_chars[i];
+    spr->drawString(s, i * cw + cw / 2, h / 2);
+  }
+
+  a->spr = spr;
+  a->cw  = cw;
+  a->h   = h;
+  atlas_reset(a);
+  return true;
+}
+
+// Screen content unknown (e.g. after fillScreen) - next draw pushes every slot
+void atlas_reset(digit_atlas *a){
+  memset(a->shown, 0, sizeof(a->shown));
+}
+
+//---------------------------------Draw a clock string---------------------------------
+// txt is right aligned to 'right'. buf must hold DIGIT_SLOTS cells and must not
+// be in flight on DMA. Returns bytes pushed.
+uint32_t atlas_draw(digit_atlas *a, TFT_eSPI *tft, const char *txt, int16_t right, int16_t top, uint16_t *buf){
+  char slot[DIGIT_SLOTS];
+  uint8_t len = strlen(txt);
+  int8_t first = -1;
+  int8_t last  = -1;
+
+  for (uint8_t k = 0; k < DIGIT_SLOTS; k++) {
+    int8_t i = k - (DIGIT_SLOTS - len);
+    slot[k] = (i >= 0) ? txt[i] : ' ';
+    if (slot[k] != a->shown[k]) {
+      if (first < 0) first = k;
+      last = k;
+    }
+  }
+  if (first < 0) return 0;
+
+  const uint16_t *src = (const uint16_t *)a->spr->getPointer();
+  int16_t aw = a->cw * DIGIT_CELLS;
+  int16_t w  = (last - first + 1) * a->cw;
+
+  for (int16_t y = 0; y < a->h; y++) {
+    uint16_t *dst = buf + y * w;
+    for (int8_t k = first; k <= last; k++) {
+      memcpy(dst, src + y * aw + cell_of(slot[k]) * a->cw, a->cw * 2);
+      dst += a->cw;
+    }
+  }
+  memcpy(a->shown, slot, sizeof(slot));
+
+  tft->pushImageDMA(right - (DIGIT_SLOTS - first) * a->cw, top, w, a->h, buf);
+  return (uint32_t)w * a->h * 2;
+}
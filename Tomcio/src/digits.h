@@ -0,0 +1,26 @@
+// Digit glyph atlas
+//
+// "0"-"9", ":" and a blank cell rendered once into a sprite for a given font
+// and size. Clock strings are then drawn by copying cached cells into a DMA
+// buffer, and only the slots that changed since the last draw are pushed.
+
+#ifndef DIGITS_H
+#define DIGITS_H
+
+#include <TFT_eSPI.h>
+
+#define DIGIT_CELLS 12                           // 0-9, ':', blank
+#define DIGIT_SLOTS 7                            // up to "1092:15" (65535 s), right aligned
+
+struct digit_atlas {
+  TFT_eSprite *spr;                              // DIGIT_CELLS cells side by side
+  int16_t cw;                                    // cell width
+  int16_t h;                                     // cell height
+  char shown[DIGIT_SLOTS];                       // slots currently on screen
+};
+
+bool     atlas_build(digit_atlas *a, TFT_eSprite *spr, const GFXfont *font, uint8_t size, uint16_t fg, uint16_t bg, int16_t h);
+void     atlas_reset(digit_atlas *a);
+uint32_t atlas_draw(digit_atlas *a, TFT_eSPI *tft, const char *txt, int16_t right, int16_t top, uint16_t *buf);
+
+#endif
@@ -0,0 +1,24 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "fmt.h"
+#include "proto.h"
+
+static char line[FMT_LEN];
+static char log_line[LOG_LEN];
+
+const char *ui_fmt(const char *f, ...){
+  va_list ap;
+  va_start(ap, f);
+  vsnprintf(line, sizeof(line), f, ap);
+  va_end(ap);
+  return line;
+}
+
+void log_fmt(const char *f, ...){
+  va_list ap;
+  va_start(ap, f);
+  int n = vsnprintf(log_line, sizeof(log_line), f, ap);
+  va_end(ap);
+  if (n > 0) proto_log(log_line, min(n, (int)sizeof(log_line) - 1));
+}
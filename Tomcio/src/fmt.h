@@ -0,0 +1,23 @@
+// Fixed buffer text formatting
+//
+// Draw calls format into one static line buffer instead of building String
+// temporaries, so the UI never touches the heap. The returned text is only
+// valid until the next ui_fmt() call - pass it straight to drawString().
+//
+// Serial log lines printed during a run go through log_fmt() for the same
+// reason: Print::printf on arduino-esp32 mallocs a buffer for any line over
+// 64 characters. The line is handed to proto_log(), a PT_LOG frame when a
+// host is attached.
+
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdint.h>
+
+#define FMT_LEN 96                               // longest line on any screen
+#define LOG_LEN 192                              // longest serial log line
+
+const char *ui_fmt(const char *f, ...) __attribute__((format(printf, 1, 2)));
+void        log_fmt(const char *f, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "heapmon.h"
+#include "fmt.h"
+
+static bool     on = 0;
+static uint32_t free_start;                      // free heap at START
+static uint32_t free_min;                        // lowest seen during the run
+static uint32_t free_max;                        // highest seen during the run
+
+#ifdef HEAP_WATCH
+static volatile uint32_t allocs;                 // allocations during the run
+static volatile uint32_t allocs_all;             // since power on
+#if defined(ARDUINO_ARCH_ESP32)
+static TaskHandle_t watch_th;                    // only count the loop task
+#define WATCHED() (xTaskGetCurrentTaskHandle() == watch_th)
+#else
+#define WATCHED() 1
+#endif
+
+static inline void count(){
+  if (!WATCHED()) return;
+  allocs_all++;
+  if (on) allocs++;
+}
+
+extern "C" {
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t s);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n){
+  count();
+  return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t n, size_t s){
+  count();
+  return __real_calloc(n, s);
+}
+
+void *__wrap_realloc(void *p, size_t n){
+  count();
+  return __real_realloc(p, n);
+}
+}
+
+uint32_t heap_allocs(){
+  return allocs_all;
+}
+#endif
+
+void heap_mark_start(){
+  free_start = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  free_min   = free_start;
+  free_max   = free_start;
+#ifdef HEAP_WATCH
+#if defined(ARDUINO_ARCH_ESP32)
+  watch_th = xTaskGetCurrentTaskHandle();
+#endif
+  allocs = 0;
+#endif
+  on = 1;
+}
+
+void heap_mark_check(){
+  if (!on) return;
+  uint32_t f = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  if (f < free_min) free_min = f;
+  if (f > free_max) free_max = f;
+}
+
+void heap_mark_report(){
+  if (!on) return;
+  heap_mark_check();
+  on = 0;
+  log_fmt("Heap: free %lu at START, min %lu, max %lu\n", (unsigned long)free_start, (unsigned long)free_min,
+          (unsigned long)free_max);
+#ifdef HEAP_WATCH
+  log_fmt("Heap: %lu allocations by loop task during run\n", (unsigned long)allocs);
+#endif
+}
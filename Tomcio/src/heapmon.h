@@ -0,0 +1,22 @@
+// Heap watermark
+//
+// Free heap is sampled from START to the end of the last rinse. With
+// -D HEAP_WATCH and malloc/calloc/realloc wrapped at link time (see
+// platformio.ini) every allocation made by the loop task is counted too,
+// so the report proves whether the run touched the heap at all. The
+// simulator counts every allocation and fails a run that makes any after
+// setup().
+
+#ifndef HEAPMON_H
+#define HEAPMON_H
+
+#include <stdint.h>
+
+void heap_mark_start();
+void heap_mark_check();
+void heap_mark_report();
+#ifdef HEAP_WATCH
+uint32_t heap_allocs();                          // watched allocations so far
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include "hist.h"
+#include "fmt.h"
+
+struct hist_def {
+  const char *name;
+  const char *unit;
+  int32_t     lo[HIST_N];                        // bucket lower bounds, lo[0] unused
+};
+
+static const hist_def defs[H_COUNT] = {
+  {"agit_late", "ms", {0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000}},
+  {"agit_time", "ms", {0, 500, 1000, 2000, 3000, 4000, 5000, 7500, 10000, 15000, 20000, 30000}},
+  {"stage_end", "ms", {0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000}},
+  {"frame",     "us", {0, 1000, 2000, 5000, 10000, 15000, 20000, 30000, 50000, 100000, 200000, 500000}},
+};
+
+static hist hs[H_COUNT];
+
+//---------------------------------Counting---------------------------------
+void hist_reset(){
+  memset(hs, 0, sizeof(hs));
+}
+
+void hist_add(uint8_t id, int32_t v){
+  hist &h = hs[id];
+  uint8_t b = HIST_N - 1;
+  while (b > 0 && v < defs[id].lo[b]) b--;
+  h.n[b]++;
+  h.min = h.count ? min(h.min, v) : v;
+  h.max = h.count ? max(h.max, v) : v;
+  h.sum += v;
+  h.count++;
+}
+
+//---------------------------------Access---------------------------------
+const hist &hist_get(uint8_t id){
+  return hs[id];
+}
+
+const char *hist_name(uint8_t id){
+  return defs[id].name;
+}
+
+const char *hist_unit(uint8_t id){
+  return defs[id].unit;
+}
+
+// 1000 and up in k
+const char *hist_label(uint8_t id, uint8_t b){
+  static char s[16];
+  int32_t v = defs[id].lo[b ? b : 1];
+  const char *lt = b ? "" : "<";
+  if (v >= 1000 && v % 1000 == 0) snprintf(s, sizeof(s), "%s%ldk", lt, (long)(v / 1000));
+  else snprintf(s, sizeof(s), "%s%ld", lt, (long)v);
+  return s;
+}
+
+//---------------------------------Serial---------------------------------
+// name,unit,count,min,mean,max, then lower bound:count for each bucket
+void hist_dump(){
+  for (uint8_t id = 0; id < H_COUNT; id++) {
+    const hist &h = hs[id];
+    char bk[LOG_LEN];
+    int  n = 0;
+    for (uint8_t b = 0; b < HIST_N && n < (int)sizeof(bk); b++) {
+      n += snprintf(bk + n, sizeof(bk) - n, ",%s:%lu", hist_label(id, b), (unsigned long)h.n[b]);
+    }
+    log_fmt("Hist %s,%s,%lu,%ld,%ld,%ld%s\n", defs[id].name, defs[id].unit, (unsigned long)h.count, (long)h.min,
+            (long)(h.count ? h.sum / h.count : 0), (long)h.max, bk);
+  }
+}
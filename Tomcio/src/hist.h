@@ -0,0 +1,47 @@
+// Timing histograms
+//
+// How close the run keeps to its plan, counted into fixed buckets in RAM
+// from START to the end of the run:
+//   H_AGIT_LATE   agitation start against its timeline time [ms]
+//   H_AGIT_TIME   agitation length, motion start to end [ms]
+//   H_STAGE_END   stage end against endTime [ms]
+//   H_FRAME       tft_upd() run screen frame [us]
+// Each histogram has HIST_N buckets given by their lower bounds, the first
+// takes everything below the second. hist_add() is a few compares, cheap
+// enough for every frame.
+//
+// The DIAG button on the DONE / ABORTED screen draws them as bars, and
+// sending 'h' on the serial port prints them, one line each - the same
+// line is printed when the run ends.
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+#define HIST_N 12                                // buckets
+
+enum {
+  H_AGIT_LATE,
+  H_AGIT_TIME,
+  H_STAGE_END,
+  H_FRAME,
+  H_COUNT
+};
+
+struct hist {
+  uint32_t n[HIST_N];
+  uint32_t count;
+  int32_t  min, max;
+  int64_t  sum;
+};
+
+void        hist_reset();                        // first START of a run
+void        hist_add(uint8_t id, int32_t v);
+const hist &hist_get(uint8_t id);
+const char *hist_name(uint8_t id);
+const char *hist_unit(uint8_t id);
+const char *hist_label(uint8_t id, uint8_t b);   // bucket b's lower bound, "<1" for the first
+void        hist_dump();
+
+#endif
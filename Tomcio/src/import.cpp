@@ -0,0 +1,373 @@
+#include <Arduino.h>
+#include <string.h>
+#include "FS.h"
+#include "SPIFFS.h"
+#include "esp_heap_caps.h"
+#include "import.h"
+#include "recipes.h"
+#include "progstore.h"
+#include "timeline.h"
+#include "agit.h"
+
+#define IMPORT_SHOW 10                           // rejected rows listed, the rest only counted
+
+enum {                                           // column ids, 0..16 are program words
+  F_FILM = PROG_WORDS, F_DEV, F_DIL, F_ISO, F_SLOT,
+  F_PAT,                                         // dev, stop, fix pattern
+  F_N = F_PAT + 3,
+  F_NONE = -1
+};
+
+static const char *const col_names[F_N] = {
+  "dev_init",  "dev_time",  "dev_agit",  "dev_every",
+  "stop_init", "stop_time", "stop_agit", "stop_every",
+  "fix_init",  "fix_time",  "fix_agit",  "fix_every",
+  "rinse1", "rinse2", "rinse3", "rinse4", "rinse5",
+  "film", "developer", "dilution", "iso", "slot",
+  "dev_pattern", "stop_pattern", "fix_pattern"
+};
+
+enum {                                           // CSV field states
+  C_START, C_PLAIN, C_QUOTED, C_QUOTE
+};
+
+enum {                                           // JSON states
+  J_ARRAY,                                       // before [
+  J_OBJ,                                         // before { or ]
+  J_KEY,                                         // before "key" or }
+  J_KSTR,                                        // in key
+  J_COLON,
+  J_VAL,
+  J_VSTR,                                        // in string value
+  J_VSCAL,                                       // in number, true, null...
+  J_SKIP,                                        // in nested object or array, ignored
+  J_DONE
+};
+
+// Everything an import needs, one allocation
+struct import_ctx {
+  uint8_t      chunk[IMPORT_CHUNK];
+  recipe       batch[IMPORT_BATCH];
+  recipe       row;
+  char         tok[IMPORT_TOK + 1];
+  int8_t       cols[IMPORT_COLS];                // CSV column -> field
+  uint8_t      nb;                               // recipes in batch
+  uint8_t      tl;                               // tok length
+  uint8_t      col;                              // CSV column
+  int8_t       key;                              // field of the JSON key being read
+  uint8_t      ncols;
+  uint8_t      state;
+  uint8_t      depth;                            // J_SKIP nesting
+  uint8_t      hex;                              // \u digits still to skip
+  uint8_t      slot;
+  uint8_t      pat[3];                           // dev, stop, fix pattern
+  bool         json;
+  bool         header;                           // CSV header line not read yet
+  bool         esc;                              // after \ in a JSON string
+  bool         in_str;                           // J_SKIP is inside a string
+  bool         blank;                            // row has no data so far
+  const char  *bad;                              // why the row is rejected
+  uint32_t     line;
+  uint32_t     row_line;                         // line the row starts on
+  const char  *path;
+  import_stats *st;
+};
+
+//---------------------------------Rows---------------------------------
+static int8_t col_find(const char *name){
+  for (int8_t i = 0; i < F_N; i++) {
+    if (!strcasecmp(name, col_names[i])) return i;
+  }
+  return F_NONE;
+}
+
+static void row_start(import_ctx *c){
+  memset(&c->row, 0, sizeof(c->row));
+  c->slot     = 0;
+  memset(c->pat, 0, sizeof(c->pat));
+  c->bad      = NULL;
+  c->blank    = true;
+  c->row_line = c->line;
+}
+
+static bool number(const char *s, uint16_t *v){
+  uint32_t n = 0;
+  if (!*s) return false;
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9') return false;
+    n = n * 10 + (*s - '0');
+    if (n > 0xFFFF) return false;
+  }
+  *v = n;
+  return true;
+}
+
+// Cut to the record field, which stays zero padded
+static void text(char *dst, const char *src, size_t n){
+  size_t l = strlen(src);
+  memcpy(dst, src, l < n ? l : n - 1);
+}
+
+static void row_field(import_ctx *c, int8_t f){
+  c->tok[c->tl] = 0;
+  c->tl = 0;
+  if (c->tok[0]) c->blank = false;
+  if (f == F_NONE || c->bad) return;
+  uint16_t v = 0;
+  switch (f) {
+    case F_FILM: text(c->row.film, c->tok, LIB_FILM_LEN); return;
+    case F_DEV:  text(c->row.dev,  c->tok, LIB_DEV_LEN);  return;
+    case F_DIL:  text(c->row.dil,  c->tok, LIB_DIL_LEN);  return;
+  }
+  if (!c->tok[0]) return;                        // empty number is 0
+  if (f >= F_PAT) {                              // pattern name or index
+    int16_t p = agit_find(c->tok);
+    if (p < 0 && number(c->tok, &v) && v <= 0xFF && agit_code(v)) p = v;
+    if (p < 0) c->bad = "unknown pattern";
+    else c->pat[f - F_PAT] = p;
+    return;
+  }
+  if (!number(c->tok, &v)) { c->bad = "not a number"; return; }
+  if (f == F_ISO) c->row.iso = v;
+  else if (f == F_SLOT) {
+    if (v > PROG_N) c->bad = "slot not 1-9";
+    else c->slot = v;
+  }
+  else c->row.prog[f] = v;
+}
+
+static void batch_flush(import_ctx *c){
+  if (!c->nb) return;
+  if (lib_add(c->batch, c->nb)) {
+    c->st->added += c->nb;
+    c->st->batches++;
+  } else {
+    c->st->bad += c->nb;
+    Serial.printf("%s: library write failed, %u recipes lost\n", c->path, c->nb);
+  }
+  c->nb = 0;
+}
+
+static void row_end(import_ctx *c){
+  if (c->blank) return;                          // empty line
+  import_stats *st = c->st;
+  st->rows++;
+  if (!c->bad && !c->row.film[0]) c->bad = "no film";
+  for (uint8_t s = 0; s < 3; s++) {
+    if (c->pat[s]) c->row.prog[4 * s + 2] = PD_AGIT(PD_COUNT(c->row.prog[4 * s + 2]), c->pat[s]);
+  }
+  if (!c->bad) {
+    uint8_t err = tl_check(c->row.prog);
+    if (err != TL_OK) c->bad = tl_error(err);
+  }
+  if (!c->bad && st->added + c->nb >= LIB_MAX) c->bad = "library full";
+  if (c->bad) {
+    if (st->bad++ < IMPORT_SHOW) Serial.printf("%s line %u: %s\n", c->path, c->row_line, c->bad);
+    return;
+  }
+  if (c->slot) {
+    prog_save(c->slot - 1, c->row.prog);
+    st->slots++;
+  }
+  c->batch[c->nb++] = c->row;
+  if (c->nb == IMPORT_BATCH) batch_flush(c);
+}
+
+static void tok_add(import_ctx *c, char ch){
+  if (c->tl < IMPORT_TOK) c->tok[c->tl++] = ch;
+}
+
+//---------------------------------CSV---------------------------------
+static void csv_field(import_ctx *c){
+  if (c->header) {
+    c->tok[c->tl] = 0;
+    c->tl = 0;
+    if (c->col < IMPORT_COLS) c->cols[c->col] = col_find(c->tok);
+    c->ncols = c->col + 1;
+  } else {
+    row_field(c, c->col < c->ncols && c->col < IMPORT_COLS ? c->cols[c->col] : (int8_t)F_NONE);
+  }
+  c->col++;
+  c->state = C_START;
+}
+
+static void csv_line(import_ctx *c){
+  csv_field(c);
+  if (c->header) c->header = false;
+  else row_end(c);
+  c->col = 0;
+  row_start(c);
+}
+
+static void csv_byte(import_ctx *c, char ch){
+  if (ch == '\n') c->line++;
+  switch (c->state) {
+    case C_START:
+      if (ch == '"') { c->state = C_QUOTED; return; }
+      c->state = C_PLAIN;
+      // fall through
+    case C_PLAIN:
+      if (ch == ',') csv_field(c);
+      else if (ch == '\n') csv_line(c);
+      else if (ch != '\r') tok_add(c, ch);
+      return;
+    case C_QUOTED:
+      if (ch == '"') c->state = C_QUOTE;
+      else tok_add(c, ch);
+      return;
+    case C_QUOTE:                                // "" inside quotes is one "
+      if (ch == '"') { tok_add(c, ch); c->state = C_QUOTED; }
+      else if (ch == ',') csv_field(c);
+      else if (ch == '\n') csv_line(c);
+      else if (ch != '\r') { tok_add(c, ch); c->state = C_PLAIN; }
+      return;
+  }
+}
+
+static void csv_eof(import_ctx *c){
+  if (c->state != C_START || c->col > 0) csv_line(c);
+}
+
+//---------------------------------JSON---------------------------------
+static bool space(char ch){
+  return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+// String body, false once the closing quote is read
+static bool json_str(import_ctx *c, char ch){
+  if (c->hex) { if (--c->hex == 0) tok_add(c, '?'); return true; }
+  if (c->esc) {
+    c->esc = false;
+    switch (ch) {
+      case 'n': tok_add(c, ' '); break;
+      case 't': tok_add(c, ' '); break;
+      case 'u': c->hex = 4;      break;
+      default:  tok_add(c, ch);  break;     // \" \\ \/
+    }
+    return true;
+  }
+  if (ch == '\\') { c->esc = true; return true; }
+  if (ch == '"') return false;
+  tok_add(c, ch);
+  return true;
+}
+
+// False on a syntax error
+static bool json_byte(import_ctx *c, char ch){
+  if (ch == '\n') c->line++;
+  switch (c->state) {
+    case J_ARRAY:
+      if (ch == '[') c->state = J_OBJ;
+      else if (!space(ch)) return false;
+      return true;
+    case J_OBJ:
+      if (ch == '{') { row_start(c); c->state = J_KEY; }
+      else if (ch == ']') c->state = J_DONE;
+      else if (!space(ch) && ch != ',') return false;
+      return true;
+    case J_KEY:
+      if (ch == '"') { c->tl = 0; c->state = J_KSTR; }
+      else if (ch == '}') { row_end(c); c->state = J_OBJ; }
+      else if (!space(ch) && ch != ',') return false;
+      return true;
+    case J_KSTR:
+      if (!json_str(c, ch)) {
+        c->tok[c->tl] = 0;
+        c->tl  = 0;
+        c->key = col_find(c->tok);
+        c->state = J_COLON;
+      }
+      return true;
+    case J_COLON:
+      if (ch == ':') c->state = J_VAL;
+      else if (!space(ch)) return false;
+      return true;
+    case J_VAL:
+      if (space(ch)) return true;
+      if (ch == '"') c->state = J_VSTR;
+      else if (ch == '{' || ch == '[') { c->depth = 1; c->state = J_SKIP; }
+      else if (ch == ',' || ch == '}' || ch == ']' || ch == ':') return false;
+      else { tok_add(c, ch); c->state = J_VSCAL; }
+      return true;
+    case J_VSTR:
+      if (!json_str(c, ch)) { row_field(c, c->key); c->state = J_KEY; }
+      return true;
+    case J_VSCAL:
+      if (ch == ',' || ch == '}' || space(ch)) {
+        c->tok[c->tl] = 0;
+        if (!strcmp(c->tok, "null") || !strcmp(c->tok, "false")) c->tl = 0;
+        row_field(c, c->key);
+        c->state = J_KEY;
+        if (ch == '}') { row_end(c); c->state = J_OBJ; }
+      } else tok_add(c, ch);
+      return true;
+    case J_SKIP:                                 // brackets in strings don't count
+      if (c->esc) c->esc = false;
+      else if (c->in_str) { if (ch == '\\') c->esc = true; else if (ch == '"') c->in_str = false; }
+      else if (ch == '"') c->in_str = true;
+      else if (ch == '{' || ch == '[') c->depth++;
+      else if ((ch == '}' || ch == ']') && --c->depth == 0) { c->tl = 0; c->state = J_KEY; }
+      return true;
+    case J_DONE:
+      return space(ch);
+  }
+  return false;
+}
+
+//---------------------------------Import a file---------------------------------
+// Replaces the library. Rows stream from the file a chunk at a time, good
+// ones go out a batch at a time, and the index is sorted once at the end.
+bool import_file(const char *path, import_stats *st){
+  memset(st, 0, sizeof(*st));
+  uint32_t t0    = micros();
+  size_t   free0 = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+  File f = SPIFFS.open(path, "r");
+  if (!f) return false;
+  import_ctx *c = (import_ctx *)heap_caps_malloc(sizeof(import_ctx), MALLOC_CAP_8BIT);
+  if (c == NULL) { f.close(); return false; }
+  memset(c, 0, sizeof(*c));
+  st->heap = free0 - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+  const char *ext = strrchr(path, '.');
+  c->json   = ext && !strcasecmp(ext, ".json");
+  c->header = true;
+  c->line   = 1;
+  c->path   = path;
+  c->st     = st;
+  c->state  = c->json ? (uint8_t)J_ARRAY : (uint8_t)C_START;
+  row_start(c);
+
+  bool ok = lib_clear();
+  size_t n;
+  while (ok && (n = f.read(c->chunk, IMPORT_CHUNK)) > 0) {
+    st->bytes += n;
+    for (size_t i = 0; i < n && ok; i++) {
+      if (c->json) ok = json_byte(c, (char)c->chunk[i]);
+      else csv_byte(c, (char)c->chunk[i]);
+    }
+  }
+  f.close();
+  if (c->json && (!ok || c->state != J_DONE)) {
+    Serial.printf("%s line %u: %s\n", path, c->line, ok ? "file ends early" : "syntax error");
+    ok = false;
+  }
+  if (!c->json) csv_eof(c);
+  batch_flush(c);
+  heap_caps_free(c);
+
+  // rows read before a syntax error are kept, the file is left for another try
+  st->index = st->added * sizeof(uint16_t);
+  if (!lib_end()) ok = false;
+  if (st->slots && !prog_flush()) ok = false;
+  st->us = micros() - t0;
+  return ok;
+}
+
+void import_report(const import_stats &st){
+  Serial.printf("Import: %u rows, %u recipes, %u rejected, %u programs replaced\n",
+                st.rows, st.added, st.bad, st.slots);
+  Serial.printf("Import: %u bytes in %u ms (%u rows/s), %u library writes, heap %u B + %u B index sort\n",
+                st.bytes, st.us / 1000, st.us ? (uint32_t)(st.rows * 1000000ULL / st.us) : 0,
+                st.batches, st.heap, st.index);
+}
@@ -0,0 +1,48 @@
+// Recipe import
+//
+// Loads the recipe library from a CSV or JSON file on SPIFFS. The file is
+// read in IMPORT_CHUNK byte chunks through a byte-at-a-time parser, so it is
+// never held in memory. Each row becomes a recipe and is checked with
+// tl_check(), so programs that can't run are rejected with their line
+// number. Good rows go to the library IMPORT_BATCH records - one flash
+// sector - per write. A row with a slot (1-9) also replaces that program.
+//
+// CSV: the first line names the columns, fields may be "quoted".
+// JSON: an array of flat objects, keys as the CSV column names.
+// Columns: film, developer, dilution, iso, slot and the program fields
+//   dev_init dev_time dev_agit dev_every     (initial agitation, time [s],
+//   stop_init stop_time stop_agit stop_every  agitation count, every [s])
+//   fix_init fix_time fix_agit fix_every
+//   rinse1 .. rinse5
+//   dev_pattern stop_pattern fix_pattern      (agitation pattern, name or index)
+// Unknown columns are ignored, missing ones are 0.
+//
+// All parser state, the chunk and the batch sit in one block allocated for
+// the import and freed after it.
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stdint.h>
+
+#define IMPORT_CHUNK 512                         // bytes per file read
+#define IMPORT_BATCH 51                          // recipes per flash write, 51 * 80 B < 4 KB
+#define IMPORT_TOK   24                          // longest field kept, longer ones are cut
+#define IMPORT_COLS  32                          // CSV columns
+
+struct import_stats {
+  uint32_t bytes;
+  uint32_t rows;
+  uint32_t added;                                // recipes in the library
+  uint32_t bad;                                  // rejected rows
+  uint32_t slots;                                // programs replaced
+  uint32_t batches;                              // library writes
+  uint32_t us;
+  uint32_t heap;                                 // most heap in use while parsing
+  uint32_t index;                                // heap taken by the index sort at the end
+};
+
+bool import_file(const char *path, import_stats *st);
+void import_report(const import_stats &st);
+
+#endif
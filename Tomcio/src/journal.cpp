@@ -0,0 +1,238 @@
+#include <Arduino.h>
+#include <string.h>
+#include <stddef.h>
+#include "esp_partition.h"
+#include "progstore.h"
+#include "sched.h"
+#include "tick.h"
+#include "motor.h"
+#include "journal.h"
+#include "fmt.h"
+
+#define SEC   SPI_FLASH_SEC_SIZE
+#define PPS   (SEC / JOURNAL_PAGE)               // pages per sector
+#define PAGES (JOURNAL_SECS * PPS)
+#define QM    (JOURNAL_RAM - 1)
+
+static_assert(sizeof(journal_page) == JOURNAL_PAGE, "journal_page is one flash page");
+
+static const esp_partition_t   *part = NULL;     // "journal" partition
+static const uint8_t           *mem  = NULL;     // mapped
+static spi_flash_mmap_handle_t  map_h;
+static uint16_t                 wr;              // next page to program
+static uint16_t                 avail;           // blank pages from wr on, ends on a sector boundary
+static uint32_t                 seq;             // last page written
+static uint16_t                 session;
+static uint32_t                 wear[JOURNAL_SECS];   // erases per sector
+
+static journal_page q[JOURNAL_RAM];              // q_tail..q_head-1 queued, q_head being filled
+static uint32_t     q_head, q_tail;              // free running, & QM
+static uint16_t     lost;                        // dropped since the last JE_LOST entry
+
+static uint32_t s_entries, s_pages, s_erases, s_fails, s_lost;   // this session
+static uint32_t write_us_max, erase_us_max;
+
+static const char *const names[] = {"stage", "start", "agit", "agit_done", "spin", "reverse", "spin_done",
+                                    "stage_done", "finished", "aborted"};
+static const char *const je_names[] = {"session", "touch", "resume", "lost"};
+
+//---------------------------------Pages---------------------------------
+static const journal_page *page(uint16_t i){
+  return (const journal_page *)(mem + i * JOURNAL_PAGE);
+}
+
+static bool valid(const journal_page *p){
+  return p->n > 0 && p->n <= JOURNAL_PER_PAGE && p->crc == crc32(p, offsetof(journal_page, crc));
+}
+
+static bool blank(uint16_t i){
+  const uint32_t *w = (const uint32_t *)page(i);
+  for (uint16_t k = 0; k < JOURNAL_PAGE / 4; k++) {
+    if (w[k] != 0xFFFFFFFF) return false;
+  }
+  return true;
+}
+
+static uint16_t blank_run(){
+  uint16_t n = 0;
+  while (n < PAGES && blank((wr + n) % PAGES)) n++;
+  return n;
+}
+
+//---------------------------------Boot---------------------------------
+// The newest page sets seq and session, the writer goes on after it
+void journal_begin(){
+  const void *p;
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)JOURNAL_SUBTYPE, JOURNAL_PART_NAME);
+  if (!part || part->size < JOURNAL_SECS * SEC ||
+      esp_partition_mmap(part, 0, JOURNAL_SECS * SEC, SPI_FLASH_MMAP_DATA, &p, &map_h) != ESP_OK) {
+    part = NULL;
+    return;
+  }
+  mem = (const uint8_t *)p;
+
+  int32_t  newest = -1;
+  uint32_t wmax   = 0;
+  for (uint16_t i = 0; i < PAGES; i++) {
+    const journal_page *pg = page(i);
+    if (!valid(pg)) continue;
+    wear[i / PPS] = max(wear[i / PPS], pg->wear);
+    wmax          = max(wmax, pg->wear);
+    if (newest < 0 || (int32_t)(pg->seq - page(newest)->seq) > 0) newest = i;
+  }
+  for (uint8_t s = 0; s < JOURNAL_SECS; s++) {   // no page left to tell, erased since
+    bool any = false;
+    for (uint16_t i = s * PPS; i < (s + 1) * PPS && !any; i++) any = valid(page(i));
+    if (!any) wear[s] = wmax;
+  }
+  if (newest >= 0) {
+    seq     = page(newest)->seq;
+    session = page(newest)->session;
+    wr      = (newest + 1) % PAGES;
+  }
+
+  // a torn page or an erase cut short ends the blank run inside a sector
+  avail = blank_run();
+  uint16_t end = wr + avail;
+  if (avail < PAGES && end % PPS) {
+    if (end / PPS == wr / PPS) {                 // the newest pages are in there, go to the next sector
+      wr    = (end / PPS + 1) * PPS % PAGES;
+      avail = blank_run();
+      if (avail < PAGES) avail -= (wr + avail) % PPS;
+    } else avail -= end % PPS;
+  }
+}
+
+//---------------------------------Entries---------------------------------
+static void seal(){
+  q_head++;
+  if (q_head - q_tail < JOURNAL_RAM) q[q_head & QM].n = 0;
+}
+
+static bool put(uint8_t kind, uint8_t stage, uint16_t a, int32_t b){
+  if (q_head - q_tail >= JOURNAL_RAM) return false;
+  journal_page &p = q[q_head & QM];
+  if (p.n == 0) p.session = session;
+  p.e[p.n++] = {(uint32_t)millis(), kind, stage, a, b};
+  if (p.n == JOURNAL_PER_PAGE) seal();
+  return true;
+}
+
+// RAM only, never waits for the flash
+void journal_add(uint8_t kind, uint8_t stage, uint16_t a, int32_t b){
+  if (!part) return;
+  if (lost && put(JE_LOST, stage, lost, 0)) lost = 0;
+  if (!lost && put(kind, stage, a, b)) {
+    s_entries++;
+    return;
+  }
+  if (lost < UINT16_MAX) lost++;
+  s_lost++;
+}
+
+void journal_sync(){
+  if (q_head - q_tail < JOURNAL_RAM && q[q_head & QM].n) seal();
+}
+
+void journal_session(uint8_t prog, uint8_t stages){
+  journal_sync();
+  session++;
+  s_entries = s_pages = s_erases = s_fails = s_lost = 0;
+  write_us_max = erase_us_max = 0;
+  journal_add(JE_SESSION, 0, prog, stages);
+}
+
+//---------------------------------Flash---------------------------------
+static void program(journal_page &p){
+  uint32_t t0 = micros();
+  p.seq   = ++seq;
+  p.wear  = wear[wr / PPS];
+  p.spare = 0;
+  p.crc   = crc32(&p, offsetof(journal_page, crc));
+  if (esp_partition_write(part, wr * JOURNAL_PAGE, &p, sizeof(p)) == ESP_OK && !memcmp(page(wr), &p, sizeof(p))) {
+    s_pages++;
+  } else s_fails++;
+  wr = (wr + 1) % PAGES;
+  avail--;
+  write_us_max = max(write_us_max, micros() - t0);
+}
+
+// The sector after the blank pages holds the oldest ones
+static void erase_ahead(){
+  uint32_t t0 = micros();
+  uint8_t  s  = (wr + avail) % PAGES / PPS;
+  if (esp_partition_erase_range(part, s * SEC, SEC) == ESP_OK) {
+    wear[s]++;
+    avail += PPS;
+    s_erases++;
+  } else s_fails++;
+  erase_us_max = max(erase_us_max, micros() - t0);
+}
+
+// us until the next timer tick or timeline event, what a flash operation could hold up
+static int32_t quiet_us(){
+  int32_t  q = tick_next_us() - micros();
+  uint32_t d;
+  if (sched_next_due(&d)) q = min(q, ((int32_t)(d - millis()) - 1) * 1000);
+  return q;
+}
+
+// One flash operation at most, and only into a gap it fits in
+void journal_service(bool erase_ok){
+  if (!part || motor_busy()) return;
+  int32_t quiet = quiet_us();
+  if (erase_ok && avail < PPS && quiet >= JOURNAL_ERASE_US) {
+    erase_ahead();
+    return;
+  }
+  if (q_tail == q_head || avail == 0 || quiet < JOURNAL_WRITE_US) return;
+  journal_page &p = q[q_tail & QM];
+  program(p);
+  if (q_head - q_tail++ == JOURNAL_RAM) p.n = 0; // was full, this slot is the one being filled now
+}
+
+//---------------------------------Dump---------------------------------
+static uint32_t dump_page(const journal_page &p){
+  for (uint8_t i = 0; i < p.n; i++) {
+    const journal_ent &e = p.e[i];
+    const char *name = e.kind < sizeof(names) / sizeof(names[0]) ? names[e.kind]
+                     : e.kind >= JE_SESSION && e.kind <= JE_LOST ? je_names[e.kind - JE_SESSION] : "?";
+    Serial.printf("%u,%lu,%u,%s,%u,%ld\n", p.session, (unsigned long)e.t_ms, e.stage, name, e.a, (long)e.b);
+  }
+  return p.n;
+}
+
+// Flash oldest first, then what is still in RAM
+void journal_dump(){
+  uint32_t n = 0;
+  uint16_t used = 0;
+  for (uint16_t i = 0; part && i < PAGES; i++) used += valid(page(i));
+  Serial.printf("# journal: %u of %u pages in use, session %u\n", used, part ? PAGES : 0, session);
+  Serial.println("session,t_ms,stage,event,a,b");
+  for (uint16_t k = 0; part && k < PAGES; k++) {
+    const journal_page *p = page((wr + k) % PAGES);
+    if (valid(p)) n += dump_page(*p);
+  }
+  for (uint32_t i = q_tail; i != q_head; i++) n += dump_page(q[i & QM]);
+  if (q_head - q_tail < JOURNAL_RAM) n += dump_page(q[q_head & QM]);
+  Serial.printf("# end, %lu entries\n", (unsigned long)n);
+}
+
+//---------------------------------Report---------------------------------
+void journal_report(){
+  if (part == NULL) {
+    Serial.println("Journal: no \"" JOURNAL_PART_NAME "\" partition, flash partitions.csv");
+    return;
+  }
+  uint32_t wmin = UINT32_MAX, wmax = 0;
+  for (uint8_t s = 0; s < JOURNAL_SECS; s++) {
+    wmin = min(wmin, wear[s]);
+    wmax = max(wmax, wear[s]);
+  }
+  log_fmt("Journal: session %u, %lu entries, %lu pages written (%lu bytes, longest %lu us), "
+          "%lu erases (%lu bytes, longest %lu us), %lu failed, %lu lost; page %u of %u, wear %lu..%lu erases/sector\n",
+          session, (unsigned long)s_entries, (unsigned long)s_pages, (unsigned long)(s_pages * JOURNAL_PAGE),
+          (unsigned long)write_us_max, (unsigned long)s_erases, (unsigned long)(s_erases * SEC),
+          (unsigned long)erase_us_max, (unsigned long)s_fails, (unsigned long)s_lost, wr, PAGES,
+          (unsigned long)wmin, (unsigned long)wmax);
+}
@@ -0,0 +1,76 @@
+// Session journal
+//
+// What happened during each run - stage screens and STARTs, every
+// agitation with how late it started against the timeline and how long it
+// took, stage ends against endTime, touches, aborts - kept in the "journal"
+// data partition.
+//
+// journal_add() only puts the entry in a RAM page. Full pages, and the page
+// in use at a stage end (journal_sync()), queue up for journal_service(),
+// which loop() calls before it waits: a page is programmed only with no
+// timer tick or timeline event due for JOURNAL_WRITE_US and the motor
+// still, so the flash never holds up a tick, an event or a step. Sectors are
+// erased only outside the timed part of a stage, a sector ahead of the
+// writer, so a stage always has blank pages to go to. If the RAM queue
+// fills anyway the entries are dropped and a JE_LOST entry says how many.
+//
+// The partition is a ring of 256 byte pages written in order, each with a
+// sequence number and a CRC-32; the sector the writer moves into next holds
+// the oldest pages and is erased for it. The newest valid page is found at
+// boot. Every page carries its sector's erase count, so the wear on each
+// sector survives its own erase.
+//
+// Sending 'j' on the serial port prints the journal as CSV, oldest first.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+#define JOURNAL_SUBTYPE   0x43                   // data partition subtype, see partitions.csv
+#define JOURNAL_PART_NAME "journal"
+#define JOURNAL_SECS      16                     // 64 KB, 256 pages
+#define JOURNAL_PAGE      256                    // flash page, one program operation
+#define JOURNAL_PER_PAGE  20
+#define JOURNAL_RAM       8                      // pages queued in RAM, power of 2
+#define JOURNAL_WRITE_US  10000                  // quiet needed to program a page
+#define JOURNAL_ERASE_US  100000                 // quiet needed to erase a sector
+
+enum {                                           // journal_ent.kind past the PE_* kinds of proto.h
+  JE_SESSION = 0x20,                             // run started, a = prog, b = stages
+  JE_TOUCH,                                      // run screen touched, a = x, b = y
+  JE_RESUME,                                     // run resumed, a = RESUME_FROM_*, b = time down [ms], -1 unknown
+  JE_LOST                                        // a = entries dropped, the RAM queue was full
+};
+
+// PE_AGIT      a = count, b = started late against the timeline [ms]
+// PE_AGIT_DONE b = took [ms]
+// PE_STAGE_DONE b = late against endTime [ms]
+// the rest as in PT_EVT
+struct journal_ent {
+  uint32_t t_ms;                                 // millis()
+  uint8_t  kind;
+  uint8_t  stage;
+  uint16_t a;
+  int32_t  b;
+};
+
+struct journal_page {
+  uint32_t    seq;                               // pages written, newest wins
+  uint16_t    session;                           // runs started
+  uint8_t     n;                                 // entries used
+  uint8_t     spare;
+  uint32_t    wear;                              // erases of this page's sector
+  journal_ent e[JOURNAL_PER_PAGE];
+  uint32_t    crc;                               // CRC-32 of all bytes above
+};
+
+void journal_begin();                            // after the partition table is readable
+void journal_session(uint8_t prog, uint8_t stages);   // first START of a run
+void journal_add(uint8_t kind, uint8_t stage, uint16_t a = 0, int32_t b = 0);
+void journal_sync();                             // page in use queued as it is
+void journal_service(bool erase_ok);             // loop(), erase_ok outside the timed part of a stage
+void journal_dump();
+void journal_report();
+
+#endif
@@ -3,88 +3,203 @@
 #include <SPI.h>
 #include <TFT_eSPI.h>    
 #include "Free_Fonts.h"
+#include "sched.h"
+#include "motor.h"
+#include "digits.h"
+#include "fmt.h"
+#include "heapmon.h"
+#include "process.h"
+#include "timeline.h"
+#include "trace.h"
+#include "tick.h"
+#include "touch.h"
+#include "progstore.h"
+#include "recipes.h"
+#include "import.h"
+#include "boot.h"
+#include "power.h"
+#include "proto.h"
+#include "resume.h"
+#include "journal.h"
+#include "hist.h"
+#include "screens.h"
+#include "esp_heap_caps.h"
 
 TFT_eSPI tft = TFT_eSPI(); 
 
-uint16_t prog_data[9][17];                       // Programs data
-uint8_t sel_p;                                   // Selected program
-uint32_t scale;                                  // Scale to display progress maker
-unsigned long startTime;                         // Timestamp when step was started
-unsigned long endTime;                           // Timestamp when step will end
-unsigned long agitTime;                          // Timestamp of next agitation
-unsigned long curr_time;                         // Curr time to calc display progress maker
+uint8_t sel_p;                                   // Selected program, PROG_N and up are built in processes
+uint16_t run_pd[PROG_WORDS];                     // its record, zeros for built in processes
+uint32_t startTime;                              // Timestamp when step was started
+uint32_t endTime;                                // Timestamp when step will end
+uint32_t curr_time;                              // Curr time to calc display progress maker
 uint8_t vibro = 0;                               // controlls vibration
 
+//---------------------------------Stage engine state---------------------------------
+enum {                                           // scheduler event ids
+  EV_UNLOCK,                                     // START pressed 1s ago - offer initial agitation
+  EV_TL                                          // timeline event at cursor is due
+};
+
+enum {                                           // status line under the progress bar
+  SL_NONE,
+  SL_AGIT,                                       // "Agitation"
+  SL_WAIT,                                       // "WAIT"
+  SL_SPIN,                                       // "Rotation"
+  SL_DRAIN,                                      // "DRAIN OFF"
+  SL_DONE                                        // "<bath> DONE"
+};
+
+enum {                                           // run states
+  ST_READY,                                      // stage screen, waiting for START
+  ST_ARMED,                                      // timer running, START locked
+  ST_INITIAL,                                    // waiting for initial agitation touch
+  ST_RUN,                                        // stage running
+  ST_DONE,                                       // stage done message
+  ST_RINSE,                                      // waiting for rinse START
+  ST_RINSE_AGIT,                                 // rinse agitation
+  ST_FINISHED                                    // all done
+};
+
+//---------------------------------Run screen sprites---------------------------------
+// Countdown and progress marker are composed off screen and only the changed
+// area is pushed with DMA. Build with -D RUN_SPRITES=0 for the old direct
+// drawing, both paths report bytes and time per frame at the end of a stage.
+#ifndef RUN_SPRITES
+  #define RUN_SPRITES 1
+#endif
+#define CLK_X  300                               // countdown area
+#define CLK_W  180
+#define CLK_H  40
+#define BAR_X  20                                // progress marker strip
+#define BAR_Y  92
+#define BAR_W  440
+#define BAR_H  9
+#define MARK_W 40                                // marker window pushed per frame
+
+TFT_eSprite clk_spr  = TFT_eSprite(&tft);     // digit atlas of the countdown font
+TFT_eSprite mark_spr = TFT_eSprite(&tft);
+digit_atlas clk;
+uint16_t *clk_buf;                               // internal RAM, clock cells composed here
+uint16_t *dma_buf;                               // internal RAM bounce buffer for DMA
+int16_t mark_x = -1;                             // marker window currently on screen
+
+uint32_t frm_cnt;                                // frames this stage
+uint32_t frm_us;                                 // time spent in tft_upd()
+uint32_t frm_bytes;                              // pixel bytes sent to the display
+uint32_t rebuilt0;                               // tick_rebuilt when the stage came up
+
+uint8_t stage;                                   // bath of tl_proc
+uint8_t run_state = ST_READY;
+uint16_t tl_pos;                                 // timeline cursor
+uint32_t tl_base;                                // millis() the stage timeline counts from, wraps below 0 on a resume
+bool agitating = 0;                              // agitation in progress
+uint8_t agit_pending = 0;                        // inversions that came due during agitation
+uint32_t agit_due;                               // millis() agit_pending was due at
+bool end_pending = 0;                            // stage ended during agitation
+bool spinning = 0;                               // continuous rotation in progress
+uint16_t spin_revs;                              // reversals this stage
+uint32_t spin_err_max;                           // latest reversal against schedule [us]
+bool selecting = 0;                              // select screen up, no process loaded
+bool session = 0;                                // first stage started, checkpoints kept until the end
+bool run_aborted = 0;                            // run ended by the host, not finished
+bool diag_on = 0;                                // diagnostics screen up over the run end screen
+uint8_t status_pending;                          // SL_* to draw under the progress bar, SL_NONE if drawn
+uint32_t tl_skip_ms;                             // agitations due before this came while the timer was down
+uint32_t loop_max;                               // longest loop() pass since the last telemetry [us]
+uint32_t late_max;                               // latest tick since the last telemetry [us]
+
+const char *import_name;                         // recipe file imported at boot, NULL if none
+
 #define CALIBRATION_FILE "/TouchCalData2"        // Calibration file
 #define REPEAT_CAL false                         // Setting True will run calibration every time
 
-//---------------------------------Stepper driver---------------------------------
-#include "DRV8825.h"
-// Motor steps per revolution. Most steppers are 200 steps or 1.8 degrees/step
-#define MOTOR_STEPS 200
-#define RPM         20
-#define DIR         10
-#define STEP        12
-#define MODE0       48
-#define MODE1       47
-#define MODE2       21
-#define ENABLE      11
-#define MICROST     16
-#define MOTOR_ACCEL 1000
-#define MOTOR_DECEL 1000
-DRV8825 stepper(MOTOR_STEPS, DIR, STEP, ENABLE, MODE0, MODE1, MODE2);
-
 //=================================TIMER=================================
 
-volatile bool tick = 0;
 hw_timer_t *Timer0_Cfg = NULL;
 
 void IRAM_ATTR Timer0_ISR(){
-    tick = 1;
-    if(vibro > 0){
-        vibro--;
-    } else   digitalWrite(8, LOW);
+    tick_push();
+    if(vibro > 0 && --vibro == 0){
+        digitalWrite(VIBE_PIN, LOW);              // only once, patterns drive the pin too
+    }
 }
 
 // function declarations
   void init_SPIFFS();
   void touch_calibrate();
   void load_programs();
-  void read_prog();
-  void edit_prog(int prog);
+  const char *import_pending();
+  void import_boot(const char *name);
+  void boot_loader();
+  bool edit_prog(int prog, const uint16_t *src);
+  void sel_frame();
+  void lib_row(uint8_t i, uint16_t pos, uint16_t hi);
+  const recipe *lib_select();
+  uint8_t sel_wait(uint16_t *x, uint16_t *y);
   void sel_prog();
-  void irig(int ir_cnt);
+  void irig(int ir_cnt, uint32_t due);
+  void spin();
+  void spin_evt(const motor_evt &e);
+  void agit_done(const motor_evt &e);
+  void run_spr_init();
+  void clock_draw(uint32_t sec);
+  void clock_bench();
   void tft_upd();
-  void dev_stage();
-  void stop_stage();
-  void fix_stage();
-  void rinse_stage();
+  void status_draw();
+  void start_btn(uint16_t color, const char *l1, const char *l2);
+  void bar_box(uint32_t t, uint32_t d, uint16_t color);
+  void stage_enter(uint8_t st);
+  void tl_sched();
+  void tl_fire();
+  void stage_done();
+  void proc_show(const process &p);
+  void stage_touch(uint16_t x, uint16_t y);
+  bool stage_start();
+  void stage_event(const sched_ev &ev);
+  void serial_poll();
+  void host_cmd(const proto_cmd &c);
+  void host_tlm();
+  void run_abort();
+  void ckpt(bool mirror);
+  void end_screen();
+  void diag_screen();
+  void diag_panel(uint8_t id, int16_t x, int16_t y);
+  bool resume_offer();
+  void resume_run(const resume_ck &ck, bool exact);
 
 //=================================SETUP=================================
 
 void setup() {
 
   Serial.begin(115200);
+  proto_begin();
 
   // define pins
-    pinMode(8,  OUTPUT);       // vibration
+    pinMode(VIBE_PIN, OUTPUT); // vibration
     pinMode(18, OUTPUT);      // buzzer
     pinMode(1,  OUTPUT);       // status led
+    boot_mark("start");
 
   // Init screen
     tft.init();
     tft.setRotation(1);
+    boot_mark("display");
   
   // Init SPIFFS
   init_SPIFFS();
+  boot_mark("spiffs");
 
-  // Initial functions
+  // Initial functions - programs and library load on the other core meanwhile
     //load_programs();    <<== uncomment to initially load programs
-    read_prog();
+#ifdef SIM
+    load_programs();      // simulator file system starts empty
+#endif
+    import_name = import_pending();
+    boot_load(boot_loader);
     touch_calibrate();
-
-  // Turn on status LED - all initials done
-  digitalWrite(1, HIGH);
+    touch_begin(&tft);
+    tft_take();                                  // display belongs to setup()/loop() from here
+    boot_mark("touch");
 
   // Welcome screen
     tft.fillScreen(TFT_BLACK);
@@ -98,42 +213,90 @@ void setup() {
     tft.setFreeFont(FF29);
     tft.drawString("Universal film development helper", tft.width() / 2, tft.height() / 2 + 60);
     tft.setFreeFont(FF17);
-    tft.drawString("Set tank holder in position", tft.width() / 2, tft.height() / 2 + 120);
-    delay(10000);
-    tft.fillScreen(TFT_BLACK);
+    tft.drawString(import_name ? "Importing recipes" : "Set tank holder in position", tft.width() / 2, tft.height() / 2 + 120);
+    boot_mark("splash");
+    run_spr_init();
+    boot_mark("sprites");
 
-  // Motor config
-    stepper.begin(RPM);
-    stepper.setMicrostep(MICROST);
-    stepper.setEnableActiveState(LOW);
-    stepper.enable();
-    stepper.setSpeedProfile(stepper.LINEAR_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
+  // Motor config - starts the motor task
+    motor_begin();
 
   // Timer config
-    Timer0_Cfg = timerBegin(0, 8000, true);
+    Timer0_Cfg = timerBegin(0, TICK_DIV, true);
     timerAttachInterrupt(Timer0_Cfg, &Timer0_ISR, true);
-    timerAlarmWrite(Timer0_Cfg, 5000, true);
+    timerAlarmWrite(Timer0_Cfg, TICK_ALARM, true);
     timerAlarmEnable(Timer0_Cfg);
+    power_begin(Timer0_Cfg);
+    boot_mark("motor");
+
+  // Splash stays until the loader is done
+    boot_wait();
+    boot_mark("wait");
+    Serial.printf("Library: %u recipes\n", lib_count());
+    tft.fillScreen(TFT_BLACK);
+
+  // Turn on status LED - all initials done
+  digitalWrite(1, HIGH);
+    boot_report();
 
-  // Execute program
-    sel_prog();
-    dev_stage();
-    stop_stage();
-    fix_stage();
-    rinse_stage();
+  // Go on with a run a reset cut short, or select program and enter first stage - loop() runs it from here
+    if (!resume_offer()) {
+      sel_prog();
+      journal_session(sel_p, tl_proc.n);
+      stage_enter(0);
+    }
+    tick_skip();                                 // loop() didn't run on the select screen
+    tft_give();
 }
 
 //=================================ENDLESS LOOP=================================
 
 void loop(void) {
-  tft.fillScreen(TFT_BLACK);
-  tft.setFreeFont(FF32);
-  tft.setTextColor(TFT_GREEN, TFT_BLACK);
-  tft.setTextDatum(MC_DATUM);
-  tft.setTextSize(2);
-  tft.drawString("DONE", tft.width() / 2, tft.height() / 2);
+  sched_ev ev;
+  motor_evt mev;
+  touch_ev tev;
+
+  power_busy();
+  uint32_t t0 = micros();
+  tft_take();                                    // touch task samples between passes
+  motor_service();
+  while (motor_poll(&mev)) {
+    if (spinning) spin_evt(mev);
+    else if (agitating) agit_done(mev);          // else left over from an abort
+  }
 
-  while(1){}
+  // events first, nothing due waits behind a redraw
+  while (sched_pop(millis(), &ev)) {
+    stage_event(ev);
+    motor_service();
+  }
+
+  touch_service();
+  while (touch_poll(&tev)) {
+    if (tev.type == TOUCH_PRESS) stage_touch(tev.x, tev.y);
+  }
+
+  // every tick is accounted for, the screen is redrawn once for all of them
+  tick_ev te;
+  bool ticked = 0;
+  while (tick_pop(&te)) {
+    heap_mark_check();
+    late_max = max(late_max, micros() - te.t_us);
+    ticked = 1;
+  }
+  serial_poll();
+  status_draw();
+  if (ticked){
+    if (run_state == ST_ARMED || run_state == ST_INITIAL || run_state == ST_RUN) tft_upd();
+    host_tlm();
+    ckpt(false);
+  }
+  tft.dmaWait();                                 // no transfer runs into a light sleep
+  tft_give();
+  loop_max = max(loop_max, micros() - t0);
+  proto_flush();
+  journal_service(run_state != ST_ARMED && run_state != ST_INITIAL && run_state != ST_RUN);
+  power_idle();
 }
 
 //=================================INITIAL FUNCTIONS=================================
@@ -150,7 +313,7 @@ void init_SPIFFS(){
 //---------------------------------Touchscreen calibration---------------------------------
 void touch_calibrate(){
 
-  uint16_t calData[5];
+  uint16_t calData[7];                           // 5 values used, file holds 14 bytes
   uint8_t calDataOK = 0;
 
   // check if calibration file exists and size is correct
@@ -162,12 +325,14 @@ void touch_calibrate(){
     }
     else
     {
+      TRACE_BEGIN(TR_FS);
       File f = SPIFFS.open(CALIBRATION_FILE, "r");
       if (f) {
         if (f.readBytes((char *)calData, 14) == 14)
           calDataOK = 1;
         f.close();
       }
+      TRACE_END(TR_FS);
     }
   }
 
@@ -227,10 +392,11 @@ void load_programs(){
    } else Serial.println("Program_1 exists");
 
   for (int p = 2; p<10; p++){
-    String file_name = "/Program_"+String(p);
+    char file_name[16];
+    snprintf(file_name, sizeof(file_name), "/Program_%d", p);
 
       if (!SPIFFS.exists(file_name)) {
-      Serial.println("Writting " + file_name);
+      Serial.printf("Writting %s\n", file_name);
       File f = SPIFFS.open(file_name, "w");
       uint16_t prog_data[17] = {0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0};
         uint8_t prog_data8[34];
@@ -244,714 +410,1135 @@ void load_programs(){
         f.write(prog_data8, sizeof(prog_data8));
         f.close();
       }
-    } else Serial.println(file_name + " exists");
+    } else Serial.printf("%s exists\n", file_name);
   }
 
 }
 
-//---------------------------------Read programs from SPFIFS---------------------------------
-void read_prog(){
-
-  uint8_t prog_data8[34];
-
-  for (int pr = 0; pr < 9; pr = pr +1) {
-    String file_name = "/Program_" + String(pr+1);
-    File f = SPIFFS.open(file_name, "r");
-    f.read(prog_data8, 34);
-      int z = 0;
-      for (int i = 0; i<17; i++){
-        prog_data[pr][i] = prog_data8[z] + (prog_data8[z+1]<<8);
-        z = z + 2;
-      }
-    f.close();
+//---------------------------------Import recipes dropped on SPIFFS---------------------------------
+// /import.csv or /import.json replaces the library, renamed to .done when read
+const char *import_pending(){
+  static const char *const files[] = {"/import.csv", "/import.json"};
+  for (const char *name : files) {
+    if (SPIFFS.exists(name)) return name;
   }
+  return NULL;
 }
 
-//---------------------------------Edit selected program---------------------------------
-void edit_prog(int prog){
-
-  tft.fillScreen(TFT_BLACK);
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_WHITE,TFT_BLACK);
-  tft.setTextDatum(ML_DATUM);
-  tft.drawString("Dev", 5, 60);
-  tft.drawString("Stop", 5, 120);
-  tft.drawString("Fix", 5, 180);
-  tft.drawString("Rinse", 5, 260);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("I-A", 140,10);
-  tft.drawString("Time", 240,10);
-  tft.drawString("A-C", 340,10);
-  tft.drawString("A-T", 440,10);
-
-  uint8_t prog_data_cnt = 0;
-
-  for(uint8_t d = 1; d < 4; d++){
-    for(uint8_t p = 1; p < 5; p++){
-
-      tft.setTextColor(TFT_WHITE,TFT_BLACK);
-      tft.drawString(String(prog_data[prog-1][prog_data_cnt]),(p *100) + 40,d * 60);
-      prog_data_cnt++;
-
-      tft.setTextColor(TFT_RED,TFT_WHITE);
-      tft.drawString("-",(p *100) + 10,d * 60);
-      tft.setTextColor(TFT_BLUE,TFT_WHITE);
-      tft.drawString("+",(p *100) + 70,d * 60);
+void import_boot(const char *name){
+  import_stats st;
+  bool ok = import_file(name, &st);
+  import_report(st);
+  if (ok) {
+    char done[24];
+    snprintf(done, sizeof(done), "%s.done", name);
+    SPIFFS.remove(done);
+    SPIFFS.rename(name, done);
+  }
+}
 
-    }
+//---------------------------------Boot loader task - flash only, no display---------------------------------
+void boot_loader(){
+  prog_begin();
+  prog_report();
+  boot_mark("programs");
+  lib_begin();
+  boot_mark("library");
+  resume_begin();
+  resume_report();
+  boot_mark("resume");
+  journal_begin();
+  journal_report();
+  boot_mark("journal");
+  if (import_name) {
+    import_boot(import_name);
+    boot_mark("import");
   }
+}
 
-  for(uint8_t d = 0; d < 5; d++){
+//---------------------------------Edit selected program---------------------------------
+// Agitation counts and rinse steps keep the pattern in the high byte, only the count is edited
+static uint16_t edit_val(uint8_t f, uint16_t w){
+  return (f >= 12 || f % 4 == 2) ? PD_COUNT(w) : w;
+}
 
-    tft.setTextColor(TFT_WHITE,TFT_BLACK);
-    tft.drawString(String(prog_data[prog-1][12 + d]),140 + (d * 75),260);
-    tft.setTextColor(TFT_RED,TFT_WHITE);
-    tft.drawString("-",115 + (d * 75),260);
-    tft.setTextColor(TFT_BLUE,TFT_WHITE);
-    tft.drawString("+",165 + (d * 75),260);
+// Starts from src (the program itself or a recipe), true if saved to program prog
+bool edit_prog(int prog, const uint16_t *src){
 
-  }
+  tft.fillScreen(TFT_BLACK);
+  ui_draw(tft, EDIT);
 
-  tft.setTextColor(TFT_BLACK,TFT_GREEN);
-  tft.setTextDatum(BL_DATUM);
-  tft.drawString("SAVE",10,320);
-  tft.setTextColor(TFT_BLACK,TFT_YELLOW);
-  tft.setTextDatum(BR_DATUM);
-  tft.drawString("CANCEL",470,320);
+  uint16_t pd[PROG_WORDS];                       // working copy, the store is read-only
+  memcpy(pd, src, sizeof(pd));
 
   uint16_t x, y;
   uint8_t ret_res = 0;
+  tft.setTextFont(1);
   tft.setTextColor(TFT_WHITE,TFT_BLACK);
   tft.setTextSize(2);
   tft.setTextDatum(MC_DATUM);
 
-  do{  
-    while(!tft.getTouch(&x, &y)){
-      delay(5);
-    }
-
-    uint8_t prog_data_cnt = 0;
-
-    for(uint8_t d = 1; d < 4; d++){
-      for(uint8_t p = 1; p < 5; p++){
-
-        if ((x > (p * 100)) && (x < (p * 100) + 20) && (y > (d * 60) - 10) && (y < (d * 60) + 10)) {
-          if(prog_data[prog-1][prog_data_cnt]>0) prog_data[prog-1][prog_data_cnt]--;
-          tft.drawString("    ", (p * 100) + 40, d * 60);
-          tft.drawString(String(prog_data[prog-1][prog_data_cnt]), (p *100) + 40, d * 60);
-        }
-
-        if ((x > (p * 100) + 60) && (x < (p *100) + 80) && (y > (d * 60) - 10) && (y < (d * 60) + 10)) {
-          prog_data[prog-1][prog_data_cnt]++;
-          tft.drawString("    ", (p * 100) + 40, d * 60);
-          tft.drawString(String(prog_data[prog-1][prog_data_cnt]), (p *100) + 40, d * 60);
-        }
-      prog_data_cnt++;
-      }
-    }
+  for(uint8_t f = 0; f < E_FIELDS; f++){
+    const widget &v = EDIT_UI[3 * f + 1];
+    tft.drawString(ui_fmt("%u", edit_val(f, pd[f])), v.ax, v.ay);
+  }
 
-    for(uint8_t d = 0; d < 5; d++){
+  do{  
+    touch_wait(&x, &y, true);                    // held +/- repeats
 
-      if ((x > 105 + (d * 75)) && (x < 125 + (d * 75)) && (y > 250) && (y < 270)) {
-        if(prog_data[prog-1][12 + d]>0) prog_data[prog-1][12 + d]--;
-        tft.drawString("   ", 140 + (d * 75), 260);
-        tft.drawString(String(prog_data[prog-1][12 + d]), 140 + (d * 75), 260);
-      }
+    uint8_t id = ui_hit(EDIT, x, y);
 
-      if ((x > 155 + (d * 75)) && (x < 175 + (d * 75)) && (y > 250) && (y < 270)) {
-        prog_data[prog-1][12 + d]++;
-        tft.drawString("   ", 140 + (d * 75), 260);
-        tft.drawString(String(prog_data[prog-1][12 + d]), 140 + (d * 75), 260);
+    if (id < E_SAVE) {
+      uint8_t f = id / 2;
+      const widget &v = EDIT_UI[3 * f + 1];
+      uint16_t val = edit_val(f, pd[f]);
+      if (id == E_PLUS(f)) {
+        if (val != edit_val(f, 0xFFFF)) pd[f]++;  // count doesn't carry into the pattern
       }
-
+      else if (val > 0) pd[f]--;
+      tft.drawString(f < 12 ? "    " : "   ", v.ax, v.ay);   // rinse values sit closer to their buttons
+      tft.drawString(ui_fmt("%u", edit_val(f, pd[f])), v.ax, v.ay);
     }
 
-    if ((x > 9) && (x < 55) && (y > 300) && (y < 321)) {
+    if (id == E_SAVE) {
       ret_res =1;
     }
 
-    if ((x > 425) && (x < 471) && (y > 300) && (y < 321)) {
-      ESP.restart();
+    if (id == E_CANCEL) {
+      ret_res = 2;
     }
 
-    delay(30);
   } while(ret_res == 0);
 
-  //save
-
-  tft.setTextDatum(MC_DATUM);
-  tft.setTextFont(1);
-  tft.setTextColor(TFT_RED,TFT_BLACK);
-  tft.setTextSize(5);
-  tft.drawString("SAVING",240,160);
-
-    String file_name = "/Program_"+String(prog);
-      SPIFFS.remove(file_name);
-
-      if (!SPIFFS.exists(file_name)) {
-      Serial.println("Opening " + file_name);
-      File f = SPIFFS.open(file_name, "w");
-
-        if (!f) {
-            Serial.println("Failed to open file for writing");
-        } else {
-            Serial.println("File opened for writing");
-        }
-
-        uint8_t prog_data8[34];
-        uint8_t z = 0;
-        for (int i = 0; i < 17; i++) {
-          prog_data8[z] = prog_data[prog-1][i] & 0xff;
-          prog_data8[z+1] = (prog_data[prog-1][i] >> 8) & 0xff;
-          z = z + 2;
-        }
-      if (f) {
-        f.write(prog_data8, sizeof(prog_data8));
-        f.close();
-      }
-    } 
-
-    delay(5000);
-
-    ESP.restart();
+  // in use right away, sel_prog() writes it to flash once edits stop
+  if (ret_res == 1) prog_save(prog - 1, pd);
+  return ret_res == 1;
 
 }
 
 //---------------------------------Display program init screen---------------------------------
-void sel_prog(){
-
-  int prog = 1;
-  bool set = 0;
-
+void sel_frame(){
+  tft.fillScreen(TFT_BLACK);
   tft.setTextSize(1);
   tft.setFreeFont(FF22);
   tft.setTextColor(TFT_YELLOW, TFT_BLACK);
   tft.drawString("Select program", tft.width() / 2, 15);
   tft.drawLine(0,40,480,40,TFT_WHITE);
-  tft.fillTriangle(20,270,63,300,63,240,TFT_BLUE);
-  tft.fillTriangle(460,270,417,300,417,240,TFT_BLUE);
-  tft.fillRect(130,240,220,60,TFT_GREEN);
-  tft.setTextDatum(MC_DATUM);
-  tft.setFreeFont(FF5);
-  tft.setTextColor(TFT_RED,TFT_BLACK);
-  tft.drawString("Edit",450,55);
-  tft.setTextSize(1);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.drawString("LOAD", tft.width() / 2, 270);
+  ui_draw(tft, SEL);
   tft.setTextFont(1);
   tft.setTextDatum(TL_DATUM);
+}
+
+// Touch, or the host loading a program or writing to flash. Host frames are
+// served every PROTO_POLL_MS while waiting.
+enum { SW_TOUCH, SW_IDLE, SW_HOST, SW_LOAD };
+
+uint8_t sel_wait(uint16_t *x, uint16_t *y){
+  uint32_t t0     = millis();
+  uint32_t writes = proto_writes;
+  for (;;) {
+    if (touch_wait(x, y, false, PROTO_POLL_MS)) return SW_TOUCH;
+    serial_poll();
+    host_tlm();
+    proto_flush();
+    if (!selecting) return SW_LOAD;              // host_cmd() loaded a program
+    if (proto_writes != writes) return SW_HOST;
+    if (prog_dirty() && millis() - t0 >= PROG_FLUSH_MS) return SW_IDLE;
+  }
+}
+
+void sel_prog(){
+
+  int prog = 1;
+  bool set = 0;
+  const recipe *rec = NULL;                      // library pick shown instead of the program
+
+  selecting = 1;
+  sel_frame();
 
   do {
 
     tft.setTextColor(TFT_RED, TFT_BLACK);
-    tft.drawString("Program: " + String(prog),15,45);
-    tft.setTextColor(TFT_WHITE, TFT_BLACK);
-    tft.drawString("DEVELOPMENT",25,60);
-    tft.drawString("Initial agitation: " + String(prog_data[prog-1][0]) + " rotation(s)",35,75);
-    tft.drawString("Develop for " + String(prog_data[prog-1][1]) + "s with " + String(prog_data[prog-1][2]) + " rotation(s) every " + String(prog_data[prog-1][3]) +"s",35,90);
-    tft.drawString("STOP BATH",25,105);
-    tft.drawString("Initial agitation: " + String(prog_data[prog-1][4]) + " rotation(s)",35,120);
-    tft.drawString("Bath for " + String(prog_data[prog-1][5]) + "s with " + String(prog_data[prog-1][6]) + " rotation(s) every " + String(prog_data[prog-1][7]) +"s",35,135);
-    tft.drawString("FIX",25,150);
-    tft.drawString("Initial agitation: " + String(prog_data[prog-1][8]) + " rotation(s)",35,165);
-    tft.drawString("Bath for " + String(prog_data[prog-1][9]) + "s with " + String(prog_data[prog-1][10]) + " rotation(s) every " + String(prog_data[prog-1][11]) +"s",35,180);
-    tft.drawString("RINSE",25,195);
-    tft.drawString("Pattern: " + String(prog_data[prog-1][12]) + " - " + String(prog_data[prog-1][13]) + " - " + String(prog_data[prog-1][14]) + " - " + String(prog_data[prog-1][15]) + " - " + String(prog_data[prog-1][16]) + " rotation(s)",35,210);
+    bool builtin = prog > PROG_N;
+    const uint16_t *pd = rec ? rec->prog : builtin ? NULL : prog_get(prog - 1);
+    process proc;
+    if (builtin) proc = *proc_builtin[prog - PROG_N - 1];
+    else proc_from_prog(pd, &proc);
+    if (rec)          tft.drawString(ui_fmt("%.20s %.16s %.8s ISO %u", rec->film, rec->dev, rec->dil, rec->iso),15,45);
+    else if (builtin) tft.drawString(ui_fmt("Process: %s", proc.name),15,45);
+    else              tft.drawString(ui_fmt("Program: %d", prog),15,45);
+    proc_show(proc);
 
     uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      delay(5);
+    uint8_t w = sel_wait(&x, &y);
+    if (w == SW_IDLE) {
+      prog_flush();                              // edits of several programs go out in one write
+      continue;
     }
+    if (w == SW_HOST) {
+      rec = NULL;                                // the library pick may be gone
+      tft.fillRect(0,41,420,174,TFT_BLACK);
+      continue;
+    }
+    if (w == SW_LOAD) return;
 
-    if ((x > 20) && (x < 63)) {
-      if ((y > 240) && (y < 300)) {
+    switch (ui_hit(SEL, x, y)) {
+      case SEL_PREV:
+        rec = NULL;
         prog = prog - 1;
-        if (prog == 0) prog = 9;
+        if (prog == 0) prog = PROG_N + proc_builtin_n;
         tft.fillRect(0,41,420,174,TFT_BLACK);
+        tft.fillRect(0,218,480,12,TFT_BLACK);
         delay(15);
-      }
-    }
+        break;
 
-    if ((x > 417) && (x < 460)) {
-      if ((y > 240) && (y < 300)) {
+      case SEL_NEXT:
+        rec = NULL;
         prog = prog + 1;
-        if (prog == 10) prog = 1;
+        if (prog > PROG_N + proc_builtin_n) prog = 1;
         tft.fillRect(0,41,420,174,TFT_BLACK);
+        tft.fillRect(0,218,480,12,TFT_BLACK);
         delay(15);
-      }
-    }
-
-    if ((x > 130) && (x < 350)) {
-      if ((y > 240) && (y < 300)) {
-        set = 1;
+        break;
+
+      case SEL_LOAD: {
+        // compile the session, programs that can't run are not loaded
+        prog_flush();
+        uint8_t err = tl_load(&proc);
+        if (err == TL_OK) {
+          set = 1;
+          if (builtin) memset(run_pd, 0, sizeof(run_pd));
+          else memcpy(run_pd, pd, sizeof(run_pd));
+        }
+        else {
+          tft.setTextColor(TFT_RED, TFT_BLACK);
+          tft.drawString(tl_error(err),15,220);
+        }
         delay(15);
+        break;
       }
-    }
 
-    if ((x > 430) && (x < 470)) {
-      if ((y > 50) && (y < 60)) {
-        edit_prog(prog);
+      case SEL_EDIT:
+        if (builtin) break;                      // built in processes are fixed
+        if (edit_prog(prog, pd)) rec = NULL;     // a recipe is saved as program prog
+        sel_frame();
+        break;
+
+      case SEL_LIB: {
+        const recipe *r = lib_select();
+        if (r) rec = r;
+        sel_frame();
+        break;
       }
     }
 
   } while(set == 0);
 
-  sel_p = prog - 1;
+  sel_p     = prog - 1;
+  selecting = 0;
 }
 
-//=================================DEVELOP FUNCTIONS=================================
-
-//---------------------------------Development---------------------------------
-void irig(int ir_cnt){
-  tft.fillRect(0,145,480,160,TFT_BLACK);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_GREEN, TFT_GREEN);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("Agitation", tft.width() / 2, 225);
-  
-  int8_t direc = 1;
-  for( uint8_t i = 0; i < ir_cnt; i++){
-    stepper.rotate(90 * direc);
-    delay(125);
-    stepper.rotate(-90 * direc);
-    delay(125);
-    direc = direc * (-1);
+//---------------------------------Process summary---------------------------------
+// One line per bath under the select screen header
+void proc_show(const process &p){
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  for (uint8_t i = 0; i < p.n; i++) {
+    const bath &b = p.b[i];
+    int16_t y = 62 + 13 * i;
+    if (b.pattern && agit_name(b.pattern)) tft.drawString(agit_name(b.pattern), 400, y);
+    if (b.flags & PB_TOUCH) {
+      tft.drawString(ui_fmt("%-12s %u rotation(s) on START", b.name, b.init),25,y);
+    } else if (b.flags & PB_SPIN) {
+      tft.drawString(ui_fmt("%-12s %u:%02u  rotary, reversing every %us", b.name, b.time / 60, b.time % 60, b.every),25,y);
+    } else if (b.count) {
+      tft.drawString(ui_fmt("%-12s %u:%02u  %u rotation(s), then %u every %us", b.name, b.time / 60, b.time % 60,
+                            b.init, b.count, b.every),25,y);
+    } else {
+      tft.drawString(ui_fmt("%-12s %u:%02u  %u rotation(s)", b.name, b.time / 60, b.time % 60, b.init),25,y);
+    }
   }
-
-  tft.fillRect(0,145,480,160,TFT_BLACK);
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_GREEN, TFT_GREEN);
-  tft.drawString("WAIT", tft.width() / 2, 225);
-
-  digitalWrite(8, HIGH);
-  vibro = 6;
 }
 
-void tft_upd(){
-  tft.setTextColor(TFT_GOLD, TFT_BLACK);
+//---------------------------------Recipe library---------------------------------
+// One result row, empty past the end of the range
+void lib_row(uint8_t i, uint16_t pos, uint16_t hi){
+  const widget &w = LIB_UI[LIB_ROW0 + i];
+  tft.fillRect(w.x, w.y, w.w, w.h, TFT_BLACK);
+  if (pos >= hi) return;
+  const recipe *r = lib_at(pos);
+  tft.drawString(ui_fmt("%.13s", r->film), w.ax, w.ay);
+  tft.drawString(ui_fmt("%.10s", r->dev), 170, w.ay);
+  tft.drawString(ui_fmt("%.5s", r->dil), 295, w.ay);
   tft.setTextDatum(MR_DATUM);
-  tft.setFreeFont(FF6);
-  tft.setTextSize(1);
-  tft.fillRect(300,0,180,40,TFT_BLACK);
-  curr_time = millis();
-  int m = ((endTime - curr_time)/1000) / 60;
-  int s = ((endTime - curr_time)/1000) % 60;
-  if (s < 10) tft.drawString(String(m) + ":0" + String(s), 475, 20);
-  else tft.drawString(String(m) + ":" + String(s), 475, 20);
-  tft.fillRect(20,92,440,9,TFT_BLACK);
-  tft.fillTriangle(((curr_time-startTime)*scale/100000L)+30,93,((curr_time-startTime)*scale/100000L)+35,100,((curr_time-startTime)*scale/100000L)+25,100,TFT_CYAN);
-}
-
-void dev_stage(){
-  tft.fillScreen(TFT_BLACK);
-
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_RED, TFT_BLACK);
+  tft.drawString(ui_fmt("%u", r->iso), 418, w.ay);
   tft.setTextDatum(ML_DATUM);
-  tft.setTextSize(1);
-  tft.drawString("DEVELOPMENT", 20, 20);
-  tft.setTextDatum(MR_DATUM);
-  tft.setFreeFont(FF6);
-  tft.setTextSize(1);
-  int m = prog_data[sel_p][1] / 60;
-  int s = prog_data[sel_p][1] % 60;
-  if (s < 10) tft.drawString(String(m) + ":0" + String(s), 475, 20);
-  else tft.drawString(String(m) + ":" + String(s), 475, 20);
-  tft.drawLine(0,47,480,47,TFT_WHITE);
-  tft.drawRect(29,69,422,22,TFT_WHITE);
-  scale = 42000/(prog_data[sel_p][1]);
-  tft.fillRect(450-(0.1*scale),70,(0.1*scale),20,TFT_RED);
-  uint16_t t = prog_data[sel_p][3] + 1;
-  do {
-    tft.fillRect(30 + (t*scale/100),70,(prog_data[sel_p][2] * 2.5 * scale/100),20,TFT_YELLOW);
-    t=t+prog_data[sel_p][3];
-  } while(t < prog_data[sel_p][1]);
-  tft.fillRect(30,70,((prog_data[sel_p][3] - prog_data[sel_p][0] *2.5) * scale/100),20,TFT_GREEN);
-  tft.fillTriangle(29,93,34,100,24,100,TFT_CYAN);
-
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
-
-  tft.setTextSize(2);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("START", tft.width() / 2, 225);
+}
 
-  bool click = 0;
-  while(click == 0){
+// Browse and search the library - only the rows on screen are read from
+// flash, each typed character narrows the range with a binary search
+const recipe *lib_select(){
+  char     find[LIB_FILM_LEN + 1] = "";
+  uint8_t  len = 0;
+  uint16_t lo = 0, hi = lib_count(), top = 0;
+  bool     redraw = true;
 
-    uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      delay(5);
+  tft.fillScreen(TFT_BLACK);
+  ui_draw(tft, LIB);
+
+  for (;;) {
+    if (redraw) {
+      const widget &f = LIB_UI[LIB_FIND];
+      const widget &p = LIB_UI[LIB_POS];
+      tft.setTextFont(1);
+      tft.setTextSize(f.size);
+      tft.setTextColor(f.fg, f.bg);
+      tft.setTextDatum(f.datum);
+      tft.fillRect(0, 0, 295, 40, TFT_BLACK);
+      tft.drawString(ui_fmt("Find:%s_", find), f.ax, f.ay);
+
+      tft.setTextColor(TFT_WHITE, TFT_BLACK);
+      for (uint8_t i = 0; i < LIB_ROWS; i++) lib_row(i, top + i, hi);
+
+      tft.setTextSize(p.size);
+      tft.setTextColor(p.fg, p.bg);
+      tft.setTextDatum(p.datum);
+      tft.fillRect(0, 192, 420, 16, TFT_BLACK);
+      if (lo == hi) tft.drawString(lib_count() ? "no match" : "library is empty", p.ax, p.ay);
+      else tft.drawString(ui_fmt("%u-%u of %u", top - lo + 1, min(top + LIB_ROWS, (int)hi) - lo, hi - lo), p.ax, p.ay);
+      redraw = false;
     }
 
-    if ((x > 130) && (x < 350)) {
-      if ((y > 150) && (y < 300)) {
-        click = 1;
-        delay(15);
-      }
+    uint16_t x, y;
+    touch_wait(&x, &y, true);                    // held arrows page on, held DEL deletes
+    uint8_t id = ui_hit(LIB, x, y);
+
+    if (id < LIB_ROWS) {
+      if (top + id < hi) return lib_at(top + id);
+    } else if (id == LIB_UP) {
+      redraw = top > lo;
+      top = top >= lo + LIB_ROWS ? top - LIB_ROWS : lo;
+    } else if (id == LIB_DN) {
+      redraw = top + LIB_ROWS < hi;
+      if (redraw) top += LIB_ROWS;
+    } else if (id == LIB_DEL) {
+      if (len == 0) continue;
+      find[--len] = 0;
+      lo = 0;                                    // widening - search again from the whole library
+      hi = lib_count();
+      if (len) lib_narrow(find, &lo, &hi);
+      top = lo;
+      redraw = true;
+    } else if (id == LIB_BACK) {
+      return NULL;
+    } else if (id != W_NONE && len < LIB_FILM_LEN) {
+      find[len++] = LIB_KEY_LBL[2 * (id - LIB_KEY0)];
+      find[len] = 0;
+      lib_narrow(find, &lo, &hi);                // only within the current matches
+      top = lo;
+      redraw = true;
     }
   }
+}
 
-  startTime = millis();
-  endTime   = startTime + prog_data[sel_p][1] * 1000;
-  agitTime  = startTime + prog_data[sel_p][3] * 1000;
-  curr_time = startTime;
-
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_LIGHTGREY,TFT_WHITE);
-  tft.setTextSize(2);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_LIGHTGREY);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("START", tft.width() / 2, 225);
-
-  delay(1000);
-
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.drawString("Initial", tft.width() / 2, 210);
-  tft.drawString("agitation", tft.width() / 2, 240);
-
-  click = 0;
-  while(click == 0){
+//=================================DEVELOP FUNCTIONS=================================
 
-    uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      if (tick){
-        tft_upd();
-        tick = 0;
-      }
-    }
+//---------------------------------Agitation---------------------------------
+// Hands the stage's pattern to the motor task, agit_done() runs when it reports back.
+// due is the millis() it was due at.
+void irig(int ir_cnt, uint32_t due){
+  TRACE_SCOPE(TR_IRIG);
+  motor_cmd cmd = {MOTOR_AGITATE, (uint8_t)ir_cnt, tl_proc.b[stage].pattern, 0, 0};
+  agitating = 1;
+  motor_send(cmd);
+  int32_t late = millis() - due;
+  proto_event(PE_AGIT, stage, ir_cnt, cmd.pattern);
+  journal_add(PE_AGIT, stage, ir_cnt, late);
+  hist_add(H_AGIT_LATE, late);
+  status_pending = SL_AGIT;
+}
 
-    if ((x > 130) && (x < 350)) {
-      if ((y > 150) && (y < 300)) {
-        click = 1;
-        delay(15);
-      }
-    }
+void agit_done(const motor_evt &e){
+  TRACE_SCOPE(TR_AGIT_DONE);
+  power_event();
+  agitating = 0;
+  proto_event(PE_AGIT_DONE, stage, 0, e.t_end - e.t_start);
+  journal_add(PE_AGIT_DONE, stage, 0, e.t_end - e.t_start);
+  hist_add(H_AGIT_TIME, e.t_end - e.t_start);
+  digitalWrite(VIBE_PIN, HIGH);
+  vibro = 6;
+  status_pending = SL_WAIT;
+
+  if (run_state == ST_RINSE_AGIT) {
+    stage_enter(stage + 1);
+  } else if (end_pending) {
+    // cursor is parked on TL_END, the rest of the stage shifts by the delay
+    end_pending = 0;
+    tl_base = millis() - tl[tl_pos].t;
+    tl_fire();
+  } else if (agit_pending) {
+    uint8_t n = agit_pending;
+    agit_pending = 0;
+    irig(n, agit_due);
   }
+}
 
-  irig(prog_data[sel_p][0]);
-
-
-  bool drain = 1;
-  while(millis() < endTime){
-  
-    if (millis() > agitTime){
-      irig(prog_data[sel_p][2]);
-      agitTime  = agitTime + prog_data[sel_p][3] * 1000;
-    }
-  
-    if (millis() > endTime - 10000 && drain){
-      digitalWrite(18, HIGH);
-      tft.fillRect(0,145,480,160,TFT_BLACK);
-      tft.setTextSize(2);
-      tft.setTextColor(TFT_RED, TFT_BLACK);
-      tft.setTextDatum(MC_DATUM);
-      tft.drawString("DRAIN OFF", tft.width() / 2, 225);
-      drain = 0;
-    }
+//---------------------------------Continuous rotation---------------------------------
+// Runs on its own until the stage time is up, loop() only logs the reversals.
+void spin(){
+  const bath &b = tl_proc.b[stage];
+  uint32_t left = tl_base + tl_st[stage].len - millis();
+  motor_cmd cmd = {MOTOR_SPIN, 0, 0, b.every, micros() + left * 1000};
+  spinning     = 1;
+  spin_revs    = 0;
+  spin_err_max = 0;
+  motor_send(cmd);
+  proto_event(PE_SPIN, stage, b.every);
+  journal_add(PE_SPIN, stage, b.every);
+  status_pending = SL_SPIN;
+}
 
-    if (tick){
-      tft_upd();
-      tick = 0;
-    }
+void spin_evt(const motor_evt &e){
+  uint32_t err = e.err_us < 0 ? -e.err_us : e.err_us;
+  if (e.op == MOTOR_REVERSE) {
+    spin_revs++;
+    spin_err_max = max(spin_err_max, err);
+    proto_event(PE_REVERSE, stage, spin_revs, e.err_us);
+    log_fmt("Reversal %u at %lu ms: %+ld us\n", spin_revs, (unsigned long)(e.t_end - tl_base), (long)e.err_us);
+    return;
   }
-  digitalWrite(18, LOW);
-  tft.fillRect(0,145,480,160,TFT_BLACK);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_YELLOW, TFT_BLACK);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("DEVELOPMENT DONE", tft.width() / 2, 225);
-  delay(5000);
-
+  spinning = 0;
+  proto_event(PE_SPIN_DONE, stage, spin_revs, e.err_us);
+  journal_add(PE_SPIN_DONE, stage, spin_revs, e.err_us);
+  log_fmt("%s: rotation %u reversals, max error %lu us, stopped %+ld us from stage end\n", tl_proc.b[stage].name,
+          spin_revs, (unsigned long)spin_err_max, (long)e.err_us);
 }
 
-//---------------------------------Stop bath---------------------------------
-void stop_stage(){
-  tft.fillScreen(TFT_BLACK);
+//---------------------------------Run screen update---------------------------------
+// Sprites go to PSRAM - TFT_eSprite only uses PSRAM while DMA is not enabled
+// yet, so they are created before initDMA(). DMA can't read PSRAM, pushes are
+// copied through dma_buf.
+void run_spr_init(){
+#if RUN_SPRITES
+  atlas_build(&clk, &clk_spr, FF6, 1, TFT_GOLD, TFT_BLACK, CLK_H);
+  mark_spr.setColorDepth(16);
+  mark_spr.createSprite(MARK_W, BAR_H);
+  clk_buf = (uint16_t *)heap_caps_malloc(DIGIT_SLOTS * clk.cw * clk.h * 2, MALLOC_CAP_DMA);
+  dma_buf = (uint16_t *)heap_caps_malloc(MARK_W * BAR_H * 2, MALLOC_CAP_DMA);
+  tft.initDMA();
+#endif
+#ifdef CLOCK_BENCH
+  clock_bench();
+#endif
+}
 
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_DARKGREEN, TFT_BLACK);
-  tft.setTextDatum(ML_DATUM);
-  tft.setTextSize(1);
-  tft.drawString("STOP BATH", 20, 20);
+//---------------------------------Countdown clock---------------------------------
+// Only the digits that changed are pushed. Call inside startWrite()/endWrite().
+void clock_draw(uint32_t sec){
+  TRACE_SCOPE(TR_CLOCK);
+  char txt[12];
+  snprintf(txt, sizeof(txt), "%u:%02u", (unsigned)(sec / 60), (unsigned)(sec % 60));
+#if RUN_SPRITES
+  tft.dmaWait();                                 // clk_buf may still be on its way out
+  frm_bytes += atlas_draw(&clk, &tft, txt, CLK_X + CLK_W - 5, 0, clk_buf);
+#else
+  tft.setTextColor(TFT_GOLD, TFT_BLACK);
   tft.setTextDatum(MR_DATUM);
   tft.setFreeFont(FF6);
   tft.setTextSize(1);
-  int m = prog_data[sel_p][5] / 60;
-  int s = prog_data[sel_p][5] % 60;
-  if (s < 10) tft.drawString(String(m) + ":0" + String(s), 475, 20);
-  else tft.drawString(String(m) + ":" + String(s), 475, 20);
-  tft.drawLine(0,47,480,47,TFT_WHITE);
-  tft.drawRect(29,69,422,22,TFT_WHITE);
-  scale = 42000/(prog_data[sel_p][5]);
-  uint16_t t = prog_data[sel_p][7] + 1;
-  do {
-    tft.fillRect(30 + (t*scale/100),70,(prog_data[sel_p][6] * 2.5 * scale/100),20,TFT_YELLOW);
-    t=t+prog_data[sel_p][7];
-  } while(t < prog_data[sel_p][5]);
-  tft.fillRect(30,70,((prog_data[sel_p][7] - prog_data[sel_p][4] *2.5) * scale/100),20,TFT_GREEN);
-  tft.fillTriangle(29,93,34,100,24,100,TFT_CYAN);
-
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
-
-  tft.setTextSize(2);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("START", tft.width() / 2, 225);
-
-  bool click = 0;
-  while(click == 0){
+  tft.fillRect(CLK_X,0,CLK_W,CLK_H,TFT_BLACK);
+  int16_t w = tft.drawString(txt, CLK_X + CLK_W - 5, CLK_H / 2);
+  frm_bytes += (CLK_W * CLK_H + w * tft.fontHeight()) * 2;
+#endif
+}
 
-    uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      delay(5);
-    }
+#ifdef CLOCK_BENCH
+//---------------------------------Clock benchmark---------------------------------
+// Counts down 7:30 -> 5:30 both ways, -D CLOCK_BENCH to run it at boot
+void clock_bench(){
+  const uint16_t n = 120;
+  uint32_t t0 = micros();
+  for (uint16_t i = 0; i < n; i++) {
+    uint32_t sec = 450 - i;
+    tft.setTextColor(TFT_GOLD, TFT_BLACK);
+    tft.setTextDatum(MR_DATUM);
+    tft.setFreeFont(FF6);
+    tft.setTextSize(1);
+    tft.fillRect(CLK_X,0,CLK_W,CLK_H,TFT_BLACK);
+    if (sec % 60 < 10) tft.drawString(String(sec / 60) + ":0" + String(sec % 60), CLK_X + CLK_W - 5, CLK_H / 2);
+    else tft.drawString(String(sec / 60) + ":" + String(sec % 60), CLK_X + CLK_W - 5, CLK_H / 2);
+  }
+  uint32_t t_font = micros() - t0;
+
+#if RUN_SPRITES
+  atlas_reset(&clk);
+  t0 = micros();
+  tft.startWrite();
+  for (uint16_t i = 0; i < n; i++) clock_draw(450 - i);
+  tft.endWrite();
+  uint32_t t_atlas = micros() - t0;
+#else
+  uint32_t t_atlas = 0;
+#endif
+
+  Serial.printf("Clock update: font %lu us, atlas %lu us\n", (unsigned long)(t_font / n), (unsigned long)(t_atlas / n));
+  tft.fillRect(CLK_X,0,CLK_W,CLK_H,TFT_BLACK);
+}
+#endif
 
-    if ((x > 130) && (x < 350)) {
-      if ((y > 150) && (y < 300)) {
-        click = 1;
-        delay(15);
-      }
+void tft_upd(){
+  TRACE_SCOPE(TR_TFT_UPD);
+  uint32_t t0 = micros();
+  curr_time = millis();
+  uint32_t left = (int32_t)(endTime - curr_time) > 0 ? endTime - curr_time : 0;
+  uint32_t el = min(curr_time - startTime, tl_st[stage].len);
+  int16_t mx = 30 + (uint64_t)el * 420 / tl_st[stage].len;   // marker tip
+
+#if RUN_SPRITES
+  tft.startWrite();
+
+  clock_draw(left / 1000);
+
+  // marker window, also covers the old marker if it is still inside
+  int16_t wx = constrain(mx - MARK_W / 2, BAR_X, BAR_X + BAR_W - MARK_W);
+  if (wx != mark_x) {
+    if (mark_x >= 0 && (mark_x + MARK_W <= wx || wx + MARK_W <= mark_x)) {
+      mark_spr.fillSprite(TFT_BLACK);
+      tft.pushImageDMA(mark_x, BAR_Y, MARK_W, BAR_H, (uint16_t *)mark_spr.getPointer(), dma_buf);
+      frm_bytes += MARK_W * BAR_H * 2;
+      tft.dmaWait();                             // dma_buf is reused below
     }
+    mark_spr.fillSprite(TFT_BLACK);
+    mark_spr.fillTriangle(mx - wx, 1, mx - wx + 5, 8, mx - wx - 5, 8, TFT_CYAN);
+    tft.pushImageDMA(wx, BAR_Y, MARK_W, BAR_H, (uint16_t *)mark_spr.getPointer(), dma_buf);
+    frm_bytes += MARK_W * BAR_H * 2;
+    mark_x = wx;
   }
 
-  startTime = millis();
-  endTime   = startTime + prog_data[sel_p][5] * 1000;
-  agitTime  = startTime + prog_data[sel_p][7] * 1000;
-  long curr_time = startTime;
+  tft.endWrite();                                // waits for the last DMA
+#else
+  clock_draw(left / 1000);
+  tft.fillRect(20,92,440,9,TFT_BLACK);
+  tft.fillTriangle(mx,93,mx+5,100,mx-5,100,TFT_CYAN);
+  // cleared strip and triangle
+  frm_bytes += (BAR_W * BAR_H + 11 * 8 / 2) * 2;
+#endif
+
+  uint32_t us = micros() - t0;
+  frm_us += us;
+  frm_cnt++;
+  hist_add(H_FRAME, us);
+}
 
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_LIGHTGREY,TFT_WHITE);
-  tft.setTextSize(2);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_LIGHTGREY);
+//---------------------------------Status line---------------------------------
+// Event handlers only set status_pending, loop() draws it once everything due
+// has fired - clearing the area alone keeps the SPI bus ~30ms
+void status_draw(){
+  if (status_pending == SL_NONE) return;
+  tft.fillRect(0,145,480,160,TFT_BLACK);
   tft.setTextDatum(MC_DATUM);
-  tft.drawString("START", tft.width() / 2, 225);
-
-  delay(1000);
-
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.drawString("Initial", tft.width() / 2, 210);
-  tft.drawString("agitation", tft.width() / 2, 240);
+  switch (status_pending) {
+    case SL_AGIT:
+    case SL_SPIN:
+      tft.setTextSize(1);
+      tft.setTextColor(TFT_GREEN, TFT_GREEN);
+      tft.drawString(status_pending == SL_AGIT ? "Agitation" : "Rotation", tft.width() / 2, 225);
+      break;
+
+    case SL_WAIT:
+      tft.setTextSize(2);
+      tft.setTextColor(TFT_GREEN, TFT_GREEN);
+      tft.drawString("WAIT", tft.width() / 2, 225);
+      break;
 
-  click = 0;
-  while(click == 0){
+    case SL_DRAIN:
+      tft.setTextSize(2);
+      tft.setTextColor(TFT_RED, TFT_BLACK);
+      tft.drawString("DRAIN OFF", tft.width() / 2, 225);
+      break;
 
-    uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      if (tick){
-        tft_upd();
-        tick = 0;
-      }
-    }
+    case SL_DONE:
+      tft.setTextSize(1);
+      tft.setTextColor(TFT_YELLOW, TFT_BLACK);
+      tft.drawString(ui_fmt("%s DONE", tl_proc.b[stage].name), tft.width() / 2, 225);
+      break;
+  }
+  status_pending = SL_NONE;
+}
 
-    if ((x > 130) && (x < 350)) {
-      if ((y > 150) && (y < 300)) {
-        click = 1;
-        delay(15);
-      }
-    }
+//---------------------------------Start button---------------------------------
+void start_btn(uint16_t color, const char *l1, const char *l2){
+  widget b = RUN_UI[RUN_START];
+  b.bg = color;
+  ui_draw(tft, b);
+  tft.setFreeFont(b.font);
+  tft.setTextColor(b.fg, color);
+  tft.setTextDatum(b.datum);
+  if (l2 == NULL) {
+    tft.setTextSize(2);
+    tft.drawString(l1, b.ax, b.ay);
+  } else {
+    tft.setTextSize(1);
+    tft.drawString(l1, b.ax, b.ay - 15);
+    tft.drawString(l2, b.ax, b.ay + 15);
   }
+}
 
-  irig(prog_data[sel_p][4]);
+//---------------------------------Progress bar---------------------------------
+// Box for [t, t+d) ms of the current stage, 420px wide bar
+void bar_box(uint32_t t, uint32_t d, uint16_t color){
+  uint32_t len = tl_st[stage].len;
+  int16_t x0 = 30 + (uint64_t)t * 420 / len;
+  int16_t x1 = 30 + (uint64_t)min(t + d, len) * 420 / len;
+  tft.fillRect(x0,70,max(x1 - x0, 1),20,color);
+}
 
-  while(millis() < endTime){
-  
-    if (millis() > agitTime){
-      irig(prog_data[sel_p][6]);
-      agitTime  = agitTime + prog_data[sel_p][7] * 1000;
-    }
-  
-    if (tick){
-      tft_upd();
-      tick = 0;
-    }
+//---------------------------------Stage screen---------------------------------
+void stage_enter(uint8_t st){
+  stage = st;
+  status_pending = SL_NONE;                      // the old stage's, the screen is cleared below
+  power_event();
+  proto_lock(stage < tl_proc.n);                 // no flash writes from the host until the end
+  tl_skip_ms = 0;
+  if (stage >= tl_proc.n) {
+    run_state = ST_FINISHED;
+    session   = 0;
+    resume_clear();
+    proto_event(PE_FINISHED, stage);
+    journal_add(PE_FINISHED, stage);
+    journal_sync();
+    heap_mark_report();
+    power_session_report();
+    resume_report();
+    journal_report();
+    hist_dump();
+    run_aborted = 0;
+    end_screen();
+    return;
   }
 
-  tft.fillRect(0,145,480,160,TFT_BLACK);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_YELLOW, TFT_BLACK);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("STOP BATH DONE", tft.width() / 2, 225);
-  digitalWrite(18, HIGH);
-  delay(5000);
-  digitalWrite(18, LOW);
+  const bath &sd = tl_proc.b[stage];
+  const tl_stage &ts = tl_st[stage];
+  tl_pos = ts.first;
 
-}
-
-//---------------------------------Fix---------------------------------
-void fix_stage(){
   tft.fillScreen(TFT_BLACK);
 
   tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_RED, TFT_BLACK);
+  tft.setTextColor(sd.color, TFT_BLACK);
   tft.setTextDatum(ML_DATUM);
   tft.setTextSize(1);
-  tft.drawString("FIXING", 20, 20);
-  tft.setTextDatum(MR_DATUM);
-  tft.setFreeFont(FF6);
-  tft.setTextSize(1);
-  int m = prog_data[sel_p][9] / 60;
-  int s = prog_data[sel_p][9] % 60;
-  if (s < 10) tft.drawString(String(m) + ":0" + String(s), 475, 20);
-  else tft.drawString(String(m) + ":" + String(s), 475, 20);
+  tft.drawString(sd.name, 20, 20);
+  proto_event(PE_STAGE, stage, ts.len / 1000);
+  journal_add(PE_STAGE, stage, ts.len / 1000);
+  if (sd.flags & PB_TOUCH) {                     // agitation on START, no clock
+    tft.drawLine(0,47,480,47,TFT_WHITE);
+    start_btn(TFT_GREEN, "START", NULL);
+    run_state = ST_RINSE;
+    ckpt(true);
+    return;
+  }
+#if RUN_SPRITES
+  atlas_reset(&clk);
+#endif
+  tft.startWrite();
+  clock_draw(ts.len / 1000);
+  tft.endWrite();
   tft.drawLine(0,47,480,47,TFT_WHITE);
   tft.drawRect(29,69,422,22,TFT_WHITE);
-  scale = 42000/(prog_data[sel_p][9]);
-  tft.fillRect(450-(0.1*scale),70,(0.1*scale),20,TFT_RED);
-  uint16_t t = prog_data[sel_p][11] + 1;
-  do {
-    tft.fillRect(30 + (t*scale/100),70,(prog_data[sel_p][10] * 2.5 * scale/100),20,TFT_YELLOW);
-    t=t+prog_data[sel_p][11];
-  } while(t < prog_data[sel_p][9]);
-  tft.fillRect(30,70,((prog_data[sel_p][11] - prog_data[sel_p][8] *2.5) * scale/100),20,TFT_GREEN);
+  for (uint16_t i = ts.first; i < ts.first + ts.count; i++) {
+    const tl_ev &e = tl[i];
+    if (e.type == TL_AGIT_INIT && (sd.flags & PB_SPIN)) bar_box(e.t, ts.len, TFT_GREEN);
+    else if (e.type == TL_AGIT_INIT) bar_box(e.t, tl_agit_ms(e.stage, e.arg), TFT_GREEN);
+    if (e.type == TL_AGIT)      bar_box(e.t, tl_agit_ms(e.stage, e.arg), TFT_YELLOW);
+    if (e.type == TL_DRAIN)     bar_box(e.t, ts.len - e.t, TFT_RED);
+  }
   tft.fillTriangle(29,93,34,100,24,100,TFT_CYAN);
 
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
+  start_btn(TFT_GREEN, "START", NULL);
+
+  sched_late_max = 0;
+  tick_stats_reset();
+  rebuilt0       = tick_rebuilt;
+  touch_stats_reset();
+  power_stats_reset();
+  frm_cnt        = 0;
+  frm_us         = 0;
+  frm_bytes      = 0;
+  mark_x         = -1;
+  end_pending    = 0;
+  agit_pending   = 0;
+  run_state      = ST_READY;
+  ckpt(true);
+}
 
-  tft.setTextSize(2);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("START", tft.width() / 2, 225);
+//---------------------------------Stage end---------------------------------
+void stage_done(){
+  const bath &sd = tl_proc.b[stage];
+  int32_t late = millis() - endTime;
+  proto_event(PE_STAGE_DONE, stage);
+  journal_add(PE_STAGE_DONE, stage, 0, late);
+  hist_add(H_STAGE_END, late);
+  journal_sync();
+  run_state      = ST_DONE;
+  status_pending = SL_DONE;
+
+  log_fmt("%s: max event latency %lu ms\n", sd.name, (unsigned long)sched_late_max);
+  if (tick_late_n > 0) {
+    log_fmt("%s: %lu ticks, late max %lu us, mean %lu ms, %lu rebuilt after overrun\n", sd.name, (unsigned long)tick_late_n,
+            (unsigned long)tick_late_max, (unsigned long)(tick_late_sum / tick_late_n), (unsigned long)(tick_rebuilt - rebuilt0));
+  }
+  touch_report(sd.name);
+  power_report(sd.name);
+  if (frm_cnt > 0) {
+    log_fmt("%s: %lu frames, %lu us/frame, %lu bytes/frame\n", sd.name, (unsigned long)frm_cnt,
+            (unsigned long)(frm_us / frm_cnt), (unsigned long)(frm_bytes / frm_cnt));
+  }
 
-  bool click = 0;
-  while(click == 0){
+}
 
-    uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      delay(5);
-    }
+//---------------------------------Timeline cursor---------------------------------
+void tl_sched(){
+  const tl_stage &ts = tl_st[stage];
+  if (tl_pos < ts.first + ts.count) sched_at(tl_base + tl[tl_pos].t, EV_TL);
+}
 
-    if ((x > 130) && (x < 350)) {
-      if ((y > 150) && (y < 300)) {
-        click = 1;
-        delay(15);
+void tl_fire(){
+  TRACE_SCOPE(TR_TL_FIRE);
+  power_event();
+  const tl_ev &e = tl[tl_pos];
+
+  switch (e.type) {
+    case TL_AGIT:
+      if (e.t < tl_skip_ms) break;               // came due while the timer was down
+      if (agitating) {
+        agit_pending = e.arg;
+        agit_due     = tl_base + e.t;
       }
-    }
-  }
+      else irig(e.arg, tl_base + e.t);
+      break;
 
-  startTime = millis();
-  endTime   = startTime + prog_data[sel_p][9] * 1000;
-  agitTime  = startTime + prog_data[sel_p][11] * 1000;
-  long curr_time = startTime;
+    case TL_DRAIN:
+      status_pending = SL_DRAIN;
+      break;
 
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_LIGHTGREY,TFT_WHITE);
-  tft.setTextSize(2);
-  tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_BLACK, TFT_LIGHTGREY);
-  tft.setTextDatum(MC_DATUM);
-  tft.drawString("START", tft.width() / 2, 225);
+    case TL_END:
+      if (agitating) {
+        end_pending = 1;                         // agit_done() fires it again
+        return;
+      }
+      stage_done();
+      break;
 
-  delay(1000);
+    case TL_BUZZ_ON:
+      digitalWrite(18, HIGH);
+      break;
 
-  tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_BLACK, TFT_GREEN);
-  tft.drawString("Initial", tft.width() / 2, 210);
-  tft.drawString("agitation", tft.width() / 2, 240);
+    case TL_BUZZ_OFF:
+      digitalWrite(18, LOW);
+      break;
 
-  click = 0;
-  while(click == 0){
+    case TL_NEXT:
+      stage_enter(stage + 1);
+      return;
+  }
 
-    uint16_t x, y;
-    while(!tft.getTouch(&x, &y)){
-      if (tick){
-        tft_upd();
-        tick = 0;
+  tl_pos++;
+  tl_sched();
+  ckpt(e.type == TL_END);                        // a power cut after it goes on with the next stage
+}
+
+//---------------------------------Touch on run screens---------------------------------
+void stage_touch(uint16_t x, uint16_t y){
+  if (run_state == ST_FINISHED) {
+    if (!diag_on && ui_hit(FIN, x, y) == FIN_DIAG) diag_screen();
+    else if (diag_on && ui_hit(DIAG, x, y) == DIAG_BACK) end_screen();
+    return;
+  }
+  journal_add(JE_TOUCH, stage, x, y);
+  if (ui_hit(RUN, x, y) == RUN_START) stage_start();
+}
+
+// START button, from the screen or the host. False if it does nothing now.
+bool stage_start(){
+  switch (run_state) {
+    case ST_READY:
+      if (stage == 0) {
+        heap_mark_start();
+        power_session_reset();
+        hist_reset();
+        session = 1;
       }
+      startTime = millis();
+      endTime   = startTime + tl_st[stage].len;
+      curr_time = startTime;
+      tl_base   = startTime;
+      start_btn(TFT_LIGHTGREY, "START", NULL);
+      run_state = ST_ARMED;
+      sched_at(startTime + 1000, EV_UNLOCK);
+      proto_event(PE_START, stage);
+      journal_add(PE_START, stage);
+      ckpt(true);
+      break;
+
+    case ST_INITIAL:
+      // cursor is on the stage's TL_AGIT_INIT
+      run_state = ST_RUN;
+      if (tl_proc.b[stage].flags & PB_SPIN) {
+        tl_pos++;
+        spin();
+      } else irig(tl[tl_pos++].arg, millis());
+      tl_sched();
+      ckpt(false);
+      break;
+
+    case ST_RINSE:
+      run_state = ST_RINSE_AGIT;
+      irig(tl[tl_pos++].arg, millis());
+      ckpt(false);
+      break;
+
+    default:
+      return false;
+  }
+  return true;
+}
+
+//---------------------------------Event dispatch---------------------------------
+void stage_event(const sched_ev &ev){
+  switch (ev.id) {
+    case EV_UNLOCK:
+      start_btn(TFT_GREEN, "Initial", "agitation");
+      run_state = ST_INITIAL;
+      ckpt(false);
+      break;
+
+    case EV_TL:
+      tl_fire();
+      break;
+  }
+}
+
+//---------------------------------Serial commands---------------------------------
+// Host frames and single characters, read every pass
+void serial_poll(){
+  proto_cmd c;
+  while (proto_poll(&c)) {
+    if (c.op != PC_CHAR) {
+      host_cmd(c);
+      continue;
+    }
+    switch (c.arg) {
+#ifdef HOT_TRACE
+      case 't': trace_dump(); break;             // trace ring as Chrome JSON
+      case 'c': trace_clear(); break;
+#endif
+      case 'j': journal_dump(); break;           // session journal as CSV
+      case 'h': hist_dump(); break;              // timing histograms
+      default: break;
     }
+  }
+}
 
-    if ((x > 130) && (x < 350)) {
-      if ((y > 150) && (y < 300)) {
-        click = 1;
-        delay(15);
+//---------------------------------Host control---------------------------------
+// Run control frames, acknowledged with a PS_* status
+void host_cmd(const proto_cmd &c){
+  uint8_t st  = PS_OK;
+  uint8_t err = TL_OK;
+  bool    idle = selecting || run_state == ST_FINISHED || (run_state == ST_READY && stage == 0);
+
+  switch (c.op) {
+    case PC_LOAD: {
+      if (!idle || motor_busy()) { st = PS_BUSY; break; }
+      if (c.arg >= PROG_N + proc_builtin_n) { st = PS_RANGE; break; }
+      process proc;
+      if (c.arg >= PROG_N) proc = *proc_builtin[c.arg - PROG_N];
+      else proc_from_prog(prog_get(c.arg), &proc);
+      prog_flush();
+      err = tl_load(&proc);
+      if (err != TL_OK) { st = PS_INVALID; break; }
+      sel_p = c.arg;
+      if (c.arg >= PROG_N) memset(run_pd, 0, sizeof(run_pd));
+      else memcpy(run_pd, prog_get(c.arg), sizeof(run_pd));
+      if (selecting) selecting = 0;              // sel_prog() returns, setup() enters the first stage
+      else {
+        journal_session(sel_p, tl_proc.n);
+        stage_enter(0);
       }
+      break;
     }
-  }
 
-  irig(prog_data[sel_p][8]);
+    case PC_START:
+      if (selecting || !stage_start()) st = PS_STATE;
+      break;
 
+    case PC_ABORT:
+      if (selecting || run_state == ST_FINISHED) st = PS_STATE;
+      else run_abort();
+      break;
+  }
+  proto_ack(c, st, err);
+}
 
-  bool drain = 1;
-  while(millis() < endTime){
-  
-    if (millis() > agitTime){
-      irig(prog_data[sel_p][10]);
-      agitTime  = agitTime + prog_data[sel_p][11] * 1000;
-    }
-  
-    if (millis() > endTime - 10000 && drain){
-      tft.fillRect(0,145,480,160,TFT_BLACK);
-      tft.setTextSize(2);
-      tft.setTextColor(TFT_RED, TFT_BLACK);
-      tft.setTextDatum(MC_DATUM);
-      tft.drawString("DRAIN OFF", tft.width() / 2, 225);
-      drain = 0;
-    }
+// Everything stops where it is, the tank may be left turned
+void run_abort(){
+  sched_clear();
+  motor_stop();
+  digitalWrite(18, LOW);                         // buzzer
+  digitalWrite(VIBE_PIN, LOW);
+  vibro          = 0;
+  agitating      = 0;
+  spinning       = 0;
+  agit_pending   = 0;
+  end_pending    = 0;
+  status_pending = SL_NONE;
+  run_state      = ST_FINISHED;
+  session        = 0;
+  resume_clear();
+  proto_lock(false);
+  proto_event(PE_ABORTED, stage);
+  journal_add(PE_ABORTED, stage);
+  journal_sync();
+  journal_report();
+  power_event();
+  log_fmt("%s: aborted by the host\n", stage < tl_proc.n ? tl_proc.b[stage].name : "Run");
+  hist_dump();
+  run_aborted = 1;
+  end_screen();
+}
 
-    if (tick){
-      tft_upd();
-      tick = 0;
+//---------------------------------Telemetry---------------------------------
+// Every tick, the host gets nothing until it sent PT_HELLO
+void host_tlm(){
+  static uint32_t last;
+  if (selecting) {                               // no ticks popped on the select screen
+    if (millis() - last < TICK_US / 1000) return;
+    last = millis();
+  }
+  proto_tlm t = {};
+  t.state  = selecting ? PROTO_SELECT : run_state;
+  t.stage  = stage;
+  t.stages = tl_proc.n;
+  t.motor  = spinning ? 2 : agitating;
+  if (!selecting && stage < tl_proc.n) {
+    t.stage_ms = tl_st[stage].len;
+    if (run_state == ST_READY) t.left_ms = t.stage_ms;
+    if (run_state == ST_ARMED || run_state == ST_INITIAL || run_state == ST_RUN) {
+      t.left_ms = (int32_t)(endTime - millis()) > 0 ? endTime - millis() : 0;
     }
   }
+  t.loop_us = loop_max;
+  t.late_us = late_max;
+  loop_max  = 0;
+  late_max  = 0;
+  proto_tlm_send(t);
+}
 
-  tft.fillRect(0,145,480,160,TFT_BLACK);
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_YELLOW, TFT_BLACK);
+//---------------------------------Run end---------------------------------
+// DONE or ABORTED, DIAG shows the run's timing histograms and BACK comes back here
+void end_screen(){
+  diag_on = 0;
+  tft.fillScreen(TFT_BLACK);
+  tft.setFreeFont(FF32);
   tft.setTextDatum(MC_DATUM);
-  tft.drawString("FIXING DONE", tft.width() / 2, 225);
-  digitalWrite(18, HIGH);
-  delay(5000);
-  digitalWrite(18, LOW);
+  if (run_aborted) {
+    tft.setTextColor(TFT_RED, TFT_BLACK);
+    tft.setTextSize(1);
+    tft.drawString("ABORTED", tft.width() / 2, tft.height() / 2);
+  } else {
+    tft.setTextColor(TFT_GREEN, TFT_BLACK);
+    tft.setTextSize(2);
+    tft.drawString("DONE", tft.width() / 2, tft.height() / 2);
+  }
+  ui_draw(tft, FIN);
+}
 
+// One histogram, bars scaled to its fullest bucket, every other bucket labelled
+void diag_panel(uint8_t id, int16_t x, int16_t y){
+  const hist &h = hist_get(id);
+  const int16_t bw = (DIAG_PW - 12) / HIST_N;
+  const int16_t bh = DIAG_PH - 40;
+  const int16_t base = y + 24 + bh;
+  uint32_t top = 1;
+  for (uint8_t b = 0; b < HIST_N; b++) top = max(top, h.n[b]);
+
+  tft.setTextDatum(TL_DATUM);
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.drawString(ui_fmt("%s [%s]", hist_name(id), hist_unit(id)), x + 6, y + 2);
+  tft.setTextColor(TFT_LIGHTGREY, TFT_BLACK);
+  if (h.count) {
+    tft.drawString(ui_fmt("n %lu  %ld..%ld  mean %ld", (unsigned long)h.count, (long)h.min, (long)h.max,
+                          (long)(h.sum / h.count)), x + 6, y + 12);
+  } else tft.drawString("nothing yet", x + 6, y + 12);
+
+  tft.setTextDatum(TC_DATUM);
+  for (uint8_t b = 0; b < HIST_N; b++) {
+    int16_t bx = x + 6 + b * bw;
+    int16_t hb = h.n[b] ? max((int16_t)1, (int16_t)((uint64_t)h.n[b] * bh / top)) : 0;
+    if (hb) tft.fillRect(bx, base - hb, bw - 2, hb, TFT_CYAN);
+    if (b % 2 == 0) tft.drawString(hist_label(id, b), bx + bw / 2, base + 3);
+  }
+  tft.drawLine(x + 6, base, x + 5 + HIST_N * bw, base, TFT_WHITE);
 }
 
-//---------------------------------Rinse---------------------------------
-void rinse_stage(){
+void diag_screen(){
+  diag_on = 1;
   tft.fillScreen(TFT_BLACK);
+  tft.setTextSize(1);
   tft.setFreeFont(FF22);
-  tft.setTextColor(TFT_RED, TFT_BLACK);
+  tft.setTextColor(TFT_YELLOW, TFT_BLACK);
   tft.setTextDatum(ML_DATUM);
+  tft.drawString("Run timing", 15, 20);
+  tft.drawLine(0,40,480,40,TFT_WHITE);
+  ui_draw(tft, DIAG);
+  tft.setTextFont(1);
   tft.setTextSize(1);
-  tft.drawLine(0,47,480,47,TFT_WHITE);
+  for (uint8_t id = 0; id < H_COUNT; id++) diag_panel(id, id % 2 * DIAG_PW, DIAG_Y + id / 2 * DIAG_PH);
+}
 
-  for(uint8_t p = 1; p < 6; p++){
+//---------------------------------Checkpoint---------------------------------
+// Where the run is, RTC memory every time and the flash mirror at stage boundaries
+void ckpt(bool mirror){
+  if (!session) return;
+  resume_ck ck;
+  ck.prog       = sel_p;
+  ck.stage      = stage;
+  ck.state      = run_state;
+  ck.tl_pos     = tl_pos;
+  ck.elapsed_ms = millis() - tl_base;
+  ck.shift_ms   = tl_base - startTime;
+  memcpy(ck.pd, run_pd, sizeof(ck.pd));
+  resume_save(ck, mirror);
+}
 
-    if (prog_data[sel_p][11 + p] > 0) {
-      tft.drawString("RINSE " + String(p), 20, 20);
-      tft.fillSmoothRoundRect(130,150,220,150,10,TFT_GREEN,TFT_WHITE);
+//---------------------------------Resume after a reset---------------------------------
+// Offered before the select screen, RESUME by itself after RESUME_AUTO_MS.
+// True if the run goes on.
+bool resume_offer(){
+  resume_ck ck;
+  uint8_t src = resume_find(&ck);
+  if (src == RESUME_NONE) return false;
+
+  process proc;
+  bool ok = ck.prog < PROG_N + proc_builtin_n;
+  if (ok && ck.prog >= PROG_N) proc = *proc_builtin[ck.prog - PROG_N];
+  else if (ok) proc_from_prog(ck.pd, &proc);
+  ok = ok && tl_load(&proc) == TL_OK && ck.stage < tl_proc.n && ck.tl_pos >= tl_st[ck.stage].first &&
+       ck.tl_pos <= tl_st[ck.stage].first + tl_st[ck.stage].count;
+  if (!ok) {
+    Serial.println("Resume: checkpoint doesn't fit the programs, dropped");
+    resume_clear();
+    return false;
+  }
 
-      tft.setTextSize(2);
-      tft.setFreeFont(FF22);
-      tft.setTextColor(TFT_BLACK, TFT_GREEN);
-      tft.setTextDatum(MC_DATUM);
-      tft.drawString("START", tft.width() / 2, 225);
+  const char *name = tl_proc.b[ck.stage].name;
+  bool timed = ck.state == ST_ARMED || ck.state == ST_INITIAL || ck.state == ST_RUN || ck.state == ST_DONE;
+  bool exact = timed && src == RESUME_FROM_RTC;
 
-      bool click = 0;
-      while(click == 0){
+  tft.fillScreen(TFT_BLACK);
+  tft.setTextSize(1);
+  tft.setFreeFont(FF22);
+  tft.setTextColor(TFT_YELLOW, TFT_BLACK);
+  tft.setTextDatum(MC_DATUM);
+  tft.drawString("Run interrupted", tft.width() / 2, 15);
+  tft.drawLine(0,40,480,40,TFT_WHITE);
+  ui_draw(tft, RES);
+  tft.setTextFont(1);
+  tft.setTextSize(2);
+  tft.setTextDatum(TL_DATUM);
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  if (ck.prog >= PROG_N) tft.drawString(ui_fmt("Process: %s", tl_proc.name), 15, 60);
+  else tft.drawString(ui_fmt("Program: %u", ck.prog + 1), 15, 60);
+  if (exact) {
+    uint32_t el = ck.elapsed_ms + max(resume_off_ms(ck), (int32_t)0);
+    tft.drawString(ui_fmt("%s, %lu:%02lu into it", name, (unsigned long)(el / 60000), (unsigned long)(el / 1000 % 60)), 15, 100);
+  } else if (ck.state == ST_DONE) {
+    tft.drawString(ui_fmt("%s was done,", name), 15, 100);
+    tft.drawString(ck.stage + 1 < tl_proc.n ? "the next stage is up" : "the run has finished", 15, 125);
+  } else if (timed) {
+    tft.drawString(ui_fmt("%s was running,", name), 15, 100);
+    tft.drawString("power was cut - it starts over", 15, 125);
+  } else {
+    tft.drawString(ui_fmt("%s, waiting for START", name), 15, 100);
+  }
 
-        uint16_t x, y;
-        while(!tft.getTouch(&x, &y)){
-          delay(5);
-        }
-        if ((x > 130) && (x < 350)) {
-          if ((y > 150) && (y < 300)) {
-            click = 1;
-            delay(15);
-          }
-        }
-      }
-      irig(prog_data[sel_p][11 + p]);
+  uint32_t t0 = millis();
+  uint32_t shown = UINT32_MAX;
+  for (;;) {
+    uint32_t left = (RESUME_AUTO_MS - min(millis() - t0, (uint32_t)RESUME_AUTO_MS) + 999) / 1000;
+    if (left != shown) {
+      tft.setTextColor(TFT_LIGHTGREY, TFT_BLACK);
+      tft.drawString(ui_fmt("Resuming in %2lu s", (unsigned long)left), 15, 175);
+      shown = left;
+    }
+    uint16_t x, y;
+    if (left == 0) break;
+    if (!touch_wait(&x, &y, false, 1000 - (millis() - t0) % 1000)) continue;
+    uint8_t id = ui_hit(RES, x, y);
+    if (id == RES_GO) break;
+    if (id == RES_DROP) {
+      Serial.printf("Resume: %s discarded\n", name);
+      resume_clear();
+      tft.fillScreen(TFT_BLACK);
+      return false;
     }
   }
+  tft.fillScreen(TFT_BLACK);
+  resume_run(ck, exact);
+  return true;
 }
 
+// Stage screen as stage_enter() draws it, then the timer where it would be now.
+// Agitations that came due while it was down are skipped.
+void resume_run(const resume_ck &ck, bool exact){
+  sel_p = ck.prog;
+  memcpy(run_pd, ck.pd, sizeof(run_pd));
+  session = 1;
+  heap_mark_start();
+  power_session_reset();
+  hist_reset();
+  journal_add(JE_RESUME, ck.stage, exact ? RESUME_FROM_RTC : RESUME_FROM_FLASH, exact ? resume_off_ms(ck) : -1);
+  stage_enter(ck.stage + (!exact && ck.state == ST_DONE));   // its time was up
+  if (stage >= tl_proc.n) return;
+  const char *name = tl_proc.b[stage].name;
+  if (!exact) {
+    Serial.printf("Resume: %s from its start\n", name);
+    return;
+  }
 
-
+  int32_t  off = resume_off_ms(ck);
+  uint32_t el  = ck.elapsed_ms + (off >= 0 ? off : millis());   // unknown: at least this boot
+  const tl_stage &ts = tl_st[stage];
+  tl_base   = millis() - el;
+  startTime = tl_base - ck.shift_ms;
+  endTime   = startTime + ts.len;
+  curr_time = millis();
+  tl_pos    = ck.tl_pos;
+
+  uint16_t missed = 0;
+  switch (ck.state) {
+    case ST_ARMED:
+    case ST_INITIAL:
+      if (millis() - startTime < 1000) {
+        start_btn(TFT_LIGHTGREY, "START", NULL);
+        run_state = ST_ARMED;
+        sched_at(startTime + 1000, EV_UNLOCK);
+      } else {
+        start_btn(TFT_GREEN, "Initial", "agitation");
+        run_state = ST_INITIAL;
+      }
+      break;
+
+    case ST_RUN:
+    case ST_DONE:
+      for (uint16_t i = tl_pos; i < ts.first + ts.count && tl[i].t < el; i++) missed += tl[i].type == TL_AGIT;
+      tl_skip_ms     = el;
+      run_state      = ck.state;
+      status_pending = run_state == ST_DONE ? SL_DONE : SL_WAIT;
+      if (run_state == ST_RUN && (tl_proc.b[stage].flags & PB_SPIN) && el < ts.len) spin();
+      tl_sched();
+      break;
+  }
+  log_fmt("Resume: %s at %lu ms of %lu, timer was down %ld ms%s, %u agitation(s) missed\n", name,
+          (unsigned long)el, (unsigned long)ts.len, (long)(off >= 0 ? off : millis()), off >= 0 ? "" : " or more",
+          missed);
+  ckpt(false);
+}
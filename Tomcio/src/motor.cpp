@@ -0,0 +1,409 @@
+#include <atomic>
+#include "motor.h"
+#include "agit.h"
+#include "step_profile.h"
+#include "trace.h"
+#include "power.h"
+#if STEP_RMT
+  #include "driver/rmt.h"
+#endif
+
+DRV8825 stepper(MOTOR_STEPS, DIR, STEP, ENABLE, MODE0, MODE1, MODE2);
+
+enum { PH_IDLE, PH_STEP, PH_DWELL };
+
+static std::atomic<uint8_t> phase{PH_IDLE};      // motor task writes, motor_busy() reads from loop()
+static uint8_t  mode;                            // motor_cmd.op being run
+static agit_vm  vm;                              // pattern being run
+static bool     vibe;                            // vibration on until the dwell ends
+static uint32_t due;                             // micros() of next action
+static motor_evt cur;                            // event being built
+static volatile bool stop_req;                   // motor_stop(), ends the command at the next move
+
+static uint32_t spin_until;                      // MOTOR_SPIN stops at this micros()
+static uint32_t spin_every;                      // reversal period [us]
+static uint32_t spin_next;                       // micros() the current leg is due to end
+static int8_t   spin_dir;
+static long     spin_full;                       // shortest leg that reaches SPIN_RPM [steps]
+static uint32_t spin_full_us;                    // and its time
+static long     spin_pulse;                      // cruise step interval [us]
+
+#if STEP_RMT
+static rmt_item32_t move_items[MOVE_MAX_STEPS];  // pulse train of the current move
+static uint32_t     move_n;
+static uint8_t      move_rpm;                    // move_items was built for these
+static uint16_t     move_deg;
+static step_profile leg;                         // move or spin leg, streamed in move_items sized parts
+static step_iter    leg_it;                      // when it doesn't fit in one
+#endif
+
+#if MOTOR_TASK
+static QueueHandle_t cmd_q;
+static QueueHandle_t evt_q;
+static TaskHandle_t  motor_th;
+static uint32_t      cmd_sent, cmd_dropped;      // loop() side
+static std::atomic<uint32_t> cmd_started{0};     // motor task, once phase shows the command
+#else
+static motor_cmd cmd_slot;                       // single slot mailboxes
+static bool      cmd_full = 0;
+static motor_evt evt_slot;
+static bool      evt_full = 0;
+#endif
+
+#if STEP_RMT
+//---------------------------------RMT step generator---------------------------------
+// Items of the LINEAR_SPEED profile, see profile_items(). Rebuilt when a
+// move differs from the last one, patterns repeat a few moves. A move with
+// more items than move_items holds goes on in parts as a spin leg does and
+// is built again next time.
+static void rmt_build(uint8_t rpm, uint16_t deg){
+  profile_init(&leg, rpm, MOTOR_STEPS, MICROST, MOTOR_ACCEL, MOTOR_DECEL, (long)deg * MOTOR_STEPS * MICROST / 360);
+  profile_start(&leg, &leg_it);
+  move_n   = profile_items(&leg, &leg_it, move_items, MOVE_MAX_STEPS, STEP_HIGH_US);
+  move_rpm = rpm;
+  move_deg = leg_it.remaining > 0 ? 0 : deg;
+}
+
+// Next part of a spin leg or long move. The next part is only written once the RMT is
+// done with the last, so there is a gap of the task wakeup between them.
+static void rmt_leg_part(){
+  move_n   = profile_items(&leg, &leg_it, move_items, MOVE_MAX_STEPS, STEP_HIGH_US);
+  move_deg = 0;                                  // no longer an agitation move
+  rmt_write_items(STEP_RMT_CH, move_items, move_n, false);
+}
+
+static void rmt_begin(){
+  rmt_config_t cfg = RMT_DEFAULT_CONFIG_TX((gpio_num_t)STEP, STEP_RMT_CH);
+  cfg.clk_div       = 80;                        // 80MHz APB -> 1us
+  cfg.mem_block_num = 2;
+  rmt_config(&cfg);
+  rmt_driver_install(STEP_RMT_CH, 0, 0);
+  rmt_build(RPM, 90);
+  Serial.printf("RMT steps: %lu pulses per 90 deg\n", (unsigned long)move_n);
+}
+#endif
+
+static void finish_cmd();
+
+static void post(const motor_evt &e){
+#if MOTOR_TASK
+  // progress events are dropped rather than hold up the motor
+  xQueueSend(evt_q, &e, e.op == MOTOR_DONE ? portMAX_DELAY : 0);
+  power_wake();
+#else
+  if (evt_full && e.op != MOTOR_DONE) return;
+  evt_slot = e;
+  evt_full = 1;
+#endif
+}
+
+//---------------------------------Start a move---------------------------------
+static void start_move(uint8_t rpm, int16_t deg){
+  TRACE_BEGIN(TR_MOVE);
+#if STEP_RMT
+  uint16_t d = deg < 0 ? -deg : deg;
+  if (rpm != move_rpm || d != move_deg) rmt_build(rpm, d);
+  digitalWrite(DIR, deg > 0 ? HIGH : LOW);
+  rmt_write_items(STEP_RMT_CH, move_items, move_n, false);
+#else
+  stepper.setRPM(rpm);
+  stepper.startRotate(deg);
+#endif
+  phase = PH_STEP;
+}
+
+//---------------------------------Next action of the pattern---------------------------------
+// Returns micros until motor_step() is due again, 0 once the pattern ended
+static long run_next(){
+  agit_act a;
+  if (vibe) {
+    digitalWrite(VIBE_PIN, LOW);
+    vibe = 0;
+  }
+  if (stop_req || !agit_next(&vm, &a)) {
+    finish_cmd();
+    return 0;
+  }
+  switch (a.op) {
+    case AA_MOVE:
+      start_move(a.rpm, a.deg);
+      due = micros();
+      return 1;
+    case AA_VIBE:
+      digitalWrite(VIBE_PIN, HIGH);
+      vibe = 1;
+      // fall through
+    default:
+      phase = PH_DWELL;
+      due  += a.ms * 1000UL;                     // from when the last action ended
+      return a.ms * 1000L;
+  }
+}
+
+//---------------------------------Continuous rotation---------------------------------
+static long leg_time(long steps){
+  step_profile prof;
+  profile_init(&prof, SPIN_RPM, MOTOR_STEPS, MICROST, MOTOR_ACCEL, MOTOR_DECEL, steps);
+  return profile_time_us(&prof);
+}
+
+// Most steps a leg can make in us, it ends less than one step before
+static long leg_steps(uint32_t us){
+  long lo = 0, hi = spin_full;
+  if (us >= spin_full_us) {
+    // past the ramps every step is one cruise interval
+    lo = spin_full + (us - spin_full_us) / spin_pulse;
+    while (lo > 0 && (uint32_t)leg_time(lo) > us) lo--;
+    return lo;
+  }
+  while (lo < hi) {
+    long mid = (lo + hi + 1) / 2;
+    if ((uint32_t)leg_time(mid) <= us) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+static void spin_leg(){
+  int32_t left = spin_next - micros();
+  long steps = left > 0 ? leg_steps(left) : 0;
+  due = spin_next;
+  if (steps == 0) {                              // too short to move, wait it out
+    phase = PH_DWELL;
+    return;
+  }
+  TRACE_BEGIN(TR_MOVE);
+#if STEP_RMT
+  profile_init(&leg, SPIN_RPM, MOTOR_STEPS, MICROST, MOTOR_ACCEL, MOTOR_DECEL, steps);
+  profile_start(&leg, &leg_it);
+  digitalWrite(DIR, spin_dir > 0 ? HIGH : LOW);
+  rmt_leg_part();
+#else
+  stepper.setRPM(SPIN_RPM);
+  stepper.startMove(steps * spin_dir);
+  due = micros();
+#endif
+  phase = PH_STEP;
+}
+
+// Leg ended and its deadline is here: reverse, or stop at the end
+static long spin_next_leg(){
+  motor_evt e = {MOTOR_REVERSE, cur.t_start, millis(), (int32_t)(micros() - spin_next)};
+  if (spin_next == spin_until || stop_req) {
+    cur.err_us = e.err_us;
+    finish_cmd();
+    return 0;
+  }
+  post(e);
+  spin_dir  = -spin_dir;
+  spin_next = spin_until - spin_next > spin_every ? spin_next + spin_every : spin_until;
+  spin_leg();
+  return 1;
+}
+
+//---------------------------------Commands---------------------------------
+static void start_cmd(const motor_cmd &cmd){
+  mode        = cmd.op;
+  cur.op      = MOTOR_DONE;
+  cur.t_start = millis();
+  cur.err_us  = 0;
+  TRACE_BEGIN(TR_AGIT);
+  due = micros();
+  if (mode == MOTOR_SPIN) {
+    int32_t left = cmd.until - due;
+    spin_until = left > 0 ? cmd.until : due;
+    spin_every = cmd.every * 1000000UL;
+    spin_dir   = 1;
+    spin_next  = spin_every && spin_until - due > spin_every ? due + spin_every : spin_until;
+    spin_leg();
+    return;
+  }
+  const uint8_t *code = agit_code(cmd.pattern);
+  agit_start(&vm, code ? code : agit_patterns[AGIT_INVERT].code, cmd.count, RPM);
+  run_next();
+}
+
+static void finish_cmd(){
+  cur.t_end = millis();
+  TRACE_END(TR_AGIT);
+  phase    = PH_IDLE;
+  stop_req = 0;
+  post(cur);
+}
+
+//---------------------------------Advance the motion---------------------------------
+// Returns micros until the next call is due, 0 once the command is finished.
+static long motor_step(){
+  switch (phase) {
+    case PH_STEP: {
+#if STEP_RMT
+      // whole move is in the RMT, sleep until it is played out
+      rmt_wait_tx_done(STEP_RMT_CH, portMAX_DELAY);
+      if (leg_it.remaining > 0 && (mode != MOTOR_SPIN || !stop_req)) {   // a move ends where it was going
+        rmt_leg_part();
+        return 1;
+      }
+#else
+      long wait = stepper.nextAction();
+      if (wait > 0) return wait;
+#endif
+      TRACE_END(TR_MOVE);
+      if (mode == MOTOR_SPIN) {
+        phase = PH_DWELL;                        // less than a step to the leg deadline
+        due   = spin_next;
+        return 1;
+      }
+      due = micros();
+      return run_next();
+    }
+
+    case PH_DWELL: {
+      // the task sleeps whole ticks, the rest of the dwell is timed here
+      int32_t left = stop_req ? 0 : due - micros();
+      if (left >= 1000) return left;
+      if (left > 0) delayMicroseconds(left);
+      return mode == MOTOR_SPIN ? spin_next_leg() : run_next();
+    }
+  }
+  return 0;
+}
+
+#if MOTOR_TASK
+#if !STEP_RMT
+//---------------------------------Bit-banged steps---------------------------------
+// nextAction() busy-waits out the step interval. Whole ticks of a long
+// interval are slept here instead, and a move at speed, where no interval
+// holds a tick, sleeps one every MOTOR_YIELD_MS - that step comes up to a
+// tick late, but IDLE0 runs and the task watchdog is fed.
+static void step_yield(long wait){
+  static TickType_t last;
+  TickType_t now = xTaskGetTickCount();
+  if (wait >= 2000) vTaskDelay(pdMS_TO_TICKS(wait / 1000 - 1));
+  else if (now - last >= pdMS_TO_TICKS(MOTOR_YIELD_MS)) vTaskDelay(1);
+  else return;
+  last = xTaskGetTickCount();
+}
+#endif
+
+//---------------------------------Motor task (core 0)---------------------------------
+static void motor_task(void *){
+  motor_cmd cmd;
+  for (;;) {
+    xQueueReceive(cmd_q, &cmd, portMAX_DELAY);
+    start_cmd(cmd);
+    cmd_started++;
+    long wait;
+    while ((wait = motor_step()) > 0) {
+      // the RMT times the step pulses itself, only sleep through the dwell
+      if (phase == PH_DWELL && wait >= 1000) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait / 1000));
+#if !STEP_RMT
+      else if (phase == PH_STEP) step_yield(wait);
+#endif
+    }
+  }
+}
+#endif
+
+//---------------------------------Init---------------------------------
+void motor_begin(){
+  stepper.begin(RPM);
+  stepper.setMicrostep(MICROST);
+  stepper.setEnableActiveState(LOW);
+  stepper.enable();
+  stepper.setSpeedProfile(stepper.LINEAR_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
+
+  step_profile prof;                             // long leg, only the ramps are read
+  profile_init(&prof, SPIN_RPM, MOTOR_STEPS, MICROST, MOTOR_ACCEL, MOTOR_DECEL, 0x7FFFFFFF);
+  spin_full    = prof.steps_to_cruise + prof.steps_to_brake;
+  spin_full_us = leg_time(spin_full);
+  spin_pulse   = prof.cruise_pulse;
+
+#if STEP_RMT
+  rmt_begin();                                   // takes STEP pin over from the library
+#endif
+
+#if MOTOR_TASK
+  cmd_q = xQueueCreate(4, sizeof(motor_cmd));
+  evt_q = xQueueCreate(4, sizeof(motor_evt));
+  xTaskCreatePinnedToCore(motor_task, "motor", MOTOR_STACK, NULL, MOTOR_PRIO, &motor_th, MOTOR_CORE);
+#endif
+}
+
+//---------------------------------UI side---------------------------------
+bool motor_send(const motor_cmd &cmd){
+#if MOTOR_TASK
+  if (xQueueSend(cmd_q, &cmd, 0) != pdTRUE) return false;
+  cmd_sent++;
+  return true;
+#else
+  if (cmd_full) return false;
+  cmd_slot = cmd;
+  cmd_full = 1;
+  return true;
+#endif
+}
+
+bool motor_poll(motor_evt *evt){
+#if MOTOR_TASK
+  return xQueueReceive(evt_q, evt, 0) == pdTRUE;
+#else
+  if (!evt_full) return false;
+  *evt = evt_slot;
+  evt_full = 0;
+  return true;
+#endif
+}
+
+//---------------------------------Cooperative stepping (no motor task)---------------------------------
+void motor_service(){
+#if !MOTOR_TASK
+  if (phase == PH_IDLE) {
+    if (!cmd_full) return;
+    cmd_full = 0;
+    start_cmd(cmd_slot);
+  }
+  if ((int32_t)(micros() - due) < 0) return;
+  long wait = motor_step();
+  if (wait > 0 && phase == PH_STEP) due = micros() + wait - 1;   // nextAction() waits out the rest
+#endif
+}
+
+// micros() motor_service() wants to run next, false when there is nothing to do
+bool motor_next_due(uint32_t *due_us){
+#if MOTOR_TASK
+  return false;
+#else
+  if (phase == PH_IDLE) {
+    if (!cmd_full) return false;
+    *due_us = micros();
+  } else *due_us = due;
+  return true;
+#endif
+}
+
+// Ends the running command after the move under way, drops the queued ones.
+// One the motor task has taken but not started yet stops at its first move.
+void motor_stop(){
+  if (!motor_busy()) return;
+#if MOTOR_TASK
+  motor_cmd cmd;
+  while (xQueueReceive(cmd_q, &cmd, 0) == pdTRUE) cmd_dropped++;
+#else
+  cmd_full = 0;
+#endif
+  if (!motor_busy()) return;
+  stop_req = 1;
+#if MOTOR_TASK
+  xTaskNotifyGive(motor_th);                     // out of a dwell
+#endif
+}
+
+// Sent and not started yet covers the queue and a command the motor task
+// has taken off it but not set phase for
+bool motor_busy(){
+#if MOTOR_TASK
+  return phase != PH_IDLE || cmd_sent - cmd_dropped != cmd_started;
+#else
+  return phase != PH_IDLE || cmd_full;
+#endif
+}
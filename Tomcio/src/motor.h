@@ -0,0 +1,97 @@
+// Agitation motor
+//
+// On the ESP32 the stepper is owned by a task pinned to core 0, so stepping
+// never waits for the display or touch work done by loop() on core 1. The UI
+// sends agitation commands through a queue and gets completion events back.
+//
+// Without FreeRTOS (host build) the same state machine is stepped from loop()
+// through motor_service().
+//
+// MOTOR_SPIN turns the tank at SPIN_RPM until a given micros(), reversing
+// every few seconds. Each leg between reversals is one accel/cruise/decel
+// move sized to end just before its deadline, so the reversals stay on the
+// schedule and the last leg stops at the stage end. How late each reversal
+// was comes back as a MOTOR_REVERSE event.
+//
+// motor_stop() ends the command once the move under way (or the part of a
+// leg in the RMT) is done, and still sends its MOTOR_DONE.
+
+#ifndef MOTOR_H
+#define MOTOR_H
+
+#include <Arduino.h>
+#include "DRV8825.h"
+#include "agit.h"
+
+// Motor steps per revolution. Most steppers are 200 steps or 1.8 degrees/step
+#define MOTOR_STEPS 200
+#define RPM         20
+#define DIR         10
+#define STEP        12
+#define MODE0       48
+#define MODE1       47
+#define MODE2       21
+#define ENABLE      11
+#define MICROST     16
+#define MOTOR_ACCEL 1000
+#define MOTOR_DECEL 1000
+
+#define AGIT_DWELL  125                          // pause between inversion moves [ms]
+#define SPIN_RPM    30                           // continuous rotation
+#define VIBE_PIN    8                            // vibration motor, patterns and loop() both drive it
+
+#if defined(ARDUINO_ARCH_ESP32)
+  #define MOTOR_TASK  1
+  #define MOTOR_CORE  0                          // loop() runs on core 1
+  #define MOTOR_PRIO  5
+  #define MOTOR_STACK 4096
+  #define MOTOR_YIELD_MS 50                      // STEP_RMT=0: longest stretch of steps without a sleep
+#else
+  #define MOTOR_TASK  0
+#endif
+
+// Step pulses from the RMT peripheral, build with -D STEP_RMT=0 to bit-bang
+// them through StepperDriver's nextAction() instead
+#ifndef STEP_RMT
+  #define STEP_RMT    MOTOR_TASK
+#endif
+#define STEP_RMT_CH   RMT_CHANNEL_0
+#define STEP_HIGH_US  2                          // DRV8825 needs >= 1.9us STEP high
+#define MOVE_MAX_STEPS (AGIT_MAX_DEG * MOTOR_STEPS * MICROST / 360)
+
+enum {                                           // motor_cmd.op
+  MOTOR_AGITATE,                                 // run pattern with count agitations
+  MOTOR_SPIN                                     // rotate until, reversing every s
+};
+
+enum {                                           // motor_evt.op
+  MOTOR_DONE,                                    // command finished
+  MOTOR_REVERSE                                  // MOTOR_SPIN changed direction
+};
+
+struct motor_cmd {
+  uint8_t  op;
+  uint8_t  count;                                // MOTOR_AGITATE
+  uint8_t  pattern;                              // MOTOR_AGITATE, agit_code() index
+  uint16_t every;                                // MOTOR_SPIN, reversal period [s]
+  uint32_t until;                                // MOTOR_SPIN, micros() to stop at
+};
+
+struct motor_evt {
+  uint8_t  op;
+  uint32_t t_start;                              // millis() when motion started
+  uint32_t t_end;                                // millis() when last move ended
+  int32_t  err_us;                               // MOTOR_REVERSE, MOTOR_DONE of a spin: late against plan
+};
+
+extern DRV8825 stepper;
+
+void motor_begin();
+bool motor_send(const motor_cmd &cmd);
+bool motor_poll(motor_evt *evt);
+void motor_service();
+bool motor_next_due(uint32_t *due);
+bool motor_busy();                               // command running or queued
+void motor_stop();                               // abort, MOTOR_DONE still comes
+
+#endif
@@ -0,0 +1,232 @@
+#include "power.h"
+#include "fmt.h"
+#include "sched.h"
+#include "tick.h"
+#include "motor.h"
+#include "touch.h"
+#include "esp_timer.h"
+#if POWER_TASK
+  #include "esp_sleep.h"
+  #include "driver/gpio.h"
+  #include "driver/ledc.h"
+#endif
+
+static const char *const state_names[PS_N] = {"run", "idle", "sleep"};
+
+static uint8_t  state = PS_RUN;
+static int64_t  state_t0;                        // esp_timer time the state started
+static uint64_t stage_us[PS_N];
+static uint64_t session_us[PS_N];
+static uint32_t stage_sleeps, session_sleeps;
+
+static uint32_t last_event;                      // millis() of the last touch or stage event
+static bool     dim;
+static int64_t  dim_t0;
+static uint64_t stage_dim_us, session_dim_us;
+
+#if POWER_TASK
+static TaskHandle_t loop_th;
+static hw_timer_t  *tick_tmr;
+static uint32_t     tick_rest;                   // slept us not yet added to timer 0
+static uint32_t     run_mhz;
+static uint32_t     cpu_mhz;                     // last set, setCpuFrequencyMhz() is not cheap
+#endif
+
+//---------------------------------Accounting---------------------------------
+static void enter(uint8_t s){
+  int64_t now = esp_timer_get_time();
+  uint64_t d  = now - state_t0;
+  stage_us[state]   += d;
+  session_us[state] += d;
+  if (dim) {
+    stage_dim_us   += now - dim_t0;
+    session_dim_us += now - dim_t0;
+    dim_t0 = now;
+  }
+  state    = s;
+  state_t0 = now;
+  if (s == PS_SLEEP) {
+    stage_sleeps++;
+    session_sleeps++;
+  }
+}
+
+//---------------------------------Backlight---------------------------------
+static void backlight(uint8_t level){
+#if POWER_TASK && defined(TFT_BL)
+  #if TFT_BACKLIGHT_ON == LOW
+    level = 255 - level;
+  #endif
+  ledc_set_duty(LEDC_LOW_SPEED_MODE, POWER_BL_CH, level);
+  ledc_update_duty(LEDC_LOW_SPEED_MODE, POWER_BL_CH);
+#else
+  (void)level;
+#endif
+}
+
+static void backlight_begin(){
+#if POWER_TASK && defined(TFT_BL)
+  ledc_timer_config_t tc = {};
+  tc.speed_mode      = LEDC_LOW_SPEED_MODE;
+  tc.duty_resolution = LEDC_TIMER_8_BIT;
+  tc.timer_num       = LEDC_TIMER_3;
+  tc.freq_hz         = 1000;
+  tc.clk_cfg         = LEDC_USE_RTC8M_CLK;       // keeps running in light sleep
+  ledc_timer_config(&tc);
+  ledc_channel_config_t cc = {};
+  cc.gpio_num   = TFT_BL;
+  cc.speed_mode = LEDC_LOW_SPEED_MODE;
+  cc.channel    = POWER_BL_CH;
+  cc.timer_sel  = LEDC_TIMER_3;
+  ledc_channel_config(&cc);
+  esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON);
+#endif
+  backlight(POWER_BL_ON);
+}
+
+void power_event(){
+  last_event = millis();
+  if (!dim) return;
+  enter(state);                                  // closes the dimmed time
+  dim = 0;
+  backlight(POWER_BL_ON);
+}
+
+static void dim_check(){
+  if (dim || millis() - last_event < POWER_DIM_MS) return;
+  enter(state);
+  dim    = 1;
+  dim_t0 = state_t0;
+  backlight(POWER_BL_DIM);
+}
+
+//---------------------------------Next deadline---------------------------------
+// us from now until anything is due, at most one timer tick
+static int32_t next_wait(){
+  uint32_t now_ms = millis();
+  uint32_t now    = micros();
+  int32_t  wait   = tick_next_us() - now;
+  uint32_t d;
+  // a millis() deadline can come up to 1ms sooner than whole ms from now
+  if (sched_next_due(&d)) wait = min(wait, ((int32_t)(d - now_ms) - 1) * 1000);
+  if (touch_next_due(&d)) wait = min(wait, ((int32_t)(d - now_ms) - 1) * 1000);
+  if (motor_next_due(&d)) wait = min(wait, (int32_t)(d - now));
+  return wait;
+}
+
+#if POWER_TASK
+static void cpu_clock(uint32_t mhz){
+  if (mhz == cpu_mhz) return;
+  setCpuFrequencyMhz(mhz);
+  cpu_mhz = mhz;
+}
+#endif
+
+#if POWER_TASK && POWER_SLEEP
+//---------------------------------Light sleep---------------------------------
+// Timer 0 doesn't count in light sleep, it is moved on by the time slept.
+// It is never moved past its alarm, the sleep ends before the next tick.
+static void light_sleep(uint32_t us){
+  gpio_wakeup_enable((gpio_num_t)TOUCH_IRQ, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup(us);
+
+  int64_t t0 = esp_timer_get_time();
+  esp_light_sleep_start();
+  uint32_t slept = esp_timer_get_time() - t0 + tick_rest;
+
+  gpio_wakeup_disable((gpio_num_t)TOUCH_IRQ);
+  gpio_set_intr_type((gpio_num_t)TOUCH_IRQ, GPIO_INTR_NEGEDGE);   // as attachInterrupt() left it
+  uint64_t cnt = timerRead(tick_tmr) + slept / TICK_TIMER_US;
+  tick_rest    = slept % TICK_TIMER_US;
+  timerWrite(tick_tmr, min(cnt, (uint64_t)TICK_ALARM - 1));
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) touch_kick();   // the edge went by unseen
+}
+#endif
+
+//---------------------------------Idle---------------------------------
+void power_begin(hw_timer_t *tick_timer){
+#if POWER_TASK
+  loop_th  = xTaskGetCurrentTaskHandle();
+  tick_tmr = tick_timer;
+  run_mhz  = getCpuFrequencyMhz();
+  cpu_mhz  = run_mhz;
+#else
+  (void)tick_timer;
+#endif
+  last_event = millis();
+  state_t0   = esp_timer_get_time();
+  backlight_begin();
+}
+
+void power_busy(){
+  if (state != PS_RUN) enter(PS_RUN);
+}
+
+void power_idle(){
+  dim_check();
+  int32_t wait = next_wait();
+  if (wait < POWER_SPIN_US) return;              // loop() again, it is nearly due
+
+  bool sleep = POWER_SLEEP && wait >= POWER_SLEEP_MS * 1000L && !motor_busy() && !touch_busy();
+#if POWER_SLEEP
+  sleep = sleep && digitalRead(TOUCH_IRQ) == HIGH;
+#endif
+#if POWER_TASK && ARDUINO_USB_CDC_ON_BOOT
+  sleep = sleep && !Serial;                      // light sleep drops the USB connection
+#endif
+  enter(sleep ? PS_SLEEP : PS_IDLE);
+#if POWER_TASK
+  cpu_clock(POWER_IDLE_MHZ);
+  #if POWER_SLEEP
+  if (sleep) light_sleep(wait - POWER_WAKE_US);
+  else
+  #endif
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((wait - POWER_SPIN_US) / 1000));
+  cpu_clock(run_mhz);
+  enter(PS_RUN);
+#endif
+}
+
+void power_wake(){
+#if POWER_TASK
+  if (loop_th) xTaskNotifyGive(loop_th);
+#endif
+}
+
+//---------------------------------Stats---------------------------------
+void power_stats_reset(){
+  enter(state);
+  memset(stage_us, 0, sizeof(stage_us));
+  stage_sleeps = 0;
+  stage_dim_us = 0;
+}
+
+void power_session_reset(){
+  power_stats_reset();
+  memset(session_us, 0, sizeof(session_us));
+  session_sleeps = 0;
+  session_dim_us = 0;
+}
+
+static void report(const char *tag, const uint64_t *us, uint32_t sleeps, uint64_t dim_us){
+  enter(state);
+  uint64_t all = 0;
+  for (uint8_t s = 0; s < PS_N; s++) all += us[s];
+  if (all == 0) return;
+  char st[LOG_LEN];
+  int  n = 0;
+  for (uint8_t s = 0; s < PS_N && n < (int)sizeof(st); s++) {
+    n += snprintf(st + n, sizeof(st) - n, " %s %.1f s (%u%%)", state_names[s], us[s] / 1e6, (unsigned)(us[s] * 100 / all));
+  }
+  log_fmt("%s: power%s, %lu sleeps, backlight dimmed %u%%\n", tag, st, (unsigned long)sleeps,
+          (unsigned)(dim_us * 100 / all));
+}
+
+void power_report(const char *tag){
+  report(tag, stage_us, stage_sleeps, stage_dim_us);
+}
+
+void power_session_report(){
+  report("Session", session_us, session_sleeps, session_dim_us);
+}
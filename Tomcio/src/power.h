@@ -0,0 +1,68 @@
+// Power management
+//
+// loop() ends in power_idle(). It works out when anything is next due -
+// scheduler event, timer 0 tick, motor or touch on the host - and waits for
+// it instead of spinning through loop() again:
+//   PS_IDLE   the loop task blocks with the CPU at POWER_IDLE_MHZ, the idle
+//             task clock-gates it. Touch and motor events wake it early.
+//   PS_SLEEP  light sleep, for waits of POWER_SLEEP_MS or more while the
+//             motor and the panel are idle. Woken by the deadline timer or
+//             by T_IRQ, so it needs -D TOUCH_IRQ. Timer 0 stops in light
+//             sleep, its count is moved on by the time slept afterwards.
+// Both wake POWER_SPIN_US before the deadline and loop() runs the rest at
+// full clock as before, so events come on time as they did without.
+//
+// The backlight dims to POWER_BL_DIM after POWER_DIM_MS without a touch or
+// stage event. It runs from the RTC 8 MHz clock so it stays on in sleep.
+// Needs TFT_BL from the TFT_eSPI setup, without it nothing is dimmed.
+//
+// Time in each state (PS_RUN is everything else, loop() working or waiting
+// less than POWER_SPIN_US) is counted per stage and for the session.
+//
+// The state and the backlight are the loop task's alone. The touch and motor
+// tasks only call power_wake(), a press gets to power_event() once loop()
+// has taken it off the touch queue.
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <Arduino.h>
+#include "touch.h"
+
+#define POWER_IDLE_MHZ  80                       // APB stays 80MHz, SPI and RMT don't notice
+#define POWER_SPIN_US   2000                     // waits shorter than this stay awake
+#define POWER_SLEEP_MS  20                       // shortest light sleep
+#define POWER_WAKE_US   3000                     // light sleep ends this early, wakeup latency
+#define POWER_DIM_MS    15000                    // no event for this long dims the backlight
+#define POWER_BL_ON     255
+#define POWER_BL_DIM    40
+#define POWER_BL_CH     LEDC_CHANNEL_7
+
+#if defined(ARDUINO_ARCH_ESP32)
+  #define POWER_TASK  1                          // power_idle() really waits
+#else
+  #define POWER_TASK  0                          // the simulator moves the clock on itself
+#endif
+
+// Light sleep has to be woken by a touch, so only with T_IRQ wired
+#define POWER_SLEEP (TOUCH_IRQ >= 0)
+
+enum {                                           // power states
+  PS_RUN,
+  PS_IDLE,
+  PS_SLEEP,
+  PS_N
+};
+
+void power_begin(hw_timer_t *tick_timer);
+void power_busy();                               // top of loop(), the wait is over
+void power_idle();                               // end of loop()
+void power_wake();                               // from the touch and motor tasks
+void power_event();                              // touch or stage event, backlight up - loop task only
+
+void power_stats_reset();                        // stage
+void power_session_reset();
+void power_report(const char *tag);
+void power_session_report();
+
+#endif
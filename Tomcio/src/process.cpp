@@ -0,0 +1,65 @@
+#include <TFT_eSPI.h>
+#include "process.h"
+#include "progstore.h"
+
+//---------------------------------Built in processes---------------------------------
+// Times at 38 C as in the kit sheets. Rotary processing all the way, the
+// tank changes direction every 10 s.
+#define PB_C41 (PB_SPIN | PB_DRAIN | PB_BUZZ_DONE)
+
+static const process c41 = {"C-41", 6, {
+  {"DEVELOPER",   195, 0, 0, 10, PB_SPIN | PB_DRAIN | PB_BUZZ_DRAIN, TFT_RED      },
+  {"BLEACH",      390, 0, 0, 10, PB_C41,                             TFT_ORANGE   },
+  {"WASH",        195, 0, 0, 10, PB_C41,                             TFT_CYAN     },
+  {"FIXER",       390, 0, 0, 10, PB_C41,                             TFT_RED      },
+  {"WASH",        195, 0, 0, 10, PB_C41,                             TFT_CYAN     },
+  {"STABILIZER",   90, 0, 0, 10, PB_C41,                             TFT_DARKGREEN},
+}};
+
+static const process e6 = {"E-6", 9, {
+  {"FIRST DEV",   360, 0, 0, 10, PB_SPIN | PB_DRAIN | PB_BUZZ_DRAIN, TFT_RED      },
+  {"WASH",        120, 0, 0, 10, PB_C41,                             TFT_CYAN     },
+  {"REVERSAL",    120, 0, 0, 10, PB_C41,                             TFT_MAGENTA  },
+  {"COLOR DEV",   360, 0, 0, 10, PB_SPIN | PB_DRAIN | PB_BUZZ_DRAIN, TFT_RED      },
+  {"PRE-BLEACH",  120, 0, 0, 10, PB_C41,                             TFT_ORANGE   },
+  {"BLEACH",      360, 0, 0, 10, PB_C41,                             TFT_ORANGE   },
+  {"FIXER",       240, 0, 0, 10, PB_C41,                             TFT_RED      },
+  {"WASH",        240, 0, 0, 10, PB_C41,                             TFT_CYAN     },
+  {"FINAL RINSE",  60, 0, 0, 10, PB_C41,                             TFT_DARKGREEN},
+}};
+
+const process *const proc_builtin[] = {&c41, &e6};
+const uint8_t        proc_builtin_n = sizeof(proc_builtin) / sizeof(proc_builtin[0]);
+
+//---------------------------------Program record---------------------------------
+// Dev, stop and fix share the same layout in a program record:
+// [base] initial agitation, [base+1] time [s], [base+2] agitation count, [base+3] period [s]
+// followed by the inversions of up to five rinse steps, 0 = step not used
+static const bath prog_baths[3] = {
+  {"DEVELOPMENT", 0, 0, 0, 0, PB_DRAIN | PB_BUZZ_DRAIN, TFT_RED      },
+  {"STOP BATH",   0, 0, 0, 0, PB_BUZZ_DONE,             TFT_DARKGREEN},
+  {"FIXING",      0, 0, 0, 0, PB_DRAIN | PB_BUZZ_DONE,  TFT_RED      },
+};
+
+static const char *const rinse_names[5] = {"RINSE 1", "RINSE 2", "RINSE 3", "RINSE 4", "RINSE 5"};
+
+// Agitation words are count | pattern << 8, see PD_COUNT() and PD_PATTERN()
+void proc_from_prog(const uint16_t *pd, process *p){
+  p->name = "Ilford";
+  p->n    = 0;
+  for (uint8_t s = 0; s < 3; s++) {
+    const uint16_t *w = pd + 4 * s;
+    bath &b = p->b[p->n++];
+    b       = prog_baths[s];
+    b.init    = w[0] > 255 ? 255 : w[0];
+    b.time    = w[1];
+    b.count   = PD_COUNT(w[2]);
+    b.every   = w[3];
+    b.pattern = PD_PATTERN(w[2]);
+  }
+  for (uint8_t r = 0; r < 5; r++) {
+    uint16_t inv = pd[12 + r];
+    if (inv == 0) continue;
+    p->b[p->n++] = {rinse_names[r], 0, (uint8_t)PD_COUNT(inv), 0, 0, PB_TOUCH, TFT_RED, (uint8_t)PD_PATTERN(inv)};
+  }
+}
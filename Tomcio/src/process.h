@@ -0,0 +1,61 @@
+// Processes
+//
+// A process is a list of baths run in order. A timed bath has its time,
+// initial agitation and periodic agitation, plus flags for the drain off
+// warning and the buzzer. A PB_TOUCH bath is a step started by touch that
+// only agitates, as the rinse steps are. A PB_SPIN bath rotates the tank
+// from the initial agitation to the end of the stage, changing direction
+// every `every` seconds, the way a rotary processor does.
+//
+// The nine programs and the recipes keep the 17 word record, which is the
+// Ilford flow - development, stop, fix and up to five rinse steps.
+// proc_from_prog() turns a record into that process. Longer processes,
+// C-41 and E-6, are built in.
+//
+// The agitation words of a record carry the count in the low byte and the
+// pattern index in the high byte (agit_code()), so old records run
+// inversions.
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stdint.h>
+#include "agit.h"
+
+#define PROC_BATHS 12                            // baths per process
+
+enum {                                           // bath.flags
+  PB_DRAIN      = 1,                             // drain off warning before end
+  PB_BUZZ_DRAIN = 2,                             // buzzer on from drain warning to end
+  PB_BUZZ_DONE  = 4,                             // buzzer on during done message
+  PB_TOUCH      = 8,                             // untimed, init inversions on START
+  PB_SPIN       = 16                             // continuous rotation, every = reversal period
+};
+
+struct bath {
+  const char *name;                              // header text
+  uint16_t    time;                              // [s]
+  uint8_t     init;                              // initial agitation, pattern runs
+  uint8_t     count;                             // periodic agitation, pattern runs
+  uint16_t    every;                             // agitation period [s]
+  uint8_t     flags;
+  uint16_t    color;                             // header color
+  uint8_t     pattern = AGIT_INVERT;             // agit_code() index
+};
+
+struct process {
+  const char *name;
+  uint8_t     n;                                 // baths used
+  bath        b[PROC_BATHS];
+};
+
+#define PD_COUNT(w)   ((w) & 0xFF)             // agitation word of a program record
+#define PD_PATTERN(w) ((w) >> 8)
+#define PD_AGIT(count, pattern) (uint16_t)((count) | ((pattern) << 8))
+
+extern const process *const proc_builtin[];
+extern const uint8_t        proc_builtin_n;
+
+void proc_from_prog(const uint16_t *pd, process *p);
+
+#endif
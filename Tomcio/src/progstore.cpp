@@ -0,0 +1,297 @@
+#include <Arduino.h>
+#include <string.h>
+#include <stddef.h>
+#include "FS.h"
+#include "SPIFFS.h"
+#include "esp_partition.h"
+#include "progstore.h"
+#include "trace.h"
+#include "fmt.h"
+
+#define SEC SPI_FLASH_SEC_SIZE
+
+// Version 1 image - one slot, CRC of the records only
+struct prog_image_v1 {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t  count;
+  uint8_t  words;
+  uint32_t crc;
+  uint16_t data[PROG_N][PROG_WORDS];
+};
+
+// Version 2 image - two slots as now, no patterns
+struct prog_image_v2 {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t  count;
+  uint8_t  words;
+  uint32_t seq;
+  uint16_t data[PROG_N][PROG_WORDS];
+  uint16_t spare;
+  uint32_t crc;
+};
+
+#define PAT_DIRTY (1 << PROG_N)                  // dirty bit of the patterns
+#define PAT_FILE  "/Patterns"
+
+static const esp_partition_t   *part = NULL;     // "progs" partition
+static const prog_image        *slot[PROG_SLOTS];// mapped slots
+static const prog_image        *img  = NULL;     // programs in use: a slot, or ram_img
+static spi_flash_mmap_handle_t  map_h;
+static bool                     mapped = false;
+static prog_image               ram_img;         // staged edits / image being built / PROG_FILES copy
+static int8_t                   active = -1;     // slot img points to, -1 none
+static int8_t                   old_slot;        // slot of a migrated image, written over last
+static uint8_t                  pat_ok;          // user patterns that passed agit_check(), bit each
+
+static uint16_t dirty;                           // staged programs, bit per program, PAT_DIRTY
+static uint16_t saves;                           // prog_save() calls since the last flush
+
+static uint8_t  prog_src;
+static uint32_t boot_us;                         // prog_begin() time
+static uint32_t files_us;                        // time spent reading /Program_N
+static uint8_t  files_bad;                       // missing or short files
+
+//---------------------------------CRC-32 (IEEE, reflected)---------------------------------
+uint32_t crc32(const void *buf, uint32_t len, uint32_t crc){
+  const uint8_t *b = (const uint8_t *)buf;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *b++;
+    for (uint8_t k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static bool valid(const prog_image *m){
+  return m->magic == PROG_MAGIC && m->version == PROG_VERSION &&
+         m->count == PROG_N && m->words == PROG_WORDS &&
+         m->crc == crc32(m, offsetof(prog_image, crc));
+}
+
+static void seal(prog_image *m, uint32_t seq){
+  m->magic   = PROG_MAGIC;
+  m->version = PROG_VERSION;
+  m->count   = PROG_N;
+  m->words   = PROG_WORDS;
+  m->seq     = seq;
+  m->spare   = 0xFFFF;
+  m->crc     = crc32(m, offsetof(prog_image, crc));
+}
+
+static bool from_v1(const prog_image_v1 *v, prog_image *m){
+  if (v->magic != PROG_MAGIC || v->version != 1 || v->count != PROG_N || v->words != PROG_WORDS ||
+      v->crc != crc32(v->data, sizeof(v->data))) return false;
+  memcpy(m->data, v->data, sizeof(m->data));
+  old_slot = 0;
+  return true;
+}
+
+// Newest whole version 2 slot
+static bool from_v2(const prog_image_v2 *const *v, prog_image *m){
+  int8_t s = -1;
+  for (uint8_t i = 0; i < PROG_SLOTS; i++) {
+    if (v[i]->magic != PROG_MAGIC || v[i]->version != 2 || v[i]->count != PROG_N || v[i]->words != PROG_WORDS ||
+        v[i]->crc != crc32(v[i], offsetof(prog_image_v2, crc))) continue;
+    if (s < 0 || (int32_t)(v[i]->seq - v[s]->seq) > 0) s = i;
+  }
+  if (s < 0) return false;
+  memcpy(m->data, v[s]->data, sizeof(m->data));
+  old_slot = s;
+  return true;
+}
+
+//---------------------------------User patterns---------------------------------
+// Name ends in the field and the code passes agit_check()
+static void check_pats(){
+  pat_ok = 0;
+  for (uint8_t u = 0; u < AGIT_USER; u++) {
+    const agit_user &a = img->pat[u];
+    if (a.name[0] && !a.name[AGIT_NAME_LEN - 1] && agit_check(a.code)) pat_ok |= 1 << u;
+  }
+}
+
+//---------------------------------Old format - one 34 byte file per program---------------------------------
+static void file_name(char *buf, size_t n, uint8_t p, const char *ext = ""){
+  snprintf(buf, n, "/Program_%d%s", p + 1, ext);
+}
+
+static void read_files(prog_image *m){
+  uint32_t t0 = micros();
+  uint8_t b[2 * PROG_WORDS];
+  files_bad = 0;
+  for (uint8_t p = 0; p < PROG_N; p++) {
+    char name[20];
+    file_name(name, sizeof(name), p);
+    File f = SPIFFS.open(name, "r");
+    if (!f) {                                    // power lost between remove and rename
+      file_name(name, sizeof(name), p, ".tmp");
+      f = SPIFFS.open(name, "r");
+    }
+    size_t n = f ? f.read(b, sizeof(b)) : 0;
+    if (f) f.close();
+    if (n != sizeof(b)) {
+      Serial.printf("%s: %u of %u bytes, program cleared\n", name, (unsigned)n, (unsigned)sizeof(b));
+      memset(b, 0, sizeof(b));
+      files_bad++;
+    }
+    for (uint8_t i = 0; i < PROG_WORDS; i++) m->data[p][i] = b[2 * i] | (b[2 * i + 1] << 8);
+  }
+  File f = SPIFFS.open(PAT_FILE, "r");           // only there if the programs ever were files
+  if (!f) f = SPIFFS.open(PAT_FILE ".tmp", "r");
+  if (!f || f.read((uint8_t *)m->pat, sizeof(m->pat)) != sizeof(m->pat)) memset(m->pat, 0, sizeof(m->pat));
+  if (f) f.close();
+  files_us = micros() - t0;
+}
+
+// Whole file written aside first, so a power loss leaves the old or the new one
+static bool write_aside(const char *name, const char *tmp, const uint8_t *b, size_t len){
+  File f = SPIFFS.open(tmp, "w");
+  if (!f) return false;
+  size_t n = f.write(b, len);
+  f.close();
+  if (n != len) return false;
+  SPIFFS.remove(name);
+  return SPIFFS.rename(tmp, name);
+}
+
+static bool write_file(uint8_t p, const uint16_t *pd){
+  char name[20], tmp[20];
+  uint8_t b[2 * PROG_WORDS];
+  file_name(name, sizeof(name), p);
+  file_name(tmp, sizeof(tmp), p, ".tmp");
+  for (uint8_t i = 0; i < PROG_WORDS; i++) {
+    b[2 * i]     = pd[i] & 0xff;
+    b[2 * i + 1] = pd[i] >> 8;
+  }
+  return write_aside(name, tmp, b, sizeof(b));
+}
+
+//---------------------------------Write ram_img to the slot not in use---------------------------------
+static bool commit(){
+  int8_t   s   = (active < 0 ? old_slot : active) ^ 1;   // keep a migrated image until this one is whole
+  uint32_t seq = active < 0 ? 1 : slot[active]->seq + 1;
+  seal(&ram_img, seq);
+  if (esp_partition_erase_range(part, s * SEC, SEC) != ESP_OK) return false;
+  if (esp_partition_write(part, s * SEC, &ram_img, sizeof(ram_img)) != ESP_OK) return false;
+  if (!valid(slot[s]) || memcmp(slot[s], &ram_img, sizeof(ram_img))) return false;
+  active = s;
+  img    = slot[s];
+  return true;
+}
+
+//---------------------------------Map programs, migrate old formats if needed---------------------------------
+bool prog_begin(){
+  TRACE_SCOPE(TR_FS);
+  uint32_t t0 = micros();
+  const void *p;
+
+  active   = -1;
+  old_slot = 0;
+  dirty    = 0;
+  saves    = 0;
+  files_us = 0;
+  if (mapped) spi_flash_munmap(map_h);           // called again, scan from scratch
+  mapped = false;
+
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)PROG_SUBTYPE, PROG_PART_NAME);
+  if (part && esp_partition_mmap(part, 0, PROG_SLOTS * SEC, SPI_FLASH_MMAP_DATA, &p, &map_h) == ESP_OK) {
+    mapped = true;
+    for (uint8_t s = 0; s < PROG_SLOTS; s++) {
+      slot[s] = (const prog_image *)((const uint8_t *)p + s * SEC);
+      if (valid(slot[s]) && (active < 0 || (int32_t)(slot[s]->seq - slot[active]->seq) > 0)) active = s;
+    }
+    prog_src = PROG_MAPPED;
+    if (active >= 0) img = slot[active];
+    else {
+      memset(ram_img.pat, 0, sizeof(ram_img.pat));
+      if (!from_v2((const prog_image_v2 *const *)slot, &ram_img) &&
+          !from_v1((const prog_image_v1 *)slot[0], &ram_img)) read_files(&ram_img);
+      prog_src = PROG_MIGRATED;
+      img = &ram_img;
+      if (!commit()) dirty = ((1 << PROG_N) - 1) | PAT_DIRTY;   // run from RAM, next flush tries again
+    }
+  } else {
+    read_files(&ram_img);
+    img = &ram_img;
+    prog_src = PROG_FILES;
+  }
+  check_pats();
+
+  boot_us = micros() - t0;
+  return prog_src != PROG_FILES;
+}
+
+const uint16_t *prog_get(uint8_t p){
+  return img->data[p];
+}
+
+//---------------------------------Stage one program, in use right away---------------------------------
+void prog_save(uint8_t p, const uint16_t *pd){
+  if (img != &ram_img) ram_img = *img;
+  memcpy(ram_img.data[p], pd, sizeof(ram_img.data[p]));
+  img = &ram_img;
+  dirty |= 1 << p;
+  saves++;
+}
+
+//---------------------------------Stage a user pattern---------------------------------
+const agit_user *prog_pat(uint8_t u){
+  return u < AGIT_USER && (pat_ok & (1 << u)) ? &img->pat[u] : NULL;
+}
+
+// An empty name clears the slot
+bool prog_pat_save(uint8_t u, const agit_user *a){
+  if (a->name[0] && (a->name[AGIT_NAME_LEN - 1] || !agit_check(a->code))) return false;
+  if (img != &ram_img) ram_img = *img;
+  ram_img.pat[u] = *a;
+  img = &ram_img;
+  check_pats();
+  dirty |= PAT_DIRTY;
+  saves++;
+  return true;
+}
+
+bool prog_dirty(){
+  return dirty != 0;
+}
+
+//---------------------------------Write staged programs---------------------------------
+bool prog_flush(){
+  if (!dirty) return true;
+  TRACE_SCOPE(TR_FS);
+
+  if (prog_src == PROG_FILES) {
+    for (uint8_t p = 0; p < PROG_N; p++) {
+      if ((dirty & (1 << p)) && write_file(p, ram_img.data[p])) dirty &= ~(1 << p);
+    }
+    if ((dirty & PAT_DIRTY) && write_aside(PAT_FILE, PAT_FILE ".tmp", (const uint8_t *)ram_img.pat, sizeof(ram_img.pat))) {
+      dirty &= ~PAT_DIRTY;
+    }
+    if (dirty) return false;
+  } else if (!commit()) {
+    log_fmt("Programs: flash write failed, edits kept in RAM\n");
+    return false;
+  }
+
+  if (active >= 0) log_fmt("Programs: %u edit(s) written at once, slot %d seq %lu\n", saves, active, (unsigned long)img->seq);
+  else log_fmt("Programs: %u edit(s) written at once\n", saves);
+  dirty = 0;
+  saves = 0;
+  return true;
+}
+
+//---------------------------------Boot report---------------------------------
+void prog_report(){
+  static const char *src_name[] = {"mapped", "migrated", "read from /Program_N"};
+  Serial.printf("Programs: %s, image v%u %u B", src_name[prog_src], PROG_VERSION, (unsigned)sizeof(prog_image));
+  if (active >= 0) Serial.printf(" slot %d seq %lu", active, (unsigned long)img->seq);
+  Serial.printf(", ready in %lu us\n", (unsigned long)boot_us);
+  if (prog_src != PROG_MAPPED && files_us) {
+    Serial.printf("Programs: %u files read in %lu us, %u missing or short\n",
+                  PROG_N, (unsigned long)files_us, files_bad);
+  }
+  if (part == NULL) Serial.println("Programs: no \"" PROG_PART_NAME "\" partition, flash partitions.csv");
+  else if (active < 0) Serial.println("Programs: image not written, running from RAM");
+}
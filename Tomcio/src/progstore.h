@@ -0,0 +1,66 @@
+// Program store
+//
+// All nine programs live in one binary image in the "progs" data partition.
+// The image is memory mapped read-only at boot, so prog_get() hands out
+// pointers straight into flash - no file opens and no copies.
+//
+// Saves are atomic: the partition holds two image slots, one sector each,
+// and a save always rewrites the slot not in use. Each image carries a
+// sequence number and ends with a CRC-32 of everything before it, so an
+// image cut short by a power loss fails the check and boot keeps the
+// newest complete one. prog_save() only stages the program in RAM, where it
+// is used right away; prog_flush() writes everything staged since the last
+// flush as one image.
+//
+// Records are 17 little-endian uint16_t, the layout prog_data always had.
+// The user agitation patterns (agit.h) travel in the same image. A version
+// 2 image, a version 1 image (single slot) or, failing those, the old
+// /Program_N SPIFFS files are migrated at boot. Without the partition (old
+// partition table flashed) the programs are kept in the files and the
+// patterns in /Patterns, written through a temporary file and a rename.
+
+#ifndef PROGSTORE_H
+#define PROGSTORE_H
+
+#include <stdint.h>
+#include "agit.h"
+
+#define PROG_N         9                         // programs
+#define PROG_WORDS     17                        // uint16_t per program
+#define PROG_MAGIC     0x47525054                // "TPRG"
+#define PROG_VERSION   3
+#define PROG_SLOTS     2                         // one flash sector each
+#define PROG_SUBTYPE   0x40                      // data partition subtype, see partitions.csv
+#define PROG_PART_NAME "progs"
+#define PROG_FLUSH_MS  3000                      // staged edits are written after this much quiet
+
+struct prog_image {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t  count;                                // PROG_N
+  uint8_t  words;                                // PROG_WORDS
+  uint32_t seq;                                  // newest valid slot wins
+  uint16_t data[PROG_N][PROG_WORDS];
+  uint16_t spare;
+  agit_user pat[AGIT_USER];                      // user agitation patterns
+  uint32_t crc;                                  // CRC-32 of all bytes above, written last
+};
+
+enum {                                           // where the programs came from at boot
+  PROG_MAPPED,                                   // valid image, used in place
+  PROG_MIGRATED,                                 // image rebuilt from a v2 or v1 image or /Program_N, then mapped
+  PROG_FILES                                     // no partition, RAM copy of /Program_N
+};
+
+bool             prog_begin();
+const uint16_t  *prog_get(uint8_t p);            // p = 0..8, read-only
+void             prog_save(uint8_t p, const uint16_t *pd);
+const agit_user *prog_pat(uint8_t u);            // u = 0..AGIT_USER-1, NULL if not used or broken
+bool             prog_pat_save(uint8_t u, const agit_user *a);   // staged as prog_save(), false if broken
+bool             prog_dirty();
+bool             prog_flush();
+void             prog_report();
+
+uint32_t         crc32(const void *buf, uint32_t len, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,349 @@
+#include <Arduino.h>
+#include <string.h>
+#include "proto.h"
+#include "progstore.h"
+#include "recipes.h"
+#include "process.h"
+#include "timeline.h"
+#include "power.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && ARDUINO_USB_CDC_ON_BOOT && ARDUINO_USB_MODE
+  #define PROTO_RX_WAKE 1                        // HWCDC tells when bytes come in
+#else
+  #define PROTO_RX_WAKE 0
+#endif
+
+static uint8_t  tx[PROTO_TX];
+static uint32_t tx_head, tx_tail;                // free running, & (PROTO_TX - 1)
+
+static uint8_t  rx[PROTO_RX];
+static uint16_t rx_n;
+static bool     rx_in;                           // inside a frame, after its first zero
+static bool     rx_over;                         // too long, dropped up to the next zero
+
+static bool     attached;                        // PT_HELLO seen, telemetry on
+static bool     locked;
+
+uint32_t proto_writes;
+uint32_t proto_drops;
+
+//---------------------------------Fields---------------------------------
+static uint8_t *put16(uint8_t *p, uint16_t v){
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v){
+  put16(p, v);
+  return put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p){
+  return p[0] | (p[1] << 8);
+}
+
+//---------------------------------Sending---------------------------------
+static uint32_t tx_free(){
+  return PROTO_TX - (tx_head - tx_tail);
+}
+
+static void tx_byte(uint8_t b){
+  tx[tx_head++ & (PROTO_TX - 1)] = b;
+}
+
+// COBS straight into the ring, whole frame or nothing
+static void send(uint8_t type, uint8_t seq, const uint8_t *pl, uint16_t len){
+  uint8_t  f[PROTO_MAX + 6];
+  uint16_t n = 0;
+  f[n++] = type;
+  f[n++] = seq;
+  memcpy(f + n, pl, len);
+  n += len;
+  put32(f + n, crc32(f, n));
+  n += 4;
+
+  if (tx_free() < n + n / 254 + 3u) {
+    proto_drops++;
+    return;
+  }
+  tx_byte(0);
+  uint32_t code_at = tx_head++;                  // filled in when the run ends
+  uint8_t  code = 1;
+  for (uint16_t i = 0; i < n; i++) {
+    if (f[i] == 0) {
+      tx[code_at & (PROTO_TX - 1)] = code;
+      code_at = tx_head++;
+      code    = 1;
+      continue;
+    }
+    tx_byte(f[i]);
+    if (++code == 0xFF) {
+      tx[code_at & (PROTO_TX - 1)] = code;
+      code_at = tx_head++;
+      code    = 1;
+    }
+  }
+  tx[code_at & (PROTO_TX - 1)] = code;
+  tx_byte(0);
+}
+
+// A frame's closing zero is followed by the next frame's opening zero or by nothing
+static bool frame_end(uint32_t i){
+  return tx[i & (PROTO_TX - 1)] == 0 && (i + 1 == tx_head || tx[(i + 1) & (PROTO_TX - 1)] == 0);
+}
+
+void proto_flush(){
+  uint32_t n = min((uint32_t)Serial.availableForWrite(), tx_head - tx_tail);
+  while (n > 0 && !frame_end(tx_tail + n - 1)) n--;   // frames go out whole, text can't cut in
+  while (n > 0) {
+    uint32_t at  = tx_tail & (PROTO_TX - 1);
+    uint32_t run = min(n, PROTO_TX - at);
+    Serial.write(tx + at, run);
+    tx_tail += run;
+    n       -= run;
+  }
+}
+
+void proto_ack(const proto_cmd &c, uint8_t status, uint8_t detail){
+  static const uint8_t type[] = {0, PT_LOAD, PT_START, PT_ABORT};
+  uint8_t pl[3] = {type[c.op], status, detail};
+  send(PT_ACK, c.seq, pl, sizeof(pl));
+}
+
+static void ack(uint8_t type, uint8_t seq, uint8_t status, uint8_t detail = 0){
+  uint8_t pl[3] = {type, status, detail};
+  send(PT_ACK, seq, pl, sizeof(pl));
+}
+
+void proto_tlm_send(const proto_tlm &t){
+  if (!attached) return;
+  uint8_t pl[26], *p = pl;
+  p = put32(p, millis());
+  *p++ = t.state;
+  *p++ = t.stage;
+  *p++ = t.stages;
+  *p++ = t.motor;
+  p = put32(p, t.left_ms);
+  p = put32(p, t.stage_ms);
+  p = put32(p, t.loop_us);
+  p = put32(p, t.late_us);
+  p = put16(p, proto_drops);
+  send(PT_TLM, 0, pl, p - pl);
+}
+
+void proto_event(uint8_t kind, uint8_t stage, uint16_t a, int32_t b){
+  if (!attached) return;
+  uint8_t pl[12], *p = pl;
+  p = put32(p, millis());
+  *p++ = kind;
+  *p++ = stage;
+  p = put16(p, a);
+  p = put32(p, b);
+  send(PT_EVT, 0, pl, p - pl);
+}
+
+void proto_log(const char *s, uint16_t n){
+  if (attached) send(PT_LOG, 0, (const uint8_t *)s, min(n, (uint16_t)PROTO_MAX));
+  else Serial.write((const uint8_t *)s, n);
+}
+
+//---------------------------------Requests---------------------------------
+static void hello(uint8_t seq){
+  uint8_t pl[7] = {PROTO_VERSION, PROG_N, PROG_WORDS, proc_builtin_n};
+  put16(pl + 4, lib_count());
+  pl[6] = PROTO_MAX;
+  attached = 1;
+  send(PT_HELLO, seq, pl, sizeof(pl));
+}
+
+static void prog_get(uint8_t seq, uint8_t slot){
+  uint8_t pl[1 + PROG_WORDS * 2], *p = pl;
+  const uint16_t *pd = prog_get(slot);
+  *p++ = slot;
+  for (uint8_t i = 0; i < PROG_WORDS; i++) p = put16(p, pd[i]);
+  send(PT_PROG, seq, pl, sizeof(pl));
+}
+
+static void prog_put(uint8_t seq, const uint8_t *p){
+  uint16_t pd[PROG_WORDS];
+  for (uint8_t i = 0; i < PROG_WORDS; i++) pd[i] = get16(p + 1 + 2 * i);
+  uint8_t err = tl_check(pd);                    // same check as LOAD and the import
+  if (err != TL_OK) return ack(PT_PROG_PUT, seq, PS_INVALID, err);
+  prog_save(p[0], pd);
+  proto_writes++;
+  ack(PT_PROG_PUT, seq, prog_flush() ? PS_OK : PS_FLASH);
+}
+
+static void lib_get(uint8_t seq, uint16_t pos){
+  uint8_t pl[2 + sizeof(recipe)];
+  put16(pl, pos);
+  memcpy(pl + 2, lib_at(pos), sizeof(recipe));
+  send(PT_RECIPE, seq, pl, sizeof(pl));
+}
+
+static void lib_put(uint8_t seq, const uint8_t *p, uint8_t n){
+  recipe r[PROTO_MAX / sizeof(recipe)];
+  memcpy(r, p, n * sizeof(recipe));              // unaligned in the frame
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t err = tl_check(r[i].prog);
+    if (err != TL_OK) return ack(PT_LIB_ADD, seq, PS_INVALID, err);
+  }
+  proto_writes++;
+  ack(PT_LIB_ADD, seq, lib_add(r, n) ? PS_OK : PS_FLASH);
+}
+
+static void pat_get(uint8_t seq, uint8_t slot){
+  uint8_t pl[1 + sizeof(agit_user)] = {slot};
+  const agit_user *a = prog_pat(slot);
+  if (a) memcpy(pl + 1, a, sizeof(agit_user));
+  send(PT_PAT, seq, pl, sizeof(pl));
+}
+
+static void pat_put(uint8_t seq, const uint8_t *p){
+  agit_user a;
+  memcpy(&a, p + 1, sizeof(a));
+  if (!prog_pat_save(p[0], &a)) return ack(PT_PAT_PUT, seq, PS_INVALID, TL_ERR_PATTERN);
+  proto_writes++;
+  ack(PT_PAT_PUT, seq, prog_flush() ? PS_OK : PS_FLASH);
+}
+
+// Data requests are answered here, run control goes to loop() as a proto_cmd
+static bool request(const uint8_t *f, uint16_t n, proto_cmd *c){
+  uint8_t        type = f[0];
+  uint8_t        seq  = f[1];
+  const uint8_t *p    = f + 2;
+  uint16_t       len  = n - 2;
+
+  bool write = type == PT_PROG_PUT || type == PT_LIB_CLEAR || type == PT_LIB_ADD || type == PT_LIB_END ||
+               type == PT_PAT_PUT;               // a loaded process has the pattern times
+  if (write && locked) {
+    ack(type, seq, PS_BUSY);
+    return false;
+  }
+  switch (type) {
+    case PT_HELLO:
+      hello(seq);
+      return false;
+
+    case PT_PROG_GET:
+      if (len != 1) break;
+      if (p[0] >= PROG_N) ack(type, seq, PS_RANGE);
+      else prog_get(seq, p[0]);
+      return false;
+
+    case PT_PROG_PUT:
+      if (len != 1 + PROG_WORDS * 2) break;
+      if (p[0] >= PROG_N) ack(type, seq, PS_RANGE);
+      else prog_put(seq, p);
+      return false;
+
+    case PT_PAT_GET:
+      if (len != 1) break;
+      if (p[0] >= AGIT_USER) ack(type, seq, PS_RANGE);
+      else pat_get(seq, p[0]);
+      return false;
+
+    case PT_PAT_PUT:
+      if (len != 1 + sizeof(agit_user)) break;
+      if (p[0] >= AGIT_USER) ack(type, seq, PS_RANGE);
+      else pat_put(seq, p);
+      return false;
+
+    case PT_LIB_GET:
+      if (len != 2) break;
+      if (get16(p) >= lib_count()) ack(type, seq, PS_RANGE);
+      else lib_get(seq, get16(p));
+      return false;
+
+    case PT_LIB_CLEAR:
+    case PT_LIB_END:
+      if (len != 0) break;
+      proto_writes++;
+      ack(type, seq, (type == PT_LIB_CLEAR ? lib_clear() : lib_end()) ? PS_OK : PS_FLASH);
+      return false;
+
+    case PT_LIB_ADD:
+      if (len < 1 || p[0] == 0 || len != 1 + p[0] * sizeof(recipe)) break;
+      lib_put(seq, p + 1, p[0]);
+      return false;
+
+    case PT_LOAD:
+      if (len != 1) break;
+      *c = {PC_LOAD, p[0], seq};
+      return true;
+
+    case PT_START:
+    case PT_ABORT:
+      if (len != 0) break;
+      *c = {(uint8_t)(type == PT_START ? PC_START : PC_ABORT), 0, seq};
+      return true;
+  }
+  ack(type, seq, PS_BAD);
+  return false;
+}
+
+//---------------------------------Receiving---------------------------------
+// In place, false if the COBS code runs past the end
+static bool cobs_decode(uint8_t *b, uint16_t *n){
+  uint16_t in = 0, out = 0;
+  while (in < *n) {
+    uint8_t code = b[in++];
+    if (in + code - 1 > *n) return false;
+    for (uint8_t i = 1; i < code; i++) b[out++] = b[in++];
+    if (code != 0xFF && in < *n) b[out++] = 0;
+  }
+  *n = out;
+  return true;
+}
+
+// A whole frame is in rx, true if it is run control for loop()
+static bool frame(proto_cmd *c){
+  uint16_t n = rx_n;
+  if (!cobs_decode(rx, &n) || n < 6) return false;
+  n -= 4;
+  if (crc32(rx, n) != (get16(rx + n) | (uint32_t)get16(rx + n + 2) << 16)) return false;
+  return request(rx, n, c);
+}
+
+bool proto_poll(proto_cmd *c){
+  while (Serial.available() > 0) {
+    uint8_t b = Serial.read();
+    if (!rx_in) {
+      if (b == 0) {
+        rx_in = 1;
+        rx_n  = 0;
+        continue;
+      }
+      *c = {PC_CHAR, b, 0};
+      return true;
+    }
+    if (b != 0) {
+      if (rx_n < PROTO_RX) rx[rx_n++] = b;
+      else rx_over = 1;
+      continue;
+    }
+    if (rx_n == 0) continue;                     // opening zero after a closing one
+    bool got = !rx_over && frame(c);
+    rx_in   = 0;
+    rx_over = 0;
+    if (got) return true;
+  }
+  return false;
+}
+
+void proto_lock(bool run){
+  locked = run;
+}
+
+#if PROTO_RX_WAKE
+static void rx_event(void *, esp_event_base_t, int32_t, void *){
+  power_wake();                                  // power_idle() doesn't wait for the next tick
+}
+#endif
+
+void proto_begin(){
+#if PROTO_RX_WAKE
+  Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, rx_event);
+#endif
+}
@@ -0,0 +1,138 @@
+// Host protocol
+//
+// Binary frames on the USB serial port, next to the debug text. A frame is
+//   0x00  COBS(type, seq, payload, CRC-32)  0x00
+// with the CRC-32 of crc32() over type, seq and payload, little-endian like
+// every field. COBS leaves no zero inside, so the zeros mark the frames and
+// debug text printed between two frames is a chunk of its own the host shows
+// as text. Bytes outside a frame are still single character commands.
+//
+// The host asks, the timer answers with the same seq:
+//   PT_HELLO                     PT_HELLO version, PROG_N, PROG_WORDS,
+//                                builtin processes, library count16, PROTO_MAX.
+//                                From here telemetry and events are sent.
+//   PT_PROG_GET  slot            PT_PROG  slot, words[PROG_WORDS]
+//   PT_PROG_PUT  slot, words     PT_ACK, written to flash
+//   PT_LIB_GET   pos16           PT_RECIPE pos16, recipe (sorted order)
+//   PT_LIB_CLEAR                 PT_ACK, the library is empty until
+//   PT_LIB_ADD   n, recipe * n   PT_ACK                 PT_LIB_END sorts it
+//   PT_LIB_END                   PT_ACK
+//   PT_LOAD      prog            PT_ACK, prog 0..8 programs, 9.. built in
+//   PT_START                     PT_ACK, as the START button
+//   PT_ABORT                     PT_ACK
+//   PT_PAT_GET   slot            PT_PAT slot, name[AGIT_NAME_LEN], code[AGIT_MAX_LEN]
+//   PT_PAT_PUT   slot, name, code  PT_ACK, written to flash; user pattern
+//                                AGIT_USER_BASE + slot, an empty name clears it
+// PT_ACK is request type, PS_* status, detail (tl_check() error).
+// Writes to flash are refused while a run is on, they would stall it.
+//
+// Sent on its own (seq 0):
+//   PT_TLM   every timer tick - t_ms32, state, stage, stages, motor,
+//            left_ms32, stage_ms32, loop_us32, late_us32, drops16
+//            state is run_state of main.cpp or PROTO_SELECT, motor 0 idle,
+//            1 agitating, 2 rotating; loop_us is the longest loop() pass and
+//            late_us the latest tick since the last PT_TLM
+//   PT_EVT   t_ms32, PE_* kind, stage, a16, b32
+//   PT_LOG   text, a serial log line (log_fmt()) - once a host has sent
+//            PT_HELLO the log goes out framed, so it can't hold the loop
+//            up on a full port; before that it is plain text
+//
+// Outgoing frames go into a PROTO_TX byte ring and proto_flush() hands as
+// many whole frames to the port as it takes without blocking. A host that
+// doesn't read only loses frames, counted in drops.
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+
+#define PROTO_VERSION 2
+#define PROTO_MAX     244                        // payload bytes, 3 recipes
+#define PROTO_RX      (PROTO_MAX + 8)            // type, seq, CRC and COBS overhead
+#define PROTO_TX      2048                       // outgoing ring, power of 2
+#define PROTO_POLL_MS 100                        // select screen serves the host this often
+#define PROTO_SELECT  0xFF                       // PT_TLM state on the select screen
+
+enum {                                           // frame types
+  PT_HELLO = 1,
+  PT_PROG_GET,
+  PT_PROG_PUT,
+  PT_LIB_GET,
+  PT_LIB_CLEAR,
+  PT_LIB_ADD,
+  PT_LIB_END,
+  PT_LOAD,
+  PT_START,
+  PT_ABORT,
+  PT_PAT_GET,
+  PT_PAT_PUT,
+  PT_ACK = 0x80,
+  PT_PROG,
+  PT_RECIPE,
+  PT_TLM,
+  PT_EVT,
+  PT_LOG,
+  PT_PAT
+};
+
+enum {                                           // PT_ACK status
+  PS_OK,
+  PS_BAD,                                        // unknown type or wrong length
+  PS_RANGE,                                      // no such program or recipe
+  PS_BUSY,                                       // a run is on
+  PS_STATE,                                      // not now, e.g. START with nothing to start
+  PS_INVALID,                                    // program can't run, detail is the tl_check() error,
+                                                 // or pattern code fails agit_check()
+  PS_FLASH                                       // flash write failed
+};
+
+enum {                                           // PT_EVT kind
+  PE_STAGE,                                      // stage screen up, a = stage time [s]
+  PE_START,                                      // stage timer started
+  PE_AGIT,                                       // a = count, b = pattern
+  PE_AGIT_DONE,                                  // b = how long it took [ms]
+  PE_SPIN,                                       // rotation started, a = reversal period [s]
+  PE_REVERSE,                                    // a = reversal, b = late against plan [us]
+  PE_SPIN_DONE,                                  // a = reversals, b = stop against stage end [us]
+  PE_STAGE_DONE,
+  PE_FINISHED,                                   // all baths done
+  PE_ABORTED
+};
+
+enum {                                           // proto_cmd.op, for loop()
+  PC_CHAR,                                       // byte outside a frame
+  PC_LOAD,
+  PC_START,
+  PC_ABORT
+};
+
+struct proto_cmd {
+  uint8_t op;
+  uint8_t arg;                                   // PC_CHAR the byte, PC_LOAD the program
+  uint8_t seq;                                   // for proto_ack()
+};
+
+struct proto_tlm {
+  uint8_t  state;
+  uint8_t  stage;
+  uint8_t  stages;
+  uint8_t  motor;
+  uint32_t left_ms;
+  uint32_t stage_ms;
+  uint32_t loop_us;
+  uint32_t late_us;
+};
+
+void proto_begin();
+bool proto_poll(proto_cmd *c);                   // answers data requests, hands run control out
+void proto_ack(const proto_cmd &c, uint8_t status, uint8_t detail = 0);
+void proto_tlm_send(const proto_tlm &t);
+void proto_event(uint8_t kind, uint8_t stage, uint16_t a = 0, int32_t b = 0);
+void proto_log(const char *s, uint16_t n);
+void proto_flush();
+void proto_lock(bool run);                       // run on, flash writes refused
+
+extern uint32_t proto_writes;                    // programs or library changed by the host
+extern uint32_t proto_drops;                     // frames the TX ring had no room for, log lines too
+
+#endif
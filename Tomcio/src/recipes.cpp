@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include "esp_partition.h"
+#include "recipes.h"
+#include "trace.h"
+
+#define SEC SPI_FLASH_SEC_SIZE
+
+static const esp_partition_t   *part = NULL;     // "recipes" partition
+static const uint8_t           *base = NULL;     // mapped partition
+static spi_flash_mmap_handle_t  map_h;
+static bool                     mapped = false;
+static uint16_t                 count  = 0;      // recipes in a valid library
+
+static uint16_t added;                           // lib_add() since lib_clear()
+static uint32_t erased_to;                       // record area erased up to here
+
+static const lib_hdr  *hdr()              { return (const lib_hdr *)base; }
+static const uint16_t *idx()              { return (const uint16_t *)(base + LIB_IDX_OFF); }
+static const recipe   *rec(uint16_t n)    { return (const recipe *)(base + LIB_REC_OFF) + n; }
+
+//---------------------------------Map library, check header and index---------------------------------
+bool lib_begin(){
+  TRACE_SCOPE(TR_FS);
+  const void *p;
+  count = 0;
+  if (!mapped) {
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)LIB_SUBTYPE, LIB_PART_NAME);
+    if (part == NULL || esp_partition_mmap(part, 0, LIB_PART_SIZE, SPI_FLASH_MMAP_DATA, &p, &map_h) != ESP_OK) return false;
+    base   = (const uint8_t *)p;
+    mapped = true;
+  }
+  const lib_hdr *h = hdr();
+  if (h->magic != LIB_MAGIC || h->version != LIB_VERSION || h->rec_size != sizeof(recipe) ||
+      h->count > LIB_MAX || h->crc != crc32(h, offsetof(lib_hdr, crc)) ||
+      h->idx_crc != crc32(idx(), h->count * sizeof(uint16_t))) return false;
+  count = h->count;
+  return true;
+}
+
+uint16_t lib_count(){
+  return count;
+}
+
+const recipe *lib_at(uint16_t pos){
+  return rec(idx()[pos]);
+}
+
+//---------------------------------Order---------------------------------
+static int field_cmp(const char *a, const char *b, size_t n){
+  for (size_t i = 0; i < n; i++) {
+    int d = toupper((uint8_t)a[i]) - toupper((uint8_t)b[i]);
+    if (d || !a[i]) return d;
+  }
+  return 0;
+}
+
+int lib_cmp(const recipe *a, const recipe *b){
+  int d = field_cmp(a->film, b->film, LIB_FILM_LEN);
+  if (!d) d = field_cmp(a->dev, b->dev, LIB_DEV_LEN);
+  if (!d) d = field_cmp(a->dil, b->dil, LIB_DIL_LEN);
+  if (!d) d = (int)a->iso - (int)b->iso;
+  return d;
+}
+
+// <0 film sorts before the prefix, 0 film starts with it, >0 after
+static int prefix_cmp(const char *film, const char *prefix){
+  for (uint8_t i = 0; prefix[i] && i < LIB_FILM_LEN; i++) {
+    int d = toupper((uint8_t)film[i]) - toupper((uint8_t)prefix[i]);
+    if (d) return d;
+  }
+  return 0;
+}
+
+//---------------------------------Search---------------------------------
+// [lo, hi) becomes the part of it whose films start with prefix
+void lib_narrow(const char *prefix, uint16_t *lo, uint16_t *hi){
+  uint16_t a = *lo, b = *hi;
+  while (a < b) {                                // first >= prefix
+    uint16_t m = a + (b - a) / 2;
+    if (prefix_cmp(lib_at(m)->film, prefix) < 0) a = m + 1;
+    else b = m;
+  }
+  uint16_t first = a;
+  b = *hi;
+  while (a < b) {                                // first > prefix
+    uint16_t m = a + (b - a) / 2;
+    if (prefix_cmp(lib_at(m)->film, prefix) <= 0) a = m + 1;
+    else b = m;
+  }
+  *lo = first;
+  *hi = a;
+}
+
+//=================================WRITING=================================
+
+bool lib_clear(){
+  if (!mapped) lib_begin();
+  if (!mapped) return false;
+  count     = 0;
+  added     = 0;
+  erased_to = LIB_REC_OFF;
+  return esp_partition_erase_range(part, 0, SEC) == ESP_OK;   // header first, the old library is gone
+}
+
+bool lib_add(const recipe *r, uint16_t n){
+  uint32_t off = LIB_REC_OFF + (uint32_t)added * sizeof(recipe);
+  uint32_t end = off + (uint32_t)n * sizeof(recipe);
+  if (!mapped || added + n > LIB_MAX) return false;
+  while (erased_to < end) {
+    if (esp_partition_erase_range(part, erased_to, SEC) != ESP_OK) return false;
+    erased_to += SEC;
+  }
+  if (esp_partition_write(part, off, r, end - off) != ESP_OK) return false;
+  added += n;
+  return true;
+}
+
+static int idx_cmp(const void *a, const void *b){
+  return lib_cmp(rec(*(const uint16_t *)a), rec(*(const uint16_t *)b));
+}
+
+// Sorts the index in RAM (2 bytes per recipe, only while writing), header last
+bool lib_end(){
+  if (!mapped) return false;
+  uint16_t *ix = (uint16_t *)malloc(added ? added * sizeof(uint16_t) : 1);
+  if (ix == NULL) return false;
+  for (uint16_t i = 0; i < added; i++) ix[i] = i;
+  qsort(ix, added, sizeof(uint16_t), idx_cmp);
+
+  lib_hdr h;
+  h.magic    = LIB_MAGIC;
+  h.version  = LIB_VERSION;
+  h.rec_size = sizeof(recipe);
+  h.count    = added;
+  h.idx_crc  = crc32(ix, added * sizeof(uint16_t));
+  h.crc      = crc32(&h, offsetof(lib_hdr, crc));
+
+  bool ok = esp_partition_erase_range(part, LIB_IDX_OFF, LIB_REC_OFF - LIB_IDX_OFF) == ESP_OK &&
+            (added == 0 || esp_partition_write(part, LIB_IDX_OFF, ix, added * sizeof(uint16_t)) == ESP_OK) &&
+            esp_partition_write(part, 0, &h, sizeof(h)) == ESP_OK;
+  free(ix);
+  return ok && lib_begin();
+}
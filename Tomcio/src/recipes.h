@@ -0,0 +1,62 @@
+// Recipe library
+//
+// Film / developer combinations in the "recipes" data partition, each one a
+// full program. The partition is memory mapped read-only; only the records
+// a screen actually reads are fetched from flash, so RAM use is the same
+// for ten recipes or ten thousand.
+//
+//   0x0000  lib_hdr, written last - no header means an empty library
+//   0x1000  index, uint16_t record numbers sorted by film, developer,
+//           dilution, ISO (film and developer ignore case)
+//   0x8000  records, in the order they were added
+//
+// Searching narrows a [lo, hi) range of index positions to the films that
+// start with the typed text, a binary search per typed character.
+
+#ifndef RECIPES_H
+#define RECIPES_H
+
+#include <stdint.h>
+#include "progstore.h"
+
+#define LIB_MAGIC      0x43455254                // "TREC"
+#define LIB_VERSION    1
+#define LIB_SUBTYPE    0x41                      // data partition subtype, see partitions.csv
+#define LIB_PART_NAME  "recipes"
+#define LIB_PART_SIZE  0x100000
+#define LIB_IDX_OFF    0x1000
+#define LIB_REC_OFF    0x8000
+#define LIB_MAX        ((LIB_PART_SIZE - LIB_REC_OFF) / sizeof(recipe))   // 12697, the index has room for 14336
+#define LIB_FILM_LEN   20                        // field sizes, zero padded
+#define LIB_DEV_LEN    16
+#define LIB_DIL_LEN    8
+
+struct recipe {
+  char     film[LIB_FILM_LEN];
+  char     dev[LIB_DEV_LEN];
+  char     dil[LIB_DIL_LEN];
+  uint16_t iso;
+  uint16_t prog[PROG_WORDS];                     // same layout as a program
+};
+
+struct lib_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t rec_size;                             // sizeof(recipe)
+  uint32_t count;
+  uint32_t idx_crc;                              // CRC-32 of the index
+  uint32_t crc;                                  // CRC-32 of the fields above
+};
+
+bool          lib_begin();
+uint16_t      lib_count();
+const recipe *lib_at(uint16_t pos);              // pos in sorted order
+void          lib_narrow(const char *prefix, uint16_t *lo, uint16_t *hi);
+int           lib_cmp(const recipe *a, const recipe *b);
+
+// Writing a new library - lib_clear() drops the old one first
+bool          lib_clear();
+bool          lib_add(const recipe *r, uint16_t n = 1);   // n records, one flash write
+bool          lib_end();
+
+#endif
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "resume.h"
+#include "fmt.h"
+
+#define SEC  SPI_FLASH_SEC_SIZE
+#define RECS (SEC / RESUME_REC)                  // records per sector
+
+static RTC_NOINIT_ATTR resume_ck rtc_ck[2];      // written in turn
+
+static const esp_partition_t   *part = NULL;     // "resume" partition
+static const uint8_t           *mir  = NULL;     // mapped mirror sectors
+static spi_flash_mmap_handle_t  map_h;
+static int16_t                  rec_next = -1;   // next record to write, sector * RECS + i, -1 no mirror
+static resume_ck                last;            // newest record in the mirror
+static uint32_t                 seq;             // last written, RTC or flash
+static uint8_t                  rtc_next;        // RTC slot written next
+static bool                     rtc_ok;          // the reset kept RTC memory
+static uint8_t                  reason;          // esp_reset_reason()
+
+static uint32_t rtc_writes;
+static uint32_t mir_writes, mir_erases, mir_fails;
+static uint32_t mir_us_max;                      // longest mirror write, erase included
+
+//---------------------------------Records---------------------------------
+static int64_t rtc_now(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static bool valid(const resume_ck *c){
+  return c->magic == RESUME_MAGIC && c->crc == crc32(c, offsetof(resume_ck, crc));
+}
+
+static bool newer(const resume_ck *a, const resume_ck *b){
+  return (int32_t)(a->seq - b->seq) > 0;
+}
+
+static const resume_ck *rec(uint16_t i){
+  return (const resume_ck *)(mir + i * RESUME_REC);
+}
+
+static bool blank(uint16_t i){
+  const uint32_t *w = (const uint32_t *)rec(i);
+  for (uint16_t k = 0; k < RESUME_REC / 4; k++) {
+    if (w[k] != 0xFFFFFFFF) return false;
+  }
+  return true;
+}
+
+//---------------------------------Flash mirror---------------------------------
+// Appended after the newest record. A torn record moves it on to the other
+// sector, which is erased first - the sector with the newest record never is.
+static void mirror(const resume_ck &ck){
+  if (rec_next < 0) return;
+  uint32_t t0 = micros();
+  if (rec_next >= RESUME_SECS * RECS) rec_next = 0;
+  if (!blank(rec_next)) {
+    if (rec_next % RECS) rec_next = (rec_next / RECS + 1) % RESUME_SECS * RECS;
+    if (!blank(rec_next)) {
+      mir_erases++;
+      if (esp_partition_erase_range(part, rec_next / RECS * SEC, SEC) != ESP_OK) mir_fails++;
+    }
+  }
+  if (esp_partition_write(part, rec_next * RESUME_REC, &ck, sizeof(ck)) == ESP_OK &&
+      !memcmp(rec(rec_next), &ck, sizeof(ck))) {
+    last = ck;
+    mir_writes++;
+  } else mir_fails++;
+  rec_next++;
+  mir_us_max = max(mir_us_max, micros() - t0);
+}
+
+//---------------------------------Boot---------------------------------
+void resume_begin(){
+  const void *p;
+  reason = esp_reset_reason();
+  rtc_ok = reason != ESP_RST_POWERON && reason != ESP_RST_UNKNOWN;
+  seq    = 0;
+
+  if (rtc_ok) {
+    for (uint8_t s = 0; s < 2; s++) {
+      if (valid(&rtc_ck[s]) && (int32_t)(rtc_ck[s].seq - seq) > 0) {
+        seq      = rtc_ck[s].seq;
+        rtc_next = s ^ 1;
+      }
+    }
+  }
+
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)RESUME_SUBTYPE, RESUME_PART_NAME);
+  if (part && esp_partition_mmap(part, 0, RESUME_SECS * SEC, SPI_FLASH_MMAP_DATA, &p, &map_h) == ESP_OK) {
+    mir = (const uint8_t *)p;
+    int16_t newest = -1;
+    for (uint16_t i = 0; i < RESUME_SECS * RECS; i++) {
+      if (valid(rec(i)) && (newest < 0 || newer(rec(i), rec(newest)))) newest = i;
+    }
+    rec_next = newest + 1;
+    if (newest >= 0) {
+      last = *rec(newest);
+      if ((int32_t)(last.seq - seq) > 0) seq = last.seq;
+    }
+  }
+}
+
+uint8_t resume_find(resume_ck *ck){
+  const resume_ck *best = NULL;
+  uint8_t          src  = RESUME_NONE;
+  for (uint8_t s = 0; rtc_ok && s < 2; s++) {
+    if (valid(&rtc_ck[s]) && (!best || newer(&rtc_ck[s], best))) {
+      best = &rtc_ck[s];
+      src  = RESUME_FROM_RTC;
+    }
+  }
+  if (rec_next >= 0 && valid(&last) && (!best || newer(&last, best))) {
+    best = &last;
+    src  = RESUME_FROM_FLASH;
+  }
+  if (!best || best->stage == RESUME_CLEAR) return RESUME_NONE;
+  *ck = *best;
+  return src;
+}
+
+int32_t resume_off_ms(const resume_ck &ck){
+  int64_t d = rtc_now() - ck.rtc_us;
+  return rtc_ok && d >= 0 ? d / 1000 : -1;
+}
+
+//---------------------------------Checkpoints---------------------------------
+// RTC every time, a copy and a CRC; the flash mirror at stage boundaries
+void resume_save(resume_ck &ck, bool mirror_too){
+  ck.magic  = RESUME_MAGIC;
+  ck.seq    = ++seq;
+  ck.rtc_us = rtc_now();
+  ck.spare  = 0;
+  ck.crc    = crc32(&ck, offsetof(resume_ck, crc));
+  rtc_ck[rtc_next] = ck;
+  rtc_next ^= 1;
+  rtc_writes++;
+  if (mirror_too) mirror(ck);
+}
+
+// A flash write only if the mirror still has a run on
+void resume_clear(){
+  resume_ck ck = {};
+  ck.stage = RESUME_CLEAR;
+  resume_save(ck, valid(&last) && last.stage != RESUME_CLEAR);
+}
+
+//---------------------------------Report---------------------------------
+void resume_report(){
+  char mir[64], ck[128] = "";
+  if (part == NULL) snprintf(mir, sizeof(mir), ", no \"" RESUME_PART_NAME "\" partition, flash partitions.csv");
+  else snprintf(mir, sizeof(mir), ", mirror record %d of %u", rec_next, RESUME_SECS * RECS);
+  if (rtc_writes) {
+    snprintf(ck, sizeof(ck), ", %lu checkpoints, %lu mirrored (longest %lu us), %lu erases, %lu failed",
+             (unsigned long)rtc_writes, (unsigned long)mir_writes, (unsigned long)mir_us_max,
+             (unsigned long)mir_erases, (unsigned long)mir_fails);
+  }
+  log_fmt("Resume: reset reason %u, RTC memory %s%s%s\n", reason, rtc_ok ? "kept" : "lost", mir, ck);
+}
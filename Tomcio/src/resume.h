@@ -0,0 +1,67 @@
+// Power-loss resume
+//
+// While a run is on, loop() keeps a checkpoint of it - program, stage, run
+// state, timeline cursor and ms into the stage - in RTC slow memory, on
+// every tick and timeline event. RTC_NOINIT memory keeps its contents
+// through every reset but power-on, and writing it is a copy and a CRC, so
+// it costs the run nothing. Two slots are written in turn, each with a
+// sequence number and CRC-32, a reset in the middle of one leaves the other.
+// The checkpoint also has the system time it was written at: gettimeofday()
+// runs on the RTC timer, which counts on through a reset, so the time the
+// timer was down can be added back.
+//
+// A power cut takes RTC memory with it, so the checkpoint is mirrored to
+// the "resume" data partition at stage boundaries only - stage screen up,
+// stage START and the stage's time up. Records are appended to one of two sectors, each one a
+// single page program; when the sector is full the other one is erased
+// and written from its start. The newest valid record wins at boot.
+//
+// setup() asks resume_find() before the select screen. From RTC memory the
+// run goes on where it would be now; from the flash mirror the time into
+// the stage is lost and the stage starts again from its screen, or the
+// next stage if its time was up.
+// resume_clear() is called when the run finishes or is aborted.
+
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stdint.h>
+#include "progstore.h"
+
+#define RESUME_MAGIC     0x53455254              // "TRES"
+#define RESUME_SUBTYPE   0x42                    // data partition subtype, see partitions.csv
+#define RESUME_PART_NAME "resume"
+#define RESUME_SECS      2                       // flash mirror sectors, written in turn
+#define RESUME_REC       128                     // flash record, 32 per sector
+#define RESUME_CLEAR     0xFF                    // resume_ck.stage of "no run on"
+#define RESUME_AUTO_MS   15000                   // offer screen goes on by itself after this
+
+struct resume_ck {
+  uint32_t magic;
+  uint32_t seq;                                  // newest valid wins, RTC and flash count together
+  int64_t  rtc_us;                               // system time when written
+  uint32_t elapsed_ms;                           // millis() - tl_base
+  uint32_t shift_ms;                             // tl_base - startTime, a late stage end moves tl_base
+  uint16_t tl_pos;                               // next timeline event
+  uint8_t  prog;                                 // sel_p, PROG_N and up built in processes
+  uint8_t  stage;                                // RESUME_CLEAR when the run ended
+  uint8_t  state;                                // run_state of main.cpp
+  uint8_t  spare;
+  uint16_t pd[PROG_WORDS];                       // program record, a recipe has no slot to come back from
+  uint32_t crc;                                  // CRC-32 of all bytes above
+};
+
+enum {                                           // resume_find() result
+  RESUME_NONE,
+  RESUME_FROM_RTC,                               // exact, rtc_us is good
+  RESUME_FROM_FLASH                              // stage boundary, time into the stage unknown
+};
+
+void    resume_begin();                          // after the partition table is readable
+uint8_t resume_find(resume_ck *ck);
+void    resume_save(resume_ck &ck, bool mirror); // fills magic, seq, rtc_us, crc
+void    resume_clear();
+int32_t resume_off_ms(const resume_ck &ck);      // time since an RTC checkpoint, -1 unknown
+void    resume_report();
+
+#endif
@@ -0,0 +1,69 @@
+#include "sched.h"
+
+static sched_ev heap[SCHED_SIZE];                // binary min-heap on due
+static uint8_t  heap_n = 0;
+
+uint32_t sched_late_max   = 0;
+uint32_t sched_late_worst = 0;
+uint32_t sched_dispatched = 0;
+
+// a is earlier than b (wrap-around safe)
+static inline bool before(uint32_t a, uint32_t b){
+  return (int32_t)(a - b) < 0;
+}
+
+static void sift_up(uint8_t i){
+  while (i > 0) {
+    uint8_t p = (i - 1) / 2;
+    if (!before(heap[i].due, heap[p].due)) break;
+    sched_ev t = heap[i]; heap[i] = heap[p]; heap[p] = t;
+    i = p;
+  }
+}
+
+static void sift_down(uint8_t i){
+  while (true) {
+    uint8_t l = 2 * i + 1;
+    uint8_t r = l + 1;
+    uint8_t m = i;
+    if (l < heap_n && before(heap[l].due, heap[m].due)) m = l;
+    if (r < heap_n && before(heap[r].due, heap[m].due)) m = r;
+    if (m == i) break;
+    sched_ev t = heap[i]; heap[i] = heap[m]; heap[m] = t;
+    i = m;
+  }
+}
+
+//---------------------------------Add event---------------------------------
+bool sched_at(uint32_t due, uint8_t id, uint16_t arg){
+  if (heap_n >= SCHED_SIZE) return false;
+  heap[heap_n].due = due;
+  heap[heap_n].id  = id;
+  heap[heap_n].arg = arg;
+  sift_up(heap_n);
+  heap_n++;
+  return true;
+}
+
+//---------------------------------Pop earliest event if due---------------------------------
+bool sched_pop(uint32_t now, sched_ev *ev){
+  if (heap_n == 0 || before(now, heap[0].due)) return false;
+  *ev = heap[0];
+  heap[0] = heap[--heap_n];
+  sift_down(0);
+  uint32_t late = now - ev->due;
+  if (late > sched_late_max) sched_late_max = late;
+  if (late > sched_late_worst) sched_late_worst = late;
+  sched_dispatched++;
+  return true;
+}
+
+void sched_clear(){
+  heap_n = 0;
+}
+
+bool sched_next_due(uint32_t *due){
+  if (heap_n == 0) return false;
+  *due = heap[0].due;
+  return true;
+}
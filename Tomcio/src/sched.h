@@ -0,0 +1,31 @@
+// Cooperative event scheduler
+//
+// Small fixed size min-heap of timed events ordered by deadline. Nothing in
+// here blocks - loop() pops whatever is due and dispatches it, so touch,
+// display and motor work all get serviced between events.
+//
+// Times are millis() values, compared with wrap-around safe arithmetic.
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_SIZE 16                            // max pending events
+
+struct sched_ev {
+  uint32_t due;                                  // deadline (millis)
+  uint8_t  id;                                   // event id
+  uint16_t arg;                                  // event argument
+};
+
+bool     sched_at(uint32_t due, uint8_t id, uint16_t arg = 0);
+bool     sched_pop(uint32_t now, sched_ev *ev);
+void     sched_clear();
+bool     sched_next_due(uint32_t *due);
+
+extern uint32_t sched_late_max;                  // worst lateness since the caller reset it [ms]
+extern uint32_t sched_late_worst;                // worst lateness since power on [ms]
+extern uint32_t sched_dispatched;                // events popped so far
+
+#endif
@@ -0,0 +1,163 @@
+// Widget tables of the program select, program edit, recipe library, run,
+// resume offer, run end and diagnostics screens
+//
+// Geometry is the one the screens always had. Edit screen rows are
+// generated, so its 34 +/- buttons come from two loops.
+
+#ifndef SCREENS_H
+#define SCREENS_H
+
+#include "ui.h"
+#include "Free_Fonts.h"
+
+//---------------------------------Program select---------------------------------
+enum { SEL_PREV, SEL_NEXT, SEL_LOAD, SEL_EDIT, SEL_LIB };
+
+constexpr std::array<widget, 5> SEL_UI = {{
+  {20,  240, 43,  60, 0,   0,   SEL_PREV, W_TRI_L, 0,        0, NULL, TFT_BLUE,  TFT_BLACK, NULL},
+  {417, 240, 43,  60, 0,   0,   SEL_NEXT, W_TRI_R, 0,        0, NULL, TFT_BLUE,  TFT_BLACK, NULL},
+  {130, 240, 220, 60, 240, 270, SEL_LOAD, W_BOX,   MC_DATUM, 1, FF22, TFT_BLACK, TFT_GREEN, "LOAD"},
+  {430, 50,  40,  10, 450, 55,  SEL_EDIT, W_TEXT,  MC_DATUM, 1, FF5,  TFT_RED,   TFT_BLACK, "Edit"},
+  {422, 90,  56,  30, 450, 105, SEL_LIB,  W_BOX,   MC_DATUM, 2, NULL, TFT_BLACK, TFT_YELLOW, "LIB"},
+}};
+constexpr auto SEL_GRID = ui_grid<ui_refs(SEL_UI)>(SEL_UI);
+UI_SCREEN(SEL, SEL_UI, SEL_GRID);
+static_assert(ui_covered(SEL), "program select: a control can't be hit where it is drawn");
+
+//---------------------------------Program edit---------------------------------
+// Field f of a program (0-16) is widgets 3f (-), 3f+1 (value), 3f+2 (+)
+#define E_MINUS(f) ((uint8_t)(2 * (f)))
+#define E_PLUS(f)  ((uint8_t)(2 * (f) + 1))
+#define E_FIELDS   17
+enum { E_SAVE = 2 * E_FIELDS, E_CANCEL };
+
+constexpr std::array<widget, 3 * E_FIELDS + 2 + 8> edit_ui(){
+  std::array<widget, 3 * E_FIELDS + 2 + 8> t{};
+  uint8_t n = 0;
+  // Dev / Stop / Fix rows: initial agitation, time, agitation count, agitation period
+  for (int16_t d = 1; d < 4; d++) {
+    for (int16_t p = 1; p < 5; p++) {
+      uint8_t f = (d - 1) * 4 + p - 1;
+      t[n++] = {(int16_t)(p * 100),      (int16_t)(d * 60 - 10), 20, 20, (int16_t)(p * 100 + 10), (int16_t)(d * 60), E_MINUS(f), W_TEXT,  MC_DATUM, 2, NULL, TFT_RED,   TFT_WHITE, "-"};
+      t[n++] = {0,                       0,                      0,  0,  (int16_t)(p * 100 + 40), (int16_t)(d * 60), W_NONE,     W_VALUE, MC_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, NULL};
+      t[n++] = {(int16_t)(p * 100 + 60), (int16_t)(d * 60 - 10), 20, 20, (int16_t)(p * 100 + 70), (int16_t)(d * 60), E_PLUS(f),  W_TEXT,  MC_DATUM, 2, NULL, TFT_BLUE,  TFT_WHITE, "+"};
+    }
+  }
+  // Rinse pattern
+  for (int16_t d = 0; d < 5; d++) {
+    uint8_t f = 12 + d;
+    t[n++] = {(int16_t)(105 + d * 75), 250, 20, 20, (int16_t)(115 + d * 75), 260, E_MINUS(f), W_TEXT,  MC_DATUM, 2, NULL, TFT_RED,   TFT_WHITE, "-"};
+    t[n++] = {0,                       0,   0,  0,  (int16_t)(140 + d * 75), 260, W_NONE,     W_VALUE, MC_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, NULL};
+    t[n++] = {(int16_t)(155 + d * 75), 250, 20, 20, (int16_t)(165 + d * 75), 260, E_PLUS(f),  W_TEXT,  MC_DATUM, 2, NULL, TFT_BLUE,  TFT_WHITE, "+"};
+  }
+  t[n++] = {9,   300, 52, 21, 10,  320, E_SAVE,   W_TEXT, BL_DATUM, 2, NULL, TFT_BLACK, TFT_GREEN,  "SAVE"};
+  t[n++] = {396, 300, 75, 21, 470, 320, E_CANCEL, W_TEXT, BR_DATUM, 2, NULL, TFT_BLACK, TFT_YELLOW, "CANCEL"};
+  // Row and column captions
+  t[n++] = {0, 0, 0, 0, 5,   60,  W_NONE, W_TEXT, ML_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "Dev"};
+  t[n++] = {0, 0, 0, 0, 5,   120, W_NONE, W_TEXT, ML_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "Stop"};
+  t[n++] = {0, 0, 0, 0, 5,   180, W_NONE, W_TEXT, ML_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "Fix"};
+  t[n++] = {0, 0, 0, 0, 5,   260, W_NONE, W_TEXT, ML_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "Rinse"};
+  t[n++] = {0, 0, 0, 0, 140, 10,  W_NONE, W_TEXT, MC_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "I-A"};
+  t[n++] = {0, 0, 0, 0, 240, 10,  W_NONE, W_TEXT, MC_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "Time"};
+  t[n++] = {0, 0, 0, 0, 340, 10,  W_NONE, W_TEXT, MC_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "A-C"};
+  t[n++] = {0, 0, 0, 0, 440, 10,  W_NONE, W_TEXT, MC_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, "A-T"};
+  return t;
+}
+
+constexpr auto EDIT_UI   = edit_ui();
+constexpr auto EDIT_GRID = ui_grid<ui_refs(EDIT_UI)>(EDIT_UI);
+UI_SCREEN(EDIT, EDIT_UI, EDIT_GRID);
+static_assert(ui_covered(EDIT), "program edit: a control can't be hit where it is drawn");
+
+//---------------------------------Recipe library---------------------------------
+// Result rows, page arrows, search text and a 12x3 keyboard
+#define LIB_ROWS  6
+#define LIB_ROW_Y 45
+#define LIB_ROW_H 24
+#define LIB_NKEYS 36
+enum { LIB_ROW0, LIB_UP = LIB_ROWS, LIB_DN, LIB_DEL, LIB_BACK, LIB_KEY0 };
+
+// Key i is LIB_KEY_LBL[2 * i], its label the string at LIB_KEY_LBL + 2 * i
+constexpr const char LIB_KEY_LBL[] =
+  "A\0" "B\0" "C\0" "D\0" "E\0" "F\0" "G\0" "H\0" "I\0" "J\0" "K\0" "L\0"
+  "M\0" "N\0" "O\0" "P\0" "Q\0" "R\0" "S\0" "T\0" "U\0" "V\0" "W\0" "X\0"
+  "Y\0" "Z\0" "0\0" "1\0" "2\0" "3\0" "4\0" "5\0" "6\0" "7\0" "8\0" "9\0";
+static_assert(sizeof(LIB_KEY_LBL) == 2 * LIB_NKEYS + 1, "one label per key");
+
+constexpr std::array<widget, LIB_ROWS + 4 + LIB_NKEYS + 2> lib_ui(){
+  std::array<widget, LIB_ROWS + 4 + LIB_NKEYS + 2> t{};
+  uint8_t n = 0;
+  for (int16_t i = 0; i < LIB_ROWS; i++) {
+    int16_t y = LIB_ROW_Y + i * LIB_ROW_H;
+    t[n++] = {0, y, 420, LIB_ROW_H, 5, (int16_t)(y + LIB_ROW_H / 2), (uint8_t)(LIB_ROW0 + i), W_VALUE, ML_DATUM, 2, NULL, TFT_WHITE, TFT_BLACK, NULL};
+  }
+  t[n++] = {425, 45,  50, 70, 0,   0,  LIB_UP,   W_TRI_U, 0,        0, NULL, TFT_BLUE,  TFT_BLACK,  NULL};
+  t[n++] = {425, 120, 50, 70, 0,   0,  LIB_DN,   W_TRI_D, 0,        0, NULL, TFT_BLUE,  TFT_BLACK,  NULL};
+  t[n++] = {300, 2,   80, 36, 340, 20, LIB_DEL,  W_BOX,   MC_DATUM, 2, NULL, TFT_RED,   TFT_WHITE,  "DEL"};
+  t[n++] = {390, 2,   88, 36, 434, 20, LIB_BACK, W_BOX,   MC_DATUM, 2, NULL, TFT_BLACK, TFT_YELLOW, "BACK"};
+  for (int16_t i = 0; i < LIB_NKEYS; i++) {
+    int16_t x = (i % 12) * 40, y = 212 + (i / 12) * 36;
+    t[n++] = {x, y, 40, 36, (int16_t)(x + 20), (int16_t)(y + 18), (uint8_t)(LIB_KEY0 + i), W_KEY, MC_DATUM, 2, NULL, TFT_WHITE, TFT_DARKGREY, LIB_KEY_LBL + 2 * i};
+  }
+  t[n++] = {0, 0, 0, 0, 5,   20,  W_NONE, W_VALUE, ML_DATUM, 2, NULL, TFT_YELLOW,    TFT_BLACK, NULL};   // search text
+  t[n++] = {0, 0, 0, 0, 210, 200, W_NONE, W_VALUE, MC_DATUM, 1, NULL, TFT_LIGHTGREY, TFT_BLACK, NULL};   // position
+  return t;
+}
+
+constexpr auto LIB_UI   = lib_ui();
+constexpr auto LIB_GRID = ui_grid<ui_refs(LIB_UI)>(LIB_UI);
+UI_SCREEN(LIB, LIB_UI, LIB_GRID);
+static_assert(ui_covered(LIB), "recipe library: a control can't be hit where it is drawn");
+
+#define LIB_FIND (LIB_ROWS + 4 + LIB_NKEYS)      // search text widget
+#define LIB_POS  (LIB_FIND + 1)                  // position widget
+
+//---------------------------------Run screens---------------------------------
+// START / Initial agitation button, start_btn() picks colour and labels
+enum { RUN_START };
+
+constexpr std::array<widget, 1> RUN_UI = {{
+  {130, 150, 220, 150, 240, 225, RUN_START, W_RBOX, MC_DATUM, 2, FF22, TFT_BLACK, TFT_GREEN, NULL},
+}};
+constexpr auto RUN_GRID = ui_grid<ui_refs(RUN_UI)>(RUN_UI);
+UI_SCREEN(RUN, RUN_UI, RUN_GRID);
+static_assert(ui_covered(RUN), "run screen: START can't be hit where it is drawn");
+
+//---------------------------------Resume offer---------------------------------
+// RESUME where LOAD is, a touch that keeps loading and starting goes on with the run
+enum { RES_GO, RES_DROP };
+
+constexpr std::array<widget, 2> RES_UI = {{
+  {130, 240, 220, 60, 240, 270, RES_GO,   W_BOX, MC_DATUM, 1, FF22, TFT_BLACK, TFT_GREEN, "RESUME"},
+  {362, 250, 110, 40, 417, 270, RES_DROP, W_BOX, MC_DATUM, 2, NULL, TFT_WHITE, TFT_RED,   "DISCARD"},
+}};
+constexpr auto RES_GRID = ui_grid<ui_refs(RES_UI)>(RES_UI);
+UI_SCREEN(RES, RES_UI, RES_GRID);
+static_assert(ui_covered(RES), "resume offer: a control can't be hit where it is drawn");
+
+//---------------------------------Run end---------------------------------
+// DONE / ABORTED, DIAG out of the way of the START button a touch script hits
+enum { FIN_DIAG };
+
+constexpr std::array<widget, 1> FIN_UI = {{
+  {362, 250, 110, 40, 417, 270, FIN_DIAG, W_BOX, MC_DATUM, 2, NULL, TFT_BLACK, TFT_CYAN, "DIAG"},
+}};
+constexpr auto FIN_GRID = ui_grid<ui_refs(FIN_UI)>(FIN_UI);
+UI_SCREEN(FIN, FIN_UI, FIN_GRID);
+static_assert(ui_covered(FIN), "run end: DIAG can't be hit where it is drawn");
+
+//---------------------------------Diagnostics---------------------------------
+// Four histogram panels of DIAG_PW x DIAG_PH under the title, drawn by the screen
+#define DIAG_PW 240
+#define DIAG_PH 137
+#define DIAG_Y  44
+enum { DIAG_BACK };
+
+constexpr std::array<widget, 1> DIAG_UI = {{
+  {390, 2, 88, 36, 434, 20, DIAG_BACK, W_BOX, MC_DATUM, 2, NULL, TFT_BLACK, TFT_YELLOW, "BACK"},
+}};
+constexpr auto DIAG_GRID = ui_grid<ui_refs(DIAG_UI)>(DIAG_UI);
+UI_SCREEN(DIAG, DIAG_UI, DIAG_GRID);
+static_assert(ui_covered(DIAG), "diagnostics: BACK can't be hit where it is drawn");
+
+#endif
@@ -0,0 +1,105 @@
+#include <math.h>
+#include "step_profile.h"
+
+//---------------------------------Profile parameters---------------------------------
+// Same math as BasicStepperDriver::startMove() for LINEAR_SPEED
+void profile_init(step_profile *p, float rpm, short motor_steps, short microsteps, short accel, short decel, long steps){
+  float speed = rpm * motor_steps / 60;          // [full steps/s]
+
+  p->steps           = steps;
+  p->steps_to_cruise = speed * speed * microsteps / (2 * accel);
+  p->steps_to_brake  = p->steps_to_cruise * accel / decel;
+  if (steps < p->steps_to_cruise + p->steps_to_brake) {
+    // cannot reach max speed, will need to brake early
+    p->steps_to_cruise = steps * decel / (accel + decel);
+    p->steps_to_brake  = steps - p->steps_to_cruise;
+  }
+  // Initial pulse (c0) including error correction factor 0.676 [us]
+  p->first_pulse  = (1e+6) * 0.676 * sqrt(2.0f / accel / microsteps);
+  p->cruise_pulse = 1e+6 / speed / microsteps;
+}
+
+void profile_start(const step_profile *p, step_iter *it){
+  it->remaining = p->steps;
+  it->count     = 0;
+  it->pulse     = p->first_pulse;
+  it->rest      = 0;
+}
+
+//---------------------------------Next interval---------------------------------
+// Same series as BasicStepperDriver::calcStepPulse(), returns 0 after the last step
+long profile_next(const step_profile *p, step_iter *it){
+  if (it->remaining <= 0) return 0;
+
+  long interval = it->pulse;
+
+  it->remaining--;
+  it->count++;
+  if (it->remaining > 0) {
+    if (it->remaining <= p->steps_to_brake) {
+      // decelerating
+      it->pulse = it->pulse - (2*it->pulse+it->rest)/(-4*it->remaining+1);
+      it->rest  = (2*it->pulse+it->rest) % (-4*it->remaining+1);
+    } else if (it->count <= p->steps_to_cruise) {
+      // accelerating
+      if (it->count < p->steps_to_cruise) {
+        it->pulse = it->pulse - (2*it->pulse+it->rest)/(4*it->count+1);
+        it->rest  = (2*it->pulse+it->rest) % (4*it->count+1);
+      } else {
+        // the series approximates target, set the final value to what it should be instead
+        it->pulse = p->cruise_pulse;
+        it->rest  = 0;
+      }
+    }
+  }
+  return interval;
+}
+
+//---------------------------------RMT items---------------------------------
+// Up to max items for the steps from it on, each step high_us high and then
+// low for the rest of its interval. 1us RMT ticks in 15 bit durations, an
+// interval too long for one item goes on in all low items of up to two
+// RMT_DUR_MAX halves. No duration is 0, that would end the transmission.
+// Stops before a step whose items don't fit, and once the move is done.
+uint32_t profile_items(const step_profile *p, step_iter *it, rmt_item32_t *out, uint32_t max, uint16_t high_us){
+  uint32_t n = 0;
+
+  while (n < max) {
+    step_iter at = *it;
+    long w = profile_next(p, it);
+    if (w <= 0) break;
+
+    long low   = w - high_us;
+    long extra = low > RMT_DUR_MAX ? (low - RMT_DUR_MAX + 2*RMT_DUR_MAX - 1) / (2*RMT_DUR_MAX) : 0;
+    if (n + 1 + extra > max) {                   // next call starts with this step
+      *it = at;
+      break;
+    }
+    long d = low - 2*extra < RMT_DUR_MAX ? low - 2*extra : RMT_DUR_MAX;
+    out[n].level0    = 1;
+    out[n].duration0 = high_us;
+    out[n].level1    = 0;
+    out[n].duration1 = d;
+    n++;
+    for (low -= d; extra > 0; extra--, n++) {    // at least 2 us left per item
+      long c = (low + extra - 1) / extra;
+      out[n].level0    = 0;
+      out[n].duration0 = c / 2;
+      out[n].level1    = 0;
+      out[n].duration1 = c - c / 2;
+      low -= c;
+    }
+  }
+  return n;
+}
+
+//---------------------------------Whole move---------------------------------
+uint32_t profile_time_us(const step_profile *p){
+  step_iter it;
+  uint32_t total = 0;
+  long w;
+
+  profile_start(p, &it);
+  while ((w = profile_next(p, &it)) > 0) total += w;
+  return total;
+}
@@ -0,0 +1,39 @@
+// Step pulse profile
+//
+// Reproduces StepperDriver's LINEAR_SPEED accel/cruise/decel series so a move
+// can be precomputed and played by a peripheral instead of nextAction().
+// Interval i is the time from step i to step i+1, the last one is the trailing
+// wait the library returns after the final step. profile_items() turns the
+// intervals into the RMT items the motor plays, one STEP pulse each, and
+// more items for an interval longer than a duration field holds.
+
+#ifndef STEP_PROFILE_H
+#define STEP_PROFILE_H
+
+#include <stdint.h>
+#include "driver/rmt.h"
+
+#define RMT_DUR_MAX 32767                        // rmt_item32_t duration, 15 bits
+
+struct step_profile {
+  long steps;                                    // steps in the move
+  long steps_to_cruise;                          // end of acceleration
+  long steps_to_brake;                           // length of deceleration
+  long first_pulse;                              // c0 [us]
+  long cruise_pulse;                             // cruise interval [us]
+};
+
+struct step_iter {
+  long remaining;
+  long count;
+  long pulse;
+  long rest;
+};
+
+void     profile_init(step_profile *p, float rpm, short motor_steps, short microsteps, short accel, short decel, long steps);
+void     profile_start(const step_profile *p, step_iter *it);
+long     profile_next(const step_profile *p, step_iter *it);
+uint32_t profile_items(const step_profile *p, step_iter *it, rmt_item32_t *out, uint32_t max, uint16_t high_us);
+uint32_t profile_time_us(const step_profile *p);
+
+#endif
@@ -0,0 +1,79 @@
+#include <Arduino.h>
+#include "tick.h"
+
+static tick_ev           ring[TICK_RING];
+static volatile uint32_t head;                   // written by the ISR only
+static volatile uint32_t tail;                   // written by loop() only
+static uint32_t          stats_seq;              // ticks up to this one aren't in the late stats
+static volatile uint32_t fired_t;                // time of the last tick fired
+static volatile bool     fired;
+
+volatile uint32_t tick_seq = 0;
+uint32_t tick_done     = 0;
+uint32_t tick_rebuilt  = 0;
+uint32_t tick_late_max = 0;
+uint32_t tick_late_sum = 0;
+uint32_t tick_late_n   = 0;
+
+//---------------------------------ISR side---------------------------------
+void IRAM_ATTR tick_push(){
+  uint32_t s = tick_seq + 1;
+  uint32_t h = head;
+  if (h - tail < TICK_RING) {                    // when full only seq counts it
+    ring[h % TICK_RING].seq  = s;
+    ring[h % TICK_RING].t_us = micros();
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&tick_seq, s, __ATOMIC_RELEASE);   // after the slot is visible
+  fired_t = micros();
+  fired   = 1;
+}
+
+// Before the first tick it is at most a period away
+uint32_t tick_next_us(){
+  return fired ? fired_t + TICK_US : micros() + TICK_US;
+}
+
+//---------------------------------Loop side---------------------------------
+// A gap in seq, or seq ahead of an empty ring, is ticks dropped while the
+// ring was full. They come out in order all the same, timed a whole number
+// of periods before the next one that has a slot, or the last one fired.
+bool tick_pop(tick_ev *ev){
+  uint32_t s = __atomic_load_n(&tick_seq, __ATOMIC_ACQUIRE);   // before head, its slot is in
+  uint32_t t = tail;
+  bool     in = t != __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  if (in && ring[t % TICK_RING].seq == tick_done + 1) {
+    *ev = ring[t % TICK_RING];
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+  } else if (in || s != tick_done) {
+    const tick_ev &next = in ? ring[t % TICK_RING] : tick_ev{s, fired_t};
+    ev->seq  = tick_done + 1;
+    ev->t_us = next.t_us - (next.seq - ev->seq) * TICK_US;
+    tick_rebuilt++;
+  } else {
+    return false;
+  }
+  tick_done = ev->seq;
+
+  if ((int32_t)(ev->seq - stats_seq) > 0) {
+    uint32_t late = micros() - ev->t_us;
+    if (late > tick_late_max) tick_late_max = late;
+    tick_late_sum += late / 1000;
+    tick_late_n++;
+  }
+  return true;
+}
+
+// The select screen blocks loop(), the ticks that came meanwhile are no
+// one's lateness. Seq before head: ticks pushed in between are rebuilt.
+void tick_skip(){
+  tick_done = __atomic_load_n(&tick_seq, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&tail, __atomic_load_n(&head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+void tick_stats_reset(){
+  stats_seq     = __atomic_load_n(&tick_seq, __ATOMIC_ACQUIRE);
+  tick_late_max = 0;
+  tick_late_sum = 0;
+  tick_late_n   = 0;
+}
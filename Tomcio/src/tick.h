@@ -0,0 +1,39 @@
+// Timer tick queue
+//
+// Timer0_ISR pushes every 500ms tick with its micros() timestamp into a
+// single producer / single consumer ring. loop() pops them in order, so a
+// loop that was held up sees each tick it missed and how late it got to it.
+// If a stall outlasts the ring the sequence number still counts the ticks,
+// the ones that fell out are rebuilt from it with their nominal time, so
+// loop() still gets every one.
+
+#ifndef TICK_H
+#define TICK_H
+
+#include <stdint.h>
+
+#define TICK_RING 32                             // ticks held, power of 2 (16s at 500ms)
+#define TICK_US   500000UL                       // timer 0 period
+#define TICK_DIV  8000                           // timer 0 prescaler, 80MHz APB -> 10kHz
+#define TICK_TIMER_US 100                        // one timer 0 count
+#define TICK_ALARM (TICK_US / TICK_TIMER_US)
+
+struct tick_ev {
+  uint32_t seq;                                  // 1, 2, 3 ... without gaps
+  uint32_t t_us;                                 // micros() when the timer fired
+};
+
+void tick_push();                                // ISR side
+bool tick_pop(tick_ev *ev);
+uint32_t tick_next_us();                         // micros() the next tick is due
+void tick_stats_reset();                         // late stats from the next tick fired on
+void tick_skip();                                // all fired so far handled, loop() wasn't running
+
+extern volatile uint32_t tick_seq;               // ticks fired
+extern uint32_t tick_done;                       // ticks handed to loop() or skipped
+extern uint32_t tick_rebuilt;                    // handed out from seq after the ring overran
+extern uint32_t tick_late_max;                   // worst handling delay since reset [us]
+extern uint32_t tick_late_sum;                   // [ms], for the mean
+extern uint32_t tick_late_n;
+
+#endif
@@ -0,0 +1,140 @@
+#include <stddef.h>
+#include "timeline.h"
+#include "agit.h"
+
+tl_ev    tl[TL_SIZE];
+uint16_t tl_n;
+tl_stage tl_st[TL_STAGES];
+process  tl_proc;
+
+// Where compile() puts a process - the globals for tl_load(), nowhere for
+// tl_check(), which only counts the events
+struct sink {
+  tl_ev    *ev;                                  // NULL: count only
+  tl_stage *st;
+  uint16_t  n;
+};
+
+static bool add(sink &k, uint32_t t, uint8_t stage, uint8_t type, uint8_t arg = 0){
+  if (k.n >= TL_SIZE) return false;
+  if (k.ev) k.ev[k.n] = {t, stage, type, arg};
+  k.n++;
+  return true;
+}
+
+// insertion sort of one stage by (t, type) - few events, runs once per load
+static void sort(tl_ev *ev, uint16_t first, uint16_t n){
+  for (uint16_t i = first + 1; i < first + n; i++) {
+    tl_ev e = ev[i];
+    uint16_t j = i;
+    while (j > first && (ev[j-1].t > e.t || (ev[j-1].t == e.t && ev[j-1].type > e.type))) {
+      ev[j] = ev[j-1];
+      j--;
+    }
+    ev[j] = e;
+  }
+}
+
+static uint32_t agit_ms(const bath &b, uint8_t count){
+  return (agit_us(agit_code(b.pattern), count) + 999) / 1000;
+}
+
+// Agitation of a loaded stage, rounded up
+uint32_t tl_agit_ms(uint8_t stage, uint8_t count){
+  return agit_ms(tl_proc.b[stage], count);
+}
+
+//---------------------------------Compile a process---------------------------------
+static uint8_t compile(const process &p, sink &k){
+  if (p.n == 0 || p.n > TL_STAGES) return TL_ERR_TIME;
+
+  for (uint8_t st = 0; st < p.n; st++) {
+    const bath &b     = p.b[st];
+    uint16_t    first = k.n;
+    if (k.st) {
+      k.st[st].first = first;
+      k.st[st].len   = 0;
+    }
+    const uint8_t *code = agit_code(b.pattern);
+    if (!code || !agit_check(code)) return TL_ERR_PATTERN;
+
+    if (b.flags & PB_TOUCH) {                    // one agitation on START, nothing timed
+      if (b.init > 127) return TL_ERR_COUNT;
+      if (!add(k, 0, st, TL_RINSE, b.init)) return TL_ERR_FULL;
+      if (k.st) k.st[st].count = 1;
+      continue;
+    }
+
+    uint32_t len    = b.time * 1000UL;
+    uint32_t period = b.every * 1000UL;
+    bool     spin   = b.flags & PB_SPIN;         // rotates from TL_AGIT_INIT to TL_END
+    if (len == 0) return TL_ERR_TIME;
+    if ((b.flags & PB_DRAIN) && len <= TL_DRAIN_MS) return TL_ERR_TIME;
+    if (spin && period == 0) return TL_ERR_PERIOD;
+    if (!spin) {
+      if (b.init > 127 || b.count > 127) return TL_ERR_COUNT;
+      if (b.count > 0 && period == 0) return TL_ERR_PERIOD;
+      if (b.count > 0 && agit_ms(b, b.count) >= period) return TL_ERR_OVERLAP;
+      if (b.count > 0 && agit_ms(b, b.init) >= period) return TL_ERR_OVERLAP;
+    }
+
+    bool ok = add(k, 0, st, TL_AGIT_INIT, spin ? 0 : b.init);
+    if (b.count > 0 && !spin) {
+      for (uint32_t t = period; t < len && ok; t += period) ok = add(k, t, st, TL_AGIT, b.count);
+    }
+    if (b.flags & PB_DRAIN) ok = ok && add(k, len - TL_DRAIN_MS, st, TL_DRAIN);
+    if (b.flags & PB_BUZZ_DRAIN) {
+      ok = ok && add(k, len - TL_DRAIN_MS, st, TL_BUZZ_ON);
+      ok = ok && add(k, len, st, TL_BUZZ_OFF);
+    }
+    ok = ok && add(k, len, st, TL_END);
+    if (b.flags & PB_BUZZ_DONE) {
+      ok = ok && add(k, len, st, TL_BUZZ_ON);
+      ok = ok && add(k, len + TL_DONE_MS, st, TL_BUZZ_OFF);
+    }
+    ok = ok && add(k, len + TL_DONE_MS, st, TL_NEXT);
+    if (!ok) return TL_ERR_FULL;
+
+    if (k.st) {
+      k.st[st].len   = len;
+      k.st[st].count = k.n - first;
+    }
+    if (k.ev) sort(k.ev, first, k.n - first);
+  }
+
+  return TL_OK;
+}
+
+uint8_t tl_load(const process *p){
+  tl_n = 0;
+  if (p->n == 0 || p->n > TL_STAGES) return TL_ERR_TIME;
+  if (p != &tl_proc) tl_proc = *p;
+
+  sink k = {tl, tl_st, 0};
+  uint8_t err = compile(tl_proc, k);
+  tl_n = k.n;
+  return err;
+}
+
+uint8_t tl_check(const process *p){
+  sink k = {NULL, NULL, 0};
+  return compile(*p, k);
+}
+
+uint8_t tl_check(const uint16_t *pd){
+  process p;
+  proc_from_prog(pd, &p);
+  return tl_check(&p);
+}
+
+const char *tl_error(uint8_t err){
+  switch (err) {
+    case TL_ERR_TIME:    return "Stage time is 0 or too short for drain off";
+    case TL_ERR_PERIOD:  return "Agitation or reversal period is 0";
+    case TL_ERR_OVERLAP: return "Agitation takes longer than its period";
+    case TL_ERR_COUNT:   return "Too many rotations in one agitation";
+    case TL_ERR_FULL:    return "Too many events in program";
+    case TL_ERR_PATTERN: return "Unknown agitation pattern";
+  }
+  return "";
+}
@@ -0,0 +1,70 @@
+// Session timeline
+//
+// A loaded process is compiled once into a sorted array of events, the run
+// loop then just walks a cursor over it and the progress bar is drawn from
+// the same array. Every bath of the process is one stage. Times are ms from
+// the stage START touch. Processes that can't be run are rejected here
+// instead of failing halfway through a roll. Agitation lengths come from
+// agit_us(), the same code the motor runs.
+//
+// tl_check() runs the same compile without storing anything, so programs
+// coming in from the host or an import are checked while a loaded process
+// and its timeline stay as they are.
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include "process.h"
+
+#define TL_SIZE     256                          // max events per session
+#define TL_STAGES   PROC_BATHS                   // one per bath
+#define TL_DRAIN_MS 10000                        // drain off warning before stage end
+#define TL_DONE_MS  5000                         // done message before next stage
+
+enum {                                           // tl_ev.type, also order at equal times
+  TL_AGIT_INIT,                                  // initial agitation, started by touch
+  TL_AGIT,                                       // periodic agitation
+  TL_DRAIN,                                      // drain off warning
+  TL_END,                                        // stage time elapsed
+  TL_BUZZ_ON,
+  TL_BUZZ_OFF,
+  TL_NEXT,                                       // go to next stage
+  TL_RINSE                                       // touch step agitation, started by touch
+};
+
+enum {                                           // tl_load() / tl_check() result
+  TL_OK,
+  TL_ERR_TIME,                                   // stage time 0 or shorter than drain warning
+  TL_ERR_PERIOD,                                 // agitations or rotation with no period
+  TL_ERR_OVERLAP,                                // agitation longer than its period
+  TL_ERR_COUNT,                                  // too many inversions for one agitation
+  TL_ERR_FULL,                                   // more than TL_SIZE events
+  TL_ERR_PATTERN                                 // unknown or broken agitation pattern
+};
+
+struct tl_ev {
+  uint32_t t;                                    // ms from stage START
+  uint8_t  stage;
+  uint8_t  type;
+  uint8_t  arg;                                  // inversions for agitations
+};
+
+struct tl_stage {
+  uint16_t first;                                // index of first event
+  uint16_t count;                                // events in this stage
+  uint32_t len;                                  // stage time [ms]
+};
+
+extern tl_ev    tl[TL_SIZE];
+extern uint16_t tl_n;
+extern tl_stage tl_st[TL_STAGES];
+extern process  tl_proc;                         // process loaded, tl_st[i] is bath tl_proc.b[i]
+
+uint8_t     tl_load(const process *p);
+uint8_t     tl_check(const process *p);          // tl_load() error, globals untouched
+uint8_t     tl_check(const uint16_t *pd);        // program record, see proc_from_prog()
+uint32_t    tl_agit_ms(uint8_t stage, uint8_t count);
+const char *tl_error(uint8_t err);
+
+#endif
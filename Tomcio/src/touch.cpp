@@ -0,0 +1,283 @@
+#include "touch.h"
+#include "power.h"
+#include "fmt.h"
+#include "trace.h"
+
+static TFT_eSPI *tft;
+
+enum { TS_UP, TS_DOWN };
+
+static uint8_t  state = TS_UP;
+static uint8_t  up_cnt;                          // samples without pressure while down
+static uint16_t last_x, last_y;
+static uint32_t hold_at;                         // millis() of next HOLD
+static volatile uint32_t irq_us;                 // micros() of the T_IRQ edge
+
+static uint32_t presses;
+static uint32_t lat_max;                         // IRQ edge to PRESS queued [us]
+static uint32_t lat_sum;
+static uint32_t spi_n;                           // touch controller transactions
+static uint32_t stats_t0;
+
+#if TOUCH_TASK
+static QueueHandle_t     evt_q;
+static SemaphoreHandle_t tft_mtx;
+static TaskHandle_t      touch_th;
+#else
+static touch_ev          evt_ring[TOUCH_QUEUE];
+static uint8_t           evt_head, evt_tail;
+static volatile bool     irq_flag;
+static bool              active;                 // sampling a press
+static uint32_t          next_ms;
+#endif
+
+#if TOUCH_IRQ >= 0
+//---------------------------------T_IRQ edge---------------------------------
+static void IRAM_ATTR touch_isr(){
+  irq_us = micros();
+#if TOUCH_TASK
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(touch_th, &woken);
+  if (woken) portYIELD_FROM_ISR();
+#else
+  irq_flag = 1;
+#endif
+}
+#endif
+
+static void post(uint8_t type, uint16_t x, uint16_t y){
+  touch_ev ev = {type, x, y, millis()};
+#if TOUCH_TASK
+  xQueueSend(evt_q, &ev, 0);                     // UI busy with a full queue - drop
+  power_wake();
+#else
+  if ((uint8_t)(evt_head - evt_tail) < TOUCH_QUEUE) evt_ring[evt_head++ % TOUCH_QUEUE] = ev;
+#endif
+}
+
+//---------------------------------One filtered sample---------------------------------
+static uint16_t median(uint16_t *v){
+  for (uint8_t i = 1; i < TOUCH_OVERSAMPLE; i++) {
+    uint16_t k = v[i];
+    int8_t j = i - 1;
+    while (j >= 0 && v[j] > k) { v[j + 1] = v[j]; j--; }
+    v[j + 1] = k;
+  }
+  return v[TOUCH_OVERSAMPLE / 2];
+}
+
+// Pressure before and after the raw readings, so a finger lifting half way
+// through doesn't leave a bogus coordinate
+static bool sample(uint16_t *x, uint16_t *y){
+  TRACE_SCOPE(TR_TOUCH);
+  uint16_t xs[TOUCH_OVERSAMPLE], ys[TOUCH_OVERSAMPLE];
+
+  spi_n++;
+  if (tft->getTouchRawZ() < TOUCH_Z_MIN) return false;
+  for (uint8_t i = 0; i < TOUCH_OVERSAMPLE; i++) tft->getTouchRaw(&xs[i], &ys[i]);
+  spi_n += TOUCH_OVERSAMPLE + 1;
+  if (tft->getTouchRawZ() < TOUCH_Z_MIN) return false;
+
+  *x = median(xs);
+  *y = median(ys);
+  tft->convertRawXY(x, y);
+  return true;
+}
+
+//---------------------------------Press state machine---------------------------------
+// Returns true while the panel needs sampling again in TOUCH_SAMPLE_MS
+static bool touch_step(){
+  uint16_t x, y;
+  bool on = sample(&x, &y);
+  uint32_t now = millis();
+
+  if (state == TS_UP) {
+    if (!on) return false;                       // edge without a press
+    uint32_t lat = micros() - irq_us;
+    if (lat > lat_max) lat_max = lat;
+    lat_sum += lat;
+    presses++;
+    state   = TS_DOWN;
+    up_cnt  = 0;
+    last_x  = x;
+    last_y  = y;
+    hold_at = now + TOUCH_HOLD_MS;
+    post(TOUCH_PRESS, x, y);
+    return true;
+  }
+
+  if (on) {
+    up_cnt = 0;
+    last_x = x;
+    last_y = y;
+    if ((int32_t)(now - hold_at) >= 0) {
+      hold_at += TOUCH_REPEAT_MS;
+      post(TOUCH_HOLD, x, y);
+    }
+    return true;
+  }
+  if (++up_cnt < TOUCH_UP_N) return true;
+  state = TS_UP;
+  post(TOUCH_RELEASE, last_x, last_y);
+  return false;
+}
+
+#if TOUCH_TASK
+//---------------------------------Touch task---------------------------------
+static void touch_task(void *){
+  for (;;) {
+#if TOUCH_IRQ >= 0
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    vTaskDelay(pdMS_TO_TICKS(TOUCH_SETTLE_MS));
+#else
+    vTaskDelay(pdMS_TO_TICKS(TOUCH_IDLE_MS));
+    irq_us = micros();
+#endif
+    bool more;
+    do {
+      tft_take();
+      more = touch_step();
+      tft_give();
+      if (more) vTaskDelay(pdMS_TO_TICKS(TOUCH_SAMPLE_MS));
+    } while (more);
+#if TOUCH_IRQ >= 0
+    ulTaskNotifyTake(pdTRUE, 0);                 // edges caused by our own reads
+#endif
+  }
+}
+#endif
+
+//---------------------------------Init---------------------------------
+void touch_begin(TFT_eSPI *t){
+  tft = t;
+  stats_t0 = millis();
+#if TOUCH_TASK
+  evt_q   = xQueueCreate(TOUCH_QUEUE, sizeof(touch_ev));
+  tft_mtx = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(touch_task, "touch", TOUCH_STACK, NULL, TOUCH_PRIO, &touch_th, TOUCH_CORE);
+#endif
+#if TOUCH_IRQ >= 0
+  pinMode(TOUCH_IRQ, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(TOUCH_IRQ), touch_isr, FALLING);
+#endif
+}
+
+//---------------------------------UI side---------------------------------
+// The press reaches the power state here, on the loop task that owns it
+bool touch_poll(touch_ev *ev){
+#if TOUCH_TASK
+  if (xQueueReceive(evt_q, ev, 0) != pdTRUE) return false;
+#else
+  if (evt_head == evt_tail) return false;
+  *ev = evt_ring[evt_tail++ % TOUCH_QUEUE];
+#endif
+  if (ev->type == TOUCH_PRESS) power_event();
+  return true;
+}
+
+// Blocks until a press (and with repeat, a HOLD), display lock released meanwhile.
+// With a timeout [ms] it gives up after that long and returns false.
+bool touch_wait(uint16_t *x, uint16_t *y, bool repeat, uint32_t timeout){
+  touch_ev ev;
+  uint32_t t0 = millis();
+  for (;;) {
+    uint32_t left = timeout - (millis() - t0);
+    if (timeout && (int32_t)left <= 0) return false;
+#if TOUCH_TASK
+    tft_give();
+    bool got = xQueueReceive(evt_q, &ev, timeout ? pdMS_TO_TICKS(left) : portMAX_DELAY) == pdTRUE;
+    tft_take();
+    if (!got) continue;
+    if (ev.type == TOUCH_PRESS) power_event();
+#else
+    if (!touch_poll(&ev)) {
+      touch_service();
+      delay(1);
+      continue;
+    }
+#endif
+    if (ev.type == TOUCH_PRESS || (repeat && ev.type == TOUCH_HOLD)) break;
+  }
+  *x = ev.x;
+  *y = ev.y;
+  return true;
+}
+
+void tft_take(){
+#if TOUCH_TASK
+  xSemaphoreTake(tft_mtx, portMAX_DELAY);
+#endif
+}
+
+void tft_give(){
+#if TOUCH_TASK
+  xSemaphoreGive(tft_mtx);
+#endif
+}
+
+//---------------------------------Cooperative sampling (no touch task)---------------------------------
+void touch_service(){
+#if !TOUCH_TASK
+  uint32_t now = millis();
+  if (!active) {
+#if TOUCH_IRQ >= 0
+    if (!irq_flag) return;
+    irq_flag = 0;
+    next_ms  = now + TOUCH_SETTLE_MS;
+#else
+    if ((int32_t)(now - next_ms) < 0) return;
+    irq_us  = micros();
+    next_ms = now;
+#endif
+    active = 1;
+  }
+  if ((int32_t)(now - next_ms) < 0) return;
+  active  = touch_step();
+  next_ms = now + (active ? TOUCH_SAMPLE_MS : TOUCH_IDLE_MS);
+  irq_flag = 0;
+#endif
+}
+
+// millis() touch_service() wants to run next, false while waiting for T_IRQ
+bool touch_next_due(uint32_t *due){
+#if TOUCH_TASK
+  return false;
+#else
+  if (irq_flag && !active) *due = millis();
+  else if (active || TOUCH_IRQ < 0) *due = next_ms;
+  else return false;
+  return true;
+#endif
+}
+
+bool touch_busy(){
+  return state != TS_UP;
+}
+
+// Light sleep wakes on the T_IRQ level, the edge interrupt never saw it
+void touch_kick(){
+#if TOUCH_IRQ >= 0
+  irq_us = micros();
+#if TOUCH_TASK
+  xTaskNotifyGive(touch_th);
+#else
+  irq_flag = 1;
+#endif
+#endif
+}
+
+//---------------------------------Stats---------------------------------
+void touch_stats_reset(){
+  presses  = 0;
+  lat_max  = 0;
+  lat_sum  = 0;
+  spi_n    = 0;
+  stats_t0 = millis();
+}
+
+void touch_report(const char *tag){
+  uint32_t s = (millis() - stats_t0) / 1000;
+  log_fmt("%s: %lu presses, press latency max %lu us, mean %lu us, %lu touch SPI transactions/s\n", tag,
+          (unsigned long)presses, (unsigned long)lat_max, (unsigned long)(presses ? lat_sum / presses : 0),
+          (unsigned long)(s ? spi_n / s : spi_n));
+}
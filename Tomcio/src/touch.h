@@ -0,0 +1,70 @@
+// Touch input
+//
+// The XPT2046 pulls T_IRQ low when the panel is pressed. The edge wakes a
+// touch task, which samples the panel every TOUCH_SAMPLE_MS for as long as
+// it stays pressed. Each sample takes the median of TOUCH_OVERSAMPLE raw
+// readings. The press, hold repeats and release go to a queue, and nothing
+// reads the touch controller while the panel is untouched.
+//
+// Touch and display share the SPI bus and the TFT_eSPI object. loop() holds
+// the display lock while it runs, and the touch task samples between passes.
+// touch_wait() hands the lock over while it blocks.
+//
+// Build with -D TOUCH_IRQ=<gpio> for the pin wired to T_IRQ. Without it the
+// task checks the pressure every TOUCH_IDLE_MS instead. On the host the same
+// state machine runs from loop() through touch_service().
+
+#ifndef TOUCH_H
+#define TOUCH_H
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+#ifndef TOUCH_IRQ
+  #define TOUCH_IRQ     -1                       // T_IRQ not wired, background polling
+#endif
+#define TOUCH_Z_MIN      600                     // pressure threshold, as getTouch()
+#define TOUCH_OVERSAMPLE 5                       // raw readings per sample (median)
+#define TOUCH_SETTLE_MS  2                       // from IRQ edge to first sample
+#define TOUCH_SAMPLE_MS  10                      // while pressed
+#define TOUCH_IDLE_MS    20                      // pressure check without T_IRQ
+#define TOUCH_UP_N       2                       // samples without pressure for release
+#define TOUCH_HOLD_MS    500                     // first HOLD after press
+#define TOUCH_REPEAT_MS  100                     // HOLD repeat
+#define TOUCH_QUEUE      8
+
+#if defined(ARDUINO_ARCH_ESP32)
+  #define TOUCH_TASK  1
+  #define TOUCH_CORE  1                          // with loop(), they share the SPI bus
+  #define TOUCH_PRIO  2                          // above loop()
+  #define TOUCH_STACK 3072
+#else
+  #define TOUCH_TASK  0
+#endif
+
+enum {                                           // touch_ev.type
+  TOUCH_PRESS,
+  TOUCH_HOLD,                                    // still pressed, repeats
+  TOUCH_RELEASE
+};
+
+struct touch_ev {
+  uint8_t  type;
+  uint16_t x, y;                                 // screen coordinates
+  uint32_t t;                                    // millis() of the event
+};
+
+void touch_begin(TFT_eSPI *tft);
+bool touch_poll(touch_ev *ev);
+bool touch_wait(uint16_t *x, uint16_t *y, bool repeat, uint32_t timeout = 0);
+void touch_service();
+bool touch_next_due(uint32_t *due);
+bool touch_busy();                               // press being sampled
+void touch_kick();                               // T_IRQ went low while nobody saw the edge
+void tft_take();
+void tft_give();
+
+void touch_stats_reset();
+void touch_report(const char *tag);
+
+#endif
@@ -0,0 +1,87 @@
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "trace.h"
+
+#ifdef HOT_TRACE
+
+#if defined(ARDUINO_ARCH_ESP32)
+  #define TRACE_CORE() xPortGetCoreID()
+#else
+  #define TRACE_CORE() 1
+#endif
+
+struct trace_rec_t {
+  uint32_t t;                                    // esp_timer [us]
+  uint8_t  id;
+  char     ph;
+  uint8_t  core;
+};
+
+static trace_rec_t      ring[TRACE_SIZE];
+static uint32_t         head;                    // records written, slot = head % TRACE_SIZE
+static volatile bool    paused;
+static uint32_t         rec_cycles;              // cost of one record, measured on first dump
+
+#define TRACE_NAME(id, name) name,
+static const char *const names[TR_COUNT] = { TRACE_IDS(TRACE_NAME) };
+#undef TRACE_NAME
+
+//---------------------------------Record---------------------------------
+// Both cores reserve a slot with one atomic add and fill it in, the oldest
+// records are overwritten. Timestamps come from esp_timer rather than the
+// cycle counter - that one is per core and wraps every 18s, while the motor
+// task can sleep longer than that between agitations.
+void trace_rec(uint8_t id, char ph){
+  if (paused) return;
+  uint32_t i = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED) & (TRACE_SIZE - 1);
+  ring[i].t    = esp_timer_get_time();
+  ring[i].id   = id;
+  ring[i].ph   = ph;
+  ring[i].core = TRACE_CORE();
+}
+
+void trace_clear(){
+  paused = 1;
+  head = 0;
+  paused = 0;
+}
+
+// Cycles per record, measured with the cycle counter on this core. The test
+// records use an id past the table and are skipped by the dump.
+static uint32_t rec_cost(){
+  const uint16_t n = 64;
+  uint32_t c0 = ESP.getCycleCount();
+  for (uint16_t i = 0; i < n; i++) trace_rec(TR_COUNT, 'i');
+  return (ESP.getCycleCount() - c0) / n;
+}
+
+//---------------------------------Chrome trace JSON---------------------------------
+void trace_dump(){
+  if (!rec_cycles) rec_cycles = rec_cost();
+  paused = 1;
+  uint32_t n     = min(head, (uint32_t)TRACE_SIZE);
+  uint32_t first = head - n;
+  uint32_t t0    = n ? ring[first & (TRACE_SIZE - 1)].t : 0;
+  uint32_t span  = 1;
+
+  Serial.print("{\"traceEvents\":[\n");
+  Serial.print("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"core 0 - motor\"}},\n");
+  Serial.print("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"core 1 - loop\"}}");
+  for (uint32_t k = first; k < head; k++) {
+    const trace_rec_t &r = ring[k & (TRACE_SIZE - 1)];
+    if (r.id >= TR_COUNT) continue;
+    uint32_t ts = r.t - t0;
+    if (ts > span && ts < 0x80000000UL) span = ts;
+    Serial.printf(",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu,\"pid\":1,\"tid\":%u}",
+                  names[r.id], r.ph, (unsigned long)ts, r.core);
+  }
+  // records * cost against the time they cover
+  uint32_t pct_x100 = (uint64_t)n * rec_cycles * 100 * 100 / ((uint64_t)span * (F_CPU / 1000000));
+  Serial.printf("\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"records\":%lu,\"dropped\":%lu,"
+                "\"record_cycles\":%lu,\"overhead\":\"%lu.%02lu%%\"}}\n",
+                (unsigned long)n, (unsigned long)(head - n), (unsigned long)rec_cycles,
+                (unsigned long)(pct_x100 / 100), (unsigned long)(pct_x100 % 100));
+  paused = 0;
+}
+
+#endif
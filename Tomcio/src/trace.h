@@ -0,0 +1,56 @@
+// Hot path trace
+//
+// TRACE_BEGIN()/TRACE_END() drop timestamped records into a RAM ring that
+// both cores write without taking a lock. Sending 't' on the serial port
+// dumps the ring as Chrome trace JSON - save it and open it in
+// chrome://tracing or ui.perfetto.dev.
+//
+// Build with -D HOT_TRACE, without it every macro compiles to nothing.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_SIZE 2048                          // records kept (8 bytes each), power of 2
+
+#define TRACE_IDS(X)                       \
+  X(TR_TFT_UPD,    "tft_upd")              \
+  X(TR_CLOCK,      "clock_draw")           \
+  X(TR_TOUCH,      "getTouch")             \
+  X(TR_TL_FIRE,    "tl_fire")              \
+  X(TR_IRIG,       "irig")                 \
+  X(TR_AGIT_DONE,  "agit_done")            \
+  X(TR_FS,         "spiffs")               \
+  X(TR_AGIT,       "agitation")            \
+  X(TR_MOVE,       "move")
+
+#define TRACE_ENUM(id, name) id,
+enum { TRACE_IDS(TRACE_ENUM) TR_COUNT };
+#undef TRACE_ENUM
+
+#ifdef HOT_TRACE
+
+void trace_rec(uint8_t id, char ph);             // ph 'B' begin, 'E' end
+void trace_dump();
+void trace_clear();
+
+struct trace_scope {
+  uint8_t id;
+  trace_scope(uint8_t id) : id(id) { trace_rec(id, 'B'); }
+  ~trace_scope() { trace_rec(id, 'E'); }
+};
+
+#define TRACE_BEGIN(id)  trace_rec(id, 'B')
+#define TRACE_END(id)    trace_rec(id, 'E')
+#define TRACE_SCOPE(id)  trace_scope trace_scope_(id)
+
+#else
+
+#define TRACE_BEGIN(id)  do {} while (0)
+#define TRACE_END(id)    do {} while (0)
+#define TRACE_SCOPE(id)  do {} while (0)
+
+#endif
+
+#endif
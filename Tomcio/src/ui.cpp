@@ -0,0 +1,41 @@
+#include "ui.h"
+
+//---------------------------------Draw one widget---------------------------------
+void ui_draw(TFT_eSPI &tft, const widget &w){
+  switch (w.kind) {
+    case W_TRI_L:
+      tft.fillTriangle(w.x, w.y + w.h / 2, w.x + w.w, w.y + w.h, w.x + w.w, w.y, w.fg);
+      return;
+    case W_TRI_R:
+      tft.fillTriangle(w.x + w.w, w.y + w.h / 2, w.x, w.y + w.h, w.x, w.y, w.fg);
+      return;
+    case W_TRI_U:
+      tft.fillTriangle(w.x + w.w / 2, w.y, w.x, w.y + w.h, w.x + w.w, w.y + w.h, w.fg);
+      return;
+    case W_TRI_D:
+      tft.fillTriangle(w.x + w.w / 2, w.y + w.h, w.x, w.y, w.x + w.w, w.y, w.fg);
+      return;
+    case W_KEY:
+      tft.fillRoundRect(w.x + 2, w.y + 2, w.w - 4, w.h - 4, 4, w.bg);
+      break;
+    case W_RBOX:
+      tft.fillSmoothRoundRect(w.x, w.y, w.w, w.h, 10, w.bg, TFT_WHITE);
+      return;
+    case W_BOX:
+      tft.fillRect(w.x, w.y, w.w, w.h, w.bg);
+      break;
+    case W_VALUE:
+      return;
+  }
+  if (w.label == NULL) return;
+  if (w.font) tft.setFreeFont(w.font);
+  else tft.setTextFont(1);
+  tft.setTextSize(w.size);
+  tft.setTextColor(w.fg, w.bg);
+  tft.setTextDatum(w.datum);
+  tft.drawString(w.label, w.ax, w.ay);
+}
+
+void ui_draw(TFT_eSPI &tft, const ui_screen &s){
+  for (uint8_t i = 0; i < s.n; i++) ui_draw(tft, s.w[i]);
+}
@@ -0,0 +1,161 @@
+// Screen widgets
+//
+// Each screen is a constexpr table of widgets. The same entry gives the draw
+// call (shape, font, colours, where the text is anchored) and the hit box the
+// touch code tests, so the two can't drift apart. ui_grid() sorts the hit
+// boxes into a 8x8 grid of 60x40 cells at compile time, a touch only looks
+// at the few widgets in its cell.
+//
+// ui_covered() is evaluated in static_asserts next to each table: the
+// centre of every drawn control, and the corners of GLCD text whose size is
+// known, must hit that control.
+
+#ifndef UI_H
+#define UI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <TFT_eSPI.h>
+
+#define W_NONE    0xFF                           // id of widgets that don't take touches
+
+#define GRID_CW   60                             // hit grid cell
+#define GRID_CH   40
+#define GRID_COLS 8                              // 480x320
+#define GRID_ROWS 8
+#define GRID_CELLS (GRID_COLS * GRID_ROWS)
+
+enum {                                           // widget.kind
+  W_TEXT,                                        // label at anchor
+  W_VALUE,                                       // number drawn by the screen, anchor only
+  W_BOX,                                         // filled rectangle, label centred
+  W_RBOX,                                        // round rectangle, labels drawn by the screen
+  W_TRI_L,                                       // arrow pointing left
+  W_TRI_R,                                       // arrow pointing right
+  W_TRI_U,                                       // arrow pointing up
+  W_TRI_D,                                       // arrow pointing down
+  W_KEY                                          // keyboard key, inset round rectangle, label centred
+};
+
+struct widget {
+  int16_t  x, y, w, h;                           // hit box, edges excluded like the old checks
+  int16_t  ax, ay;                               // text anchor
+  uint8_t  id;
+  uint8_t  kind;
+  uint8_t  datum;
+  uint8_t  size;                                 // text size
+  const GFXfont *font;                           // NULL = GLCD font
+  uint16_t fg, bg;
+  const char *label;
+};
+
+template <size_t R>
+struct ui_grid_t {
+  static_assert(R < 256, "too many hit grid refs for uint8_t offsets");
+  uint8_t first[GRID_CELLS + 1];                 // refs of cell c are ref[first[c] .. first[c+1])
+  uint8_t ref[R];                                // widget index
+};
+
+struct ui_screen {
+  const widget  *w;
+  uint8_t        n;
+  const uint8_t *first;
+  const uint8_t *ref;
+};
+
+//---------------------------------Grid build---------------------------------
+constexpr int16_t grid_c(int16_t v, int16_t cell, int16_t cnt){
+  return v < 0 ? 0 : (v / cell >= cnt ? cnt - 1 : v / cell);
+}
+
+template <size_t N>
+constexpr uint16_t ui_refs(const std::array<widget, N> &t){
+  uint16_t n = 0;
+  for (const widget &w : t) {
+    if (w.id == W_NONE) continue;
+    n += (grid_c(w.x + w.w - 1, GRID_CW, GRID_COLS) - grid_c(w.x + 1, GRID_CW, GRID_COLS) + 1) *
+         (grid_c(w.y + w.h - 1, GRID_CH, GRID_ROWS) - grid_c(w.y + 1, GRID_CH, GRID_ROWS) + 1);
+  }
+  return n;
+}
+
+// Counting sort of (cell, widget) pairs
+template <size_t R, size_t N>
+constexpr ui_grid_t<R> ui_grid(const std::array<widget, N> &t){
+  ui_grid_t<R> g{};
+  uint8_t fill[GRID_CELLS] = {};
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < N; i++) {
+      const widget &w = t[i];
+      if (w.id == W_NONE) continue;
+      for (int16_t r = grid_c(w.y + 1, GRID_CH, GRID_ROWS); r <= grid_c(w.y + w.h - 1, GRID_CH, GRID_ROWS); r++) {
+        for (int16_t c = grid_c(w.x + 1, GRID_CW, GRID_COLS); c <= grid_c(w.x + w.w - 1, GRID_CW, GRID_COLS); c++) {
+          uint8_t cell = r * GRID_COLS + c;
+          if (pass == 0) g.first[cell + 1]++;
+          else g.ref[g.first[cell] + fill[cell]++] = i;
+        }
+      }
+    }
+    if (pass == 0) {
+      for (uint8_t c = 0; c < GRID_CELLS; c++) g.first[c + 1] += g.first[c];
+    }
+  }
+  return g;
+}
+
+//---------------------------------Hit test---------------------------------
+constexpr uint8_t ui_hit(const ui_screen &s, int16_t x, int16_t y){
+  if (x < 0 || y < 0) return W_NONE;
+  uint8_t cell = grid_c(y, GRID_CH, GRID_ROWS) * GRID_COLS + grid_c(x, GRID_CW, GRID_COLS);
+  for (uint8_t k = s.first[cell]; k < s.first[cell + 1]; k++) {
+    const widget &w = s.w[s.ref[k]];
+    if (x > w.x && x < w.x + w.w && y > w.y && y < w.y + w.h) return w.id;
+  }
+  return W_NONE;
+}
+
+//---------------------------------Drawn-at check---------------------------------
+constexpr int16_t ui_len(const char *s){
+  int16_t n = 0;
+  while (s && s[n]) n++;
+  return n;
+}
+
+constexpr bool ui_covered(const ui_screen &s){
+  for (uint8_t i = 0; i < s.n; i++) {
+    const widget &w = s.w[i];
+    if (w.id == W_NONE) continue;
+    int16_t cx = w.x + w.w / 2, cy = w.y + w.h / 2;
+    if (w.kind == W_TRI_L) cx = w.x + 2 * w.w / 3;   // centroid
+    if (w.kind == W_TRI_R) cx = w.x + w.w / 3;
+    if (w.kind == W_TRI_U) cy = w.y + 2 * w.h / 3;
+    if (w.kind == W_TRI_D) cy = w.y + w.h / 3;
+    if (w.kind == W_TEXT && w.font == nullptr) {
+      // GLCD cell is 6x8 per size step, datum as TFT_eSPI
+      int16_t tw = 6 * w.size * ui_len(w.label), th = 8 * w.size;
+      int16_t tx = w.ax - (w.datum % 3) * tw / 2, ty = w.ay - (w.datum / 3) * th / 2;
+      const int16_t x0 = tx + 1, x1 = tx + tw - 2, y0 = ty + 1, y1 = ty + th - 2;
+      const int16_t px[4] = {x0, x1, x0, x1};
+      const int16_t py[4] = {y0, y0, y1, y1};
+      for (uint8_t k = 0; k < 4; k++) {
+        if (ui_hit(s, px[k], py[k]) != w.id) return false;
+      }
+      cx = tx + tw / 2;
+      cy = ty + th / 2;
+    } else if (w.kind == W_TEXT) {
+      cx = w.ax;                                 // free font, only the anchor is known
+      cy = w.ay;
+    }
+    if (ui_hit(s, cx, cy) != w.id) return false;
+  }
+  return true;
+}
+
+#define UI_SCREEN(name, table, grid) \
+  constexpr ui_screen name = {table.data(), (uint8_t)table.size(), grid.first, grid.ref}
+
+void ui_draw(TFT_eSPI &tft, const widget &w);
+void ui_draw(TFT_eSPI &tft, const ui_screen &s);
+
+#endif
@@ -0,0 +1,174 @@
+// Agitation patterns - pio test -e native -f test_agit
+//
+// The interpreter has to hand out exactly the actions worked out for a
+// made-up program, and agit_check() has to turn down broken code.
+//
+// Pattern times are checked against move times worked out by hand, not
+// against step_profile. A move of s microsteps at one speed is its two ramps
+// plus s - 2n cruise steps of c us (n, c as in test_step_profile):
+//   20 rpm  n = 35,  c = 937 us, ramps 124766 us (the 70 intervals summed)
+//   40 rpm  n = 142, c = 468 us, ramps 259005 us
+//   10 rpm  n = 8,   c = 1875 us, ramps 55099 us
+// and each move within 5% of d / v + v / a (2 sqrt(d / a) if it can't
+// reach v).
+// The motor path has to take that long on the sim clock and bring the tank
+// back to where it started.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <string.h>
+#include "motor.h"
+#include "agit.h"
+
+void setUp(){}
+void tearDown(){}
+
+//---------------------------------Interpreter---------------------------------
+static const uint8_t code[] = {
+  A_SPEED(30), A_LOOP(2), A_MOVE(10), A_LOOP(0), A_DWELL(5), A_NEXT, A_FLIP, A_NEXT,
+  A_TWIST(20, 2), A_VIBE(7), A_LOOP(0), A_MOVE(-5), A_NEXT, A_END
+};
+
+static void test_trace(){
+  static const agit_act want[] = {
+    {AA_MOVE, 30,  10, 0}, {AA_WAIT, 0, 0, 5}, {AA_WAIT, 0, 0, 5}, {AA_WAIT, 0, 0, 5},
+    {AA_MOVE, 30, -10, 0}, {AA_WAIT, 0, 0, 5}, {AA_WAIT, 0, 0, 5}, {AA_WAIT, 0, 0, 5},
+    {AA_MOVE, 30,  20, 0}, {AA_MOVE, 30, -20, 0}, {AA_MOVE, 30, 20, 0}, {AA_MOVE, 30, -20, 0},
+    {AA_VIBE, 0, 0, 7},
+    {AA_MOVE, 30, -5, 0}, {AA_MOVE, 30, -5, 0}, {AA_MOVE, 30, -5, 0},
+  };
+  const uint8_t n = sizeof(want) / sizeof(want[0]);
+  agit_vm  vm;
+  agit_act a;
+  uint8_t  i = 0;
+
+  TEST_ASSERT_TRUE(agit_check(code));
+  agit_start(&vm, code, 3, RPM);
+  while (agit_next(&vm, &a)) {
+    TEST_ASSERT_TRUE_MESSAGE(i < n, "more actions than expected");
+    TEST_ASSERT_EQUAL_UINT8(want[i].op, a.op);
+    TEST_ASSERT_EQUAL_UINT8(want[i].rpm, a.rpm);
+    TEST_ASSERT_EQUAL_INT16(want[i].deg, a.deg);
+    TEST_ASSERT_EQUAL_UINT16(want[i].ms, a.ms);
+    i++;
+  }
+  TEST_ASSERT_EQUAL_UINT8(n, i);
+  TEST_ASSERT_FALSE(agit_next(&vm, &a));         // stays at the end
+  TEST_ASSERT_EQUAL_UINT8(AA_END, a.op);
+}
+
+// Count 0 skips the inner loops: 2 moves, the twist and the vibration
+static void test_count_zero(){
+  agit_vm  vm;
+  agit_act a;
+  uint8_t  i = 0;
+  agit_start(&vm, code, 0, RPM);
+  while (agit_next(&vm, &a)) i++;
+  TEST_ASSERT_EQUAL_UINT8(7, i);
+}
+
+static void test_check_rejects(){
+  static const uint8_t bad_op[]    = {0x7F, A_END};
+  static const uint8_t open[]      = {A_LOOP(2), A_MOVE(90), A_END};
+  static const uint8_t stray[]     = {A_MOVE(90), A_NEXT, A_END};
+  static const uint8_t deep[]      = {A_LOOP(2), A_LOOP(2), A_LOOP(2), A_MOVE(90), A_NEXT, A_NEXT, A_NEXT, A_END};
+  static const uint8_t zero_move[] = {A_MOVE(0), A_END};
+  static const uint8_t far[]       = {A_MOVE(-(AGIT_MAX_DEG + 1)), A_END};
+  static const uint8_t slow[]      = {A_SPEED(0), A_END};
+  static const uint8_t fast[]      = {A_SPEED(AGIT_MAX_RPM + 1), A_END};
+  static const uint8_t cut[]       = {A_FLIP, AG_DWELL};
+  const uint8_t *const bad[] = {bad_op, open, stray, deep, zero_move, far, slow, fast};
+  for (uint8_t b = 0; b < sizeof(bad) / sizeof(bad[0]); b++) TEST_ASSERT_FALSE(agit_check(bad[b]));
+
+  uint8_t tail[AGIT_MAX_LEN];
+  memset(tail, AG_FLIP, sizeof(tail));
+  TEST_ASSERT_FALSE(agit_check(tail));           // no end
+  memcpy(tail + AGIT_MAX_LEN - sizeof(cut), cut, sizeof(cut));
+  TEST_ASSERT_FALSE(agit_check(tail));           // op cut at the end
+  for (uint8_t p = 0; p < agit_n; p++) TEST_ASSERT_TRUE(agit_check(agit_patterns[p].code));
+}
+
+//---------------------------------Duration---------------------------------
+#define M90_20  (124766 + (800  - 70)  * 937)    // 808776, test_step_profile
+#define M180_20 (124766 + (1600 - 70)  * 937)
+#define M15_20  (124766 + (133  - 70)  * 937)    // 15 deg is 133.3 microsteps
+#define M360_40 (259005 + (3200 - 284) * 468)
+#define M45_10  (55099  + (400  - 16)  * 1875)
+
+// One pass of each pattern's loop, and what comes once
+static const struct {
+  uint8_t  p;
+  uint32_t pass;
+  uint32_t once;
+} want[] = {
+  {AGIT_INVERT,   2 * M90_20 + 2 * AGIT_DWELL * 1000,    0     },
+  {AGIT_STEARMAN, 2 * M180_20 + 4 * M15_20 + 2 * 200000, 0     },   // a twist is two moves
+  {AGIT_ROTARY,   2 * M360_40 + 2 * 50000,               0     },
+  {AGIT_GENTLE,   2 * M45_10 + 2 * 300000,               500000},   // vibration at the end
+};
+
+static const uint8_t counts[] = {0, 1, 4};
+
+// Each move against the kinematics of its ramps at MOTOR_ACCEL, the
+// series comes in a few % under as in test_step_profile
+static void test_moves(){
+  TEST_ASSERT_UINT32_WITHIN(816667  / 20, 816667,  M90_20);
+  TEST_ASSERT_UINT32_WITHIN(1566667 / 20, 1566667, M180_20);
+  TEST_ASSERT_UINT32_WITHIN(191354  / 20, 191354,  M15_20);
+  TEST_ASSERT_UINT32_WITHIN(1633333 / 20, 1633333, M360_40);
+  TEST_ASSERT_UINT32_WITHIN(783333  / 20, 783333,  M45_10);
+  TEST_ASSERT_EQUAL_UINT32(808776, M90_20);
+}
+
+static void test_pattern_times(){
+  TEST_ASSERT_EQUAL_UINT8(4, agit_n);
+  for (const auto &w : want) {
+    for (uint8_t c : counts) {
+      TEST_ASSERT_EQUAL_UINT32(c * w.pass + w.once, agit_us(agit_patterns[w.p].code, c));
+    }
+  }
+}
+
+// Steps the pattern has the motor make
+static uint32_t pulses_of(const uint8_t *code, uint8_t count){
+  agit_vm  vm;
+  agit_act a;
+  uint32_t n = 0;
+  agit_start(&vm, code, count, RPM);
+  while (agit_next(&vm, &a)) {
+    if (a.op == AA_MOVE) n += labs((long)a.deg * MOTOR_STEPS * MICROST / 360);
+  }
+  return n;
+}
+
+static void test_motor_path(){
+  motor_begin();
+  for (const auto &w : want) {
+    for (uint8_t c : counts) {
+      long     pos0    = stepper.position;
+      uint32_t pulses0 = stepper.pulses;
+      uint32_t t0      = micros();
+      motor_evt e;
+      TEST_ASSERT_TRUE(motor_send({MOTOR_AGITATE, c, w.p, 0, 0}));
+      while (!motor_poll(&e)) {
+        uint32_t due;
+        if (motor_next_due(&due) && (int32_t)(due - micros()) > 0) delayMicroseconds(due - micros());
+        motor_service();
+      }
+      TEST_ASSERT_EQUAL_UINT32(c * w.pass + w.once, micros() - t0);
+      TEST_ASSERT_EQUAL_UINT32(pulses_of(agit_patterns[w.p].code, c), stepper.pulses - pulses0);
+      TEST_ASSERT_EQUAL_INT32(0, stepper.position - pos0);
+    }
+  }
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_trace);
+  RUN_TEST(test_count_zero);
+  RUN_TEST(test_check_rejects);
+  RUN_TEST(test_moves);
+  RUN_TEST(test_pattern_times);
+  RUN_TEST(test_motor_path);
+  return UNITY_END();
+}
@@ -0,0 +1,243 @@
+// Program store slot recovery - pio test -e native -f test_progstore
+//
+// The two image slots of the "progs" partition are edited in sim flash
+// memory to look like what a power loss or an old firmware leaves behind,
+// then prog_begin() has to map the newest image that is whole. User
+// patterns in it are only handed out if their code passes agit_check().
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stddef.h>
+#include "FS.h"
+#include "SPIFFS.h"
+#include "esp_partition.h"
+#include "progstore.h"
+
+#define SEC SPI_FLASH_SEC_SIZE
+
+static uint8_t *flash;
+
+static prog_image *slot_img(uint8_t s){
+  return (prog_image *)(flash + s * SEC);
+}
+
+// The slot prog_get() reads from, -1 the RAM copy
+static int8_t slot_in_use(){
+  const uint8_t *p = (const uint8_t *)prog_get(0);
+  for (uint8_t s = 0; s < PROG_SLOTS; s++) {
+    if (p >= flash + s * SEC && p < flash + (s + 1) * SEC) return s;
+  }
+  return -1;
+}
+
+// Image with every word of program p set to v + p, sealed as prog_flush() would
+static void write_img(uint8_t s, uint32_t seq, uint16_t v){
+  prog_image *m = slot_img(s);
+  memset(m, 0xFF, SEC);
+  m->magic   = PROG_MAGIC;
+  m->version = PROG_VERSION;
+  m->count   = PROG_N;
+  m->words   = PROG_WORDS;
+  m->seq     = seq;
+  for (uint8_t p = 0; p < PROG_N; p++) {
+    for (uint8_t i = 0; i < PROG_WORDS; i++) m->data[p][i] = v + p;
+  }
+  m->spare = 0xFFFF;
+  memset(m->pat, 0, sizeof(m->pat));
+  m->crc   = crc32(m, offsetof(prog_image, crc));
+}
+
+static const uint8_t swirl[] = {A_SPEED(30), A_LOOP(0), A_MOVE(120), A_DWELL(80), A_MOVE(-120), A_NEXT, A_END};
+
+static void make_pat(agit_user *a, const char *name){
+  memset(a, 0, sizeof(*a));
+  strcpy(a->name, name);
+  memcpy(a->code, swirl, sizeof(swirl));
+}
+
+void setUp(){
+  memset(flash, 0xFF, PROG_SLOTS * SEC);
+}
+
+void tearDown(){}
+
+//---------------------------------Picking a slot---------------------------------
+static void test_newest_slot_wins(){
+  write_img(0, 7, 100);
+  write_img(1, 8, 200);
+  TEST_ASSERT_TRUE(prog_begin());
+  TEST_ASSERT_EQUAL_INT8(1, slot_in_use());
+  TEST_ASSERT_EQUAL_UINT16(203, prog_get(3)[5]);
+
+  write_img(0, 9, 300);
+  prog_begin();
+  TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+  TEST_ASSERT_EQUAL_UINT16(300, prog_get(0)[0]);
+}
+
+// seq compared wrap-around safe, 0 comes after 0xFFFFFFFF
+static void test_seq_wraps(){
+  write_img(0, 0xFFFFFFFF, 100);
+  write_img(1, 0, 200);
+  prog_begin();
+  TEST_ASSERT_EQUAL_INT8(1, slot_in_use());
+}
+
+//---------------------------------Damaged images---------------------------------
+// A bit flipped in the newer image: its CRC fails, the older one is used
+static void test_bad_crc_falls_back(){
+  write_img(0, 7, 100);
+  write_img(1, 8, 200);
+  slot_img(1)->data[4][2] ^= 0x0100;
+  prog_begin();
+  TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+  TEST_ASSERT_EQUAL_UINT16(104, prog_get(4)[2]);
+}
+
+// Cut off while written: the tail, CRC included, is still erased
+static void test_torn_write_falls_back(){
+  write_img(0, 7, 100);
+  write_img(1, 8, 200);
+  memset((uint8_t *)slot_img(1) + 64, 0xFF, SEC - 64);
+  prog_begin();
+  TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+}
+
+static void test_other_version_ignored(){
+  write_img(0, 7, 100);
+  write_img(1, 8, 200);
+  slot_img(1)->version = PROG_VERSION + 1;
+  slot_img(1)->crc     = crc32(slot_img(1), offsetof(prog_image, crc));
+  prog_begin();
+  TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+}
+
+// Nothing valid and no /Program_N files: cleared programs, written as a
+// fresh image to slot 1 with seq 1
+static void test_nothing_valid_starts_fresh(){
+  write_img(0, 7, 100);
+  slot_img(0)->magic = 0;
+  TEST_ASSERT_TRUE(prog_begin());
+  TEST_ASSERT_EQUAL_INT8(1, slot_in_use());
+  TEST_ASSERT_EQUAL_UINT32(1, slot_img(1)->seq);
+  for (uint8_t p = 0; p < PROG_N; p++) TEST_ASSERT_EQUAL_UINT16(0, prog_get(p)[0]);
+}
+
+// Version 2 image, no patterns: the newest slot's programs go into a
+// version 3 image in the other slot
+static void test_v2_migrated(){
+  write_img(0, 7, 100);
+  write_img(1, 8, 200);
+  for (uint8_t s = 0; s < PROG_SLOTS; s++) {
+    slot_img(s)->version = 2;
+    uint32_t c = crc32(slot_img(s), offsetof(prog_image, pat));   // v2 ended in its CRC after spare
+    memcpy(slot_img(s)->pat, &c, 4);
+  }
+  TEST_ASSERT_TRUE(prog_begin());
+  TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+  TEST_ASSERT_EQUAL_UINT16(PROG_VERSION, slot_img(0)->version);
+  TEST_ASSERT_EQUAL_UINT16(205, prog_get(5)[0]);
+  TEST_ASSERT_EQUAL_UINT16(2, slot_img(1)->version);   // kept until the new one was whole
+  for (uint8_t u = 0; u < AGIT_USER; u++) TEST_ASSERT_NULL(prog_pat(u));
+}
+
+// Code that fails agit_check() or a name without its zero isn't handed out
+static void test_broken_pattern_left_out(){
+  write_img(0, 7, 100);
+  make_pat(&slot_img(0)->pat[0], "swirl");
+  make_pat(&slot_img(0)->pat[1], "far");
+  slot_img(0)->pat[1].code[5] = 0x7F;            // move of 32639 deg
+  slot_img(0)->pat[1].code[6] = 0x7F;
+  make_pat(&slot_img(0)->pat[2], "");
+  memset(slot_img(0)->pat[2].name, 'x', AGIT_NAME_LEN);
+  slot_img(0)->crc = crc32(slot_img(0), offsetof(prog_image, crc));
+  prog_begin();
+  TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+  TEST_ASSERT_NOT_NULL(prog_pat(0));
+  TEST_ASSERT_NULL(prog_pat(1));
+  TEST_ASSERT_NULL(prog_pat(2));
+  TEST_ASSERT_NULL(prog_pat(AGIT_USER));
+}
+
+//---------------------------------Saving---------------------------------
+// A flush goes to the slot not in use, the one in use stays as it was
+static void test_flush_alternates(){
+  write_img(0, 7, 100);
+  prog_begin();
+  uint16_t pd[PROG_WORDS];
+  memcpy(pd, prog_get(2), sizeof(pd));
+  pd[1] = 42;
+  prog_save(2, pd);
+  TEST_ASSERT_EQUAL_UINT16(42, prog_get(2)[1]);  // staged, in use right away
+  TEST_ASSERT_EQUAL_INT8(-1, slot_in_use());
+  TEST_ASSERT_TRUE(prog_flush());
+  TEST_ASSERT_EQUAL_INT8(1, slot_in_use());
+  TEST_ASSERT_EQUAL_UINT32(8, slot_img(1)->seq);
+  TEST_ASSERT_EQUAL_UINT16(102, slot_img(0)->data[2][1]);
+
+  prog_begin();                                  // power cycle
+  TEST_ASSERT_EQUAL_UINT16(42, prog_get(2)[1]);
+  TEST_ASSERT_EQUAL_UINT16(103, prog_get(3)[1]);
+}
+
+// Patterns are staged and flushed as programs are, broken ones refused
+static void test_pattern_saved(){
+  write_img(0, 7, 100);
+  prog_begin();
+  agit_user a;
+  make_pat(&a, "swirl");
+  TEST_ASSERT_TRUE(prog_pat_save(4, &a));
+  TEST_ASSERT_NOT_NULL(prog_pat(4));             // staged, in use right away
+  a.code[0] = AG_NEXT;
+  TEST_ASSERT_FALSE(prog_pat_save(5, &a));
+  TEST_ASSERT_TRUE(prog_flush());
+  TEST_ASSERT_EQUAL_INT8(1, slot_in_use());
+
+  prog_begin();                                  // power cycle
+  TEST_ASSERT_EQUAL_STRING("swirl", prog_pat(4)->name);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(swirl, prog_pat(4)->code, sizeof(swirl));
+  TEST_ASSERT_NULL(prog_pat(5));
+  TEST_ASSERT_EQUAL_UINT16(104, prog_get(4)[0]);
+
+  a.name[0] = 0;                                 // cleared
+  TEST_ASSERT_TRUE(prog_pat_save(4, &a));
+  TEST_ASSERT_NULL(prog_pat(4));
+}
+
+// Power lost part way through the write: the old programs at boot
+static void test_cut_flush_keeps_old(){
+  static const int32_t cuts[] = {0, 100, SEC, SEC + 64, SEC + (int32_t)sizeof(prog_image) - 1};
+  for (uint8_t k = 0; k < sizeof(cuts) / sizeof(cuts[0]); k++) {
+    write_img(0, 7, 100);
+    prog_begin();
+    uint16_t pd[PROG_WORDS] = {0};
+    prog_save(6, pd);
+    sim_flash_cut(cuts[k]);
+    TEST_ASSERT_FALSE(prog_flush());
+    sim_flash_cut(-1);
+    prog_begin();
+    TEST_ASSERT_EQUAL_INT8(0, slot_in_use());
+    TEST_ASSERT_EQUAL_UINT16(106, prog_get(6)[0]);
+  }
+}
+
+int main(){
+  sim_fs_root = ".pio/test_progstore";           // no /Program_N files in there
+  SPIFFS.begin();
+  SPIFFS.format();
+  sim_flash_detach();
+  flash = sim_flash_mem(PROG_PART_NAME);
+  UNITY_BEGIN();
+  RUN_TEST(test_newest_slot_wins);
+  RUN_TEST(test_seq_wraps);
+  RUN_TEST(test_bad_crc_falls_back);
+  RUN_TEST(test_torn_write_falls_back);
+  RUN_TEST(test_other_version_ignored);
+  RUN_TEST(test_nothing_valid_starts_fresh);
+  RUN_TEST(test_v2_migrated);
+  RUN_TEST(test_broken_pattern_left_out);
+  RUN_TEST(test_flush_alternates);
+  RUN_TEST(test_pattern_saved);
+  RUN_TEST(test_cut_flush_keeps_old);
+  return UNITY_END();
+}
@@ -0,0 +1,334 @@
+// Host protocol framing - pio test -e native -f test_proto
+//
+// Requests are COBS encoded here, independently of proto.cpp, fed in on the
+// simulated port and the answers taken apart again: CRC-32 against its
+// published check value, frames with a bad CRC or too long dropped without
+// losing the next one, text between frames, program writes checked without
+// touching the loaded timeline, user patterns checked before they are
+// kept, and the TX ring only handing whole frames to the port.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "proto.h"
+#include "progstore.h"
+#include "timeline.h"
+#include "esp_partition.h"
+
+static uint8_t out[8192];
+static size_t  out_n;
+
+struct frame {
+  uint8_t  b[PROTO_MAX + 8];
+  uint16_t n;                                    // type, seq, payload - CRC checked and cut off
+};
+
+void setUp(){
+  out_n = 0;
+  sim_serial_capture(out, sizeof(out), &out_n);
+}
+
+void tearDown(){
+  sim_serial_capture(NULL, 0, NULL);
+}
+
+//---------------------------------COBS, the textbook way---------------------------------
+static size_t cobs(const uint8_t *in, size_t n, uint8_t *o){
+  size_t code_at = 0, k = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < n; i++) {
+    if (in[i]) {
+      o[k++] = in[i];
+      code++;
+    }
+    if (!in[i] || code == 0xFF) {
+      o[code_at] = code;
+      code_at = k++;
+      code = 1;
+    }
+  }
+  o[code_at] = code;
+  return k;
+}
+
+static size_t uncobs(const uint8_t *in, size_t n, uint8_t *o){
+  size_t k = 0;
+  for (size_t i = 0; i < n;) {
+    uint8_t code = in[i++];
+    for (uint8_t j = 1; j < code && i < n; j++) o[k++] = in[i++];
+    if (code != 0xFF && i < n) o[k++] = 0;
+  }
+  return k;
+}
+
+static void send_req(uint8_t type, uint8_t seq, const uint8_t *pl, uint16_t len, bool bad_crc = false){
+  uint8_t f[PROTO_MAX + 6], w[PROTO_MAX + 16];
+  f[0] = type;
+  f[1] = seq;
+  memcpy(f + 2, pl, len);
+  uint32_t c = crc32(f, len + 2) ^ bad_crc;
+  for (uint8_t i = 0; i < 4; i++) f[len + 2 + i] = c >> (8 * i);
+  w[0] = 0;
+  size_t n = 1 + cobs(f, len + 6, w + 1);
+  w[n++] = 0;
+  sim_serial_feed(w, n);
+}
+
+// Splits out[] at the zeros, false if a frame doesn't decode or its CRC is off
+static bool frames(frame *fr, uint8_t max, uint8_t *got){
+  *got = 0;
+  size_t i = 0;
+  while (i < out_n) {
+    if (out[i] == 0) {
+      i++;
+      continue;
+    }
+    size_t j = i;
+    while (j < out_n && out[j]) j++;
+    if (j == out_n || *got == max) return false;  // no closing zero, or too many
+    frame &f = fr[(*got)++];
+    size_t n = uncobs(out + i, j - i, f.b);
+    if (n < 6) return false;
+    uint32_t c = f.b[n - 4] | f.b[n - 3] << 8 | f.b[n - 2] << 16 | (uint32_t)f.b[n - 1] << 24;
+    if (c != crc32(f.b, n - 4)) return false;
+    f.n = n - 4;
+    i = j;
+  }
+  return true;
+}
+
+// Polls until the input is used up, run control handed out lands in c
+static uint8_t poll_all(proto_cmd *c){
+  uint8_t n = 0;
+  while (Serial.available() > 0) n += proto_poll(c);
+  proto_flush();
+  return n;
+}
+
+//---------------------------------CRC-32---------------------------------
+static void test_crc32_check_value(){
+  const char *s = "123456789";
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32(s, 9));
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32(s + 4, 5, crc32(s, 4)));   // in parts
+  TEST_ASSERT_EQUAL_HEX32(0, crc32(s, 0));
+}
+
+//---------------------------------Requests---------------------------------
+static void test_hello(){
+  proto_cmd c;
+  send_req(PT_HELLO, 7, NULL, 0);
+  TEST_ASSERT_EQUAL_UINT8(0, poll_all(&c));
+  frame f[2];
+  uint8_t n;
+  TEST_ASSERT_TRUE(frames(f, 2, &n));
+  TEST_ASSERT_EQUAL_UINT8(1, n);
+  TEST_ASSERT_EQUAL_UINT16(9, f[0].n);
+  TEST_ASSERT_EQUAL_HEX8(PT_HELLO, f[0].b[0]);
+  TEST_ASSERT_EQUAL_UINT8(7, f[0].b[1]);
+  TEST_ASSERT_EQUAL_UINT8(PROTO_VERSION, f[0].b[2]);
+  TEST_ASSERT_EQUAL_UINT8(PROG_N, f[0].b[3]);
+  TEST_ASSERT_EQUAL_UINT8(PROG_WORDS, f[0].b[4]);
+  TEST_ASSERT_EQUAL_UINT8(PROTO_MAX, f[0].b[8]);
+}
+
+// Program 3 read back word for word, zeros in it and all
+static void test_prog_get(){
+  proto_cmd c;
+  uint8_t slot = 3;
+  send_req(PT_PROG_GET, 21, &slot, 1);
+  poll_all(&c);
+  frame f[1];
+  uint8_t n;
+  TEST_ASSERT_TRUE(frames(f, 1, &n));
+  TEST_ASSERT_EQUAL_UINT8(1, n);
+  TEST_ASSERT_EQUAL_HEX8(PT_PROG, f[0].b[0]);
+  TEST_ASSERT_EQUAL_UINT8(21, f[0].b[1]);
+  TEST_ASSERT_EQUAL_UINT8(3, f[0].b[2]);
+  const uint16_t *pd = prog_get(3);
+  for (uint8_t i = 0; i < PROG_WORDS; i++) TEST_ASSERT_EQUAL_UINT16(pd[i], f[0].b[3 + 2 * i] | f[0].b[4 + 2 * i] << 8);
+}
+
+static void test_bad_length_and_range(){
+  proto_cmd c;
+  uint8_t pl[2] = {PROG_N, 0};
+  send_req(PT_PROG_GET, 1, pl, 2);               // one byte too many
+  send_req(PT_PROG_GET, 2, pl, 1);               // no program 9
+  poll_all(&c);
+  frame f[2];
+  uint8_t n;
+  TEST_ASSERT_TRUE(frames(f, 2, &n));
+  TEST_ASSERT_EQUAL_UINT8(2, n);
+  static const uint8_t bad[]   = {PT_ACK, 1, PT_PROG_GET, PS_BAD, 0};
+  static const uint8_t range[] = {PT_ACK, 2, PT_PROG_GET, PS_RANGE, 0};
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(bad, f[0].b, 5);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(range, f[1].b, 5);
+}
+
+// Writes are checked with tl_check(): the process loaded for a run and its
+// timeline stay as they were, whether the program is taken or refused
+static void test_prog_put_keeps_timeline(){
+  static const uint16_t run[PROG_WORDS] = {4, 480, 4, 60, 4, 60, 4, 30, 4, 300, 4, 60, 5, 10, 20, 0, 0};
+  process p;
+  proc_from_prog(run, &p);
+  TEST_ASSERT_EQUAL_UINT8(TL_OK, tl_load(&p));
+  uint16_t n = tl_n;
+  uint32_t len = tl_st[0].len;
+
+  proto_cmd c;
+  uint8_t pl[1 + PROG_WORDS * 2] = {4};
+  for (uint8_t i = 0; i < PROG_WORDS; i++) pl[1 + 2 * i] = run[i] / 2;   // all times halved, low bytes
+  send_req(PT_PROG_PUT, 5, pl, sizeof(pl));
+  memset(pl + 1, 0, sizeof(pl) - 1);             // stage time 0, can't run
+  send_req(PT_PROG_PUT, 6, pl, sizeof(pl));
+  poll_all(&c);
+  frame f[3];                                    // the flush logs a line, as a frame
+  uint8_t got;
+  TEST_ASSERT_TRUE(frames(f, 3, &got));
+  TEST_ASSERT_EQUAL_UINT8(3, got);
+  TEST_ASSERT_EQUAL_HEX8(PT_LOG, f[0].b[0]);
+  TEST_ASSERT_EQUAL_UINT8(PS_OK, f[1].b[3]);
+  TEST_ASSERT_EQUAL_UINT8(PS_INVALID, f[2].b[3]);
+  TEST_ASSERT_EQUAL_UINT8(TL_ERR_TIME, f[2].b[4]);
+  TEST_ASSERT_EQUAL_UINT16(240, prog_get(4)[1]);
+
+  TEST_ASSERT_EQUAL_UINT16(n, tl_n);
+  TEST_ASSERT_EQUAL_UINT32(len, tl_st[0].len);
+  TEST_ASSERT_EQUAL_UINT32(480000, len);
+  TEST_ASSERT_EQUAL_MEMORY(&p, &tl_proc, sizeof(p));
+}
+
+// A pattern is kept only if it passes agit_check(), and reads back as sent
+static void test_pat_put_get(){
+  static const uint8_t code[] = {A_SPEED(30), A_LOOP(0), A_MOVE(120), A_DWELL(80), A_MOVE(-120), A_NEXT, A_END};
+  proto_cmd c;
+  uint8_t pl[1 + sizeof(agit_user)] = {2};
+  agit_user *a = (agit_user *)(pl + 1);
+  strcpy(a->name, "swirl");
+  memcpy(a->code, code, sizeof(code));
+  send_req(PT_PAT_PUT, 8, pl, sizeof(pl));
+  pl[0] = 3;
+  a->code[5] = 0;                                // move of 0 deg
+  send_req(PT_PAT_PUT, 9, pl, sizeof(pl));
+  send_req(PT_PAT_GET, 10, pl, 1);               // slot 3 stays empty
+  pl[0] = 2;
+  send_req(PT_PAT_GET, 11, pl, 1);
+  poll_all(&c);
+  frame f[5];
+  uint8_t got;
+  TEST_ASSERT_TRUE(frames(f, 5, &got));
+  TEST_ASSERT_EQUAL_UINT8(5, got);
+  TEST_ASSERT_EQUAL_HEX8(PT_LOG, f[0].b[0]);
+  TEST_ASSERT_EQUAL_UINT8(PS_OK, f[1].b[3]);
+  TEST_ASSERT_EQUAL_UINT8(PS_INVALID, f[2].b[3]);
+  TEST_ASSERT_EQUAL_UINT8(TL_ERR_PATTERN, f[2].b[4]);
+  TEST_ASSERT_EQUAL_HEX8(PT_PAT, f[3].b[0]);
+  TEST_ASSERT_EQUAL_UINT8(0, f[3].b[3]);         // no name
+  TEST_ASSERT_EQUAL_UINT8(2, f[4].b[2]);
+  TEST_ASSERT_EQUAL_STRING("swirl", (const char *)f[4].b + 3);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(code, f[4].b + 3 + AGIT_NAME_LEN, sizeof(code));
+
+  TEST_ASSERT_EQUAL_INT16(AGIT_USER_BASE + 2, agit_find("Swirl"));
+  TEST_ASSERT_EQUAL_PTR(prog_pat(2)->code, agit_code(AGIT_USER_BASE + 2));
+  TEST_ASSERT_NULL(agit_code(AGIT_USER_BASE + 3));
+}
+
+//---------------------------------Damaged input---------------------------------
+static void test_bad_crc_dropped(){
+  proto_cmd c;
+  send_req(PT_HELLO, 1, NULL, 0, true);
+  send_req(PT_HELLO, 2, NULL, 0);
+  poll_all(&c);
+  frame f[2];
+  uint8_t n;
+  TEST_ASSERT_TRUE(frames(f, 2, &n));
+  TEST_ASSERT_EQUAL_UINT8(1, n);
+  TEST_ASSERT_EQUAL_UINT8(2, f[0].b[1]);
+}
+
+// Longer than PROTO_RX: dropped up to its closing zero, the next one is read
+static void test_too_long_dropped(){
+  proto_cmd c;
+  uint8_t junk[PROTO_RX + 40];
+  memset(junk, 'x', sizeof(junk));
+  junk[0] = 0;
+  junk[sizeof(junk) - 1] = 0;
+  sim_serial_feed(junk, sizeof(junk));
+  send_req(PT_HELLO, 9, NULL, 0);
+  poll_all(&c);
+  frame f[2];
+  uint8_t n;
+  TEST_ASSERT_TRUE(frames(f, 2, &n));
+  TEST_ASSERT_EQUAL_UINT8(1, n);
+  TEST_ASSERT_EQUAL_UINT8(9, f[0].b[1]);
+}
+
+// Outside a frame a byte is a serial command, run control goes to loop()
+static void test_chars_and_run_control(){
+  proto_cmd c;
+  sim_serial_feed((const uint8_t *)"j", 1);
+  TEST_ASSERT_TRUE(proto_poll(&c));
+  TEST_ASSERT_EQUAL_UINT8(PC_CHAR, c.op);
+  TEST_ASSERT_EQUAL_UINT8('j', c.arg);
+
+  uint8_t prog = 2;
+  send_req(PT_LOAD, 33, &prog, 1);
+  TEST_ASSERT_EQUAL_UINT8(1, poll_all(&c));
+  TEST_ASSERT_EQUAL_UINT8(PC_LOAD, c.op);
+  TEST_ASSERT_EQUAL_UINT8(2, c.arg);
+  TEST_ASSERT_EQUAL_UINT8(33, c.seq);
+}
+
+//---------------------------------TX ring---------------------------------
+// More events than the ring holds: the extra ones are counted as drops,
+// every flush ends on a frame boundary and what went out all decodes
+static void test_ring_whole_frames(){
+  proto_cmd c;
+  send_req(PT_HELLO, 1, NULL, 0);                // attach, events on
+  poll_all(&c);
+  out_n = 0;
+
+  uint32_t drops0 = proto_drops;
+  uint16_t sent = 0;
+  while (proto_drops == drops0) {
+    proto_event(PE_REVERSE, 1, sent, -(int32_t)sent);
+    sent++;
+  }
+  sent--;                                        // the last one was dropped
+
+  uint16_t got = 0;
+  uint16_t next = 0;
+  for (uint8_t k = 0; k < 100; k++) {
+    out_n = 0;
+    proto_flush();
+    if (out_n == 0) break;
+    TEST_ASSERT_LESS_OR_EQUAL(256, out_n);       // SIM_CDC_TX, no more than the port takes
+    TEST_ASSERT_EQUAL_HEX8(0, out[out_n - 1]);
+
+    frame f[32];
+    uint8_t n;
+    TEST_ASSERT_TRUE(frames(f, 32, &n));
+    for (uint8_t i = 0; i < n; i++, got++) {
+      TEST_ASSERT_EQUAL_HEX8(PT_EVT, f[i].b[0]);
+      TEST_ASSERT_EQUAL_UINT16(14, f[i].n);
+      TEST_ASSERT_EQUAL_UINT16(next++, f[i].b[8] | f[i].b[9] << 8);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT16(sent, got);
+  TEST_ASSERT_GREATER_THAN(PROTO_TX / 24, got);     // ~22 bytes a frame, the ring was full
+}
+
+int main(){
+  sim_flash_detach();                            // programs in RAM only
+  prog_begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_crc32_check_value);
+  RUN_TEST(test_hello);
+  RUN_TEST(test_prog_get);
+  RUN_TEST(test_bad_length_and_range);
+  RUN_TEST(test_prog_put_keeps_timeline);
+  RUN_TEST(test_pat_put_get);
+  RUN_TEST(test_bad_crc_dropped);
+  RUN_TEST(test_too_long_dropped);
+  RUN_TEST(test_chars_and_run_control);
+  RUN_TEST(test_ring_whole_frames);
+  return UNITY_END();
+}
@@ -0,0 +1,156 @@
+// Recipe library search - pio test -e native -f test_recipes
+//
+// lib_narrow() binary searches the sorted index for the films starting with
+// the typed text. Checked on a small hand-made library, then against a
+// plain scan of a 2000 recipe one for every one and two letter prefix.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <ctype.h>
+#include "esp_partition.h"
+#include "recipes.h"
+
+void sim_recipe(uint32_t i, uint32_t n, recipe *r);   // sim_library.cpp
+
+static void add(const char *film, const char *dev, uint16_t iso){
+  recipe r;
+  memset(&r, 0, sizeof(r));
+  strncpy(r.film, film, sizeof(r.film) - 1);
+  strncpy(r.dev, dev, sizeof(r.dev) - 1);
+  strcpy(r.dil, "1+1");
+  r.iso = iso;
+  TEST_ASSERT_TRUE(lib_add(&r));
+}
+
+// Added out of order, film case differs
+static void small_lib(){
+  TEST_ASSERT_TRUE(lib_clear());
+  add("TRI-X 400", "D-76", 400);
+  add("delta 400", "ID-11", 400);
+  add("HP5 PLUS", "ID-11", 400);
+  add("DELTA 100", "ID-11", 100);
+  add("FP4 PLUS", "ID-11", 125);
+  add("Delta 3200", "DD-X", 3200);
+  add("HP5 PLUS", "D-76", 400);
+  add("T-MAX 100", "XTOL", 100);
+  TEST_ASSERT_TRUE(lib_end());
+  TEST_ASSERT_EQUAL_UINT16(8, lib_count());
+}
+
+static void narrow(const char *prefix, uint16_t *lo, uint16_t *hi){
+  *lo = 0;
+  *hi = lib_count();
+  lib_narrow(prefix, lo, hi);
+}
+
+void setUp(){}
+void tearDown(){}
+
+//---------------------------------Small library---------------------------------
+static void test_sorted_ignoring_case(){
+  small_lib();
+  static const char *order[] = {"DELTA 100", "Delta 3200", "delta 400", "FP4 PLUS", "HP5 PLUS", "HP5 PLUS",
+                                "T-MAX 100", "TRI-X 400"};
+  for (uint16_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_STRING(order[i], lib_at(i)->film);
+  TEST_ASSERT_EQUAL_STRING("D-76", lib_at(4)->dev);   // then by developer
+}
+
+static void test_prefixes(){
+  small_lib();
+  uint16_t lo, hi;
+  narrow("", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(0, lo);
+  TEST_ASSERT_EQUAL_UINT16(8, hi);
+  narrow("d", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(0, lo);
+  TEST_ASSERT_EQUAL_UINT16(3, hi);
+  narrow("DELTA 3", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(1, lo);
+  TEST_ASSERT_EQUAL_UINT16(2, hi);
+  narrow("hp5 plus", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(4, lo);
+  TEST_ASSERT_EQUAL_UINT16(6, hi);
+  narrow("T", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(6, lo);
+  TEST_ASSERT_EQUAL_UINT16(8, hi);
+}
+
+// No match: an empty range where the film would sort in
+static void test_no_match(){
+  small_lib();
+  uint16_t lo, hi;
+  narrow("E", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(3, lo);
+  TEST_ASSERT_EQUAL_UINT16(3, hi);
+  narrow("ZZ", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(8, lo);
+  TEST_ASSERT_EQUAL_UINT16(8, hi);
+  narrow("A", &lo, &hi);
+  TEST_ASSERT_EQUAL_UINT16(0, lo);
+  TEST_ASSERT_EQUAL_UINT16(0, hi);
+  narrow("HP5 PLUS 2", &lo, &hi);                // longer than any film it matches
+  TEST_ASSERT_EQUAL_UINT16(lo, hi);
+}
+
+// One letter at a time, as typed, each step searching only the last range
+static void test_typed_letter_by_letter(){
+  small_lib();
+  const char *typed = "DELTA 4";
+  char prefix[16] = "";
+  uint16_t lo = 0, hi = lib_count();
+  for (uint8_t i = 0; typed[i]; i++) {
+    prefix[i] = typed[i];
+    lib_narrow(prefix, &lo, &hi);
+  }
+  TEST_ASSERT_EQUAL_UINT16(2, lo);
+  TEST_ASSERT_EQUAL_UINT16(3, hi);
+}
+
+//---------------------------------Against a scan---------------------------------
+static bool starts(const char *film, const char *p){
+  for (uint8_t i = 0; p[i]; i++) {
+    if (toupper((uint8_t)film[i]) != toupper((uint8_t)p[i])) return false;
+  }
+  return true;
+}
+
+static void test_matches_scan(){
+  static recipe r[50];
+  TEST_ASSERT_TRUE(lib_clear());
+  for (uint32_t i = 0; i < 2000; i += 50) {
+    for (uint32_t k = 0; k < 50; k++) sim_recipe(i + k, 2000, &r[k]);
+    TEST_ASSERT_TRUE(lib_add(r, 50));
+  }
+  TEST_ASSERT_TRUE(lib_end());
+  TEST_ASSERT_EQUAL_UINT16(2000, lib_count());
+  for (uint16_t i = 1; i < lib_count(); i++) TEST_ASSERT_LESS_OR_EQUAL(0, lib_cmp(lib_at(i - 1), lib_at(i)));
+
+  static const char abc[] = " #-0123456789ACDEFHKNOPRSTXZ";
+  char p[3] = "";
+  for (uint8_t a = 0; a < sizeof(abc) - 1; a++) {
+    for (uint8_t b = 0; b < sizeof(abc); b++) {  // b at the end is the one letter prefix
+      p[0] = abc[a];
+      p[1] = abc[b];
+      uint16_t lo, hi, first = lib_count(), n = 0;
+      for (uint16_t i = 0; i < lib_count(); i++) {
+        if (!starts(lib_at(i)->film, p)) continue;
+        if (first == lib_count()) first = i;
+        n++;
+      }
+      narrow(p, &lo, &hi);
+      TEST_ASSERT_EQUAL_UINT16(n, hi - lo);
+      if (n) TEST_ASSERT_EQUAL_UINT16(first, lo);
+    }
+  }
+}
+
+int main(){
+  sim_flash_detach();                            // library in RAM only
+  UNITY_BEGIN();
+  RUN_TEST(test_sorted_ignoring_case);
+  RUN_TEST(test_prefixes);
+  RUN_TEST(test_no_match);
+  RUN_TEST(test_typed_letter_by_letter);
+  RUN_TEST(test_matches_scan);
+  return UNITY_END();
+}
@@ -0,0 +1,116 @@
+// Event scheduler - pio test -e native -f test_sched
+//
+// Order by deadline, nothing handed out early, a full heap refused,
+// millis() wrap-around and the lateness statistics.
+
+#include <unity.h>
+#include "sched.h"
+
+void setUp(){
+  sched_clear();
+  sched_late_max = 0;
+}
+
+void tearDown(){}
+
+//---------------------------------Order---------------------------------
+static void test_pops_in_deadline_order(){
+  static const uint32_t due[] = {700, 100, 500, 300, 900, 200, 800, 400, 600};
+  for (uint8_t i = 0; i < 9; i++) TEST_ASSERT_TRUE(sched_at(due[i], i, due[i] / 100));
+  sched_ev ev;
+  for (uint32_t t = 100; t <= 900; t += 100) {
+    TEST_ASSERT_TRUE(sched_pop(1000, &ev));
+    TEST_ASSERT_EQUAL_UINT32(t, ev.due);
+    TEST_ASSERT_EQUAL_UINT16(t / 100, ev.arg);
+    TEST_ASSERT_EQUAL_UINT32(t, due[ev.id]);
+  }
+  TEST_ASSERT_FALSE(sched_pop(1000, &ev));
+}
+
+static void test_nothing_before_its_time(){
+  sched_ev ev;
+  uint32_t due;
+  TEST_ASSERT_FALSE(sched_next_due(&due));
+  sched_at(5000, 1);
+  sched_at(3000, 2);
+  TEST_ASSERT_TRUE(sched_next_due(&due));
+  TEST_ASSERT_EQUAL_UINT32(3000, due);
+  TEST_ASSERT_FALSE(sched_pop(2999, &ev));
+  TEST_ASSERT_TRUE(sched_pop(3000, &ev));
+  TEST_ASSERT_EQUAL_UINT8(2, ev.id);
+  TEST_ASSERT_FALSE(sched_pop(4999, &ev));
+  TEST_ASSERT_TRUE(sched_next_due(&due));
+  TEST_ASSERT_EQUAL_UINT32(5000, due);
+}
+
+static void test_full_heap_refuses(){
+  for (uint8_t i = 0; i < SCHED_SIZE; i++) TEST_ASSERT_TRUE(sched_at(100 + i, i));
+  TEST_ASSERT_FALSE(sched_at(50, 99));
+  sched_ev ev;
+  TEST_ASSERT_TRUE(sched_pop(200, &ev));
+  TEST_ASSERT_EQUAL_UINT8(0, ev.id);             // the refused one didn't get in
+  TEST_ASSERT_TRUE(sched_at(50, 99));
+  TEST_ASSERT_TRUE(sched_pop(200, &ev));
+  TEST_ASSERT_EQUAL_UINT8(99, ev.id);
+}
+
+static void test_clear(){
+  sched_at(10, 1);
+  sched_at(20, 2);
+  sched_clear();
+  sched_ev ev;
+  uint32_t due;
+  TEST_ASSERT_FALSE(sched_pop(1000, &ev));
+  TEST_ASSERT_FALSE(sched_next_due(&due));
+}
+
+//---------------------------------Wrap-around---------------------------------
+// 49.7 days after power on millis() wraps, events across it keep their order
+static void test_across_millis_wrap(){
+  sched_at(0xFFFFFF00, 1);
+  sched_at(0x00000100, 3);                       // after the wrap
+  sched_at(0xFFFFFFF0, 2);
+  sched_ev ev;
+  TEST_ASSERT_FALSE(sched_pop(0xFFFFFE00, &ev));
+  TEST_ASSERT_TRUE(sched_pop(0xFFFFFFF8, &ev));
+  TEST_ASSERT_EQUAL_UINT8(1, ev.id);
+  TEST_ASSERT_TRUE(sched_pop(0xFFFFFFF8, &ev));
+  TEST_ASSERT_EQUAL_UINT8(2, ev.id);
+  TEST_ASSERT_FALSE(sched_pop(0xFFFFFFF8, &ev));
+  TEST_ASSERT_FALSE(sched_pop(0x000000FF, &ev));
+  TEST_ASSERT_TRUE(sched_pop(0x00000100, &ev));
+  TEST_ASSERT_EQUAL_UINT8(3, ev.id);
+}
+
+//---------------------------------Lateness---------------------------------
+static void test_late_stats(){
+  uint32_t n0 = sched_dispatched;
+  sched_at(1000, 1);
+  sched_at(2000, 2);
+  sched_at(3000, 3);
+  sched_ev ev;
+  sched_pop(1004, &ev);
+  TEST_ASSERT_EQUAL_UINT32(4, sched_late_max);
+  sched_pop(2000, &ev);
+  TEST_ASSERT_EQUAL_UINT32(4, sched_late_max);
+  sched_pop(3040, &ev);
+  TEST_ASSERT_EQUAL_UINT32(40, sched_late_max);
+  TEST_ASSERT_EQUAL_UINT32(n0 + 3, sched_dispatched);
+
+  sched_late_max = 0;                            // as a new stage does
+  sched_at(4000, 4);
+  sched_pop(4001, &ev);
+  TEST_ASSERT_EQUAL_UINT32(1, sched_late_max);
+  TEST_ASSERT_GREATER_OR_EQUAL(40, sched_late_worst);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_pops_in_deadline_order);
+  RUN_TEST(test_nothing_before_its_time);
+  RUN_TEST(test_full_heap_refuses);
+  RUN_TEST(test_clear);
+  RUN_TEST(test_across_millis_wrap);
+  RUN_TEST(test_late_stats);
+  return UNITY_END();
+}
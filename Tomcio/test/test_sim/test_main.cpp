@@ -0,0 +1,92 @@
+// Simulator runs - pio test -e native -f test_sim
+//
+// The checks the native program does from the command line, each in a
+// child process of its own (they all leave state behind) and held to exit
+// code 0: a scripted session (-t 30), one that waits on the select screen
+// longer than the tick ring holds (-w), sessions with stalls (-r), the
+// power-fail sweep (-p), the import benchmark (-b) and resume after reset
+// (-c).
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "FS.h"
+#include "SPIFFS.h"
+
+int sim_run(uint32_t minutes, uint8_t random_stalls);
+int sim_powerfail();
+int sim_import(uint32_t rows);
+int sim_resume(uint32_t n, uint32_t minutes);
+extern uint32_t sim_touch_ms;
+
+static uint32_t arg;
+
+static int in_child(int (*fn)()){
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!freopen("/dev/null", "w", stdout)) _exit(2);
+    SPIFFS.begin();
+    SPIFFS.format();
+    _exit(fn());
+  }
+  int st = 0;
+  waitpid(pid, &st, 0);
+  return WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+}
+
+static int session()  { return sim_run(30, 0); }
+static int stalls()   { return sim_run(30, arg); }
+static int sel_wait() { sim_touch_ms = arg; return sim_run(30, 0); }
+static int import()   { return sim_import(arg); }
+static int resume()   { return sim_resume(arg, 30); }
+
+void setUp(){}
+void tearDown(){}
+
+static void test_session(){
+  TEST_ASSERT_EQUAL_INT(0, in_child(session));
+}
+
+// 20s before LOAD, the ring overruns meanwhile and none of it may show up
+// in the run
+static void test_session_after_select_wait(){
+  arg = 20000;
+  TEST_ASSERT_EQUAL_INT(0, in_child(sel_wait));
+}
+
+// Stalls up to 30s, every tick has to reach loop() all the same
+static void test_session_with_stalls(){
+  arg = 8;
+  TEST_ASSERT_EQUAL_INT(0, in_child(stalls));
+  arg = 40;
+  TEST_ASSERT_EQUAL_INT(0, in_child(stalls));
+}
+
+static void test_powerfail(){
+  TEST_ASSERT_EQUAL_INT(0, in_child(sim_powerfail));
+}
+
+static void test_import(){
+  arg = 500;
+  TEST_ASSERT_EQUAL_INT(0, in_child(import));
+}
+
+static void test_resume(){
+  arg = 10;
+  TEST_ASSERT_EQUAL_INT(0, in_child(resume));
+}
+
+int main(){
+  sim_fs_root = ".pio/test_sim";
+  UNITY_BEGIN();
+  RUN_TEST(test_session);
+  RUN_TEST(test_session_after_select_wait);
+  RUN_TEST(test_session_with_stalls);
+  RUN_TEST(test_powerfail);
+  RUN_TEST(test_import);
+  RUN_TEST(test_resume);
+  return UNITY_END();
+}
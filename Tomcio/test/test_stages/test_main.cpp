@@ -0,0 +1,135 @@
+// Stage engine - pio test -e native -f test_stages
+//
+// setup() and loop() from src on the sim clock, one pass at a time. The
+// touch at 240,270 is LOAD on the select screen, then START and the initial
+// agitation button on the stage screen. Every timeline event of the first
+// stage has to come out of sched_pop() once, in timeline order, no more than
+// LATE_MS after its time, and TL_NEXT brings up the next stage.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "FS.h"
+#include "SPIFFS.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "sched.h"
+#include "timeline.h"
+
+#define LATE_MS 5                                // as the sim's session run, SIM_LATE_MS
+
+enum { ST_READY, ST_ARMED, ST_INITIAL, ST_RUN, ST_DONE, ST_RINSE, ST_RINSE_AGIT, ST_FINISHED };   // main.cpp
+extern uint8_t  run_state;
+extern uint8_t  stage;
+extern uint16_t tl_pos;
+extern uint32_t tl_base;
+extern bool     agitating;
+void setup();
+
+static uint32_t t0_stage0;                       // tl_base of the first stage
+static uint32_t next_at;                         // pass that ran its TL_NEXT
+
+// Clear of the last press, its release takes a few samples
+static void touch_button(){
+  sim_touch(millis() + 300, 240, 270);
+}
+
+// Passes until the state is reached, false if it takes longer than ms. at is
+// the time of the pass that got there.
+static bool step_until(uint8_t st, uint32_t ms, uint32_t *at){
+  uint32_t t0 = millis();
+  while (run_state != st) {
+    if (millis() - t0 > ms) return false;
+    *at = millis();
+    sim_step();
+  }
+  return true;
+}
+
+void setUp(){}
+void tearDown(){}
+
+//---------------------------------Select and start---------------------------------
+static void test_load_from_select(){
+  sim_touch(1000, 240, 270);
+  setup();
+  TEST_ASSERT_EQUAL_UINT8(0, stage);
+  TEST_ASSERT_EQUAL_UINT8(ST_READY, run_state);
+  TEST_ASSERT_TRUE(tl_proc.n > 1);
+  TEST_ASSERT_EQUAL_UINT16(tl_st[0].first, tl_pos);
+  uint32_t due;
+  TEST_ASSERT_FALSE(sched_next_due(&due));       // nothing runs before START
+}
+
+// START arms the stage, EV_UNLOCK a second later asks for the initial agitation
+static void test_start_then_unlock(){
+  uint32_t at;
+  touch_button();
+  TEST_ASSERT_TRUE(step_until(ST_ARMED, 1000, &at));
+  uint32_t t0 = tl_base;
+  TEST_ASSERT_EQUAL_UINT32(at, t0);              // the stage counts from the pass that took START
+  TEST_ASSERT_TRUE(step_until(ST_INITIAL, 2000, &at));
+  TEST_ASSERT_INT32_WITHIN(LATE_MS, 0, (int32_t)(at - (t0 + 1000)));
+  TEST_ASSERT_EQUAL_UINT32(t0, tl_base);
+  t0_stage0 = t0;
+}
+
+//---------------------------------Timeline---------------------------------
+// The initial agitation is the touch, the rest come from the scheduler:
+// each pass, whatever the cursor moved over came due before the pass. The
+// stage end waits for an agitation still running, at most its length.
+static void test_events_in_order_on_time(){
+  const tl_stage &ts = tl_st[0];
+  uint32_t at;
+  touch_button();
+  TEST_ASSERT_TRUE(step_until(ST_RUN, 1000, &at));
+  TEST_ASSERT_EQUAL_UINT8(TL_AGIT_INIT, tl[ts.first].type);
+  TEST_ASSERT_EQUAL_UINT16(ts.first + 1, tl_pos);
+
+  uint16_t fired = 1;
+  uint32_t last_t = 0, now = 0;
+  sched_late_max = 0;
+  while (stage == 0) {
+    uint16_t pos  = tl_pos;
+    bool     agit = agitating;
+    now           = millis();
+    sim_step();
+    for (uint16_t i = pos; i < tl_pos && stage == 0; i++) {
+      const tl_ev &e = tl[i];
+      TEST_ASSERT_EQUAL_UINT16(ts.first + fired, i);
+      TEST_ASSERT_TRUE(e.t >= last_t);
+      int32_t late = now - (tl_base + e.t);
+      TEST_ASSERT_TRUE(late >= 0);
+      if (e.type == TL_END && agit) TEST_ASSERT_TRUE(late <= (int32_t)tl_agit_ms(0, 127));
+      else TEST_ASSERT_INT32_WITHIN(LATE_MS, 0, late);
+      last_t = e.t;
+      fired++;
+    }
+    TEST_ASSERT_TRUE(millis() - tl_base < ts.len + TL_DONE_MS + 60000);
+  }
+  TEST_ASSERT_EQUAL_UINT16(ts.count - 1, fired);  // TL_NEXT moved on to stage 1 itself
+  TEST_ASSERT_EQUAL_UINT8(TL_NEXT, tl[ts.first + ts.count - 1].type);
+  TEST_ASSERT_TRUE(sched_late_max <= LATE_MS);
+  next_at = now;
+}
+
+// TL_NEXT at stage time + TL_DONE_MS, the next stage waits for its START
+static void test_next_stage(){
+  TEST_ASSERT_EQUAL_UINT8(1, stage);
+  TEST_ASSERT_TRUE(run_state == ST_READY || run_state == ST_RINSE);
+  TEST_ASSERT_EQUAL_UINT16(tl_st[1].first, tl_pos);
+  TEST_ASSERT_INT32_WITHIN(LATE_MS, 0, (int32_t)(next_at - (t0_stage0 + tl_st[0].len + TL_DONE_MS)));
+}
+
+int main(){
+  sim_fs_root = ".pio/test_stages";
+  SPIFFS.begin();
+  SPIFFS.format();
+  sim_flash_detach();                            // no checkpoint of a last run to resume
+  sim_rtc_drop();
+  UNITY_BEGIN();
+  RUN_TEST(test_load_from_select);
+  RUN_TEST(test_start_then_unlock);
+  RUN_TEST(test_events_in_order_on_time);
+  RUN_TEST(test_next_stage);
+  return UNITY_END();
+}
@@ -0,0 +1,147 @@
+// Step pulse timing - pio test -e native -f test_step_profile
+//
+// The RMT items the motor plays are checked against intervals worked out by
+// hand from StepperDriver's LINEAR_SPEED math, not against step_profile
+// itself:
+//   full speed  v  = rpm * 200 / 60 full steps/s, cruise c = 1e6 / (v * 16) us
+//   ramp length n  = v^2 * 16 / (2 * 1000) microsteps, each way
+//   first pulse c0 = 1e6 * 0.676 * sqrt(2 / 1000 / 16) = 7557 us
+//   then        cn = c(n-1) - (2 c(n-1) + r) / (4n + 1), r the remainder
+//   (braking the same with -4m + 1, m steps left)
+// and the move time against the kinematics of the same ramps. Intervals over
+// the 15 bit duration of an item go on in all low items.
+
+#include <unity.h>
+#include "step_profile.h"
+
+#define HIGH_US 2                                // STEP_HIGH_US
+#define ITEMS   1600
+
+static rmt_item32_t items[ITEMS];
+
+void setUp(){}
+void tearDown(){}
+
+// Every item one STEP pulse, returns the interval of item i
+static long interval(uint32_t i){
+  TEST_ASSERT_EQUAL(1, items[i].level0);
+  TEST_ASSERT_EQUAL(HIGH_US, items[i].duration0);
+  TEST_ASSERT_EQUAL(0, items[i].level1);
+  return items[i].duration0 + items[i].duration1;
+}
+
+static uint32_t build(float rpm, long steps, step_profile *p){
+  step_iter it;
+  profile_init(p, rpm, 200, 16, 1000, 1000, steps);
+  profile_start(p, &it);
+  return profile_items(p, &it, items, ITEMS, HIGH_US);
+}
+
+//---------------------------------Agitation move---------------------------------
+// 90 deg at 20 rpm: 800 microsteps, v = 66.7/s, c = 937 us, n = 35
+static void test_quarter_turn_ramps(){
+  static const long up[]   = {7557, 4535, 3528, 2986, 2635, 2384, 2194, 2043};
+  static const long down[] = {2040, 2191, 2382, 2633, 2984, 3527, 4535, 7559};
+  step_profile p;
+  TEST_ASSERT_EQUAL_UINT32(800, build(20, 800, &p));
+  for (uint32_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_INT32(up[i], interval(i));
+  for (uint32_t i = 32; i < 35; i++) TEST_ASSERT_GREATER_THAN(937, interval(i));
+  for (uint32_t i = 35; i < 765; i++) TEST_ASSERT_EQUAL_INT32(937, interval(i));
+  for (uint32_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_INT32(down[i], interval(792 + i));
+}
+
+// 2 x 66.7 ms of ramps plus 730 steps of 937.5 us is 816.7 ms, the
+// series comes in ~1% under it
+static void test_quarter_turn_time(){
+  step_profile p;
+  uint32_t n = build(20, 800, &p);
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < n; i++) total += interval(i);
+  TEST_ASSERT_EQUAL_UINT32(808776, total);
+  TEST_ASSERT_UINT32_WITHIN(16333, 816667, total);
+  TEST_ASSERT_EQUAL_UINT32(total, profile_time_us(&p));
+}
+
+// 40 microsteps never reach cruise: 20 up, 20 down, 93.8 ms
+static void test_short_move(){
+  step_profile p;
+  TEST_ASSERT_EQUAL_UINT32(40, build(20, 40, &p));
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < 40; i++) {
+    TEST_ASSERT_GREATER_THAN(937, interval(i));
+    total += interval(i);
+  }
+  TEST_ASSERT_EQUAL_INT32(1268, interval(19));   // fastest, the turn
+  TEST_ASSERT_EQUAL_INT32(7773, interval(39));
+  TEST_ASSERT_EQUAL_UINT32(93777, total);
+}
+
+//---------------------------------Spin leg in parts---------------------------------
+// 1600 microsteps at 30 rpm (c = 625 us, n = 80) fed in 500 item parts
+// comes out as one move: 1092.7 ms against 1100 ms for the kinematics
+static void test_leg_in_parts(){
+  step_profile p;
+  step_iter    it;
+  profile_init(&p, 30, 200, 16, 1000, 1000, 1600);
+  profile_start(&p, &it);
+  uint32_t n = 0, parts = 0, total = 0, got;
+  while ((got = profile_items(&p, &it, items, 500, HIGH_US)) > 0) {
+    for (uint32_t i = 0; i < got; i++, n++) {
+      long w = interval(i);
+      if (n >= 80 && n < 1520) TEST_ASSERT_EQUAL_INT32(625, w);
+      total += w;
+    }
+    parts++;
+  }
+  TEST_ASSERT_EQUAL_UINT32(1600, n);
+  TEST_ASSERT_EQUAL_UINT32(4, parts);
+  TEST_ASSERT_EQUAL_INT32(7561, interval(99));   // trailing wait, last item of the last part
+  TEST_ASSERT_EQUAL_UINT32(1092709, total);
+  TEST_ASSERT_UINT32_WITHIN(22000, 1100000, total);
+}
+
+//---------------------------------Long intervals---------------------------------
+// Full steps at accel 100 and 1 rpm never leave c0 = 1e6 * 0.676 *
+// sqrt(2 / 100) = 95600 us: 2 high, 32767 low, then 62831 low in one item
+static void slow(step_profile *p, step_iter *it){
+  profile_init(p, 1, 200, 1, 100, 100, 4);
+  profile_start(p, it);
+}
+
+static void test_long_interval_split(){
+  step_profile p;
+  step_iter    it;
+  slow(&p, &it);
+  TEST_ASSERT_EQUAL_UINT32(8, profile_items(&p, &it, items, ITEMS, HIGH_US));
+  for (uint32_t i = 0; i < 8; i += 2) {
+    TEST_ASSERT_EQUAL_INT32(95600, interval(i) + items[i + 1].duration0 + items[i + 1].duration1);
+    TEST_ASSERT_EQUAL(32767, items[i].duration1);
+    TEST_ASSERT_EQUAL(0, items[i + 1].level0);
+    TEST_ASSERT_EQUAL(0, items[i + 1].level1);
+    TEST_ASSERT_EQUAL(31415, items[i + 1].duration0);
+    TEST_ASSERT_EQUAL(31416, items[i + 1].duration1);
+  }
+}
+
+// A step is not cut between parts, 3 items take one step and the next
+// part starts with the second
+static void test_long_interval_parts(){
+  step_profile p;
+  step_iter    it;
+  slow(&p, &it);
+  TEST_ASSERT_EQUAL_UINT32(2, profile_items(&p, &it, items, 3, HIGH_US));
+  TEST_ASSERT_EQUAL_INT32(3, it.remaining);
+  TEST_ASSERT_EQUAL_UINT32(6, profile_items(&p, &it, items, ITEMS, HIGH_US));
+  TEST_ASSERT_EQUAL_UINT32(0, profile_items(&p, &it, items, ITEMS, HIGH_US));
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_quarter_turn_ramps);
+  RUN_TEST(test_quarter_turn_time);
+  RUN_TEST(test_short_move);
+  RUN_TEST(test_leg_in_parts);
+  RUN_TEST(test_long_interval_split);
+  RUN_TEST(test_long_interval_parts);
+  return UNITY_END();
+}
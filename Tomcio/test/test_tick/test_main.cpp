@@ -0,0 +1,149 @@
+// Timer tick ring - pio test -e native -f test_tick
+//
+// tick_push() stands in for Timer0_ISR, delay() moves the sim clock. Ticks
+// come out in order with the time they fired, the late stats only take
+// ticks fired after tick_stats_reset(), ticks that fell out of a full ring
+// are rebuilt from seq in order, and tick_skip() drops what was queued.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "tick.h"
+
+void setUp(){
+  tick_ev ev;
+  while (tick_pop(&ev));                         // each test starts on an empty ring
+}
+
+void tearDown(){}
+
+//---------------------------------Order and timing---------------------------------
+static void test_in_order_with_fire_time(){
+  uint32_t seq0 = tick_seq;
+  uint32_t t[3];
+  tick_stats_reset();
+  for (uint8_t i = 0; i < 3; i++) {
+    delay(500);
+    t[i] = micros();
+    tick_push();
+  }
+  TEST_ASSERT_EQUAL_UINT32(t[2] + TICK_US, tick_next_us());
+  delay(100);                                    // loop() gets to them late
+
+  tick_ev ev;
+  for (uint8_t i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(tick_pop(&ev));
+    TEST_ASSERT_EQUAL_UINT32(seq0 + 1 + i, ev.seq);
+    TEST_ASSERT_EQUAL_UINT32(t[i], ev.t_us);
+  }
+  TEST_ASSERT_FALSE(tick_pop(&ev));
+  TEST_ASSERT_EQUAL_UINT32(tick_seq, tick_done);
+  TEST_ASSERT_EQUAL_UINT32(3, tick_late_n);
+  TEST_ASSERT_EQUAL_UINT32(1100000, tick_late_max);   // the first, 2 periods + 100 ms
+  TEST_ASSERT_EQUAL_UINT32(1100 + 600 + 100, tick_late_sum);
+}
+
+// Ticks already queued when a stage comes up aren't its lateness
+static void test_stats_from_reset_on(){
+  tick_push();
+  delay(2000);
+  tick_push();
+  tick_stats_reset();
+  delay(500);
+  tick_push();
+  delay(10);
+
+  tick_ev ev;
+  uint8_t n = 0;
+  while (tick_pop(&ev)) n++;
+  TEST_ASSERT_EQUAL_UINT8(3, n);
+  TEST_ASSERT_EQUAL_UINT32(1, tick_late_n);
+  TEST_ASSERT_EQUAL_UINT32(10000, tick_late_max);
+}
+
+//---------------------------------Overrun---------------------------------
+// Ring full, the rest only counted by seq: rebuilt once the ring is empty,
+// each a period before the last one fired
+static void test_overrun_past_the_end(){
+  uint32_t seq0 = tick_seq, rb0 = tick_rebuilt;
+  uint32_t t0 = micros();
+  for (uint8_t i = 0; i < TICK_RING + 5; i++) {
+    tick_push();
+    delay(500);
+  }
+  tick_ev ev;
+  for (uint8_t i = 0; i < TICK_RING + 5; i++) {
+    TEST_ASSERT_TRUE(tick_pop(&ev));
+    TEST_ASSERT_EQUAL_UINT32(seq0 + 1 + i, ev.seq);
+    TEST_ASSERT_EQUAL_UINT32(t0 + i * TICK_US, ev.t_us);
+  }
+  TEST_ASSERT_EQUAL_UINT32(rb0 + 5, tick_rebuilt);
+  TEST_ASSERT_FALSE(tick_pop(&ev));
+  TEST_ASSERT_EQUAL_UINT32(tick_seq, tick_done);
+
+  tick_push();                                   // and on as normal
+  TEST_ASSERT_TRUE(tick_pop(&ev));
+  TEST_ASSERT_EQUAL_UINT32(seq0 + TICK_RING + 6, ev.seq);
+  TEST_ASSERT_EQUAL_UINT32(rb0 + 5, tick_rebuilt);
+}
+
+// Ring full, loop() takes some, the gap before the next tick in the ring is
+// filled in from its time
+static void test_overrun_gap_in_seq(){
+  uint32_t seq0 = tick_seq, rb0 = tick_rebuilt;
+  for (uint8_t i = 0; i < TICK_RING + 3; i++) {
+    tick_push();
+    delay(500);
+  }
+  tick_ev ev;
+  for (uint8_t i = 0; i < 10; i++) tick_pop(&ev);
+  uint32_t t = micros();
+  tick_push();
+  for (uint8_t i = 10; i < TICK_RING + 4; i++) {
+    TEST_ASSERT_TRUE(tick_pop(&ev));
+    TEST_ASSERT_EQUAL_UINT32(seq0 + 1 + i, ev.seq);
+  }
+  TEST_ASSERT_EQUAL_UINT32(t, ev.t_us);          // the one in the ring
+  TEST_ASSERT_EQUAL_UINT32(rb0 + 3, tick_rebuilt);
+  TEST_ASSERT_FALSE(tick_pop(&ev));
+  TEST_ASSERT_EQUAL_UINT32(tick_seq, tick_done);
+}
+
+// Late stats take the rebuilt ticks too, they are that late
+static void test_rebuilt_are_late(){
+  tick_stats_reset();
+  for (uint8_t i = 0; i < TICK_RING + 2; i++) {
+    tick_push();
+    delay(500);
+  }
+  tick_ev ev;
+  while (tick_pop(&ev));
+  TEST_ASSERT_EQUAL_UINT32(TICK_RING + 2, tick_late_n);
+  TEST_ASSERT_EQUAL_UINT32((TICK_RING + 2) * TICK_US, tick_late_max);
+  TEST_ASSERT_EQUAL_UINT32(TICK_US, micros() - ev.t_us);   // the last, fired a period ago
+}
+
+//---------------------------------Skip---------------------------------
+// The select screen kept loop() away: all fired so far done, none handed out
+static void test_skip(){
+  for (uint8_t i = 0; i < TICK_RING + 7; i++) tick_push();
+  uint32_t rb0 = tick_rebuilt;
+  tick_skip();
+  TEST_ASSERT_EQUAL_UINT32(tick_seq, tick_done);
+  tick_ev ev;
+  TEST_ASSERT_FALSE(tick_pop(&ev));
+  tick_push();
+  TEST_ASSERT_TRUE(tick_pop(&ev));
+  TEST_ASSERT_EQUAL_UINT32(tick_seq, ev.seq);
+  TEST_ASSERT_EQUAL_UINT32(rb0, tick_rebuilt);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_in_order_with_fire_time);
+  RUN_TEST(test_stats_from_reset_on);
+  RUN_TEST(test_overrun_past_the_end);
+  RUN_TEST(test_overrun_gap_in_seq);
+  RUN_TEST(test_rebuilt_are_late);
+  RUN_TEST(test_skip);
+  return UNITY_END();
+}
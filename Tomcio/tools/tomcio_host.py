@@ -0,0 +1,343 @@
+#!/usr/bin/env python3
+# Tomcio host client - reference implementation of the protocol in src/proto.h
+#
+# Talks to the timer on its USB serial port, or to the simulator on the
+# pseudo-terminal it prints with -u:
+#   .pio/build/native/program -u 50 &
+#   tools/tomcio_host.py /dev/pts/5 run 1
+#
+# Commands:
+#   hello                      versions and sizes
+#   prog-get SLOT              program 1..9 as its 17 words
+#   prog-put SLOT W0 .. W16    replace program 1..9
+#   lib-get [POS]              recipe at POS in sorted order, all without POS
+#   lib-put FILE.json          replace the library, a list of objects with
+#                              film, developer, dilution, iso, prog (17 words)
+#   pat-get [SLOT]             user agitation pattern 1..8, all without SLOT
+#   pat-put SLOT NAME OP ..    replace pattern 1..8, ops as in src/agit.h:
+#                              speed RPM, move DEG, dwell MS, loop N, next,
+#                              flip, twist DEG N, vibe MS, end. An import
+#                              picks it by NAME, a program word as 127 + SLOT
+#   load PROG                  1..9 programs, 10.. built in processes
+#   start | abort
+#   watch [SECONDS]            print telemetry and events
+#   run PROG                   load, press START whenever the timer waits for
+#                              it and follow the run to the end
+# The timer's serial log is shown with a "| " prefix, PT_LOG frames and any
+# text printed between frames alike.
+# Standard library only.
+
+import argparse
+import json
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+PT_HELLO, PT_PROG_GET, PT_PROG_PUT, PT_LIB_GET, PT_LIB_CLEAR, PT_LIB_ADD, PT_LIB_END, \
+    PT_LOAD, PT_START, PT_ABORT, PT_PAT_GET, PT_PAT_PUT = range(1, 13)
+PT_ACK, PT_PROG, PT_RECIPE, PT_TLM, PT_EVT, PT_LOG, PT_PAT = range(0x80, 0x87)
+
+REQUESTS = {PT_HELLO: "HELLO", PT_PROG_GET: "PROG_GET", PT_PROG_PUT: "PROG_PUT", PT_LIB_GET: "LIB_GET",
+            PT_LIB_CLEAR: "LIB_CLEAR", PT_LIB_ADD: "LIB_ADD", PT_LIB_END: "LIB_END", PT_LOAD: "LOAD",
+            PT_START: "START", PT_ABORT: "ABORT", PT_PAT_GET: "PAT_GET", PT_PAT_PUT: "PAT_PUT"}
+STATUS = ["ok", "bad request", "out of range", "busy, a run is on", "not now", "program or pattern can't run",
+          "flash write failed"]
+STATES = ["ready", "armed", "initial", "run", "done", "rinse", "rinse agitation", "finished"]
+EVENTS = ["stage", "start", "agitation", "agitation done", "rotation", "reversal", "rotation done",
+          "stage done", "finished", "aborted"]
+ST_READY, ST_INITIAL, ST_RINSE, ST_FINISHED = 0, 2, 5, 7
+PE_FINISHED, PE_ABORTED = 8, 9
+PROTO_SELECT = 0xFF
+PROG_WORDS = 17
+RECIPE = struct.Struct("<20s16s8sH17H")          # struct recipe, 80 bytes
+TLM = struct.Struct("<IBBBBIIIIH")
+EVT = struct.Struct("<IBBHi")
+AGIT_NAME_LEN, AGIT_MAX_LEN, AGIT_USER_BASE = 10, 64, 0x80
+AGIT_OPS = ["end", "speed", "move", "dwell", "loop", "next", "flip", "twist", "vibe"]
+AGIT_ARGS = ["", "B", "h", "H", "B", "", "", "BB", "H"]  # operands, little-endian
+
+
+def cobs_encode(data):
+    out = bytearray()
+    for block in data.split(b"\0"):
+        while len(block) >= 254:
+            out += b"\xff" + block[:254]
+            block = block[254:]
+        out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("bad COBS")
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class ProtoError(Exception):
+    pass
+
+
+class Link:
+    def __init__(self, path, verbose=True):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        if os.isatty(self.fd):
+            tty.setraw(self.fd)
+            attr = termios.tcgetattr(self.fd)
+            attr[4] = attr[5] = termios.B115200    # ignored by USB CDC and ptys
+            termios.tcsetattr(self.fd, termios.TCSANOW, attr)
+        self.buf = bytearray()
+        self.seq = 0
+        self.verbose = verbose
+        self.tlm = None                            # last telemetry
+        self.events = []
+        self.bad = 0                               # chunks that weren't frames or text
+
+    def send(self, type_, payload=b""):
+        self.seq = self.seq % 255 + 1
+        body = bytes([type_, self.seq]) + payload
+        body += struct.pack("<I", zlib.crc32(body))
+        os.write(self.fd, b"\0" + cobs_encode(body) + b"\0")
+        return self.seq
+
+    # One chunk between zeros: a frame, or text the timer printed
+    def chunk(self, c):
+        try:
+            f = cobs_decode(c)
+            if len(f) >= 6 and struct.unpack("<I", f[-4:])[0] == zlib.crc32(f[:-4]):
+                return f[0], f[1], f[2:-4]
+        except ValueError:
+            pass
+        text = c.decode("latin-1")
+        if text.strip() and all(ch.isprintable() or ch in "\r\n\t" for ch in text):
+            self.show(text)
+        elif text.strip():
+            self.bad += 1
+        return None
+
+    def show(self, text):
+        if self.verbose:
+            for line in text.splitlines():
+                if line.strip():
+                    print("| " + line)
+
+    # Next frame, telemetry and events are kept on the way
+    def recv(self, timeout):
+        end = time.monotonic() + timeout
+        while True:
+            while b"\0" in self.buf:
+                c, _, self.buf = self.buf.partition(b"\0")
+                if not c:
+                    continue
+                f = self.chunk(bytes(c))
+                if f is None:
+                    continue
+                if f[0] == PT_LOG:
+                    self.show(f[2].decode("latin-1"))
+                    continue
+                if f[0] == PT_TLM:
+                    self.tlm = TLM.unpack(f[2])
+                elif f[0] == PT_EVT:
+                    self.events.append(EVT.unpack(f[2]))
+                return f
+            left = end - time.monotonic()
+            if left <= 0:
+                return None
+            r, _, _ = select.select([self.fd], [], [], left)
+            if r:
+                self.buf += os.read(self.fd, 4096)
+
+    def request(self, type_, payload=b"", timeout=2.0, tries=3):
+        for _ in range(tries):
+            seq = self.send(type_, payload)
+            end = time.monotonic() + timeout
+            while time.monotonic() < end:
+                f = self.recv(end - time.monotonic())
+                if f and f[1] == seq and f[0] not in (PT_TLM, PT_EVT):
+                    if f[0] == PT_ACK and f[2][1] != 0:
+                        a = f[2]
+                        raise ProtoError("%s: %s%s" % (REQUESTS[type_], STATUS[a[1]] if a[1] < len(STATUS) else a[1],
+                                                        " (%u)" % a[2] if a[2] else ""))
+                    return f
+        raise ProtoError("no answer to %s" % REQUESTS[type_])
+
+
+def show_tlm(t):
+    ms, state, stage, stages, motor, left, stage_ms, loop_us, late_us, drops = t
+    name = "select" if state == PROTO_SELECT else STATES[state] if state < len(STATES) else str(state)
+    print("%8.1f s  %-15s stage %u/%u  %s  left %6.1f s  loop %6u us  late %6u us  drops %u" %
+          (ms / 1e3, name, stage + 1, stages, "-AR"[motor], left / 1e3, loop_us, late_us, drops))
+
+
+def show_evt(e):
+    ms, kind, stage, a, b = e
+    name = EVENTS[kind] if kind < len(EVENTS) else str(kind)
+    print("%8.1f s  * %-14s stage %u  %u  %d" % (ms / 1e3, name, stage + 1, a, b))
+
+
+def recipe_bytes(r):
+    prog = list(r["prog"]) + [0] * PROG_WORDS
+    return RECIPE.pack(r["film"].encode(), r["developer"].encode(), r.get("dilution", "").encode(),
+                       int(r.get("iso", 0)), *prog[:PROG_WORDS])
+
+
+def recipe_dict(b):
+    film, dev, dil, iso, *prog = RECIPE.unpack(b)
+    z = lambda s: s.rstrip(b"\0").decode("latin-1")
+    return {"film": z(film), "developer": z(dev), "dilution": z(dil), "iso": iso, "prog": prog}
+
+
+def pat_code(words):
+    code, op = b"", 0
+    while words:
+        op = AGIT_OPS.index(words.pop(0).lower())
+        n = len(AGIT_ARGS[op])
+        code += bytes([op]) + struct.pack("<" + AGIT_ARGS[op], *(int(w) for w in words[:n]))
+        del words[:n]
+    return code if op == 0 else code + b"\0"
+
+
+def pat_text(code):
+    out, i = [], 0
+    while i < len(code) and code[i] < len(AGIT_OPS):
+        op = code[i]
+        n = struct.calcsize("<" + AGIT_ARGS[op])
+        out += [AGIT_OPS[op]] + [str(v) for v in struct.unpack("<" + AGIT_ARGS[op], code[i + 1:i + 1 + n])]
+        if op == 0:
+            break
+        i += 1 + n
+    return " ".join(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Tomcio host client")
+    ap.add_argument("port")
+    ap.add_argument("cmd")
+    ap.add_argument("args", nargs="*")
+    ap.add_argument("-q", action="store_true", help="hide the timer's debug text")
+    o = ap.parse_args()
+
+    link = Link(o.port, not o.q)
+    h = link.request(PT_HELLO)[2]
+    ver, prog_n, words, builtin, lib_n, pmax = struct.unpack("<BBBBHB", h)
+    if o.cmd == "hello":
+        print("protocol %u, %u programs of %u words, %u built in processes, %u recipes, %u byte frames" %
+              (ver, prog_n, words, builtin, lib_n, pmax))
+
+    elif o.cmd == "prog-get":
+        f = link.request(PT_PROG_GET, bytes([int(o.args[0]) - 1]))[2]
+        print(" ".join(str(w) for w in struct.unpack("<%uH" % PROG_WORDS, f[1:])))
+
+    elif o.cmd == "prog-put":
+        w = [int(x) for x in o.args[1:]]
+        link.request(PT_PROG_PUT, bytes([int(o.args[0]) - 1]) + struct.pack("<%uH" % PROG_WORDS, *w))
+        print("saved")
+
+    elif o.cmd == "lib-get":
+        pos = [int(o.args[0])] if o.args else range(lib_n)
+        for p in pos:
+            f = link.request(PT_LIB_GET, struct.pack("<H", p))[2]
+            print(json.dumps(recipe_dict(f[2:])))
+
+    elif o.cmd == "lib-put":
+        recs = [recipe_bytes(r) for r in json.load(open(o.args[0]))]
+        per = (pmax - 1) // RECIPE.size
+        link.request(PT_LIB_CLEAR, timeout=10)
+        try:
+            for i in range(0, len(recs), per):
+                part = recs[i:i + per]
+                link.request(PT_LIB_ADD, bytes([len(part)]) + b"".join(part), timeout=10)
+                print("%u recipes written" % (i + len(part)))
+        finally:
+            link.request(PT_LIB_END, timeout=30)   # the library keeps what was written
+
+    elif o.cmd == "pat-get":
+        for slot in [int(o.args[0])] if o.args else range(1, 9):
+            f = link.request(PT_PAT_GET, bytes([slot - 1]))[2]
+            name = f[1:1 + AGIT_NAME_LEN].rstrip(b"\0").decode("latin-1")
+            if name:
+                print("%u %s  %s" % (slot, name, pat_text(f[1 + AGIT_NAME_LEN:])))
+
+    elif o.cmd == "pat-put":
+        name = o.args[1].encode() if len(o.args) > 1 else b""
+        code = pat_code(o.args[2:]) if len(o.args) > 2 else b"\0"
+        if len(name) >= AGIT_NAME_LEN or len(code) > AGIT_MAX_LEN:
+            ap.error("name up to %u characters, code up to %u bytes" % (AGIT_NAME_LEN - 1, AGIT_MAX_LEN))
+        link.request(PT_PAT_PUT, bytes([int(o.args[0]) - 1]) + name.ljust(AGIT_NAME_LEN, b"\0") +
+                     code.ljust(AGIT_MAX_LEN, b"\0"))
+        print("saved" if name else "cleared")
+
+    elif o.cmd in ("load", "start", "abort"):
+        if o.cmd == "load":
+            link.request(PT_LOAD, bytes([int(o.args[0]) - 1]))
+        else:
+            link.request(PT_START if o.cmd == "start" else PT_ABORT)
+        print("ok")
+
+    elif o.cmd == "watch":
+        end = time.monotonic() + (float(o.args[0]) if o.args else 1e9)
+        while time.monotonic() < end:
+            f = link.recv(end - time.monotonic())
+            if f and f[0] == PT_TLM:
+                show_tlm(link.tlm)
+            while link.events:
+                show_evt(link.events.pop(0))
+
+    elif o.cmd == "run":
+        while True:                                # after an abort the motor finishes its move first
+            try:
+                link.request(PT_LOAD, bytes([int(o.args[0]) - 1]))
+                break
+            except ProtoError as e:
+                if "busy" not in str(e):
+                    raise
+                time.sleep(0.2)
+        worst_loop = worst_late = 0
+        result = None
+        while result is None:
+            f = link.recv(5.0)
+            if f is None:
+                raise ProtoError("timer went quiet")
+            while link.events:
+                e = link.events.pop(0)
+                show_evt(e)
+                if e[1] in (PE_FINISHED, PE_ABORTED):
+                    result = e[1]
+            if f[0] != PT_TLM:
+                continue
+            t = link.tlm
+            show_tlm(t)
+            worst_loop = max(worst_loop, t[7])
+            worst_late = max(worst_late, t[8])
+            if t[1] in (ST_READY, ST_INITIAL, ST_RINSE):
+                try:
+                    link.request(PT_START)
+                except ProtoError as e:
+                    print("START: %s" % e)        # the state moved on meanwhile
+        print("%s, longest loop() %u us, latest tick %u us, %u frames dropped, %u bad chunks" %
+              ("finished" if result == PE_FINISHED else "aborted", worst_loop, worst_late, link.tlm[9], link.bad))
+        return 0 if result == PE_FINISHED else 1
+
+    else:
+        ap.error("unknown command " + o.cmd)
+    return 0
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except ProtoError as e:
+        print("error: %s" % e, file=sys.stderr)
+        sys.exit(2)